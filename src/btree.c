@@ -0,0 +1,511 @@
+#include "btree.h"
+
+#include <string.h>
+
+#define XNBT_REC_HDR_SZ (sizeof(uint64_t) + sizeof(uint16_t))
+#define XNBT_MAX_ENTRIES ((XNPG_SZ - XNBT_HDR_SZ) / sizeof(struct xnbtentry))
+
+struct xnbtentry {
+    uint64_t key;
+    uint64_t child;
+};
+
+//a leaf record being moved during a split or compaction
+struct xnbtrec {
+    uint64_t key;
+    uint16_t size;
+    const uint8_t *val;
+};
+
+static inline struct xnbthdr *xnbt_hdr(uint8_t *buf) {
+    return (struct xnbthdr*)buf;
+}
+
+static inline uint16_t *xnbt_slots(uint8_t *buf) {
+    return (uint16_t*)(buf + XNBT_HDR_SZ);
+}
+
+static inline struct xnbtentry *xnbt_entries(uint8_t *buf) {
+    return (struct xnbtentry*)(buf + XNBT_HDR_SZ);
+}
+
+static inline uint64_t xnbt_leaf_key(uint8_t *buf, int slot) {
+    uint64_t key;
+    memcpy(&key, buf + xnbt_slots(buf)[slot], sizeof(uint64_t));
+    return key;
+}
+
+static inline uint16_t xnbt_leaf_size(uint8_t *buf, int slot) {
+    uint16_t size;
+    memcpy(&size, buf + xnbt_slots(buf)[slot] + sizeof(uint64_t), sizeof(uint16_t));
+    return size;
+}
+
+static inline uint8_t *xnbt_leaf_val(uint8_t *buf, int slot) {
+    return buf + xnbt_slots(buf)[slot] + XNBT_REC_HDR_SZ;
+}
+
+//first slot with a key >= key
+static int xnbt_leaf_search(uint8_t *buf, uint64_t key, bool *found) {
+    int lo = 0;
+    int hi = xnbt_hdr(buf)->count;
+    while (lo < hi) {
+        int mid = (lo + hi) / 2;
+        if (xnbt_leaf_key(buf, mid) < key)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    *found = lo < xnbt_hdr(buf)->count && xnbt_leaf_key(buf, lo) == key;
+    return lo;
+}
+
+//number of entries with a key <= key.  The child for key is child0 if that is 0, otherwise entry [n - 1]'s child
+static int xnbt_internal_search(uint8_t *buf, uint64_t key) {
+    struct xnbtentry *entries = xnbt_entries(buf);
+    int lo = 0;
+    int hi = xnbt_hdr(buf)->count;
+    while (lo < hi) {
+        int mid = (lo + hi) / 2;
+        if (entries[mid].key <= key)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return lo;
+}
+
+static uint64_t xnbt_internal_child(uint8_t *buf, int n) {
+    return n == 0 ? xnbt_hdr(buf)->child0 : xnbt_entries(buf)[n - 1].child;
+}
+
+static int xnbt_leaf_free_space(uint8_t *buf) {
+    struct xnbthdr *hdr = xnbt_hdr(buf);
+    return hdr->ceil - (XNBT_HDR_SZ + hdr->count * sizeof(uint16_t));
+}
+
+static void xnbt_leaf_init(uint8_t *buf, uint64_t next) {
+    memset(buf, 0, XNPG_SZ);
+    struct xnbthdr *hdr = xnbt_hdr(buf);
+    hdr->leaf = 1;
+    hdr->ceil = XNPG_SZ;
+    hdr->next = next;
+}
+
+//appends a record after the last slot.  Caller checks there is room
+static void xnbt_leaf_append(uint8_t *buf, struct xnbtrec rec) {
+    struct xnbthdr *hdr = xnbt_hdr(buf);
+    hdr->ceil -= XNBT_REC_HDR_SZ + rec.size;
+    memcpy(buf + hdr->ceil, &rec.key, sizeof(uint64_t));
+    memcpy(buf + hdr->ceil + sizeof(uint64_t), &rec.size, sizeof(uint16_t));
+    memcpy(buf + hdr->ceil + XNBT_REC_HDR_SZ, rec.val, rec.size);
+    xnbt_slots(buf)[hdr->count++] = hdr->ceil;
+}
+
+static xnresult_t xnbt_read_node(struct xnbtree *bt, uint64_t idx, uint8_t *buf) {
+    xnmm_init();
+    struct xnpg page = { .file_handle = bt->meta.file_handle, .idx = idx };
+    xn_ensure(xnpg_read(&page, bt->tx, buf, 0, XNPG_SZ));
+    return xn_ok();
+}
+
+static xnresult_t xnbt_write_node(struct xnbtree *bt, uint64_t idx, const uint8_t *old, const uint8_t *buf) {
+    xnmm_init();
+    struct xnpg page = { .file_handle = bt->meta.file_handle, .idx = idx };
+    xn_ensure(xnpg_write_diff(&page, bt->tx, old, buf));
+    return xn_ok();
+}
+
+//new pages are zeroed by xnfile_allocate_page
+static xnresult_t xnbt_write_new_node(struct xnbtree *bt, uint64_t *out_idx, const uint8_t *buf) {
+    xnmm_init();
+
+    struct xnpg page;
+    xn_ensure(xnfile_allocate_page(bt->meta.file_handle, bt->tx, &page));
+
+    xnmm_scoped_alloc(scoped_ptr, xn_free, xn_malloc, &scoped_ptr, XNPG_SZ);
+    uint8_t *zero = (uint8_t*)scoped_ptr;
+    memset(zero, 0, XNPG_SZ);
+    xn_ensure(xnbt_write_node(bt, page.idx, zero, buf));
+
+    *out_idx = page.idx;
+    return xn_ok();
+}
+
+static xnresult_t xnbt_root(struct xnbtree *bt, uint64_t *out_idx) {
+    xnmm_init();
+    xn_ensure(xnpg_read(&bt->meta, bt->tx, (uint8_t*)out_idx, 0, sizeof(uint64_t)));
+    return xn_ok();
+}
+
+static xnresult_t xnbt_set_root(struct xnbtree *bt, uint64_t idx) {
+    xnmm_init();
+    xn_ensure(xnpg_write(&bt->meta, bt->tx, (uint8_t*)&idx, 0, sizeof(uint64_t), true));
+    return xn_ok();
+}
+
+xnresult_t xnbt_open(struct xnbtree *bt, struct xnfile *file, bool create, struct xntx *tx) {
+    xnmm_init();
+
+    bt->meta.file_handle = file;
+    bt->meta.idx = 1; //hard-coding metadata page
+    bt->tx = tx;
+
+    if (create) {
+        xn_ensure(xnfile_set_size(file, XNPG_SZ * 32));
+        xn_ensure(xnfile_init(file, tx));
+
+        struct xnpg meta_page;
+        xn_ensure(xnfile_allocate_page(file, tx, &meta_page));
+        xn_ensure(meta_page.idx == bt->meta.idx);
+
+        //the tree starts as a single empty leaf
+        xnmm_scoped_alloc(scoped_ptr, xn_free, xn_malloc, &scoped_ptr, XNPG_SZ);
+        uint8_t *buf = (uint8_t*)scoped_ptr;
+        xnbt_leaf_init(buf, 0);
+        uint64_t root;
+        xn_ensure(xnbt_write_new_node(bt, &root, buf));
+        xn_ensure(xnbt_set_root(bt, root));
+    }
+
+    return xn_ok();
+}
+
+//descends to the leaf that holds key.  path gets the internal nodes visited, root first
+static xnresult_t xnbt_find_leaf(struct xnbtree *bt, uint64_t key, uint8_t *buf, uint64_t *path, int *out_depth, uint64_t *out_leaf) {
+    xnmm_init();
+
+    uint64_t idx;
+    xn_ensure(xnbt_root(bt, &idx));
+    int depth = 0;
+    while (true) {
+        xn_ensure(xnbt_read_node(bt, idx, buf));
+        if (xnbt_hdr(buf)->leaf)
+            break;
+        xn_ensure(depth < XNBT_MAX_DEPTH);
+        if (path)
+            path[depth] = idx;
+        depth++;
+        idx = xnbt_internal_child(buf, xnbt_internal_search(buf, key));
+    }
+
+    if (out_depth)
+        *out_depth = depth;
+    *out_leaf = idx;
+    return xn_ok();
+}
+
+//inserts (key, child) into the internal node at path[depth - 1], splitting up the path as needed.
+//A split of the root grows the tree by one level
+static xnresult_t xnbt_insert_parent(struct xnbtree *bt, uint64_t *path, int depth, uint64_t left, uint64_t key, uint64_t child) {
+    xnmm_init();
+
+    xnmm_scoped_alloc(scoped_old, xn_free, xn_malloc, &scoped_old, XNPG_SZ);
+    xnmm_scoped_alloc(scoped_buf, xn_free, xn_malloc, &scoped_buf, XNPG_SZ);
+    uint8_t *old = (uint8_t*)scoped_old;
+    uint8_t *buf = (uint8_t*)scoped_buf;
+
+    if (depth == 0) {
+        memset(buf, 0, XNPG_SZ);
+        xnbt_hdr(buf)->child0 = left;
+        xnbt_hdr(buf)->count = 1;
+        xnbt_entries(buf)[0] = (struct xnbtentry){ .key = key, .child = child };
+        uint64_t root;
+        xn_ensure(xnbt_write_new_node(bt, &root, buf));
+        xn_ensure(xnbt_set_root(bt, root));
+        return xn_ok();
+    }
+
+    uint64_t idx = path[depth - 1];
+    xn_ensure(xnbt_read_node(bt, idx, old));
+    memcpy(buf, old, XNPG_SZ);
+
+    struct xnbthdr *hdr = xnbt_hdr(buf);
+    struct xnbtentry *entries = xnbt_entries(buf);
+    int pos = xnbt_internal_search(buf, key);
+
+    if (hdr->count < XNBT_MAX_ENTRIES) {
+        memmove(&entries[pos + 1], &entries[pos], (hdr->count - pos) * sizeof(struct xnbtentry));
+        entries[pos] = (struct xnbtentry){ .key = key, .child = child };
+        hdr->count++;
+        xn_ensure(xnbt_write_node(bt, idx, old, buf));
+        return xn_ok();
+    }
+
+    //full: the middle entry moves up, and its child becomes child0 of the new right node
+    struct xnbtentry all[XNBT_MAX_ENTRIES + 1];
+    memcpy(all, entries, pos * sizeof(struct xnbtentry));
+    all[pos] = (struct xnbtentry){ .key = key, .child = child };
+    memcpy(&all[pos + 1], &entries[pos], (hdr->count - pos) * sizeof(struct xnbtentry));
+    int total = hdr->count + 1;
+    int mid = total / 2;
+
+    hdr->count = mid;
+    memcpy(entries, all, mid * sizeof(struct xnbtentry));
+    memset(&entries[mid], 0, (XNBT_MAX_ENTRIES - mid) * sizeof(struct xnbtentry));
+
+    xnmm_scoped_alloc(scoped_right, xn_free, xn_malloc, &scoped_right, XNPG_SZ);
+    uint8_t *right = (uint8_t*)scoped_right;
+    memset(right, 0, XNPG_SZ);
+    xnbt_hdr(right)->child0 = all[mid].child;
+    xnbt_hdr(right)->count = total - mid - 1;
+    memcpy(xnbt_entries(right), &all[mid + 1], (total - mid - 1) * sizeof(struct xnbtentry));
+
+    uint64_t right_idx;
+    xn_ensure(xnbt_write_new_node(bt, &right_idx, right));
+    xn_ensure(xnbt_write_node(bt, idx, old, buf));
+    xn_ensure(xnbt_insert_parent(bt, path, depth - 1, idx, all[mid].key, right_idx));
+
+    return xn_ok();
+}
+
+//rebuilds the leaf from recs, dropping the space left behind by deleted and replaced records
+static void xnbt_leaf_build(uint8_t *buf, uint64_t next, struct xnbtrec *recs, int count) {
+    xnbt_leaf_init(buf, next);
+    for (int i = 0; i < count; i++)
+        xnbt_leaf_append(buf, recs[i]);
+}
+
+//splits a full leaf.  recs holds every record including the new one, and the halves are balanced by bytes
+static xnresult_t xnbt_split_leaf(struct xnbtree *bt, uint64_t *path, int depth, uint64_t idx, const uint8_t *old, uint8_t *buf, struct xnbtrec *recs, int count) {
+    xnmm_init();
+
+    size_t total = 0;
+    for (int i = 0; i < count; i++)
+        total += sizeof(uint16_t) + XNBT_REC_HDR_SZ + recs[i].size;
+    int mid = 0;
+    size_t left_bytes = 0;
+    while (mid < count - 1 && left_bytes < total / 2) {
+        left_bytes += sizeof(uint16_t) + XNBT_REC_HDR_SZ + recs[mid].size;
+        mid++;
+    }
+
+    xnmm_scoped_alloc(scoped_right, xn_free, xn_malloc, &scoped_right, XNPG_SZ);
+    uint8_t *right = (uint8_t*)scoped_right;
+    xnbt_leaf_build(right, xnbt_hdr((uint8_t*)old)->next, &recs[mid], count - mid);
+    uint64_t right_idx;
+    xn_ensure(xnbt_write_new_node(bt, &right_idx, right));
+
+    //recs point into another buffer, so the left half can be built in buf
+    xnbt_leaf_build(buf, right_idx, recs, mid);
+    xn_ensure(xnbt_write_node(bt, idx, old, buf));
+
+    xn_ensure(xnbt_insert_parent(bt, path, depth, idx, recs[mid].key, right_idx));
+    return xn_ok();
+}
+
+//rebuilds the leaf in cur with rec added at pos, splitting it if the records don't fit in one page
+static xnresult_t xnbt_rebuild_leaf(struct xnbtree *bt, uint64_t *path, int depth, uint64_t idx, const uint8_t *old, uint8_t *cur, int pos, struct xnbtrec rec) {
+    xnmm_init();
+
+    int count = xnbt_hdr(cur)->count + 1;
+    xnmm_scoped_alloc(scoped_recs, xn_free, xn_malloc, &scoped_recs, count * sizeof(struct xnbtrec));
+    struct xnbtrec *recs = (struct xnbtrec*)scoped_recs;
+    xnmm_scoped_alloc(scoped_buf, xn_free, xn_malloc, &scoped_buf, XNPG_SZ);
+    uint8_t *buf = (uint8_t*)scoped_buf;
+
+    size_t bytes = 0;
+    for (int i = 0, j = 0; i < count; i++) {
+        if (i == pos) {
+            recs[i] = rec;
+        } else {
+            recs[i] = (struct xnbtrec){ .key = xnbt_leaf_key(cur, j), .size = xnbt_leaf_size(cur, j), .val = xnbt_leaf_val(cur, j) };
+            j++;
+        }
+        bytes += sizeof(uint16_t) + XNBT_REC_HDR_SZ + recs[i].size;
+    }
+
+    if (bytes <= XNPG_SZ - XNBT_HDR_SZ) {
+        xnbt_leaf_build(buf, xnbt_hdr(cur)->next, recs, count);
+        xn_ensure(xnbt_write_node(bt, idx, old, buf));
+        return xn_ok();
+    }
+
+    xn_ensure(xnbt_split_leaf(bt, path, depth, idx, old, buf, recs, count));
+    return xn_ok();
+}
+
+//removes the slot.  The record bytes stay behind until the leaf is next rebuilt
+static void xnbt_leaf_remove(uint8_t *buf, int slot) {
+    struct xnbthdr *hdr = xnbt_hdr(buf);
+    uint16_t *slots = xnbt_slots(buf);
+    memmove(&slots[slot], &slots[slot + 1], (hdr->count - slot - 1) * sizeof(uint16_t));
+    hdr->count--;
+    slots[hdr->count] = 0;
+}
+
+//inserts or replaces the value for key
+xnresult_t xnbt_put(struct xnbtree *bt, uint64_t key, const uint8_t *val, size_t size) {
+    xnmm_init();
+    xn_ensure(size <= XNBT_MAX_VAL_SZ);
+
+    xnmm_scoped_alloc(scoped_old, xn_free, xn_malloc, &scoped_old, XNPG_SZ);
+    xnmm_scoped_alloc(scoped_buf, xn_free, xn_malloc, &scoped_buf, XNPG_SZ);
+    uint8_t *old = (uint8_t*)scoped_old;
+    uint8_t *buf = (uint8_t*)scoped_buf;
+
+    uint64_t path[XNBT_MAX_DEPTH];
+    int depth;
+    uint64_t idx;
+    xn_ensure(xnbt_find_leaf(bt, key, old, path, &depth, &idx));
+    memcpy(buf, old, XNPG_SZ);
+
+    bool found;
+    int pos = xnbt_leaf_search(buf, key, &found);
+    if (found)
+        xnbt_leaf_remove(buf, pos);
+
+    struct xnbtrec rec = { .key = key, .size = size, .val = val };
+    if (xnbt_leaf_free_space(buf) < (int)(sizeof(uint16_t) + XNBT_REC_HDR_SZ + size)) {
+        xn_ensure(xnbt_rebuild_leaf(bt, path, depth, idx, old, buf, pos, rec));
+        return xn_ok();
+    }
+
+    //room below the records: append the record, then shift the later slots up to keep them sorted
+    struct xnbthdr *hdr = xnbt_hdr(buf);
+    xnbt_leaf_append(buf, rec);
+    uint16_t *slots = xnbt_slots(buf);
+    uint16_t off = slots[hdr->count - 1];
+    memmove(&slots[pos + 1], &slots[pos], (hdr->count - 1 - pos) * sizeof(uint16_t));
+    slots[pos] = off;
+
+    xn_ensure(xnbt_write_node(bt, idx, old, buf));
+    return xn_ok();
+}
+
+xnresult_t xnbt_get_size(struct xnbtree *bt, uint64_t key, size_t *out_size, bool *found) {
+    xnmm_init();
+
+    xnmm_scoped_alloc(scoped_ptr, xn_free, xn_malloc, &scoped_ptr, XNPG_SZ);
+    uint8_t *buf = (uint8_t*)scoped_ptr;
+    uint64_t idx;
+    xn_ensure(xnbt_find_leaf(bt, key, buf, NULL, NULL, &idx));
+
+    int pos = xnbt_leaf_search(buf, key, found);
+    if (*found)
+        *out_size = xnbt_leaf_size(buf, pos);
+
+    return xn_ok();
+}
+
+xnresult_t xnbt_get(struct xnbtree *bt, uint64_t key, uint8_t *val, size_t size, bool *found) {
+    xnmm_init();
+
+    xnmm_scoped_alloc(scoped_ptr, xn_free, xn_malloc, &scoped_ptr, XNPG_SZ);
+    uint8_t *buf = (uint8_t*)scoped_ptr;
+    uint64_t idx;
+    xn_ensure(xnbt_find_leaf(bt, key, buf, NULL, NULL, &idx));
+
+    int pos = xnbt_leaf_search(buf, key, found);
+    if (*found) {
+        xn_ensure(size >= xnbt_leaf_size(buf, pos));
+        memcpy(val, xnbt_leaf_val(buf, pos), xnbt_leaf_size(buf, pos));
+    }
+
+    return xn_ok();
+}
+
+//leaves are not merged, so a leaf can be left empty.  Scans skip over it
+xnresult_t xnbt_del(struct xnbtree *bt, uint64_t key, bool *found) {
+    xnmm_init();
+
+    xnmm_scoped_alloc(scoped_old, xn_free, xn_malloc, &scoped_old, XNPG_SZ);
+    xnmm_scoped_alloc(scoped_buf, xn_free, xn_malloc, &scoped_buf, XNPG_SZ);
+    uint8_t *old = (uint8_t*)scoped_old;
+    uint8_t *buf = (uint8_t*)scoped_buf;
+
+    uint64_t idx;
+    xn_ensure(xnbt_find_leaf(bt, key, old, NULL, NULL, &idx));
+    memcpy(buf, old, XNPG_SZ);
+
+    int pos = xnbt_leaf_search(buf, key, found);
+    if (*found) {
+        xnbt_leaf_remove(buf, pos);
+        xn_ensure(xnbt_write_node(bt, idx, old, buf));
+    }
+
+    return xn_ok();
+}
+
+//scans keys in [lo, hi] in order.  The scan reads only the fields it needs from each leaf, so it holds no buffers
+xnresult_t xnbtscan_open(struct xnbtscan *scan, struct xnbtree bt, uint64_t lo, uint64_t hi) {
+    xnmm_init();
+    scan->bt = bt;
+    scan->hi = hi;
+    scan->started = false;
+
+    xnmm_scoped_alloc(scoped_ptr, xn_free, xn_malloc, &scoped_ptr, XNPG_SZ);
+    uint8_t *buf = (uint8_t*)scoped_ptr;
+    xn_ensure(xnbt_find_leaf(&scan->bt, lo, buf, NULL, NULL, &scan->leaf));
+
+    bool found;
+    scan->slot = xnbt_leaf_search(buf, lo, &found);
+    return xn_ok();
+}
+
+static xnresult_t xnbtscan_read(struct xnbtscan *scan, int offset, uint8_t *out, size_t size) {
+    xnmm_init();
+    struct xnpg page = { .file_handle = scan->bt.meta.file_handle, .idx = scan->leaf };
+    xn_ensure(xnpg_read(&page, scan->bt.tx, out, offset, size));
+    return xn_ok();
+}
+
+static xnresult_t xnbtscan_rec_offset(struct xnbtscan *scan, uint16_t *out_off) {
+    xnmm_init();
+    xn_ensure(xnbtscan_read(scan, XNBT_HDR_SZ + scan->slot * sizeof(uint16_t), (uint8_t*)out_off, sizeof(uint16_t)));
+    return xn_ok();
+}
+
+xnresult_t xnbtscan_next(struct xnbtscan *scan, bool *result) {
+    xnmm_init();
+
+    if (scan->started)
+        scan->slot++;
+    scan->started = true;
+
+    struct xnbthdr hdr;
+    xn_ensure(xnbtscan_read(scan, 0, (uint8_t*)&hdr, sizeof(struct xnbthdr)));
+    while (scan->slot >= hdr.count) {
+        if (hdr.next == 0) {
+            *result = false;
+            return xn_ok();
+        }
+        scan->leaf = hdr.next;
+        scan->slot = 0;
+        xn_ensure(xnbtscan_read(scan, 0, (uint8_t*)&hdr, sizeof(struct xnbthdr)));
+    }
+
+    uint64_t key;
+    xn_ensure(xnbtscan_key(scan, &key));
+    *result = key <= scan->hi;
+    return xn_ok();
+}
+
+xnresult_t xnbtscan_key(struct xnbtscan *scan, uint64_t *key) {
+    xnmm_init();
+    uint16_t off;
+    xn_ensure(xnbtscan_rec_offset(scan, &off));
+    xn_ensure(xnbtscan_read(scan, off, (uint8_t*)key, sizeof(uint64_t)));
+    return xn_ok();
+}
+
+xnresult_t xnbtscan_get_size(struct xnbtscan *scan, size_t *size) {
+    xnmm_init();
+    uint16_t off;
+    xn_ensure(xnbtscan_rec_offset(scan, &off));
+    uint16_t val_size;
+    xn_ensure(xnbtscan_read(scan, off + sizeof(uint64_t), (uint8_t*)&val_size, sizeof(uint16_t)));
+    *size = val_size;
+    return xn_ok();
+}
+
+xnresult_t xnbtscan_get(struct xnbtscan *scan, uint8_t *val, size_t size) {
+    xnmm_init();
+    uint16_t off;
+    xn_ensure(xnbtscan_rec_offset(scan, &off));
+    uint16_t val_size;
+    xn_ensure(xnbtscan_read(scan, off + sizeof(uint64_t), (uint8_t*)&val_size, sizeof(uint16_t)));
+    xn_ensure(size >= val_size);
+    xn_ensure(xnbtscan_read(scan, off + XNBT_REC_HDR_SZ, val, val_size));
+    return xn_ok();
+}
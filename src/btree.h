@@ -0,0 +1,51 @@
+#pragma once
+
+#include "file.h"
+#include "page.h"
+#include "util.h"
+#include "tx.h"
+
+#define XNBT_HDR_SZ 32
+#define XNBT_MAX_DEPTH 16
+
+//values are stored inline in leaves.  Capped so a split always leaves both halves with room
+#define XNBT_MAX_VAL_SZ 1024
+
+//node header.  Leaves keep a sorted array of 2 byte record offsets after the header, and records
+//(8 byte key, 2 byte value size, value) grow down from the end of the page.  Internal nodes keep a
+//sorted array of (key, child) entries after the header - keys >= entry key are in entry child,
+//and keys smaller than the first key are in child0
+struct xnbthdr {
+    uint16_t leaf;
+    uint16_t count;
+    uint16_t ceil;
+    uint16_t unused;
+    uint64_t next;      //right sibling of a leaf, 0 for the last leaf
+    uint64_t child0;
+    uint64_t reserved;
+};
+
+struct xnbtree {
+    struct xnpg meta;
+    struct xntx *tx;
+};
+
+struct xnbtscan {
+    struct xnbtree bt;
+    uint64_t leaf;
+    int slot;
+    uint64_t hi;
+    bool started;
+};
+
+xnresult_t xnbt_open(struct xnbtree *bt, struct xnfile *file, bool create, struct xntx *tx);
+xnresult_t xnbt_put(struct xnbtree *bt, uint64_t key, const uint8_t *val, size_t size);
+xnresult_t xnbt_get_size(struct xnbtree *bt, uint64_t key, size_t *out_size, bool *found);
+xnresult_t xnbt_get(struct xnbtree *bt, uint64_t key, uint8_t *val, size_t size, bool *found);
+xnresult_t xnbt_del(struct xnbtree *bt, uint64_t key, bool *found);
+
+xnresult_t xnbtscan_open(struct xnbtscan *scan, struct xnbtree bt, uint64_t lo, uint64_t hi);
+xnresult_t xnbtscan_next(struct xnbtscan *scan, bool *result);
+xnresult_t xnbtscan_key(struct xnbtscan *scan, uint64_t *key);
+xnresult_t xnbtscan_get_size(struct xnbtscan *scan, size_t *size);
+xnresult_t xnbtscan_get(struct xnbtscan *scan, uint8_t *val, size_t size);
@@ -1,6 +1,13 @@
 #include "container.h"
 #include <string.h>
 
+//start of every container page.  The slot array grows up from XNCTN_HDR_SZ to floor, and data grows down
+//from the end of the page to ceil
+struct xnctnhdr {
+    uint16_t item_count;
+    uint16_t floor;
+    uint16_t ceil;
+};
 
 xnresult_t xnctn_open(struct xnctn *ctn, struct xnpg pg, struct xntx *tx) {
 	xnmm_init();
@@ -14,19 +21,15 @@ xnresult_t xnctn_open(struct xnctn *ctn, struct xnpg pg, struct xntx *tx) {
 xnresult_t xnctn_init(struct xnctn *ctn) {
     xnmm_init();
 
-    //zero out page
-    xnmm_scoped_alloc(scoped_ptr, xn_free, xn_malloc, &scoped_ptr, XNPG_SZ);
-    uint8_t *buf = (uint8_t*)scoped_ptr;
-    memset(buf, 0, XNPG_SZ);
-    xn_ensure(xnpg_write(&ctn->pg, ctn->tx, buf, 0, XNPG_SZ, true));
-
-    //write header
-    uint16_t item_count = 0;
-    uint16_t floor = XNCTN_HDR_SZ;
-    uint16_t ceil = XNPG_SZ;
-    xn_ensure(xnpg_write(&ctn->pg, ctn->tx, (uint8_t*)&item_count, 0, sizeof(uint16_t), true));
-    xn_ensure(xnpg_write(&ctn->pg, ctn->tx, (uint8_t*)&floor, sizeof(uint16_t), sizeof(uint16_t), true));
-    xn_ensure(xnpg_write(&ctn->pg, ctn->tx, (uint8_t*)&ceil, sizeof(uint16_t) * 2, sizeof(uint16_t), true));
+    //zeroed page with an empty header.  Every byte is written, so the old contents aren't read.  The zeroes are
+    //logged without their bytes
+    uint8_t *data;
+    xn_ensure(xnpg_pin_overwrite(&ctn->pg, ctn->tx, &data));
+    memset(data, 0, XNPG_SZ);
+    struct xnctnhdr hdr = { .item_count = 0, .floor = XNCTN_HDR_SZ, .ceil = XNPG_SZ };
+    memcpy(data, &hdr, sizeof(struct xnctnhdr));
+    struct xnpgrange ranges[2] = { { 0, sizeof(struct xnctnhdr) }, { sizeof(struct xnctnhdr), XNPG_SZ - sizeof(struct xnctnhdr) } };
+    xn_ensure(xnpg_mark_dirty(&ctn->pg, ctn->tx, ranges, 2));
 
     return xn_ok();
 }
@@ -35,12 +38,10 @@ xnresult_t xnctn_can_fit(struct xnctn *ctn, size_t data_size, bool *result) {
     xnmm_init();
 
     //read container metadata
-    uint16_t floor;
-    xn_ensure(xnpg_read(&ctn->pg, ctn->tx, (uint8_t*)&floor, sizeof(uint16_t), sizeof(uint16_t)));
-    uint16_t ceil;
-    xn_ensure(xnpg_read(&ctn->pg, ctn->tx, (uint8_t*)&ceil, sizeof(uint16_t) * 2, sizeof(uint16_t)));
+    struct xnctnhdr hdr;
+    xn_ensure(xnpg_read(&ctn->pg, ctn->tx, (uint8_t*)&hdr, 0, sizeof(struct xnctnhdr)));
 
-    *result = ceil - floor >= data_size + sizeof(uint32_t);
+    *result = hdr.ceil - hdr.floor >= data_size + sizeof(uint32_t);
     return xn_ok();
 }
 
@@ -55,41 +56,46 @@ static inline void xnctn_get_ptr_fields(uint32_t ptr, uint32_t *used, uint32_t *
     *used = ptr & used_mask;
 }
 
-xnresult_t xnctn_insert(struct xnctn *ctn, const uint8_t *buf, size_t size, struct xnitemid *out_id) {
+//caller has pinned the page.  Adds the item to the tx's copy of the page, and fills in the three ranges
+//that changed: the header, the new slot and the data
+static xnresult_t xnctn_place(struct xnctn *ctn, uint8_t *data, const uint8_t *buf, size_t size, struct xnitemid *out_id, struct xnpgrange *ranges) {
     xnmm_init();
 
-    //read container metadata
-    uint16_t item_count;
-    xn_ensure(xnpg_read(&ctn->pg, ctn->tx, (uint8_t*)&item_count, 0, sizeof(uint16_t)));
-    uint16_t floor;
-    xn_ensure(xnpg_read(&ctn->pg, ctn->tx, (uint8_t*)&floor, sizeof(uint16_t), sizeof(uint16_t)));
-    uint16_t ceil;
-    xn_ensure(xnpg_read(&ctn->pg, ctn->tx, (uint8_t*)&ceil, sizeof(uint16_t) * 2, sizeof(uint16_t)));
-    xn_ensure(ceil <= XNPG_SZ);
+    struct xnctnhdr *hdr = (struct xnctnhdr*)data;
+    xn_ensure(hdr->ceil <= XNPG_SZ);
 
     //make sure enough space in container to store data + array pointer
-    xn_ensure(ceil - size > floor + sizeof(uint16_t) * 2);
+    xn_ensure(hdr->ceil >= hdr->floor + sizeof(uint32_t) + size);
 
-    //write pointer
-    uint32_t data_off = ceil - size;
-    uint32_t data_size = size;
-    uint32_t used = 1;
-    uint32_t ptr = xnctn_set_ptr_fields(used, data_size, data_off);
-    xn_ensure(xnpg_write(&ctn->pg, ctn->tx, (uint8_t*)&ptr , floor, sizeof(uint32_t), true));
-
-    //write data
-    xn_ensure(xnpg_write(&ctn->pg, ctn->tx, buf, data_off, size, true));
+    //write pointer and data
+    uint32_t data_off = hdr->ceil - size;
+    uint32_t ptr = xnctn_set_ptr_fields(1, size, data_off);
+    memcpy(data + hdr->floor, &ptr, sizeof(uint32_t));
+    memcpy(data + data_off, buf, size);
+    ranges[0] = (struct xnpgrange){ 0, sizeof(struct xnctnhdr) };
+    ranges[1] = (struct xnpgrange){ hdr->floor, sizeof(uint32_t) };
+    ranges[2] = (struct xnpgrange){ data_off, size };
 
     out_id->pg_idx = ctn->pg.idx;
-    out_id->arr_idx = item_count;
+    out_id->arr_idx = hdr->item_count;
 
     //update container metadata
-    item_count++;
-    floor += sizeof(uint16_t) * 2;
-    ceil -= size;
-    xn_ensure(xnpg_write(&ctn->pg, ctn->tx, (uint8_t*)&item_count, 0, sizeof(uint16_t), true));
-    xn_ensure(xnpg_write(&ctn->pg, ctn->tx, (uint8_t*)&floor, sizeof(uint16_t), sizeof(uint16_t), true));
-    xn_ensure(xnpg_write(&ctn->pg, ctn->tx, (uint8_t*)&ceil, sizeof(uint16_t) * 2, sizeof(uint16_t), true));
+    hdr->item_count++;
+    hdr->floor += sizeof(uint32_t);
+    hdr->ceil -= size;
+
+    return xn_ok();
+}
+
+//modifies the tx's copy of the page in place, and logs the slot, the data and the header in one record
+xnresult_t xnctn_insert(struct xnctn *ctn, const uint8_t *buf, size_t size, struct xnitemid *out_id) {
+    xnmm_init();
+
+    uint8_t *data;
+    xn_ensure(xnpg_pin(&ctn->pg, ctn->tx, &data));
+    struct xnpgrange ranges[3];
+    xn_ensure(xnctn_place(ctn, data, buf, size, out_id, ranges));
+    xn_ensure(xnpg_mark_dirty(&ctn->pg, ctn->tx, ranges, 3));
 
     return xn_ok();
 }
@@ -146,28 +152,37 @@ xnresult_t xnctn_get_size(struct xnctn *ctn, struct xnitemid id, size_t *size) {
     return xn_ok();
 }
 
-xnresult_t xnctn_delete(struct xnctn *ctn, struct xnitemid id) {
+//reads and updates the slot in the tx's copy of the page
+static xnresult_t xnctn_pin_slot(struct xnctn *ctn, struct xnitemid id, uint8_t **out_data, uint32_t **out_ptr) {
     xnmm_init();
 
     xn_ensure(ctn->pg.idx == id.pg_idx);
 
-    //read container metadata
-    uint16_t item_count;
-    xn_ensure(xnpg_read(&ctn->pg, ctn->tx, (uint8_t*)&item_count, 0, sizeof(uint16_t)));
-    xn_ensure(id.arr_idx < item_count);
+    uint8_t *data;
+    xn_ensure(xnpg_pin(&ctn->pg, ctn->tx, &data));
+    xn_ensure(id.arr_idx < ((struct xnctnhdr*)data)->item_count);
 
-    off_t ptr_off = XNCTN_HDR_SZ + id.arr_idx * 2 * sizeof(uint16_t); //TODO change to uint32_t
-    uint32_t ptr;
-    xn_ensure(xnpg_read(&ctn->pg, ctn->tx, (uint8_t*)&ptr, ptr_off, sizeof(uint32_t)));
+    *out_data = data;
+    *out_ptr = (uint32_t*)(data + XNCTN_HDR_SZ + id.arr_idx * sizeof(uint32_t));
+    return xn_ok();
+}
+
+xnresult_t xnctn_delete(struct xnctn *ctn, struct xnitemid id) {
+    xnmm_init();
+
+    uint8_t *data;
+    uint32_t *ptr;
+    xn_ensure(xnctn_pin_slot(ctn, id, &data, &ptr));
 
     uint32_t used;
     uint32_t data_size;
     uint32_t data_off;
-    xnctn_get_ptr_fields(ptr, &used, &data_size, &data_off);
+    xnctn_get_ptr_fields(*ptr, &used, &data_size, &data_off);
     xn_ensure(used == 1);
 
-    uint32_t new_ptr = xnctn_set_ptr_fields(0, data_size, data_off);
-    xn_ensure(xnpg_write(&ctn->pg, ctn->tx, (uint8_t*)&new_ptr , ptr_off, sizeof(uint32_t), true));
+    *ptr = xnctn_set_ptr_fields(0, data_size, data_off);
+    struct xnpgrange range = { (uint8_t*)ptr - data, sizeof(uint32_t) };
+    xn_ensure(xnpg_mark_dirty(&ctn->pg, ctn->tx, &range, 1));
 
     return xn_ok();
 }
@@ -175,31 +190,31 @@ xnresult_t xnctn_delete(struct xnctn *ctn, struct xnitemid id) {
 xnresult_t xnctn_update(struct xnctn *ctn, struct xnitemid id, uint8_t *data, size_t size, struct xnitemid *new_id) {
     xnmm_init();
 
-    xn_ensure(ctn->pg.idx == id.pg_idx);
-
-    //read container metadata
-    uint16_t item_count;
-    xn_ensure(xnpg_read(&ctn->pg, ctn->tx, (uint8_t*)&item_count, 0, sizeof(uint16_t)));
-    xn_ensure(id.arr_idx < item_count);
-
-    off_t ptr_off = XNCTN_HDR_SZ + id.arr_idx * 2 * sizeof(uint16_t); //TODO change to uint32_t
-    uint32_t ptr;
-    xn_ensure(xnpg_read(&ctn->pg, ctn->tx, (uint8_t*)&ptr, ptr_off, sizeof(uint32_t)));
+    uint8_t *page;
+    uint32_t *ptr;
+    xn_ensure(xnctn_pin_slot(ctn, id, &page, &ptr));
 
     uint32_t used;
     uint32_t data_size;
     uint32_t data_off;
-    xnctn_get_ptr_fields(ptr, &used, &data_size, &data_off);
+    xnctn_get_ptr_fields(*ptr, &used, &data_size, &data_off);
     xn_ensure(used == 1);
 
     if (data_size == size) {
-        xn_ensure(xnpg_write(&ctn->pg, ctn->tx, data, data_off, size, true));
+        memcpy(page + data_off, data, size);
+        struct xnpgrange range = { data_off, size };
+        xn_ensure(xnpg_mark_dirty(&ctn->pg, ctn->tx, &range, 1));
         *new_id = id;
-    } else {
-        xn_ensure(xnctn_delete(ctn, id));
-        xn_ensure(xnctn_insert(ctn, data, size, new_id));        
+        return xn_ok();
     }
 
+    //a different size moves the item to a new slot.  The new slot and the freed old one go in one record
+    struct xnpgrange ranges[4];
+    xn_ensure(xnctn_place(ctn, page, data, size, new_id, ranges));
+    *ptr = xnctn_set_ptr_fields(0, data_size, data_off);
+    ranges[3] = (struct xnpgrange){ (uint8_t*)ptr - page, sizeof(uint32_t) };
+    xn_ensure(xnpg_mark_dirty(&ctn->pg, ctn->tx, ranges, 4));
+
     return xn_ok();
 }
 
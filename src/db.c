@@ -13,7 +13,8 @@ static void xndb_make_path(char *out, const char *path1, const char *path2) {
     strcat(out, path2);
 }
 
-static xnresult_t xndb_get_file(struct xndb *db, struct xnfile **out_file, const char *filename, bool create, bool direct) {
+//caller must hold files lock
+static xnresult_t xndb_get_file_locked(struct xndb *db, struct xnfile **out_file, const char *filename, bool create, bool direct) {
     xnmm_init();
 
     char path[PATH_MAX];
@@ -28,9 +29,15 @@ static xnresult_t xndb_get_file(struct xndb *db, struct xnfile **out_file, const
     }
 
     if (!file) {
+        xn_ensure(db->file_counter < XNLOG_MAX_FILES);
         int idx = db->file_counter++;
-        xnmm_alloc(xnfile_close, xnfile_create, &db->files[idx], path, 0, create, direct);
+        //file ids are the index into db->files, so they are unique within the database
+        xnmm_alloc(xnfile_close, xnfile_create, &db->files[idx], path, idx, create, direct);
         file = db->files[idx];
+        //the log is the only file opened for direct I/O
+        file->uring = direct ? db->log_uring : db->data_uring;
+        file->growth = db->growth;
+        file->grower = db->grower;
     }
 
     *out_file = file;
@@ -38,22 +45,126 @@ static xnresult_t xndb_get_file(struct xndb *db, struct xnfile **out_file, const
     return xn_ok();
 }
 
+static xnresult_t xndb_get_file(struct xndb *db, struct xnfile **out_file, const char *filename, bool create, bool direct) {
+    xnmm_init();
+    xn_ensure(xn_mutex_lock(db->files_lock));
+    bool ok = xndb_get_file_locked(db, out_file, filename, create, direct);
+    xn_ensure(xn_mutex_unlock(db->files_lock));
+    xn_ensure(ok);
+    return xn_ok();
+}
+
+//one flusher pass: versions every snapshot can see go to the buffer pool, dirty pages are written
+//back, and a checkpoint is taken if enough log has built up.  Also called directly to flush synchronously
+xnresult_t xndb_flush(struct xndb *db) {
+    xnmm_init();
+    xn_ensure(xnmvcc_gc(db->mvcc, db->pool));
+    xn_ensure(xnpool_flush(db->pool));
+    xn_ensure(xndb_maybe_checkpoint(db));
+    return xn_ok();
+}
+
+//wake-ups that arrive during a pass are merged into one more pass, so a burst of commits costs a single flush
+static void *xndb_flusher(void *arg) {
+    struct xndb *db = (struct xndb*)arg;
+
+    if (!xn_mutex_lock(db->flusher_lock))
+        return NULL;
+
+    while (!db->flusher_stopping && !db->flusher_failed) {
+        if (!db->flush_pending) {
+            if (!xn_cond_wait(&db->flusher_cv, db->flusher_lock))
+                break;
+            continue;
+        }
+
+        db->flush_pending = false;
+        if (!xn_mutex_unlock(db->flusher_lock))
+            return NULL;
+        bool ok = xndb_flush(db);
+        if (!xn_mutex_lock(db->flusher_lock))
+            return NULL;
+        //a failure sticks, since write txs check it before they start
+        if (!ok)
+            db->flusher_failed = true;
+    }
+
+    if (!xn_mutex_unlock(db->flusher_lock))
+        return NULL;
+    return NULL;
+}
+
+//called after commits, and when the oldest snapshot ends, since both can let gc make progress.  Nothing is
+//returned, since the caller may already have committed - a flusher that stopped on an error is reported to
+//new write txs by xndb_check_flusher instead
+void xndb_wake_flusher(struct xndb *db) {
+    if (!xn_mutex_lock(db->flusher_lock))
+        return;
+    db->flush_pending = true;
+    if (!xn_cond_signal(&db->flusher_cv))
+        db->flusher_failed = true;
+    if (!xn_mutex_unlock(db->flusher_lock))
+        db->flusher_failed = true;
+}
+
+//fails once the flusher has stopped on an error, since committed versions would no longer reach disk
+xnresult_t xndb_check_flusher(struct xndb *db) {
+    xnmm_init();
+    xn_ensure(xn_mutex_lock(db->flusher_lock));
+    bool ok = !db->flusher_failed;
+    xn_ensure(xn_mutex_unlock(db->flusher_lock));
+    xn_ensure(ok);
+    return xn_ok();
+}
+
+struct xndbopts xndb_default_opts() {
+    struct xndbopts opts = { .pool_frames = XNPOOL_DEFAULT_FRAMES,
+                             .commit_wait_us = 0,
+                             .commit_batch = XNLOG_DEFAULT_COMMIT_BATCH,
+                             .log_pages = XNLOG_DEFAULT_RING_PAGES,
+                             .checkpoint_log_bytes = XNDB_DEFAULT_CHECKPOINT_LOG_BYTES,
+                             .io_uring = true,
+                             .growth = xnfile_default_growth() };
+    return opts;
+}
+
 xnresult_t xndb_create(const char *dir_path, bool create, struct xndb **out_db) {
     xnmm_init();
+    xn_ensure(xndb_create_opts(dir_path, create, xndb_default_opts(), out_db));
+    return xn_ok();
+}
+
+xnresult_t xndb_create_opts(const char *dir_path, bool create, struct xndbopts opts, struct xndb **out_db) {
+    xnmm_init();
 
     struct xndb *db;
     xnmm_alloc(xn_free, xn_malloc, (void**)&db, sizeof(struct xndb));
 
     //initialize locks and protected data
-    xnmm_alloc(xnmtx_free, xnmtx_create, &db->wrtx_lock);
-    xnmm_alloc(xnmtx_free, xnmtx_create, &db->rdtx_count_lock);
-    xnmm_alloc(xnmtx_free, xnmtx_create, &db->committed_wrtx_lock);
+    xnmm_alloc(xnmtx_free, xnmtx_create, &db->files_lock);
     xnmm_alloc(xnmtx_free, xnmtx_create, &db->tx_id_counter_lock);
-    db->rdtx_count = 0;
-    db->committed_wrtx = NULL;
+    xnmm_alloc(xnmtx_free, xnmtx_create, &db->wrtx_list_lock);
+    xnmm_alloc(xnmtx_free, xnmtx_create, &db->checkpoint_lock);
+    xnmm_alloc(xnmtx_free, xnmtx_create, &db->flusher_lock);
+    xn_ensure(pthread_cond_init(&db->flusher_cv, NULL) == 0);
+    db->flush_pending = false;
+    db->flusher_stopping = false;
+    db->flusher_failed = false;
+    db->wrtx_list = NULL;
+    db->checkpoint_log_bytes = opts.checkpoint_log_bytes;
     db->tx_id_counter = 1;
     db->file_counter = 0;
 
+    //rings are attached to files as they are opened, so they have to exist first
+    db->log_uring = NULL;
+    db->data_uring = NULL;
+    if (opts.io_uring && xnuring_supported()) {
+        xnmm_alloc(xnuring_free, xnuring_create, &db->log_uring, XNURING_DEPTH);
+        xnmm_alloc(xnuring_free, xnuring_create, &db->data_uring, XNURING_DEPTH);
+    }
+    db->growth = opts.growth;
+    xnmm_alloc(xngrower_free, xngrower_create, &db->grower);
+
     if (create) {
         xn_ensure(xn_mkdir(dir_path, 0700));
     }
@@ -73,95 +184,254 @@ xnresult_t xndb_create(const char *dir_path, bool create, struct xndb **out_db)
         for (int i = 0; i < 32; i++) {
             xn_ensure(xnfile_write(log_file, buf, i * XNPG_SZ, XNPG_SZ));
         }
+        xn_ensure(xnfile_sync(log_file));
     }
 
-    xnmm_alloc(xnlog_free, xnlog_create, &db->log, log_file, create);
+    xnmm_alloc(xnlog_free, xnlog_create, &db->log, log_file, create, opts.log_pages);
+    db->log->commit_wait_us = opts.commit_wait_us;
+    db->log->commit_batch = opts.commit_batch;
 
-    //need root page table initialized before transactions can be created
-    xnmm_alloc(xntbl_free, xntbl_create, &db->pg_tbl, true);
+    //need buffer pool and version store initialized before transactions can be created
+    xnmm_alloc(xnpool_free, xnpool_create, &db->pool, opts.pool_frames);
+    db->pool->log = db->log;
+    xnmm_alloc(xnmvcc_free, xnmvcc_create, &db->mvcc);
 
     xn_ensure(xndb_recover(db));
 
-   *out_db = db;
+    //started last since nothing after this can fail.  Recovery already asked for a flush, so
+    //the flusher writes the recovered pages back as soon as it starts
+    xn_ensure(pthread_create(&db->flusher, NULL, xndb_flusher, db) == 0);
+
+    *out_db = db;
     return xn_ok();
 }
 
 xnresult_t xndb_free(struct xndb *db) {
     xnmm_init();
-    xn_ensure(xnmtx_free((void**)&db->wrtx_lock));
-    xn_ensure(xnmtx_free((void**)&db->rdtx_count_lock));
-    xn_ensure(xnmtx_free((void**)&db->committed_wrtx_lock));
+
+    xn_ensure(xn_mutex_lock(db->flusher_lock));
+    db->flusher_stopping = true;
+    xn_ensure(xn_cond_signal(&db->flusher_cv));
+    xn_ensure(xn_mutex_unlock(db->flusher_lock));
+    xn_ensure(pthread_join(db->flusher, NULL) == 0);
+    xn_ensure(!db->flusher_failed);
+    xn_ensure(xnmtx_free((void**)&db->flusher_lock));
+    pthread_cond_destroy(&db->flusher_cv);
+
+    xn_ensure(xnmtx_free((void**)&db->files_lock));
     xn_ensure(xnmtx_free((void**)&db->tx_id_counter_lock));
-    xn_ensure(xntbl_free((void**)&db->pg_tbl));
+    xn_ensure(xnmtx_free((void**)&db->wrtx_list_lock));
+    xn_ensure(xnmtx_free((void**)&db->checkpoint_lock));
+
+    //all txs are done, so every version can go to the buffer pool
+    xn_ensure(xnmvcc_gc(db->mvcc, db->pool));
+    xn_ensure(xnmvcc_free((void**)&db->mvcc));
+    xn_ensure(xnpool_flush(db->pool));
+    xn_ensure(xnpool_free((void**)&db->pool));
+    xn_ensure(xnlog_free((void**)&db->log));
+    //the grower may still be extending a file, so it has to stop before the files close
+    xn_ensure(xngrower_free((void**)&db->grower));
     for (int i = 0; i < db->file_counter; i++) {
         xn_ensure(xnfile_close((void**)&db->files[i]));
     }
+    xn_ensure(xnuring_free((void**)&db->log_uring));
+    xn_ensure(xnuring_free((void**)&db->data_uring));
     free(db);
     return xn_ok();
 }
 
-static xnresult_t xndb_redo(struct xndb *db, struct xntx *tx, uint64_t page_idx, int page_off, int tx_id) {
+//applies a logged update to a page in tx without logging it again.  See xnpg_log for the layout
+static xnresult_t xndb_redo_update(struct xndb *db, struct xntx *tx, struct xnlogitr *itr, size_t data_size, struct xnlogfiles *files) {
+    xnmm_init();
+
+    xnmm_scoped_alloc(scoped_ptr, xn_free, xn_malloc, &scoped_ptr, data_size);
+    uint8_t *buf = (uint8_t*)scoped_ptr;
+    xn_ensure(xnlogitr_read_data(itr, buf, data_size));
+
+    size_t off = 0;
+    uint64_t fields[3];
+    for (int i = 0; i < 3; i++) {
+        int n;
+        xn_ensure((n = xn_varint_get(buf + off, data_size - off, &fields[i])) > 0);
+        off += n;
+    }
+    uint64_t file_id = fields[0];
+    uint64_t pg_idx = fields[1];
+    uint64_t range_count = fields[2];
+    xn_ensure(file_id < XNLOG_MAX_FILES && files->named[file_id]);
+
+    struct xnfile *file;
+    xn_ensure(xndb_get_file(db, &file, files->names[file_id], false, false));
+    struct xnpg page = { .file_handle = file, .idx = pg_idx };
+
+    uint8_t zero[XNPG_SZ];
+    memset(zero, 0, XNPG_SZ);
+    for (uint64_t i = 0; i < range_count; i++) {
+        uint64_t range_off;
+        uint64_t len;
+        int n;
+        xn_ensure((n = xn_varint_get(buf + off, data_size - off, &range_off)) > 0);
+        off += n;
+        xn_ensure((n = xn_varint_get(buf + off, data_size - off, &len)) > 0);
+        off += n;
+
+        size_t size = len >> 1;
+        xn_ensure(range_off + size <= XNPG_SZ);
+        if (len & XNPG_RANGE_ZERO) {
+            xn_ensure(xnpg_write(&page, tx, zero, range_off, size, false));
+        } else {
+            xn_ensure(off + size <= data_size);
+            xn_ensure(xnpg_write(&page, tx, buf + off, range_off, size, false));
+            off += size;
+        }
+    }
+
+    return xn_ok();
+}
+
+//reads a logged alloc or free record.  See xnfile_log_alloc for the layout
+static xnresult_t xndb_read_alloc(struct xndb *db, struct xnlogitr *itr, enum xnlogt type, size_t data_size, struct xnlogfiles *files,
+                                  struct xnfile **out_file, uint64_t *out_idx, bool *out_used) {
+    xnmm_init();
+
+    uint8_t buf[XN_VARINT_MAX * 3];
+    xn_ensure(data_size <= sizeof(buf));
+    xn_ensure(xnlogitr_read_data(itr, buf, data_size));
+
+    size_t off = 0;
+    uint64_t fields[3] = { 0, 0, 0 };
+    int field_count = type == XNLOGT_ALLOC ? 3 : 2;
+    for (int i = 0; i < field_count; i++) {
+        int n;
+        xn_ensure((n = xn_varint_get(buf + off, data_size - off, &fields[i])) > 0);
+        off += n;
+    }
+    uint64_t file_id = fields[0];
+    xn_ensure(file_id < XNLOG_MAX_FILES && files->named[file_id]);
+
+    xn_ensure(xndb_get_file(db, out_file, files->names[file_id], false, false));
+    *out_idx = fields[1];
+    *out_used = fields[2] != 0;
+    return xn_ok();
+}
+
+//a page claimed or freed by a tx that didn't commit, found during redo
+struct xndbclaim {
+    struct xnfile *file;
+    uint64_t idx;
+    int tx_id;
+    bool freed;
+};
+
+//pages claimed by txs that didn't commit.  Their alloc records are redone like the rest, so the pages would stay in
+//use with nothing pointing at them.  The frees are kept to tell a page going back to the tx that freed it apart
+//from a claim
+struct xndbclaims {
+    struct xndbclaim *claims;
+    int count;
+    int capacity;
+};
+
+//an alloc record that sets the bit of a page the tx freed is that page going back to it, and one that clears a bit
+//is the tx giving a claim back
+static xnresult_t xndb_claims_track(struct xndbclaims *set, int tx_id, enum xnlogt type, struct xnfile *file, uint64_t idx, bool used) {
+    xnmm_init();
+
+    if (type == XNLOGT_ALLOC) {
+        for (int i = 0; i < set->count; i++) {
+            struct xndbclaim *claim = &set->claims[i];
+            if (claim->file == file && claim->idx == idx && claim->tx_id == tx_id && claim->freed == used) {
+                set->claims[i] = set->claims[--set->count];
+                return xn_ok();
+            }
+        }
+        if (!used)
+            return xn_ok();
+    }
+
+    if (set->count == set->capacity) {
+        int capacity = set->capacity == 0 ? 64 : set->capacity * 2;
+        struct xndbclaim *claims;
+        xn_ensure((claims = realloc(set->claims, sizeof(struct xndbclaim) * capacity)) != NULL);
+        set->claims = claims;
+        set->capacity = capacity;
+    }
+    set->claims[set->count++] = (struct xndbclaim){ .file = file, .idx = idx, .tx_id = tx_id, .freed = type == XNLOGT_FREE };
+    return xn_ok();
+}
+
+//committed transaction ids found during analysis, indexed by tx id
+struct xndbtxset {
+    bool *committed;
+    int capacity;
+};
+
+static xnresult_t xndb_txset_add(struct xndbtxset *set, int tx_id) {
+    xnmm_init();
+    xn_ensure(tx_id > 0);
+
+    if (tx_id >= set->capacity) {
+        int capacity = set->capacity == 0 ? 64 : set->capacity;
+        while (capacity <= tx_id)
+            capacity *= 2;
+
+        bool *committed;
+        xn_ensure((committed = realloc(set->committed, sizeof(bool) * capacity)) != NULL);
+        memset(committed + set->capacity, 0, sizeof(bool) * (capacity - set->capacity));
+        set->committed = committed;
+        set->capacity = capacity;
+    }
+
+    set->committed[tx_id] = true;
+    return xn_ok();
+}
+
+static bool xndb_txset_contains(struct xndbtxset *set, int tx_id) {
+    return tx_id > 0 && tx_id < set->capacity && set->committed[tx_id];
+}
+
+//analysis pass: single scan of the log to find committed transactions and the highest tx id
+static xnresult_t xndb_analyze(struct xndb *db, struct xndbtxset *set, int *max_tx_id) {
     xnmm_init();
 
     xnmm_scoped_alloc(scoped_ptr, xnlogitr_free, xnlogitr_create, (struct xnlogitr**)&scoped_ptr, db->log);
     struct xnlogitr *itr = (struct xnlogitr*)scoped_ptr;
 
-    xn_ensure(xnlogitr_seek(itr, page_idx, page_off));
-
-    bool valid = true;
+    *max_tx_id = 0;
+    bool valid;
     while (true) {
         xn_ensure(xnlogitr_next(itr, &valid));
         if (!valid) break;
-
-        int cur_tx_id;
+        int tx_id;
         enum xnlogt type;
         size_t data_size;
-        xn_ensure(xnlogitr_read_header(itr, &cur_tx_id, &type, &data_size));
-        if (type == XNLOGT_COMMIT && cur_tx_id == tx_id) {
-            break;
-        } else if (type == XNLOGT_UPDATE && cur_tx_id == tx_id) {
-            xnmm_scoped_alloc(scoped_ptr, xn_free, xn_malloc, &scoped_ptr, data_size);
-            uint8_t *buf = (uint8_t*)scoped_ptr;
-
-            xn_ensure(xnlogitr_read_data(itr, buf, data_size));
-
-            //writing changes back to file (but not logging)
-            uint64_t path_size = *((uint64_t*)buf);
-            char path[path_size + 1];
-            memcpy(path, buf + sizeof(uint64_t), path_size);
-            path[path_size] = '\0';
-            uint64_t pg_idx = *((uint64_t*)(buf + sizeof(uint64_t) + path_size));
-            int off = *((int*)(buf + sizeof(uint64_t) * 2 + path_size));
-
-            //TODO this pointer needs to exist until tx writes are flushed (which is not happending in this function)
-            //xnmm_scoped_alloc(scoped_ptr2, xnfile_close, xnfile_create, (struct xnfile**)&scoped_ptr2, path, 0, false, false);
-            //struct xnfile* file = (struct xnfile*)scoped_ptr2;
-            struct xnfile *file;
-            xn_ensure(xndb_get_file(db, &file, path, false, false));
-
-            //TODO open file here
-            struct xnpg page = { .file_handle = file, .idx = pg_idx };
-            size_t data_hdr_size = sizeof(path_size) + path_size + sizeof(pg_idx) + sizeof(off);
-            size_t size = data_size - data_hdr_size;
-            xn_ensure(xnpg_write(&page, tx, buf + data_hdr_size, off, size, false));
-        }
+        xn_ensure(xnlogitr_read_header(itr, &tx_id, &type, &data_size));
+        if (tx_id > *max_tx_id)
+            *max_tx_id = tx_id;
+        if (type == XNLOGT_COMMIT)
+            xn_ensure(xndb_txset_add(set, tx_id));
     }
 
     return xn_ok();
 }
 
-xnresult_t xndb_recover(struct xndb *db) {
+//redo pass: single sequential scan applying updates and frees from committed transactions, and every alloc record.
+//Pages still claimed by txs that didn't commit are given back before the free maps are rebuilt
+static xnresult_t xndb_redo(struct xndb *db, struct xntx *tx, struct xndbtxset *set, struct xndbclaims *claims) {
     xnmm_init();
 
     xnmm_scoped_alloc(scoped_ptr, xnlogitr_free, xnlogitr_create, (struct xnlogitr**)&scoped_ptr, db->log);
     struct xnlogitr *itr = (struct xnlogitr*)scoped_ptr;
 
-    struct xntx *tx;
-    xnmm_alloc(xntx_rollback, xntx_create, &tx, db, XNTXMODE_WR);
+    //file ids named before the redo point come from the checkpoint record, and the rest from file records as they are reached
+    xnmm_scoped_alloc(scoped_files, xn_free, xn_malloc, &scoped_files, sizeof(struct xnlogfiles));
+    struct xnlogfiles *files = (struct xnlogfiles*)scoped_files;
+    memcpy(files, &db->log->redo_files, sizeof(struct xnlogfiles));
+
+    //files whose free map was redone, indexed by file id
+    bool redone[XNLOG_MAX_FILES];
+    memset(redone, 0, sizeof(redone));
 
-    uint64_t start_pageidx;
-    int start_pageoff;
-    int start_txid = 0;
     bool valid;
     while (true) {
         xn_ensure(xnlogitr_next(itr, &valid));
@@ -170,19 +440,144 @@ xnresult_t xndb_recover(struct xndb *db) {
         enum xnlogt type;
         size_t data_size;
         xn_ensure(xnlogitr_read_header(itr, &tx_id, &type, &data_size));
-        if (type == XNLOGT_START) {
-            start_pageidx = itr->page.idx;
-            start_pageoff = itr->page_off;
-            start_txid = tx_id;
-        } else if (type == XNLOGT_COMMIT && start_txid == tx_id) {
-            xn_ensure(xndb_redo(db, tx, start_pageidx, start_pageoff, start_txid));
+        if (type == XNLOGT_FILE)
+            xn_ensure(xnlogitr_read_file(itr, files));
+        if (type == XNLOGT_UPDATE && xndb_txset_contains(set, tx_id))
+            xn_ensure(xndb_redo_update(db, tx, itr, data_size, files));
+        if (type == XNLOGT_ALLOC || type == XNLOGT_FREE) {
+            struct xnfile *file;
+            uint64_t idx;
+            bool used;
+            xn_ensure(xndb_read_alloc(db, itr, type, data_size, files, &file, &idx, &used));
+            bool committed = xndb_txset_contains(set, tx_id);
+            if (type == XNLOGT_ALLOC || committed) {
+                xn_ensure(xnfile_redo_alloc(file, db->pool, idx, used));
+                redone[file->id] = true;
+            }
+            if (!committed)
+                xn_ensure(xndb_claims_track(claims, tx_id, type, file, idx, used));
         }
     }
 
+    //map pages are claimed by the file, not the tx
+    for (int i = 0; i < claims->count; i++) {
+        struct xndbclaim *claim = &claims->claims[i];
+        if (!claim->freed && claim->idx % XNFILE_GROUP_PAGES != 0)
+            xn_ensure(xnfile_redo_alloc(claim->file, db->pool, claim->idx, false));
+    }
+
+    for (int i = 0; i < db->file_counter; i++) {
+        if (redone[db->files[i]->id])
+            xn_ensure(xnfile_rebuild_map(db->files[i], db->pool));
+    }
+
+    return xn_ok();
+}
+
+xnresult_t xndb_recover(struct xndb *db) {
+    xnmm_init();
+
+    struct xndbtxset set = { .committed = NULL, .capacity = 0 };
+    struct xndbclaims claims = { .claims = NULL, .count = 0, .capacity = 0 };
+    int max_tx_id;
+    bool ok = xndb_analyze(db, &set, &max_tx_id);
+
+    //tx ids need to be unique across restarts so analysis can tell transactions apart
+    if (ok && max_tx_id >= db->tx_id_counter)
+        db->tx_id_counter = max_tx_id + 1;
+
+    struct xntx *tx = NULL;
+    ok = ok && xntx_create(&tx, db, XNTXMODE_WR);
+    ok = ok && xndb_redo(db, tx, &set, &claims);
+    free(set.committed);
+    free(claims.claims);
+
+    if (!ok) {
+        if (tx)
+            xn_ensure(xntx_rollback((void**)&tx));
+        xn_ensure(false);
+    }
+
     xn_ensure(xntx_commit(tx));
     return xn_ok();
 }
 
+//caller must hold checkpoint lock
+static xnresult_t xndb_checkpoint_locked(struct xndb *db) {
+    xnmm_init();
+
+    //versions every snapshot can see don't need to hold back the redo point
+    xn_ensure(xnmvcc_gc(db->mvcc, db->pool));
+
+    //updates logged before the start of the oldest write tx still in flight, and before the oldest version
+    //still in memory, have all been copied into the buffer pool.  Transactions keep running during the
+    //checkpoint - anything they do is after redo_lsn.  Versions are checked after the list since a tx
+    //installs its versions before it leaves the list
+    uint64_t redo_lsn;
+    xn_ensure(xn_mutex_lock(db->wrtx_list_lock));
+    bool ok = xnlog_end_lsn(db->log, &redo_lsn);
+    for (struct xntx *tx = db->wrtx_list; tx; tx = tx->next) {
+        if (tx->start_lsn < redo_lsn)
+            redo_lsn = tx->start_lsn;
+    }
+    xn_ensure(xn_mutex_unlock(db->wrtx_list_lock));
+    xn_ensure(ok);
+
+    uint64_t version_lsn;
+    xn_ensure(xnmvcc_oldest_lsn(db->mvcc, &version_lsn));
+    if (version_lsn < redo_lsn)
+        redo_lsn = version_lsn;
+
+    //make those updates durable in the data files.  Files nothing was written to since their last sync are skipped
+    xn_ensure(xnpool_flush(db->pool));
+    xn_ensure(xn_mutex_lock(db->files_lock));
+    for (int i = 0; i < db->file_counter && ok; i++) {
+        ok = xnfile_sync_written(db->files[i]);
+    }
+    xn_ensure(xn_mutex_unlock(db->files_lock));
+    xn_ensure(ok);
+
+    //the checkpoint record needs a tx id that analysis has not seen before
+    int tx_id;
+    xn_ensure(xn_mutex_lock(db->tx_id_counter_lock));
+    tx_id = db->tx_id_counter++;
+    xn_ensure(xn_mutex_unlock(db->tx_id_counter_lock));
+
+    xn_ensure(xnlog_checkpoint(db->log, tx_id, redo_lsn));
+    return xn_ok();
+}
+
+//fuzzy checkpoint: moves the point recovery starts from up to the oldest update that may not be on disk,
+//and frees the log before it
+xnresult_t xndb_checkpoint(struct xndb *db) {
+    xnmm_init();
+    xn_ensure(xn_mutex_lock(db->checkpoint_lock));
+    bool ok = xndb_checkpoint_locked(db);
+    xn_ensure(xn_mutex_unlock(db->checkpoint_lock));
+    xn_ensure(ok);
+    return xn_ok();
+}
+
+//checkpoints if recovery would scan more than checkpoint_log_bytes of log.  Skipped if
+//another checkpoint is already running
+xnresult_t xndb_maybe_checkpoint(struct xndb *db) {
+    xnmm_init();
+    if (db->checkpoint_log_bytes == 0)
+        return xn_ok();
+
+    uint64_t redo_bytes;
+    xn_ensure(xnlog_redo_bytes(db->log, &redo_bytes));
+    if (redo_bytes < db->checkpoint_log_bytes)
+        return xn_ok();
+
+    if (pthread_mutex_trylock(db->checkpoint_lock) != 0)
+        return xn_ok();
+    bool ok = xndb_checkpoint_locked(db);
+    xn_ensure(xn_mutex_unlock(db->checkpoint_lock));
+    xn_ensure(ok);
+    return xn_ok();
+}
+
 xnresult_t xnrs_open(struct xnrs *rs, struct xndb *db, const char *filename, bool create, enum xnrst type, struct xntx *tx) {
     xnmm_init();
 
@@ -194,6 +589,26 @@ xnresult_t xnrs_open(struct xnrs *rs, struct xndb *db, const char *filename, boo
 			xn_ensure(xnhp_open(&rs->as.hp, rs->file, create, tx));
             break;
         }
+        case XNRST_BTREE: {
+            xn_ensure(xndb_get_file(db, &rs->file, filename, create, false));
+            xn_ensure(xnbt_open(&rs->as.bt, rs->file, create, tx));
+            break;
+        }
+        case XNRST_HASH: {
+            xn_ensure(xndb_get_file(db, &rs->file, filename, create, false));
+            xn_ensure(xnhs_open(&rs->as.hs, rs->file, create, tx));
+            break;
+        }
+        case XNRST_IVFFLAT: {
+            xn_ensure(xndb_get_file(db, &rs->file, filename, create, false));
+            xn_ensure(xnivf_open(&rs->as.ivf, rs->file, create, tx));
+            break;
+        }
+        case XNRST_HNSW: {
+            xn_ensure(xndb_get_file(db, &rs->file, filename, create, false));
+            xn_ensure(xnhnsw_open(&rs->as.hnsw, rs->file, create, tx));
+            break;
+        }
         default:
             xn_ensure(false);
             break;
@@ -266,6 +681,187 @@ xnresult_t xnrs_del(struct xnrs rs, struct xnitemid id) {
     return xn_ok();
 }
 
+//keyed record stores (B+tree and hash) map a uint64_t key to a value.  Putting an existing key replaces its value
+xnresult_t xnrs_put_key(struct xnrs rs, uint64_t key, size_t val_size, uint8_t *val) {
+    xnmm_init();
+
+    switch (rs.type) {
+        case XNRST_BTREE: {
+            xn_ensure(xnbt_put(&rs.as.bt, key, val, val_size));
+            break;
+        }
+        case XNRST_HASH: {
+            xn_ensure(xnhs_put(&rs.as.hs, key, val, val_size));
+            break;
+        }
+        default:
+            xn_ensure(false);
+            break;
+    }
+
+    return xn_ok();
+}
+
+xnresult_t xnrs_get_key_size(struct xnrs rs, uint64_t key, size_t *out_size, bool *found) {
+    xnmm_init();
+
+    switch (rs.type) {
+        case XNRST_BTREE: {
+            xn_ensure(xnbt_get_size(&rs.as.bt, key, out_size, found));
+            break;
+        }
+        case XNRST_HASH: {
+            xn_ensure(xnhs_get_size(&rs.as.hs, key, out_size, found));
+            break;
+        }
+        default:
+            xn_ensure(false);
+            break;
+    }
+
+    return xn_ok();
+}
+
+xnresult_t xnrs_get_key(struct xnrs rs, uint64_t key, uint8_t *val, size_t size, bool *found) {
+    xnmm_init();
+
+    switch (rs.type) {
+        case XNRST_BTREE: {
+            xn_ensure(xnbt_get(&rs.as.bt, key, val, size, found));
+            break;
+        }
+        case XNRST_HASH: {
+            xn_ensure(xnhs_get(&rs.as.hs, key, val, size, found));
+            break;
+        }
+        default:
+            xn_ensure(false);
+            break;
+    }
+
+    return xn_ok();
+}
+
+xnresult_t xnrs_del_key(struct xnrs rs, uint64_t key, bool *found) {
+    xnmm_init();
+
+    switch (rs.type) {
+        case XNRST_BTREE: {
+            xn_ensure(xnbt_del(&rs.as.bt, key, found));
+            break;
+        }
+        case XNRST_HASH: {
+            xn_ensure(xnhs_del(&rs.as.hs, key, found));
+            break;
+        }
+        default:
+            xn_ensure(false);
+            break;
+    }
+
+    return xn_ok();
+}
+
+//vector record stores hold float vectors tagged with a uint64_t id, and answer nearest neighbor queries
+xnresult_t xnrs_train(struct xnrs rs, struct xnivfopts opts, const float *sample, int count) {
+    xnmm_init();
+
+    switch (rs.type) {
+        case XNRST_IVFFLAT: {
+            xn_ensure(xnivf_train(&rs.as.ivf, opts, sample, count));
+            break;
+        }
+        default:
+            xn_ensure(false);
+            break;
+    }
+
+    return xn_ok();
+}
+
+//trains on a uniform sample of up to sample vectors read from scan, so the training data doesn't have to fit
+//in memory.  Each record the scan returns has to be one vector of opts.dim floats
+xnresult_t xnrs_train_scan(struct xnrs rs, struct xnivfopts opts, struct xnrsscan *scan, int sample) {
+    xnmm_init();
+    xn_ensure(opts.dim > 0 && sample > 0);
+
+    size_t vec_size = opts.dim * sizeof(float);
+    xnmm_scoped_alloc(scoped_vecs, xn_free, xn_malloc, &scoped_vecs, (size_t)sample * vec_size);
+    float *vecs = (float*)scoped_vecs;
+
+    //reservoir sampling - the nth vector replaces a random one already taken with probability sample / n
+    unsigned int seed = 42;
+    uint64_t seen = 0;
+    bool more;
+    while (true) {
+        xn_ensure(xnrsscan_next(scan, &more));
+        if (!more)
+            break;
+        size_t size;
+        xn_ensure(xnrsscan_get_size(scan, &size));
+        xn_ensure(size == vec_size);
+
+        uint64_t slot = seen;
+        if (seen >= (uint64_t)sample)
+            slot = (((uint64_t)rand_r(&seed) << 31) | rand_r(&seed)) % (seen + 1);
+        if (slot < (uint64_t)sample)
+            xn_ensure(xnrsscan_get(scan, (uint8_t*)(vecs + slot * opts.dim), vec_size));
+        seen++;
+    }
+
+    xn_ensure(xnrs_train(rs, opts, vecs, seen < (uint64_t)sample ? (int)seen : sample));
+    return xn_ok();
+}
+
+//graph stores are built incrementally and need no training, only their options set once
+xnresult_t xnrs_init_hnsw(struct xnrs rs, struct xnhnswopts opts) {
+    xnmm_init();
+    xn_ensure(rs.type == XNRST_HNSW);
+    xn_ensure(xnhnsw_init(&rs.as.hnsw, opts));
+    return xn_ok();
+}
+
+xnresult_t xnrs_put_vecs(struct xnrs rs, int count, const uint64_t *ids, const float *vecs) {
+    xnmm_init();
+
+    switch (rs.type) {
+        case XNRST_IVFFLAT: {
+            xn_ensure(xnivf_put(&rs.as.ivf, count, ids, vecs));
+            break;
+        }
+        case XNRST_HNSW: {
+            xn_ensure(xnhnsw_put(&rs.as.hnsw, count, ids, vecs));
+            break;
+        }
+        default:
+            xn_ensure(false);
+            break;
+    }
+
+    return xn_ok();
+}
+
+//nprobe is the number of lists probed for IVF stores, and the search breadth ef for HNSW stores
+xnresult_t xnrs_search(struct xnrs rs, const float *query, int k, int nprobe, uint64_t *out_ids, float *out_dists, int *out_count) {
+    xnmm_init();
+
+    switch (rs.type) {
+        case XNRST_IVFFLAT: {
+            xn_ensure(xnivf_search(&rs.as.ivf, query, k, nprobe, out_ids, out_dists, out_count));
+            break;
+        }
+        case XNRST_HNSW: {
+            xn_ensure(xnhnsw_search(&rs.as.hnsw, query, k, nprobe, out_ids, out_dists, out_count));
+            break;
+        }
+        default:
+            xn_ensure(false);
+            break;
+    }
+
+    return xn_ok();
+}
+
 xnresult_t xnrsscan_open(struct xnrsscan *scan, struct xnrs rs) {
     xnmm_init();
 	switch (rs.type) {
@@ -273,6 +869,13 @@ xnresult_t xnrsscan_open(struct xnrsscan *scan, struct xnrs rs) {
 			scan->rs = rs;
 			xn_ensure(xnhpscan_open(&scan->as.hpscan, rs.as.hp));
 			break;
+		case XNRST_BTREE:
+			xn_ensure(xnrsscan_open_range(scan, rs, 0, UINT64_MAX));
+			break;
+		case XNRST_HASH:
+			scan->rs = rs;
+			xn_ensure(xnhsscan_open(&scan->as.hsscan, rs.as.hs));
+			break;
 		default:
 			assert(false);
 			break;
@@ -286,6 +889,12 @@ xnresult_t xnrsscan_next(struct xnrsscan *scan, bool *more) {
 		case XNRST_HEAP:
 			xn_ensure(xnhpscan_next(&scan->as.hpscan, more));
 			break;
+		case XNRST_BTREE:
+			xn_ensure(xnbtscan_next(&scan->as.btscan, more));
+			break;
+		case XNRST_HASH:
+			xn_ensure(xnhsscan_next(&scan->as.hsscan, more));
+			break;
 		default:
 			assert(false);
 			break;
@@ -306,3 +915,77 @@ xnresult_t xnrsscan_itemid(struct xnrsscan *scan, struct xnitemid *id) {
 	return xn_ok();
 }
 
+//scans keys in [lo, hi] in key order.  Only for B+tree record stores
+xnresult_t xnrsscan_open_range(struct xnrsscan *scan, struct xnrs rs, uint64_t lo, uint64_t hi) {
+    xnmm_init();
+	switch (rs.type) {
+		case XNRST_BTREE:
+			scan->rs = rs;
+			xn_ensure(xnbtscan_open(&scan->as.btscan, rs.as.bt, lo, hi));
+			break;
+		default:
+			xn_ensure(false);
+			break;
+	}
+	return xn_ok();
+}
+
+xnresult_t xnrsscan_key(struct xnrsscan *scan, uint64_t *key) {
+    xnmm_init();
+	switch (scan->rs.type) {
+		case XNRST_BTREE:
+			xn_ensure(xnbtscan_key(&scan->as.btscan, key));
+			break;
+		case XNRST_HASH:
+			xn_ensure(xnhsscan_key(&scan->as.hsscan, key));
+			break;
+		default:
+			xn_ensure(false);
+			break;
+	}
+	return xn_ok();
+}
+
+xnresult_t xnrsscan_get_size(struct xnrsscan *scan, size_t *size) {
+    xnmm_init();
+	switch (scan->rs.type) {
+		case XNRST_HEAP: {
+			struct xnitemid id;
+			xn_ensure(xnhpscan_itemid(&scan->as.hpscan, &id));
+			xn_ensure(xnhp_get_size(&scan->rs.as.hp, id, size));
+			break;
+		}
+		case XNRST_BTREE:
+			xn_ensure(xnbtscan_get_size(&scan->as.btscan, size));
+			break;
+		case XNRST_HASH:
+			xn_ensure(xnhsscan_get_size(&scan->as.hsscan, size));
+			break;
+		default:
+			assert(false);
+			break;
+	}
+	return xn_ok();
+}
+
+xnresult_t xnrsscan_get(struct xnrsscan *scan, uint8_t *val, size_t size) {
+    xnmm_init();
+	switch (scan->rs.type) {
+		case XNRST_HEAP: {
+			struct xnitemid id;
+			xn_ensure(xnhpscan_itemid(&scan->as.hpscan, &id));
+			xn_ensure(xnhp_get(&scan->rs.as.hp, id, val, size));
+			break;
+		}
+		case XNRST_BTREE:
+			xn_ensure(xnbtscan_get(&scan->as.btscan, val, size));
+			break;
+		case XNRST_HASH:
+			xn_ensure(xnhsscan_get(&scan->as.hsscan, val, size));
+			break;
+		default:
+			assert(false);
+			break;
+	}
+	return xn_ok();
+}
@@ -6,31 +6,72 @@
 #include "table.h"
 #include "tx.h"
 #include "heap.h"
+#include "btree.h"
+#include "hash.h"
+#include "ivfflat.h"
+#include "hnsw.h"
+#include "pool.h"
+#include "mvcc.h"
+
+//a checkpoint is taken once recovery would have to scan this much log
+#define XNDB_DEFAULT_CHECKPOINT_LOG_BYTES (64 * 1024 * 1024)
 
 struct xndb {
     const char* dir_path;
     struct xnlog *log;
     int file_counter;
-    struct xnfile *files[32];
+    struct xnfile *files[XNLOG_MAX_FILES];
 
-    pthread_mutex_t *wrtx_lock;
-    struct xntbl *pg_tbl;
+    pthread_mutex_t *files_lock;
+    struct xnpool *pool;
 
-    pthread_mutex_t *committed_wrtx_lock;
-    struct xntx *committed_wrtx;
+    //NULL when io_uring is off or unavailable.  The log has a ring of its own so commits never queue
+    //behind page write-back
+    struct xnuring *log_uring;
+    struct xnuring *data_uring;
+    struct xnmvcc *mvcc;
 
-    pthread_mutex_t *rdtx_count_lock;
-    int rdtx_count;
+    //every file grows by this policy, ahead of need on the grower thread
+    struct xngrowth growth;
+    struct xngrower *grower;
 
     pthread_mutex_t *tx_id_counter_lock;
     int tx_id_counter;
+
+    //write txs whose updates have not reached the buffer pool yet.  A checkpoint
+    //can't move the redo point past the oldest of them
+    pthread_mutex_t *wrtx_list_lock;
+    struct xntx *wrtx_list;
+
+    pthread_mutex_t *checkpoint_lock;
+    uint64_t checkpoint_log_bytes;
+
+    //background flusher - commits return once their log record is durable, and leave
+    //writing pages back to this thread
+    pthread_mutex_t *flusher_lock;
+    pthread_cond_t flusher_cv;
+    pthread_t flusher;
+    bool flush_pending;
+    bool flusher_stopping;
+    bool flusher_failed;
+};
+
+struct xndbopts {
+    int pool_frames;
+    int commit_wait_us;
+    int commit_batch;
+    int log_pages;
+    uint64_t checkpoint_log_bytes;
+    bool io_uring;              //batches of page I/O go through io_uring when the kernel supports it
+    struct xngrowth growth;     //how data and log files grow once they fill up
 };
 
 enum xnrst {
     XNRST_HEAP,
-    //XNRST_BTREE,
-    //XNRST_HASH,
-    //XNRS_IVFFLAT
+    XNRST_BTREE,
+    XNRST_HASH,
+    XNRST_IVFFLAT,
+    XNRST_HNSW
 };
 
 struct xnrs {
@@ -39,9 +80,10 @@ struct xnrs {
 	struct xntx *tx;
     union {
         struct xnhp hp;
-        //struct xnbtree
-        //struct xnhash
-        //struct xnivfflat
+        struct xnbtree bt;
+        struct xnhash hs;
+        struct xnivfflat ivf;
+        struct xnhnsw hnsw;
     } as;
 };
 
@@ -49,12 +91,21 @@ struct xnrsscan {
     struct xnrs rs;
     union {
         struct xnhpscan hpscan;
+        struct xnbtscan btscan;
+        struct xnhsscan hsscan;
     } as;
 };
 
+struct xndbopts xndb_default_opts();
 xnresult_t xndb_create(const char *dir_path, bool create, struct xndb **out_db);
+xnresult_t xndb_create_opts(const char *dir_path, bool create, struct xndbopts opts, struct xndb **out_db);
 xnresult_t xndb_free(struct xndb *db);
 xnresult_t xndb_recover(struct xndb *db);
+xnresult_t xndb_checkpoint(struct xndb *db);
+xnresult_t xndb_maybe_checkpoint(struct xndb *db);
+xnresult_t xndb_flush(struct xndb *db);
+void xndb_wake_flusher(struct xndb *db);
+xnresult_t xndb_check_flusher(struct xndb *db);
 
 xnresult_t xnrs_open(struct xnrs *rs, struct xndb *db, const char *filename, bool create, enum xnrst type, struct xntx *tx);
 xnresult_t xnrs_close(struct xnrs rs);
@@ -62,6 +113,19 @@ xnresult_t xnrs_put(struct xnrs rs, size_t val_size, uint8_t *val, struct xnitem
 xnresult_t xnrs_get_size(struct xnrs rs, struct xnitemid id, size_t *out_size);
 xnresult_t xnrs_get(struct xnrs rs, struct xnitemid id, uint8_t *val, size_t size);
 xnresult_t xnrs_del(struct xnrs rs, struct xnitemid id);
+xnresult_t xnrs_put_key(struct xnrs rs, uint64_t key, size_t val_size, uint8_t *val);
+xnresult_t xnrs_get_key_size(struct xnrs rs, uint64_t key, size_t *out_size, bool *found);
+xnresult_t xnrs_get_key(struct xnrs rs, uint64_t key, uint8_t *val, size_t size, bool *found);
+xnresult_t xnrs_del_key(struct xnrs rs, uint64_t key, bool *found);
+xnresult_t xnrs_train(struct xnrs rs, struct xnivfopts opts, const float *sample, int count);
+xnresult_t xnrs_train_scan(struct xnrs rs, struct xnivfopts opts, struct xnrsscan *scan, int sample);
+xnresult_t xnrs_init_hnsw(struct xnrs rs, struct xnhnswopts opts);
+xnresult_t xnrs_put_vecs(struct xnrs rs, int count, const uint64_t *ids, const float *vecs);
+xnresult_t xnrs_search(struct xnrs rs, const float *query, int k, int nprobe, uint64_t *out_ids, float *out_dists, int *out_count);
 xnresult_t xnrsscan_open(struct xnrsscan *scan, struct xnrs rs);
+xnresult_t xnrsscan_open_range(struct xnrsscan *scan, struct xnrs rs, uint64_t lo, uint64_t hi);
 xnresult_t xnrsscan_next(struct xnrsscan *scan, bool *more);
 xnresult_t xnrsscan_itemid(struct xnrsscan *scan, struct xnitemid *id);
+xnresult_t xnrsscan_key(struct xnrsscan *scan, uint64_t *key);
+xnresult_t xnrsscan_get_size(struct xnrsscan *scan, size_t *size);
+xnresult_t xnrsscan_get(struct xnrsscan *scan, uint8_t *val, size_t size);
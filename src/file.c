@@ -3,6 +3,7 @@
 #include "file.h"
 #include "page.h"
 #include "tx.h"
+#include "db.h"
 
 #include <libgen.h>
 #include <string.h>
@@ -13,6 +14,7 @@
 #include <fcntl.h>
 #include <limits.h>
 #include <sys/mman.h>
+#include <sys/uio.h>
 #include <math.h>
 
 
@@ -38,9 +40,10 @@ xnresult_t xnfile_create(struct xnfile **out_handle, const char *path, int id, b
     if (create) {
         flags |= O_CREAT;
     }
+    //writes that have to be durable are followed by a fdatasync (xnfile_sync or xnfile_writev_sync), so a batch
+    //of writes costs one device cache flush rather than one per write
     if (direct) {
         flags |= O_DIRECT;
-        flags |= O_DSYNC;
     }
 
     //closing file immediately in case of failures in following function calls.
@@ -50,12 +53,24 @@ xnresult_t xnfile_create(struct xnfile **out_handle, const char *path, int id, b
     xn_ensure(close(handle->fd) == 0);
 
     handle->path = strdup(path);
+    xnmm_alloc(xnmtx_free, xnmtx_create, &handle->lock);
+    xnmm_alloc(xnmtx_free, xnmtx_create, &handle->sync_lock);
 
     struct stat s;
     xn_ensure(xn_stat(handle->path, &s));
     handle->size = s.st_size;
     handle->block_size = s.st_blksize;
     handle->id = id;
+    handle->uring = NULL;
+    handle->unsynced = false;
+    handle->growth = xnfile_default_growth();
+    handle->grower = NULL;
+    handle->grow_target = 0;
+    xnmm_alloc(xnmtx_free, xnmtx_create, &handle->alloc_lock);
+    handle->alloc_end = 0;
+    handle->open_pages = NULL;
+    handle->open_count = 0;
+    handle->open_capacity = 0;
 
     //need to sync parent directory to ensure new file remains on disk in case of failure
     if (handle->size == 0) {
@@ -72,34 +87,77 @@ bool xnfile_close(void **handle) {
     xnmm_init();
     struct xnfile *file = (struct xnfile*)(*handle);
     close(file->fd);
+    xn_ensure(xnmtx_free((void**)&file->lock));
+    xn_ensure(xnmtx_free((void**)&file->sync_lock));
+    xn_ensure(xnmtx_free((void**)&file->alloc_lock));
+    free(file->open_pages);
     free(file->path);
     free(*handle);
     return xn_ok();
 }
 
-xnresult_t xnfile_set_size(struct xnfile *handle, size_t size) {
+//caller must hold file lock.  A size change only touches the inode, so the parent directory is left alone
+//and the new size is made durable by the next fdatasync of the file
+static xnresult_t xnfile_set_size_locked(struct xnfile *handle, size_t size) {
     xnmm_init();
     xn_ensure(ftruncate(handle->fd, size) == 0);
-    xn_ensure(xnfile_sync_parent(handle->path));
+    __atomic_store_n(&handle->unsynced, true, __ATOMIC_SEQ_CST);
     handle->size = size;
     return xn_ok();
 }
 
+xnresult_t xnfile_set_size(struct xnfile *handle, size_t size) {
+    xnmm_init();
+    xn_ensure(xn_mutex_lock(handle->lock));
+    bool ok = xnfile_set_size_locked(handle, size);
+    xn_ensure(xn_mutex_unlock(handle->lock));
+    xn_ensure(ok);
+    return xn_ok();
+}
+
+//caller must hold sync lock.  The flag is cleared before syncing, and writers only set it once their write is
+//done, so a write that finishes during the sync marks the file again
+static xnresult_t xnfile_sync_locked(struct xnfile *handle) {
+    xnmm_init();
+    __atomic_store_n(&handle->unsynced, false, __ATOMIC_SEQ_CST);
+    if (fdatasync(handle->fd) != 0) {
+        __atomic_store_n(&handle->unsynced, true, __ATOMIC_SEQ_CST);
+        xn_ensure(false);
+    }
+    return xn_ok();
+}
+
 xnresult_t xnfile_sync(struct xnfile *handle) {
     xnmm_init();
-    xn_ensure(fdatasync(handle->fd) == 0);
+    xn_ensure(xn_mutex_lock(handle->sync_lock));
+    bool ok = xnfile_sync_locked(handle);
+    xn_ensure(xn_mutex_unlock(handle->sync_lock));
+    xn_ensure(ok);
     return xn_ok();
 }
 
+//syncs the file only if something was written to it since the last sync.  The flag is checked under the sync
+//lock, so a clear flag means a sync that covers every finished write has completed, not just started
+xnresult_t xnfile_sync_written(struct xnfile *handle) {
+    xnmm_init();
+    xn_ensure(xn_mutex_lock(handle->sync_lock));
+    bool ok = true;
+    if (__atomic_load_n(&handle->unsynced, __ATOMIC_SEQ_CST))
+        ok = xnfile_sync_locked(handle);
+    xn_ensure(xn_mutex_unlock(handle->sync_lock));
+    xn_ensure(ok);
+    return xn_ok();
+}
+
+//positional I/O never touches the shared file offset, so threads can use the same fd at once
 xnresult_t xnfile_write(struct xnfile *handle, const char *buf, off_t off, size_t size) {
     xnmm_init();
     xn_ensure(off + size <= handle->size);
-    xn_ensure(lseek(handle->fd, off, SEEK_SET) != -1);
 
     size_t written = 0;
 
     while (written < size) {
-        ssize_t res = write(handle->fd, buf + written, size - written);
+        ssize_t res = pwrite(handle->fd, buf + written, size - written, off + written);
 
         if (res == -1) {
             xn_ensure(errno == EINTR);
@@ -109,30 +167,184 @@ xnresult_t xnfile_write(struct xnfile *handle, const char *buf, off_t off, size_
         written += res;
     }
 
+    __atomic_store_n(&handle->unsynced, true, __ATOMIC_SEQ_CST);
     return xn_ok();
 }
 
 xnresult_t xnfile_read(struct xnfile *handle, char *buf, off_t off, size_t size) {
     xnmm_init();
     xn_ensure(off + size <= handle->size);
-    xn_ensure(lseek(handle->fd, off, SEEK_SET) != -1);
 
     size_t red = 0;
 
     while (red < size) {
-        ssize_t res = read(handle->fd, buf + red, size - red);
+        ssize_t res = pread(handle->fd, buf + red, size - red, off + red);
 
         if (res == -1) {
             xn_ensure(errno == EINTR);
             continue;
         }
 
+        //reading past the end of the file, which can only happen if it was truncated underneath us
+        xn_ensure(res != 0);
         red += res;
     }
 
     return xn_ok();
 }
 
+//one pwritev/preadv for a run of pages, resubmitting whatever is left after a short transfer
+static xnresult_t xnfile_transfer_run(struct xnfile *handle, struct iovec *iov, int count, off_t off, bool write) {
+    xnmm_init();
+
+    while (count > 0) {
+        ssize_t res = write ? pwritev(handle->fd, iov, count, off) : preadv(handle->fd, iov, count, off);
+
+        if (res == -1) {
+            xn_ensure(errno == EINTR);
+            continue;
+        }
+        xn_ensure(res != 0);
+
+        off += res;
+        while (count > 0 && (size_t)res >= iov->iov_len) {
+            res -= iov->iov_len;
+            iov++;
+            count--;
+        }
+        if (count > 0) {
+            iov->iov_base = (uint8_t*)iov->iov_base + res;
+            iov->iov_len -= res;
+        }
+    }
+
+    return xn_ok();
+}
+
+//fills iov with one entry per page and returns the number of pages in the run of consecutive indices starting
+//at pages[0], up to XNFILE_IOV_MAX
+static xnresult_t xnfile_next_run(struct xnfile *handle, const struct xnfileiov *pages, int count, struct iovec *iov, int *out_run) {
+    xnmm_init();
+
+    int run = 0;
+    while (run < count && run < XNFILE_IOV_MAX && pages[run].idx == pages[0].idx + run) {
+        xn_ensure((pages[run].idx + 1) * XNPG_SZ <= handle->size);
+        iov[run].iov_base = pages[run].buf;
+        iov[run].iov_len = XNPG_SZ;
+        run++;
+    }
+
+    *out_run = run;
+    return xn_ok();
+}
+
+//pages with consecutive indices are transferred with a single syscall.  Pages are taken in the order given,
+//so callers sort them first to get the longest runs
+static xnresult_t xnfile_transfer_sync(struct xnfile *handle, const struct xnfileiov *pages, int count, bool write) {
+    xnmm_init();
+
+    struct iovec iov[XNFILE_IOV_MAX];
+    int i = 0;
+    while (i < count) {
+        int run;
+        xn_ensure(xnfile_next_run(handle, pages + i, count - i, iov, &run));
+        xn_ensure(xnfile_transfer_run(handle, iov, run, pages[i].idx * XNPG_SZ, write));
+        i += run;
+    }
+
+    return xn_ok();
+}
+
+//every run is in flight at once.  With sync set, a fdatasync follows the writes - linked to the write if there
+//is only one, and drained behind all of them otherwise.  Anything the ring didn't finish, such as a short
+//transfer or a cancelled link, is redone synchronously, which also reports real I/O errors
+static xnresult_t xnfile_transfer_uring(struct xnfile *handle, const struct xnfileiov *pages, int count, bool write, bool sync) {
+    xnmm_init();
+
+    xnmm_scoped_alloc(scoped_iov, xn_free, xn_malloc, &scoped_iov, count * sizeof(struct iovec));
+    struct iovec *iov = (struct iovec*)scoped_iov;
+    xnmm_scoped_alloc(scoped_ops, xn_free, xn_malloc, &scoped_ops, (count + 1) * sizeof(struct xnuringop));
+    struct xnuringop *ops = (struct xnuringop*)scoped_ops;
+
+    int op_count = 0;
+    int i = 0;
+    while (i < count) {
+        int run;
+        xn_ensure(xnfile_next_run(handle, pages + i, count - i, iov + i, &run));
+        struct xnuringop op = { .opcode = write ? XNURING_WRITEV : XNURING_READV, .fd = handle->fd, .iov = iov + i,
+                                .iov_count = run, .off = pages[i].idx * XNPG_SZ, .link = false, .drain = false, .res = 0 };
+        ops[op_count++] = op;
+        i += run;
+    }
+
+    int io_count = op_count;
+    if (sync) {
+        struct xnuringop op = { .opcode = XNURING_FDATASYNC, .fd = handle->fd, .link = false, .drain = io_count > 1, .res = 0 };
+        if (io_count == 1)
+            ops[0].link = true;
+        ops[op_count++] = op;
+    }
+
+    xn_ensure(xnuring_run(handle->uring, ops, op_count));
+
+    bool redo_sync = false;
+    for (int j = 0; j < io_count; j++) {
+        size_t expected = (size_t)ops[j].iov_count * XNPG_SZ;
+        if (ops[j].res == (int)expected)
+            continue;
+
+        //skip whatever was transferred and finish the rest synchronously
+        size_t done = ops[j].res > 0 ? ops[j].res : 0;
+        struct iovec *rest = ops[j].iov + done / XNPG_SZ;
+        rest->iov_base = (uint8_t*)rest->iov_base + done % XNPG_SZ;
+        rest->iov_len -= done % XNPG_SZ;
+        xn_ensure(xnfile_transfer_run(handle, rest, ops[j].iov_count - done / XNPG_SZ, ops[j].off + done, write));
+        redo_sync = true;
+    }
+    if (sync && (redo_sync || ops[io_count].res < 0))
+        xn_ensure(xnfile_sync(handle));
+
+    return xn_ok();
+}
+
+static xnresult_t xnfile_transfer(struct xnfile *handle, const struct xnfileiov *pages, int count, bool write, bool sync) {
+    xnmm_init();
+
+    if (count == 0 && !sync)
+        return xn_ok();
+
+    bool ok;
+    if (handle->uring && count > 0)
+        ok = xnfile_transfer_uring(handle, pages, count, write, sync);
+    else
+        ok = xnfile_transfer_sync(handle, pages, count, write) && (!sync || xnfile_sync(handle));
+
+    //marked once the writes are done (even partly), so a sync that clears the flag after this covers them
+    if (write && !sync)
+        __atomic_store_n(&handle->unsynced, true, __ATOMIC_SEQ_CST);
+    xn_ensure(ok);
+    return xn_ok();
+}
+
+xnresult_t xnfile_writev(struct xnfile *handle, const struct xnfileiov *pages, int count) {
+    xnmm_init();
+    xn_ensure(xnfile_transfer(handle, pages, count, true, false));
+    return xn_ok();
+}
+
+xnresult_t xnfile_readv(struct xnfile *handle, const struct xnfileiov *pages, int count) {
+    xnmm_init();
+    xn_ensure(xnfile_transfer(handle, pages, count, false, false));
+    return xn_ok();
+}
+
+//writes the pages and then makes them durable with fdatasync
+xnresult_t xnfile_writev_sync(struct xnfile *handle, const struct xnfileiov *pages, int count) {
+    xnmm_init();
+    xn_ensure(xnfile_transfer(handle, pages, count, true, true));
+    return xn_ok();
+}
+
 xnresult_t xnfile_mmap(struct xnfile *handle, off_t offset, size_t len, void **out_ptr) {
     xnmm_init();
     xn_ensure(offset % handle->block_size == 0);
@@ -149,104 +361,608 @@ xnresult_t xnfile_munmap(void *addr, size_t len) {
     return xn_ok();
 }
 
-//grow file size by 20%, rounded up to the nearest page
-xnresult_t xnfile_grow(struct xnfile *handle) {
+//frees the disk space behind [off, off + size) without changing the file size.  The range reads back
+//as zeroes.  Filesystems that can't punch holes keep the space, which is not an error
+xnresult_t xnfile_punch_hole(struct xnfile *handle, off_t off, size_t size) {
     xnmm_init();
-    size_t new_size = ceil((handle->size * 1.2f) / XNPG_SZ) * XNPG_SZ;
-    xn_ensure(xnfile_set_size(handle, new_size));
-    xn_ensure(xnfile_sync(handle));
+    if (fallocate(handle->fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE, off, size) != 0)
+        xn_ensure(errno == EOPNOTSUPP);
     return xn_ok();
 }
 
-xnresult_t xnfile_init(struct xnfile *file, struct xntx *tx) {
+//20% of the file, but no less than 32 pages and no more than 64MB at a time
+struct xngrowth xnfile_default_growth() {
+    struct xngrowth growth = { .chunk = XNPG_SZ * 32, .percent = 0.2f, .max = 64 * 1024 * 1024 };
+    return growth;
+}
+
+static size_t xnfile_growth_step(struct xngrowth growth, size_t size) {
+    size_t step = size * growth.percent;
+    if (step < growth.chunk)
+        step = growth.chunk;
+    if (growth.max > 0 && step > growth.max)
+        step = growth.max;
+    step = ceil((double)step / XNPG_SZ) * XNPG_SZ;
+    return step > 0 ? step : XNPG_SZ;
+}
+
+//caller must hold file lock.  The new range is allocated as one extent with fallocate, so later writes into it
+//don't have to allocate blocks.  Filesystems without fallocate fall back to ftruncate
+static xnresult_t xnfile_extend_locked(struct xnfile *handle, size_t size) {
+    xnmm_init();
+    if (fallocate(handle->fd, 0, handle->size, size - handle->size) != 0) {
+        xn_ensure(errno == EOPNOTSUPP);
+        xn_ensure(ftruncate(handle->fd, size) == 0);
+    }
+    __atomic_store_n(&handle->unsynced, true, __ATOMIC_SEQ_CST);
+    handle->size = size;
+    return xn_ok();
+}
+
+//grows the file by whole growth steps until it is at least min_size bytes.  Concurrent write txs and the grower
+//can grow the same file, so the size is checked again under the file lock and a file that is already big enough
+//is left alone.  The new size isn't synced here - the next fdatasync of the file covers it
+xnresult_t xnfile_grow(struct xnfile *handle, size_t min_size) {
+    xnmm_init();
+    xn_ensure(xn_mutex_lock(handle->lock));
+    size_t new_size = handle->size;
+    while (new_size < min_size)
+        new_size += xnfile_growth_step(handle->growth, new_size);
+    bool ok = new_size == handle->size || xnfile_extend_locked(handle, new_size);
+    xn_ensure(xn_mutex_unlock(handle->lock));
+    xn_ensure(ok);
+    return xn_ok();
+}
+
+//call after using the file up to used bytes.  Once less than half a growth step is left, the grower is asked for
+//one more step.  Does nothing if the file has no grower
+xnresult_t xnfile_grow_ahead(struct xnfile *handle, size_t used) {
     xnmm_init();
+    struct xngrower *grower = handle->grower;
+    size_t size = __atomic_load_n(&handle->size, __ATOMIC_SEQ_CST);
+    if (!grower || used + xnfile_growth_step(handle->growth, size) / 2 <= size)
+        return xn_ok();
+
+    xn_ensure(xn_mutex_lock(grower->lock));
+    bool ok = true;
+    if (handle->grow_target == 0) {
+        ok = grower->count < XNGROWER_QUEUE;
+        if (ok)
+            grower->queue[grower->count++] = handle;
+    }
+    if (ok && handle->grow_target < size + 1)
+        handle->grow_target = size + 1;
+    ok = ok && xn_cond_signal(&grower->cv);
+    xn_ensure(xn_mutex_unlock(grower->lock));
+    xn_ensure(ok);
+    return xn_ok();
+}
 
-    //metadata page
-    struct xnpg meta_page = { .file_handle = file, .idx = 0 };
+static size_t xnfile_group_off(uint64_t group) {
+    return XNFILE_MAP_BYTES + sizeof(struct xnfileroot) + group * sizeof(struct xnfilegroup);
+}
 
-    //initialize metadata page
-    {
-        //zero out page
-        xnmm_scoped_alloc(scoped_ptr, xn_free, xn_malloc, &scoped_ptr, XNPG_SZ);
-        uint8_t *buf = (uint8_t*)scoped_ptr;
-        memset(buf, 0, XNPG_SZ);
-        xn_ensure(xnpg_write(&meta_page, tx, buf, 0, XNPG_SZ, true));
+//caller must hold alloc lock.  Finds the last page in use from the highest group's bitmap
+static xnresult_t xnfile_load_end_locked(struct xnfile *file, struct xnpool *pool, uint8_t *root_data) {
+    xnmm_init();
+    struct xnfileroot *root = (struct xnfileroot*)(root_data + XNFILE_MAP_BYTES);
+
+    //every group has its map page in use, so the highest group always has a bit set
+    file->alloc_end = 0;
+    if (root->group_count == 0)
+        return xn_ok();
+    uint64_t group = root->group_count - 1;
+    struct xnpg map_page = { .file_handle = file, .idx = group * XNFILE_GROUP_PAGES };
+    struct xnframe *frame = NULL;
+    uint8_t *map = root_data;
+    if (group > 0) {
+        xn_ensure(xnpool_pin(pool, &map_page, &frame));
+        map = frame->data;
+    }
 
-        //set bit for metadata page to 'used'
-        uint8_t page0_used = 1;
-        xn_ensure(xnpg_write(&meta_page, tx, &page0_used, 0, sizeof(uint8_t), true));
+    uint64_t *words = (uint64_t*)map;
+    for (int w = XNFILE_MAP_BYTES / sizeof(uint64_t) - 1; w >= 0; w--) {
+        if (words[w]) {
+            file->alloc_end = map_page.idx + w * 64 + (64 - __builtin_clzll(words[w]));
+            break;
+        }
     }
 
+    if (frame)
+        xn_ensure(xnpool_unpin(pool, frame, false));
     return xn_ok();
 }
 
-static xnresult_t xnfile_find_free_page(struct xnfile *file, struct xntx *tx, struct xnpg *new_page) {
+//takes the alloc lock and pins page 0, which holds the root of the map.  Undone by xnfile_unlock_map
+static xnresult_t xnfile_lock_map(struct xnfile *file, struct xnpool *pool, struct xnframe **out_root) {
     xnmm_init();
+    xn_ensure(xn_mutex_lock(file->alloc_lock));
+
+    struct xnpg root_page = { .file_handle = file, .idx = 0 };
+    bool ok = xnfile_grow(file, XNPG_SZ) && xnpool_pin(pool, &root_page, out_root);
+    if (ok && file->alloc_end == 0) {
+        ok = xnfile_load_end_locked(file, pool, (*out_root)->data);
+        if (!ok)
+            xn_ensure(xnpool_unpin(pool, *out_root, false));
+    }
 
-    int byte_count = file->size / XNPG_SZ / 8;
-    int i, j;
-    struct xnpg meta_page = { .file_handle = file, .idx = 0 };
-    for (i = 0; i < byte_count; i++) {
-        uint8_t byte;
-        xn_ensure(xnpg_read(&meta_page, tx, &byte, i * sizeof(uint8_t), sizeof(uint8_t)));
-        for (j = 0; j < 8; j++) {
-            uint8_t mask = 1 << j;
-            uint8_t bit = (mask & byte) >> j;
+    if (!ok)
+        xn_ensure(xn_mutex_unlock(file->alloc_lock));
+    xn_ensure(ok);
+    return xn_ok();
+}
 
-            if (bit == 0)
-                goto found_free_bit;
+//a map page changed after appending the record that ends at lsn waits for it to be durable before it is written back.
+//Recovery passes 0, since the records it redoes are durable already
+static xnresult_t xnfile_unpin_map(struct xnpool *pool, struct xnframe *frame, bool dirty, uint64_t lsn) {
+    xnmm_init();
+    xn_ensure(dirty ? xnpool_unpin_logged(pool, frame, lsn) : xnpool_unpin(pool, frame, false));
+    return xn_ok();
+}
+
+static xnresult_t xnfile_unlock_map(struct xnfile *file, struct xnpool *pool, struct xnframe *root, bool dirty, uint64_t lsn) {
+    xnmm_init();
+    bool ok = xnfile_unpin_map(pool, root, dirty, lsn);
+    xn_ensure(xn_mutex_unlock(file->alloc_lock));
+    xn_ensure(ok);
+    return xn_ok();
+}
+
+//caller must hold alloc lock and have page 0 pinned.  Adds groups up to group, each with the bit of its map page
+//set.  Map pages are not cleared first, so redoing this over a map that already has later bits keeps them
+static xnresult_t xnfile_add_groups_locked(struct xnfile *file, struct xnpool *pool, uint8_t *root_data, uint64_t group, uint64_t lsn) {
+    xnmm_init();
+    xn_ensure(group < XNFILE_MAX_GROUPS);
+    struct xnfileroot *root = (struct xnfileroot*)(root_data + XNFILE_MAP_BYTES);
+    struct xnfilegroup *groups = (struct xnfilegroup*)(root_data + xnfile_group_off(0));
+
+    while (root->group_count <= group) {
+        uint64_t g = root->group_count;
+        struct xnpg map_page = { .file_handle = file, .idx = g * XNFILE_GROUP_PAGES };
+        xn_ensure(xnfile_grow(file, (map_page.idx + 1) * XNPG_SZ));
+        if (g == 0) {
+            root_data[0] |= 1;
+        } else {
+            struct xnframe *frame;
+            xn_ensure(xnpool_pin(pool, &map_page, &frame));
+            frame->data[0] |= 1;
+            xn_ensure(xnfile_unpin_map(pool, frame, true, lsn));
         }
+        groups[g] = (struct xnfilegroup){ .free = XNFILE_GROUP_PAGES - 1, .hint = 0 };
+        root->group_count++;
+        if (map_page.idx + 1 > file->alloc_end)
+            file->alloc_end = map_page.idx + 1;
     }
 
-    //if no free page found, grow file and set i = byte_count to allocate fresh page 
-    xn_ensure(xnfile_grow(file));
-    i = byte_count;
-    j = 0;
+    return xn_ok();
+}
 
-found_free_bit:
-    new_page->file_handle = file;
-    new_page->idx = i * 8 + j;
+//caller must hold alloc lock and have page 0 pinned.  Sets or clears the bit of page idx, and keeps the free count
+//and hints in step if it changed.  lsn is the end of the record logging the change
+static xnresult_t xnfile_set_used_locked(struct xnfile *file, struct xnpool *pool, uint8_t *root_data, uint64_t idx, bool used, uint64_t lsn) {
+    xnmm_init();
+    struct xnfileroot *root = (struct xnfileroot*)(root_data + XNFILE_MAP_BYTES);
+    struct xnfilegroup *groups = (struct xnfilegroup*)(root_data + xnfile_group_off(0));
+
+    uint64_t group = idx / XNFILE_GROUP_PAGES;
+    uint64_t w = (idx % XNFILE_GROUP_PAGES) / 64;
+    int bit = idx % 64;
+    xn_ensure(xnfile_add_groups_locked(file, pool, root_data, group, lsn));
+
+    struct xnpg map_page = { .file_handle = file, .idx = group * XNFILE_GROUP_PAGES };
+    struct xnframe *frame = NULL;
+    uint8_t *map = root_data;
+    if (group > 0) {
+        xn_ensure(xnpool_pin(pool, &map_page, &frame));
+        map = frame->data;
+    }
+
+    uint64_t *words = (uint64_t*)map;
+    bool was_used = (words[w] & (1ull << bit)) != 0;
+    if (used && !was_used) {
+        words[w] |= 1ull << bit;
+        groups[group].free--;
+    } else if (!used && was_used) {
+        words[w] &= ~(1ull << bit);
+        groups[group].free++;
+        if (w < groups[group].hint)
+            groups[group].hint = w;
+        if (group < root->group_hint)
+            root->group_hint = group;
+    }
+    if (used && idx + 1 > file->alloc_end)
+        file->alloc_end = idx + 1;
+
+    if (frame)
+        xn_ensure(xnfile_unpin_map(pool, frame, used != was_used, lsn));
+    return xn_ok();
+}
+
+//caller must hold alloc lock and have page 0 pinned.  out_used is false for pages no group covers yet
+static xnresult_t xnfile_is_used_locked(struct xnfile *file, struct xnpool *pool, uint8_t *root_data, uint64_t idx, bool *out_used) {
+    xnmm_init();
+    struct xnfileroot *root = (struct xnfileroot*)(root_data + XNFILE_MAP_BYTES);
+
+    uint64_t group = idx / XNFILE_GROUP_PAGES;
+    *out_used = false;
+    if (group >= root->group_count)
+        return xn_ok();
+
+    struct xnpg map_page = { .file_handle = file, .idx = group * XNFILE_GROUP_PAGES };
+    struct xnframe *frame = NULL;
+    uint8_t *map = root_data;
+    if (group > 0) {
+        xn_ensure(xnpool_pin(pool, &map_page, &frame));
+        map = frame->data;
+    }
+    uint64_t *words = (uint64_t*)map;
+    *out_used = (words[(idx % XNFILE_GROUP_PAGES) / 64] & (1ull << (idx % 64))) != 0;
+    if (frame)
+        xn_ensure(xnpool_unpin(pool, frame, false));
+    return xn_ok();
+}
+
+//appends an alloc or free record: a varint file id and a varint page index, and for alloc records whether the
+//page is now in use.  Appended under the alloc lock and before the map changes, so records for the same bit are in
+//the order they were applied and map pages can wait for them.  out_lsn, if set, is the end of the record
+static xnresult_t xnfile_log_alloc(struct xnfile *file, struct xntx *tx, enum xnlogt type, uint64_t idx, bool used, uint64_t *out_lsn) {
+    xnmm_init();
+
+    uint64_t file_id;
+    xn_ensure(xnlog_file_id(tx->db->log, tx->id, file, &file_id));
+
+    uint8_t data[XN_VARINT_MAX * 3];
+    size_t data_size = xn_varint_put(data, file_id);
+    data_size += xn_varint_put(data + data_size, idx);
+    if (type == XNLOGT_ALLOC)
+        data_size += xn_varint_put(data + data_size, used);
+
+    size_t rec_size = xnlog_record_size(tx->id, data_size);
+    uint8_t rec[rec_size];
+    xn_ensure(xnlog_serialize_record(tx->id, type, data_size, data, rec));
+    uint64_t lsn;
+    xn_ensure(xnlog_append(tx->db->log, rec, rec_size, &lsn));
+    if (out_lsn)
+        *out_lsn = lsn + rec_size;
+    return xn_ok();
+}
+
+//page 0 gets the bitmap of group 0, with page 0 itself marked used, and a root with that one group
+xnresult_t xnfile_init(struct xnfile *file, struct xntx *tx) {
+    xnmm_init();
+
+    struct xnframe *root;
+    xn_ensure(xnfile_lock_map(file, tx->db->pool, &root));
+    uint64_t lsn = 0;
+    bool ok = xnfile_log_alloc(file, tx, XNLOGT_ALLOC, 0, true, &lsn) &&
+              xnfile_set_used_locked(file, tx->db->pool, root->data, 0, true, lsn);
+    xn_ensure(xnfile_unlock_map(file, tx->db->pool, root, true, lsn));
+    xn_ensure(ok);
+
+    return xn_ok();
+}
+
+//caller must hold alloc lock and have page 0 pinned.  Finds the lowest free page, for the caller to log and mark as
+//used.  Full groups are skipped using the free counts, and the hints skip full groups and bitmap words below the
+//first free page, so allocation reads a few words instead of scanning the map.  A new group is added once every
+//group is full
+static xnresult_t xnfile_find_free_locked(struct xnfile *file, struct xnpool *pool, uint8_t *root_data, uint64_t *out_idx) {
+    xnmm_init();
+    struct xnfileroot *root = (struct xnfileroot*)(root_data + XNFILE_MAP_BYTES);
+    struct xnfilegroup *groups = (struct xnfilegroup*)(root_data + xnfile_group_off(0));
+
+    uint64_t group = root->group_hint;
+    while (group < root->group_count && groups[group].free == 0)
+        group++;
+
+    //a free count above zero guarantees a clear bit at or after the hint
+    uint64_t w = 0;
+    uint64_t idx = group * XNFILE_GROUP_PAGES + 1;
+    if (group < root->group_count) {
+        struct xnpg map_page = { .file_handle = file, .idx = group * XNFILE_GROUP_PAGES };
+        struct xnframe *frame = NULL;
+        uint8_t *map = root_data;
+        if (group > 0) {
+            xn_ensure(xnpool_pin(pool, &map_page, &frame));
+            map = frame->data;
+        }
+        uint64_t *words = (uint64_t*)map;
+        w = groups[group].hint;
+        while (w < XNFILE_MAP_BYTES / sizeof(uint64_t) && words[w] == UINT64_MAX)
+            w++;
+        bool found = w < XNFILE_MAP_BYTES / sizeof(uint64_t);
+        if (found)
+            idx = map_page.idx + w * 64 + __builtin_ctzll(~words[w]);
+        if (frame)
+            xn_ensure(xnpool_unpin(pool, frame, false));
+        xn_ensure(found);
+    }
+
+    //the hints only move past pages in use, so they hold whether or not the caller goes on to set the bit
+    if (group < root->group_count)
+        groups[group].hint = w;
+    root->group_hint = group;
+
+    *out_idx = idx;
     return xn_ok();
 }
 
-static int xnpgr_bitmap_byte_offset(uint64_t page_idx) {
-    return page_idx / 8;
+//bits are only cleared once the tx that freed the page commits, so a claimed page is never in use by a tx that
+//might still commit.  If this tx doesn't commit, xnfile_end_tx gives the page back
+static xnresult_t xnfile_claim_page(struct xnfile *file, struct xntx *tx, struct xnpg *new_page) {
+    xnmm_init();
+
+    struct xnframe *root;
+    xn_ensure(xnfile_lock_map(file, tx->db->pool, &root));
+    uint64_t idx;
+    uint64_t lsn = 0;
+    bool ok = xnfile_find_free_locked(file, tx->db->pool, root->data, &idx) &&
+              xnfile_log_alloc(file, tx, XNLOGT_ALLOC, idx, true, &lsn) &&
+              xnfile_set_used_locked(file, tx->db->pool, root->data, idx, true, lsn);
+    xn_ensure(xnfile_unlock_map(file, tx->db->pool, root, true, lsn));
+    xn_ensure(ok);
+
+    //pages are handed out lowest first, so the pages past this one are mostly unused
+    xn_ensure(xnfile_grow(file, (idx + 1) * XNPG_SZ));
+    xn_ensure(xnfile_grow_ahead(file, (idx + 1) * XNPG_SZ));
+
+    new_page->file_handle = file;
+    new_page->idx = idx;
+    xn_ensure(xntx_add_page(tx, new_page, XNTXPG_CLAIMED));
+    return xn_ok();
 }
 
+//the page stays in use until the tx commits, since snapshots older than the commit can still read it and the
+//tx might not commit at all.  The free record is redone with the tx's updates
 xnresult_t xnfile_free_page(struct xnfile *file, struct xntx *tx, struct xnpg *page) {
     xnmm_init();
 
-    //set bit to 'free' in metadata page
-    struct xnpg meta_page = { .file_handle = file, .idx = 0 };
-    uint8_t byte;
-    xn_ensure(xnpg_read(&meta_page, tx, &byte, xnpgr_bitmap_byte_offset(page->idx), sizeof(uint8_t)));
+    //map pages are never freed
+    xn_ensure(page->idx % XNFILE_GROUP_PAGES != 0);
+    xn_ensure(xntx_find_page(tx, file, page->idx, XNTXPG_FREED) == -1);
 
     //ensure that page is actually allocated
-    xn_ensure((byte & (1 << (page->idx % 8))) != 0);
-
-    byte &= ~(1 << (page->idx % 8));
-    xn_ensure(xnpg_write(&meta_page, tx, &byte, xnpgr_bitmap_byte_offset(page->idx), sizeof(uint8_t), true));
+    struct xnframe *root;
+    xn_ensure(xnfile_lock_map(file, tx->db->pool, &root));
+    bool used = false;
+    bool ok = xnfile_is_used_locked(file, tx->db->pool, root->data, page->idx, &used) && used &&
+              xnfile_log_alloc(file, tx, XNLOGT_FREE, page->idx, false, NULL);
+    xn_ensure(xnfile_unlock_map(file, tx->db->pool, root, false, 0));
+    xn_ensure(ok);
+
+    xn_ensure(xntx_add_page(tx, page, XNTXPG_FREED));
     return xn_ok();
 }
 
 xnresult_t xnfile_allocate_page(struct xnfile *file, struct xntx *tx, struct xnpg *page) {
     xnmm_init();
 
-    xn_ensure(xnfile_find_free_page(file, tx, page));
+    //a page this tx freed goes straight back to it.  No other tx can have it, since its bit was never cleared.
+    //The alloc record puts the bit back if the free is redone
+    int freed = xntx_find_page(tx, file, XNTX_ANY_PAGE, XNTXPG_FREED);
+    if (freed >= 0) {
+        *page = tx->pgs[freed].page;
+        xntx_remove_page(tx, freed);
+        xn_ensure(xnfile_log_alloc(file, tx, XNLOGT_ALLOC, page->idx, true, NULL));
+    } else {
+        xn_ensure(xnfile_claim_page(file, tx, page));
+    }
 
     //zero out new page data
     xnmm_scoped_alloc(scoped_ptr, xn_free, xn_malloc, &scoped_ptr, XNPG_SZ);
     uint8_t *buf = (uint8_t*)scoped_ptr;
-
     memset(buf, 0, XNPG_SZ);
     xn_ensure(xnpg_write(page, tx, buf, 0, XNPG_SZ, true));
 
-    //set bit to 'used' in metadata page
-    struct xnpg meta_page = { .file_handle = file, .idx = 0 };
-    uint8_t byte;
-    xn_ensure(xnpg_read(&meta_page, tx, &byte, xnpgr_bitmap_byte_offset(page->idx), sizeof(uint8_t)));
-    byte |= 1 << (page->idx % 8);
-    xn_ensure(xnpg_write(&meta_page, tx, &byte, xnpgr_bitmap_byte_offset(page->idx), sizeof(uint8_t), true));
+    return xn_ok();
+}
+
+static xnresult_t xnfile_offer_insert_page(struct xnfile *file, uint64_t idx) {
+    xnmm_init();
+    xn_ensure(xn_mutex_lock(file->alloc_lock));
+    bool ok = true;
+    if (file->open_count == file->open_capacity) {
+        int capacity = file->open_capacity == 0 ? 8 : file->open_capacity * 2;
+        uint64_t *pages = realloc(file->open_pages, sizeof(uint64_t) * capacity);
+        ok = pages != NULL;
+        if (ok) {
+            file->open_pages = pages;
+            file->open_capacity = capacity;
+        }
+    }
+    if (ok)
+        file->open_pages[file->open_count++] = idx;
+    xn_ensure(xn_mutex_unlock(file->alloc_lock));
+    xn_ensure(ok);
+    return xn_ok();
+}
+
+//called while the tx is still in the write tx list.  Pages claimed by a tx that didn't commit are given back and
+//logged, since their alloc records are redone anyway.  Pages freed by a tx that committed are cleared without a
+//record, since the free records before the durable commit record are redone.  Heap pages the tx was inserting into are
+//offered to later txs, unless they were new and are going back to the map
+xnresult_t xnfile_end_tx(struct xntx *tx, bool committed) {
+    xnmm_init();
+    struct xnpool *pool = tx->db->pool;
+
+    for (int i = 0; i < tx->pg_count; i++) {
+        struct xntxpg *pg = &tx->pgs[i];
+        struct xnfile *file = pg->page.file_handle;
+        bool release = pg->op == XNTXPG_CLAIMED && !committed;
+        bool clear = pg->op == XNTXPG_FREED && committed;
+
+        if (release || clear) {
+            struct xnframe *root;
+            xn_ensure(xnfile_lock_map(file, pool, &root));
+            uint64_t lsn = 0;
+            bool ok = !release || xnfile_log_alloc(file, tx, XNLOGT_ALLOC, pg->page.idx, false, &lsn);
+            ok = ok && xnfile_set_used_locked(file, pool, root->data, pg->page.idx, false, lsn);
+            xn_ensure(xnfile_unlock_map(file, pool, root, true, lsn));
+            xn_ensure(ok);
+        }
+
+        if (pg->op == XNTXPG_INSERT && (committed || xntx_find_page(tx, file, pg->page.idx, XNTXPG_CLAIMED) == -1))
+            xn_ensure(xnfile_offer_insert_page(file, pg->page.idx));
+    }
+
+    return xn_ok();
+}
+
+//takes a heap page an earlier tx left room in, and adds it to the tx's insert pages.  Pages changed by a commit
+//the tx's snapshot can't see are skipped, since inserting into them would conflict
+xnresult_t xnfile_take_insert_page(struct xnfile *file, struct xntx *tx, struct xnpg *out_page, bool *out_found) {
+    xnmm_init();
+
+    xn_ensure(xn_mutex_lock(file->alloc_lock));
+    bool ok = true;
+    bool found = false;
+    for (int i = file->open_count - 1; ok && !found && i >= 0; i--) {
+        struct xnpg page = { .file_handle = file, .idx = file->open_pages[i] };
+        bool changed;
+        ok = xnmvcc_changed_since(tx->db->mvcc, &page, tx->snapshot, &changed);
+        if (ok && !changed) {
+            file->open_pages[i] = file->open_pages[--file->open_count];
+            *out_page = page;
+            found = true;
+        }
+    }
+    xn_ensure(xn_mutex_unlock(file->alloc_lock));
+    xn_ensure(ok);
+
+    if (found)
+        xn_ensure(xntx_add_page(tx, out_page, XNTXPG_INSERT));
+    *out_found = found;
+    return xn_ok();
+}
+
+//one past the highest page in use.  Pages claimed by txs the caller's snapshot can't see read as they were
+//before the claim, so scans can stop here
+xnresult_t xnfile_alloc_end(struct xnfile *file, struct xntx *tx, uint64_t *out_end) {
+    xnmm_init();
+    struct xnframe *root;
+    xn_ensure(xnfile_lock_map(file, tx->db->pool, &root));
+    *out_end = file->alloc_end;
+    xn_ensure(xnfile_unlock_map(file, tx->db->pool, root, false, 0));
+    return xn_ok();
+}
+
+//applies a logged alloc or free record without logging it again.  The free counts and hints may not match the
+//bitmaps until xnfile_rebuild_map runs, since the root and the group map pages reach disk at different times
+xnresult_t xnfile_redo_alloc(struct xnfile *file, struct xnpool *pool, uint64_t idx, bool used) {
+    xnmm_init();
+    struct xnframe *root;
+    xn_ensure(xnfile_lock_map(file, pool, &root));
+    bool ok = xnfile_set_used_locked(file, pool, root->data, idx, used, 0);
+    xn_ensure(xnfile_unlock_map(file, pool, root, true, 0));
+    xn_ensure(ok);
+    return xn_ok();
+}
+
+//recounts each group's free pages from its bitmap and resets the hints, after recovery redid alloc records
+xnresult_t xnfile_rebuild_map(struct xnfile *file, struct xnpool *pool) {
+    xnmm_init();
+    struct xnframe *root;
+    xn_ensure(xnfile_lock_map(file, pool, &root));
+    struct xnfileroot *rt = (struct xnfileroot*)(root->data + XNFILE_MAP_BYTES);
+    struct xnfilegroup *groups = (struct xnfilegroup*)(root->data + xnfile_group_off(0));
+
+    bool ok = true;
+    for (uint64_t g = 0; ok && g < rt->group_count; g++) {
+        struct xnpg map_page = { .file_handle = file, .idx = g * XNFILE_GROUP_PAGES };
+        struct xnframe *frame = NULL;
+        uint8_t *map = root->data;
+        if (g > 0) {
+            ok = xnpool_pin(pool, &map_page, &frame);
+            if (!ok)
+                break;
+            map = frame->data;
+        }
+
+        uint64_t *words = (uint64_t*)map;
+        int used = 0;
+        for (size_t w = 0; w < XNFILE_MAP_BYTES / sizeof(uint64_t); w++)
+            used += __builtin_popcountll(words[w]);
+        groups[g] = (struct xnfilegroup){ .free = XNFILE_GROUP_PAGES - used, .hint = 0 };
+
+        if (frame)
+            ok = xnpool_unpin(pool, frame, false);
+    }
+    rt->group_hint = 0;
+    ok = ok && xnfile_load_end_locked(file, pool, root->data);
+
+    xn_ensure(xnfile_unlock_map(file, pool, root, true, 0));
+    xn_ensure(ok);
+    return xn_ok();
+}
+
+//failed growth is dropped - the writer that reaches the end of the file grows it instead
+static void *xngrower_run(void *arg) {
+    struct xngrower *grower = (struct xngrower*)arg;
+    if (!xn_mutex_lock(grower->lock))
+        return NULL;
+
+    while (true) {
+        while (grower->count == 0 && !grower->stopping) {
+            if (!xn_cond_wait(&grower->cv, grower->lock))
+                break;
+        }
+        if (grower->count == 0)
+            break;
+
+        struct xnfile *file = grower->queue[--grower->count];
+        size_t target = file->grow_target;
+        file->grow_target = 0;
+        if (!xn_mutex_unlock(grower->lock))
+            return NULL;
+
+        //syncing here keeps the metadata journal commit for the new extent off the write path
+        bool ok = xnfile_grow(file, target) && xnfile_sync(file);
+
+        if (!xn_mutex_lock(grower->lock))
+            return NULL;
+        grower->failed |= !ok;
+    }
+
+    if (!xn_mutex_unlock(grower->lock))
+        return NULL;
+    return NULL;
+}
 
+//queued growth is finished before the thread exits, so files must stay open until the grower is freed
+bool xngrower_free(void **ptr) {
+    struct xngrower *grower = (struct xngrower*)*ptr;
+    if (!grower)
+        return true;
+    bool ok = true;
+    if (grower->started) {
+        ok = xn_mutex_lock(grower->lock);
+        grower->stopping = true;
+        ok = ok && xn_cond_signal(&grower->cv);
+        ok = ok && xn_mutex_unlock(grower->lock);
+        ok = ok && pthread_join(grower->thread, NULL) == 0;
+    }
+    pthread_cond_destroy(&grower->cv);
+    ok = (!grower->lock || xnmtx_free((void**)&grower->lock)) && ok;
+    free(grower);
+    *ptr = NULL;
+    return ok;
+}
+
+static bool xngrower_alloc(void **ptr) {
+    struct xngrower *grower = calloc(1, sizeof(struct xngrower));
+    *ptr = grower;
+    if (!grower)
+        return false;
+    if (pthread_cond_init(&grower->cv, NULL) != 0 || !xnmtx_create(&grower->lock))
+        return false;
+    grower->started = pthread_create(&grower->thread, NULL, xngrower_run, grower) == 0;
+    return grower->started;
+}
+
+xnresult_t xngrower_create(struct xngrower **out_grower) {
+    xnmm_init();
+    xnmm_scoped_alloc(scoped_grower, xngrower_free, xngrower_alloc, &scoped_grower);
+    *out_grower = (struct xngrower*)scoped_grower;
+    scoped_grower = NULL;
     return xn_ok();
 }
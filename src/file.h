@@ -1,25 +1,109 @@
 #pragma once
 #include "util.h"
+#include "uring.h"
+
+//pages transferred by one pwritev/preadv call.  Linux allows up to 1024 iovecs
+#define XNFILE_IOV_MAX 256
+
+//free-page map.  Pages are tracked in groups, each with a bitmap in the first half of the group's first page.
+//Page 0 is the first page of group 0, and the second half of it holds the summary of every group
+#define XNFILE_MAP_BYTES (XNPG_SZ / 2)
+#define XNFILE_GROUP_PAGES (XNFILE_MAP_BYTES * 8)
+#define XNFILE_MAX_GROUPS ((XNPG_SZ - XNFILE_MAP_BYTES - sizeof(struct xnfileroot)) / sizeof(struct xnfilegroup))
+
+//files queued for background growth at once
+#define XNGROWER_QUEUE 32
 
 struct xntx;
 struct xnpg;
+struct xnpool;
+
+//summary of the free-page map, stored in page 0 after the bitmap of the first group.  group_hint is the
+//lowest group that may have a free page
+struct xnfileroot {
+    uint32_t group_count;
+    uint32_t group_hint;
+};
+
+//one per group, right after the root.  hint is the lowest bitmap word that may have a clear bit
+struct xnfilegroup {
+    uint16_t free;
+    uint16_t hint;
+};
+
+//a whole page and the XNPG_SZ byte buffer it is written from or read into
+struct xnfileiov {
+    uint64_t idx;
+    uint8_t *buf;
+};
+
+//how a file grows when it runs out of room.  Each step is percent of the current size, but at least chunk
+//bytes and at most max bytes (no cap if max is 0), rounded up to a whole page
+struct xngrowth {
+    size_t chunk;
+    float percent;
+    size_t max;
+};
+
 struct xnfile {
     int fd;
     char *path;
     size_t size;
     size_t block_size;
     uint64_t id;
+    pthread_mutex_t *lock;
+    struct xnuring *uring;  //vectored I/O goes through this ring if set, and is synchronous otherwise.  Not owned
+    bool unsynced;          //written or grown since the last fdatasync
+    pthread_mutex_t *sync_lock;  //held across xnfile_sync, so xnfile_sync_written can't skip a sync still running
+    struct xngrowth growth;
+    struct xngrower *grower;  //grows the file ahead of need if set.  Not owned
+    size_t grow_target;       //size requested from the grower, or 0 if not queued.  Protected by the grower lock
+
+    //the free map is changed in place in the buffer pool under alloc_lock, rather than in a tx's private copy,
+    //so txs allocating in the same file don't conflict.  The lock also protects the fields below
+    pthread_mutex_t *alloc_lock;
+    uint64_t alloc_end;       //one past the highest page in use, or 0 if the map hasn't been read yet
+    uint64_t *open_pages;     //heap pages with room that no tx is inserting into
+    int open_count;
+    int open_capacity;
+};
+
+//background thread that extends files before writers reach the end, so the allocation and the metadata
+//sync happen off the write path.  Writers that get there first still grow the file themselves
+struct xngrower {
+    pthread_t thread;
+    pthread_mutex_t *lock;
+    pthread_cond_t cv;
+    struct xnfile *queue[XNGROWER_QUEUE];
+    int count;
+    bool started;
+    bool stopping;
+    bool failed;    //some growth failed, and was left to the writers
 };
 
 xnresult_t xnfile_create(struct xnfile **handle, const char *name, int id, bool create, bool direct);
 bool xnfile_close(void **handle);
 xnresult_t xnfile_set_size(struct xnfile *handle, size_t size);
 xnresult_t xnfile_sync(struct xnfile *handle);
+xnresult_t xnfile_sync_written(struct xnfile *handle);
 xnresult_t xnfile_write(struct xnfile *handle, const char *buf, off_t off, size_t size);
 xnresult_t xnfile_read(struct xnfile *handle, char *buf, off_t off, size_t size);
+xnresult_t xnfile_writev(struct xnfile *handle, const struct xnfileiov *pages, int count);
+xnresult_t xnfile_readv(struct xnfile *handle, const struct xnfileiov *pages, int count);
+xnresult_t xnfile_writev_sync(struct xnfile *handle, const struct xnfileiov *pages, int count);
 xnresult_t xnfile_mmap(struct xnfile *handle, off_t offset, size_t len, void **out_ptr);
 xnresult_t xnfile_munmap(void *addr, size_t len);
-xnresult_t xnfile_grow(struct xnfile *handle);
+struct xngrowth xnfile_default_growth();
+xnresult_t xnfile_grow(struct xnfile *handle, size_t min_size);
+xnresult_t xnfile_grow_ahead(struct xnfile *handle, size_t used);
+xnresult_t xnfile_punch_hole(struct xnfile *handle, off_t off, size_t size);
 xnresult_t xnfile_init(struct xnfile *file, struct xntx *tx);
 xnresult_t xnfile_free_page(struct xnfile *file, struct xntx *tx, struct xnpg *page);
 xnresult_t xnfile_allocate_page(struct xnfile *file, struct xntx *tx, struct xnpg *page);
+xnresult_t xnfile_end_tx(struct xntx *tx, bool committed);
+xnresult_t xnfile_take_insert_page(struct xnfile *file, struct xntx *tx, struct xnpg *out_page, bool *out_found);
+xnresult_t xnfile_alloc_end(struct xnfile *file, struct xntx *tx, uint64_t *out_end);
+xnresult_t xnfile_redo_alloc(struct xnfile *file, struct xnpool *pool, uint64_t idx, bool used);
+xnresult_t xnfile_rebuild_map(struct xnfile *file, struct xnpool *pool);
+xnresult_t xngrower_create(struct xngrower **out_grower);
+bool xngrower_free(void **grower);
@@ -0,0 +1,498 @@
+#include "hash.h"
+
+#include <string.h>
+
+#define XNHS_REC_HDR_SZ (sizeof(uint64_t) + sizeof(uint16_t))
+#define XNHS_DIR_OFF sizeof(struct xnhsmeta)
+
+//start of the metadata page.  The index page indices follow
+struct xnhsmeta {
+    uint32_t depth;     //global depth - the directory has 2^depth entries
+    uint32_t dir_page_count;
+};
+
+//a bucket record being moved during a split or compaction
+struct xnhsrec {
+    uint64_t key;
+    uint16_t size;
+    const uint8_t *val;
+};
+
+//murmur3 finalizer.  Keys are often sequential, and the directory is indexed by the low bits
+static inline uint64_t xnhs_hash(uint64_t key) {
+    key ^= key >> 33;
+    key *= 0xff51afd7ed558ccdULL;
+    key ^= key >> 33;
+    key *= 0xc4ceb9fe1a85ec53ULL;
+    key ^= key >> 33;
+    return key;
+}
+
+static inline struct xnhshdr *xnhs_hdr(uint8_t *buf) {
+    return (struct xnhshdr*)buf;
+}
+
+static inline uint16_t *xnhs_slots(uint8_t *buf) {
+    return (uint16_t*)(buf + XNHS_HDR_SZ);
+}
+
+static inline uint64_t xnhs_rec_key(uint8_t *buf, int slot) {
+    uint64_t key;
+    memcpy(&key, buf + xnhs_slots(buf)[slot], sizeof(uint64_t));
+    return key;
+}
+
+static inline uint16_t xnhs_rec_size(uint8_t *buf, int slot) {
+    uint16_t size;
+    memcpy(&size, buf + xnhs_slots(buf)[slot] + sizeof(uint64_t), sizeof(uint16_t));
+    return size;
+}
+
+static inline uint8_t *xnhs_rec_val(uint8_t *buf, int slot) {
+    return buf + xnhs_slots(buf)[slot] + XNHS_REC_HDR_SZ;
+}
+
+static inline size_t xnhs_rec_bytes(size_t size) {
+    return sizeof(uint16_t) + XNHS_REC_HDR_SZ + size;
+}
+
+//slot holding key, or -1
+static int xnhs_bucket_find(uint8_t *buf, uint64_t key) {
+    for (int i = 0; i < xnhs_hdr(buf)->count; i++) {
+        if (xnhs_rec_key(buf, i) == key)
+            return i;
+    }
+    return -1;
+}
+
+static int xnhs_bucket_free_space(uint8_t *buf) {
+    struct xnhshdr *hdr = xnhs_hdr(buf);
+    return hdr->ceil - (XNHS_HDR_SZ + hdr->count * sizeof(uint16_t));
+}
+
+static void xnhs_bucket_init(uint8_t *buf, uint16_t depth) {
+    memset(buf, 0, XNPG_SZ);
+    struct xnhshdr *hdr = xnhs_hdr(buf);
+    hdr->depth = depth;
+    hdr->ceil = XNPG_SZ;
+}
+
+//caller checks there is room
+static void xnhs_bucket_append(uint8_t *buf, struct xnhsrec rec) {
+    struct xnhshdr *hdr = xnhs_hdr(buf);
+    hdr->ceil -= XNHS_REC_HDR_SZ + rec.size;
+    memcpy(buf + hdr->ceil, &rec.key, sizeof(uint64_t));
+    memcpy(buf + hdr->ceil + sizeof(uint64_t), &rec.size, sizeof(uint16_t));
+    memcpy(buf + hdr->ceil + XNHS_REC_HDR_SZ, rec.val, rec.size);
+    xnhs_slots(buf)[hdr->count++] = hdr->ceil;
+}
+
+//slots are unsorted, so the last slot fills the hole.  The record bytes stay behind until the bucket is rebuilt
+static void xnhs_bucket_remove(uint8_t *buf, int slot) {
+    struct xnhshdr *hdr = xnhs_hdr(buf);
+    uint16_t *slots = xnhs_slots(buf);
+    hdr->count--;
+    slots[slot] = slots[hdr->count];
+    slots[hdr->count] = 0;
+}
+
+static xnresult_t xnhs_read_meta(struct xnhash *hs, struct xnhsmeta *meta) {
+    xnmm_init();
+    xn_ensure(xnpg_read(&hs->meta, hs->tx, (uint8_t*)meta, 0, sizeof(struct xnhsmeta)));
+    return xn_ok();
+}
+
+//index page holding the page index of directory page dir_page
+static xnresult_t xnhs_index_page(struct xnhash *hs, uint64_t dir_page, struct xnpg *index) {
+    xnmm_init();
+    index->file_handle = hs->meta.file_handle;
+    int off = XNHS_DIR_OFF + (dir_page / XNHS_DIR_ENTRIES) * sizeof(uint64_t);
+    xn_ensure(xnpg_read(&hs->meta, hs->tx, (uint8_t*)&index->idx, off, sizeof(uint64_t)));
+    return xn_ok();
+}
+
+static xnresult_t xnhs_dir_page(struct xnhash *hs, uint64_t entry, struct xnpg *page) {
+    xnmm_init();
+    uint64_t dir_page = entry / XNHS_DIR_ENTRIES;
+    struct xnpg index;
+    xn_ensure(xnhs_index_page(hs, dir_page, &index));
+    page->file_handle = hs->meta.file_handle;
+    int off = (dir_page % XNHS_DIR_ENTRIES) * sizeof(uint64_t);
+    xn_ensure(xnpg_read(&index, hs->tx, (uint8_t*)&page->idx, off, sizeof(uint64_t)));
+    return xn_ok();
+}
+
+//records idx as directory page dir_page, starting a new index page every XNHS_DIR_ENTRIES directory pages
+static xnresult_t xnhs_add_dir_page(struct xnhash *hs, uint64_t dir_page, uint64_t idx) {
+    xnmm_init();
+    xn_ensure(dir_page / XNHS_DIR_ENTRIES < XNHS_MAX_INDEX_PAGES);
+    struct xnpg index;
+    if (dir_page % XNHS_DIR_ENTRIES == 0) {
+        xn_ensure(xnfile_allocate_page(hs->meta.file_handle, hs->tx, &index));
+        int off = XNHS_DIR_OFF + (dir_page / XNHS_DIR_ENTRIES) * sizeof(uint64_t);
+        xn_ensure(xnpg_write(&hs->meta, hs->tx, (uint8_t*)&index.idx, off, sizeof(uint64_t), true));
+    } else {
+        xn_ensure(xnhs_index_page(hs, dir_page, &index));
+    }
+    int off = (dir_page % XNHS_DIR_ENTRIES) * sizeof(uint64_t);
+    xn_ensure(xnpg_write(&index, hs->tx, (uint8_t*)&idx, off, sizeof(uint64_t), true));
+    return xn_ok();
+}
+
+static xnresult_t xnhs_dir_get(struct xnhash *hs, uint64_t entry, uint64_t *bucket) {
+    xnmm_init();
+    struct xnpg page;
+    xn_ensure(xnhs_dir_page(hs, entry, &page));
+    xn_ensure(xnpg_read(&page, hs->tx, (uint8_t*)bucket, (entry % XNHS_DIR_ENTRIES) * sizeof(uint64_t), sizeof(uint64_t)));
+    return xn_ok();
+}
+
+static xnresult_t xnhs_dir_set(struct xnhash *hs, uint64_t entry, uint64_t bucket) {
+    xnmm_init();
+    struct xnpg page;
+    xn_ensure(xnhs_dir_page(hs, entry, &page));
+    xn_ensure(xnpg_write(&page, hs->tx, (uint8_t*)&bucket, (entry % XNHS_DIR_ENTRIES) * sizeof(uint64_t), sizeof(uint64_t), true));
+    return xn_ok();
+}
+
+static xnresult_t xnhs_find_bucket(struct xnhash *hs, uint64_t key, uint64_t *out_entry, uint64_t *out_bucket) {
+    xnmm_init();
+    struct xnhsmeta meta;
+    xn_ensure(xnhs_read_meta(hs, &meta));
+    *out_entry = xnhs_hash(key) & ((1ULL << meta.depth) - 1);
+    xn_ensure(xnhs_dir_get(hs, *out_entry, out_bucket));
+    return xn_ok();
+}
+
+static xnresult_t xnhs_read_bucket(struct xnhash *hs, uint64_t idx, uint8_t *buf) {
+    xnmm_init();
+    struct xnpg page = { .file_handle = hs->meta.file_handle, .idx = idx };
+    xn_ensure(xnpg_read(&page, hs->tx, buf, 0, XNPG_SZ));
+    return xn_ok();
+}
+
+static xnresult_t xnhs_write_bucket(struct xnhash *hs, uint64_t idx, const uint8_t *old, const uint8_t *buf) {
+    xnmm_init();
+    struct xnpg page = { .file_handle = hs->meta.file_handle, .idx = idx };
+    xn_ensure(xnpg_write_diff(&page, hs->tx, old, buf));
+    return xn_ok();
+}
+
+//new pages are zeroed by xnfile_allocate_page
+static xnresult_t xnhs_write_new_bucket(struct xnhash *hs, uint64_t *out_idx, const uint8_t *buf) {
+    xnmm_init();
+
+    struct xnpg page;
+    xn_ensure(xnfile_allocate_page(hs->meta.file_handle, hs->tx, &page));
+
+    xnmm_scoped_alloc(scoped_ptr, xn_free, xn_malloc, &scoped_ptr, XNPG_SZ);
+    uint8_t *zero = (uint8_t*)scoped_ptr;
+    memset(zero, 0, XNPG_SZ);
+    xn_ensure(xnpg_write_diff(&page, hs->tx, zero, buf));
+
+    *out_idx = page.idx;
+    return xn_ok();
+}
+
+xnresult_t xnhs_open(struct xnhash *hs, struct xnfile *file, bool create, struct xntx *tx) {
+    xnmm_init();
+
+    hs->meta.file_handle = file;
+    hs->meta.idx = 1; //hard-coding metadata page
+    hs->tx = tx;
+
+    if (create) {
+        xn_ensure(xnfile_set_size(file, XNPG_SZ * 32));
+        xn_ensure(xnfile_init(file, tx));
+
+        struct xnpg meta_page;
+        xn_ensure(xnfile_allocate_page(file, tx, &meta_page));
+        xn_ensure(meta_page.idx == hs->meta.idx);
+
+        struct xnpg dir_page;
+        xn_ensure(xnfile_allocate_page(file, tx, &dir_page));
+
+        //global depth 0: one directory entry pointing at one empty bucket
+        xnmm_scoped_alloc(scoped_ptr, xn_free, xn_malloc, &scoped_ptr, XNPG_SZ);
+        uint8_t *buf = (uint8_t*)scoped_ptr;
+        xnhs_bucket_init(buf, 0);
+        uint64_t bucket;
+        xn_ensure(xnhs_write_new_bucket(hs, &bucket, buf));
+
+        struct xnhsmeta meta = { .depth = 0, .dir_page_count = 1 };
+        xn_ensure(xnpg_write(&hs->meta, tx, (uint8_t*)&meta, 0, sizeof(struct xnhsmeta), true));
+        xn_ensure(xnhs_add_dir_page(hs, 0, dir_page.idx));
+        xn_ensure(xnhs_dir_set(hs, 0, bucket));
+    }
+
+    return xn_ok();
+}
+
+//entry i + 2^depth starts out pointing at the same bucket as entry i.  Below one page the upper half of
+//the entries is copied within the first directory page, and after that whole directory pages are copied.  Fails
+//once the directory is XNHS_MAX_DEPTH deep
+static xnresult_t xnhs_double_dir(struct xnhash *hs, struct xnhsmeta *meta) {
+    xnmm_init();
+    xn_ensure(meta->depth < XNHS_MAX_DEPTH);
+
+    xnmm_scoped_alloc(scoped_ptr, xn_free, xn_malloc, &scoped_ptr, XNPG_SZ);
+    uint8_t *buf = (uint8_t*)scoped_ptr;
+
+    uint64_t count = 1ULL << meta->depth;
+    if (count < XNHS_DIR_ENTRIES) {
+        struct xnpg page;
+        xn_ensure(xnhs_dir_page(hs, 0, &page));
+        xn_ensure(xnpg_read(&page, hs->tx, buf, 0, count * sizeof(uint64_t)));
+        xn_ensure(xnpg_write(&page, hs->tx, buf, count * sizeof(uint64_t), count * sizeof(uint64_t), true));
+    } else {
+        for (uint32_t i = 0; i < meta->dir_page_count; i++) {
+            struct xnpg src;
+            xn_ensure(xnhs_dir_page(hs, i * XNHS_DIR_ENTRIES, &src));
+            xn_ensure(xnpg_read(&src, hs->tx, buf, 0, XNPG_SZ));
+            struct xnpg dst;
+            xn_ensure(xnfile_allocate_page(hs->meta.file_handle, hs->tx, &dst));
+            xn_ensure(xnpg_write(&dst, hs->tx, buf, 0, XNPG_SZ, true));
+            xn_ensure(xnhs_add_dir_page(hs, meta->dir_page_count + i, dst.idx));
+        }
+        meta->dir_page_count *= 2;
+    }
+
+    meta->depth++;
+    xn_ensure(xnpg_write(&hs->meta, hs->tx, (uint8_t*)meta, 0, sizeof(struct xnhsmeta), true));
+    return xn_ok();
+}
+
+//splits the bucket at idx (read into buf) on hash bit 'local depth', doubling the directory first if the
+//bucket is already as deep as the directory.  Entries with that bit set are pointed at the new bucket
+static xnresult_t xnhs_split(struct xnhash *hs, uint64_t entry, uint64_t idx, const uint8_t *old, uint8_t *buf) {
+    xnmm_init();
+
+    struct xnhsmeta meta;
+    xn_ensure(xnhs_read_meta(hs, &meta));
+    uint16_t depth = xnhs_hdr(buf)->depth;
+    if (depth == meta.depth)
+        xn_ensure(xnhs_double_dir(hs, &meta));
+
+    xnmm_scoped_alloc(scoped_low, xn_free, xn_malloc, &scoped_low, XNPG_SZ);
+    xnmm_scoped_alloc(scoped_high, xn_free, xn_malloc, &scoped_high, XNPG_SZ);
+    uint8_t *low = (uint8_t*)scoped_low;
+    uint8_t *high = (uint8_t*)scoped_high;
+    xnhs_bucket_init(low, depth + 1);
+    xnhs_bucket_init(high, depth + 1);
+
+    for (int i = 0; i < xnhs_hdr(buf)->count; i++) {
+        struct xnhsrec rec = { .key = xnhs_rec_key(buf, i), .size = xnhs_rec_size(buf, i), .val = xnhs_rec_val(buf, i) };
+        xnhs_bucket_append(xnhs_hash(rec.key) & (1ULL << depth) ? high : low, rec);
+    }
+
+    uint64_t high_idx;
+    xn_ensure(xnhs_write_new_bucket(hs, &high_idx, high));
+    xn_ensure(xnhs_write_bucket(hs, idx, old, low));
+
+    uint64_t first = (entry & ((1ULL << depth) - 1)) | (1ULL << depth);
+    for (uint64_t i = first; i < (1ULL << meta.depth); i += 1ULL << (depth + 1)) {
+        xn_ensure(xnhs_dir_set(hs, i, high_idx));
+    }
+
+    return xn_ok();
+}
+
+//rebuilds the bucket from buf with rec added, dropping the space left behind by deleted and replaced records
+static void xnhs_bucket_compact(uint8_t *out, uint8_t *buf, struct xnhsrec rec) {
+    xnhs_bucket_init(out, xnhs_hdr(buf)->depth);
+    for (int i = 0; i < xnhs_hdr(buf)->count; i++) {
+        struct xnhsrec r = { .key = xnhs_rec_key(buf, i), .size = xnhs_rec_size(buf, i), .val = xnhs_rec_val(buf, i) };
+        xnhs_bucket_append(out, r);
+    }
+    xnhs_bucket_append(out, rec);
+}
+
+//inserts or replaces the value for key.  A full bucket is compacted, or split and the put retried
+xnresult_t xnhs_put(struct xnhash *hs, uint64_t key, const uint8_t *val, size_t size) {
+    xnmm_init();
+    xn_ensure(size <= XNHS_MAX_VAL_SZ);
+
+    xnmm_scoped_alloc(scoped_old, xn_free, xn_malloc, &scoped_old, XNPG_SZ);
+    xnmm_scoped_alloc(scoped_buf, xn_free, xn_malloc, &scoped_buf, XNPG_SZ);
+    uint8_t *old = (uint8_t*)scoped_old;
+    uint8_t *buf = (uint8_t*)scoped_buf;
+    struct xnhsrec rec = { .key = key, .size = size, .val = val };
+
+    while (true) {
+        uint64_t entry;
+        uint64_t idx;
+        xn_ensure(xnhs_find_bucket(hs, key, &entry, &idx));
+        xn_ensure(xnhs_read_bucket(hs, idx, old));
+        memcpy(buf, old, XNPG_SZ);
+
+        int slot = xnhs_bucket_find(buf, key);
+        if (slot != -1)
+            xnhs_bucket_remove(buf, slot);
+
+        if (xnhs_bucket_free_space(buf) >= (int)xnhs_rec_bytes(size)) {
+            xnhs_bucket_append(buf, rec);
+            xn_ensure(xnhs_write_bucket(hs, idx, old, buf));
+            return xn_ok();
+        }
+
+        size_t live = xnhs_rec_bytes(size);
+        for (int i = 0; i < xnhs_hdr(buf)->count; i++)
+            live += xnhs_rec_bytes(xnhs_rec_size(buf, i));
+
+        if (live <= XNPG_SZ - XNHS_HDR_SZ) {
+            xnmm_scoped_alloc(scoped_out, xn_free, xn_malloc, &scoped_out, XNPG_SZ);
+            uint8_t *out = (uint8_t*)scoped_out;
+            xnhs_bucket_compact(out, buf, rec);
+            xn_ensure(xnhs_write_bucket(hs, idx, old, out));
+            return xn_ok();
+        }
+
+        xn_ensure(xnhs_split(hs, entry, idx, old, buf));
+    }
+}
+
+xnresult_t xnhs_get_size(struct xnhash *hs, uint64_t key, size_t *out_size, bool *found) {
+    xnmm_init();
+
+    xnmm_scoped_alloc(scoped_ptr, xn_free, xn_malloc, &scoped_ptr, XNPG_SZ);
+    uint8_t *buf = (uint8_t*)scoped_ptr;
+    uint64_t entry;
+    uint64_t idx;
+    xn_ensure(xnhs_find_bucket(hs, key, &entry, &idx));
+    xn_ensure(xnhs_read_bucket(hs, idx, buf));
+
+    int slot = xnhs_bucket_find(buf, key);
+    *found = slot != -1;
+    if (*found)
+        *out_size = xnhs_rec_size(buf, slot);
+
+    return xn_ok();
+}
+
+xnresult_t xnhs_get(struct xnhash *hs, uint64_t key, uint8_t *val, size_t size, bool *found) {
+    xnmm_init();
+
+    xnmm_scoped_alloc(scoped_ptr, xn_free, xn_malloc, &scoped_ptr, XNPG_SZ);
+    uint8_t *buf = (uint8_t*)scoped_ptr;
+    uint64_t entry;
+    uint64_t idx;
+    xn_ensure(xnhs_find_bucket(hs, key, &entry, &idx));
+    xn_ensure(xnhs_read_bucket(hs, idx, buf));
+
+    int slot = xnhs_bucket_find(buf, key);
+    *found = slot != -1;
+    if (*found) {
+        xn_ensure(size >= xnhs_rec_size(buf, slot));
+        memcpy(val, xnhs_rec_val(buf, slot), xnhs_rec_size(buf, slot));
+    }
+
+    return xn_ok();
+}
+
+//buckets are not merged, and the directory never shrinks
+xnresult_t xnhs_del(struct xnhash *hs, uint64_t key, bool *found) {
+    xnmm_init();
+
+    xnmm_scoped_alloc(scoped_old, xn_free, xn_malloc, &scoped_old, XNPG_SZ);
+    xnmm_scoped_alloc(scoped_buf, xn_free, xn_malloc, &scoped_buf, XNPG_SZ);
+    uint8_t *old = (uint8_t*)scoped_old;
+    uint8_t *buf = (uint8_t*)scoped_buf;
+
+    uint64_t entry;
+    uint64_t idx;
+    xn_ensure(xnhs_find_bucket(hs, key, &entry, &idx));
+    xn_ensure(xnhs_read_bucket(hs, idx, old));
+    memcpy(buf, old, XNPG_SZ);
+
+    int slot = xnhs_bucket_find(buf, key);
+    *found = slot != -1;
+    if (*found) {
+        xnhs_bucket_remove(buf, slot);
+        xn_ensure(xnhs_write_bucket(hs, idx, old, buf));
+    }
+
+    return xn_ok();
+}
+
+//visits each bucket once, from the lowest directory entry pointing at it.  Keys come out in no particular order
+xnresult_t xnhsscan_open(struct xnhsscan *scan, struct xnhash hs) {
+    xnmm_init();
+    scan->hs = hs;
+    scan->dir_idx = 0;
+    scan->slot = 0;
+    scan->started = false;
+    xn_ensure(xnhs_dir_get(&scan->hs, 0, &scan->bucket));
+    return xn_ok();
+}
+
+static xnresult_t xnhsscan_read(struct xnhsscan *scan, int offset, uint8_t *out, size_t size) {
+    xnmm_init();
+    struct xnpg page = { .file_handle = scan->hs.meta.file_handle, .idx = scan->bucket };
+    xn_ensure(xnpg_read(&page, scan->hs.tx, out, offset, size));
+    return xn_ok();
+}
+
+static xnresult_t xnhsscan_rec_offset(struct xnhsscan *scan, uint16_t *out_off) {
+    xnmm_init();
+    xn_ensure(xnhsscan_read(scan, XNHS_HDR_SZ + scan->slot * sizeof(uint16_t), (uint8_t*)out_off, sizeof(uint16_t)));
+    return xn_ok();
+}
+
+xnresult_t xnhsscan_next(struct xnhsscan *scan, bool *result) {
+    xnmm_init();
+
+    if (scan->started)
+        scan->slot++;
+    scan->started = true;
+
+    struct xnhsmeta meta;
+    xn_ensure(xnhs_read_meta(&scan->hs, &meta));
+
+    struct xnhshdr hdr;
+    xn_ensure(xnhsscan_read(scan, 0, (uint8_t*)&hdr, sizeof(struct xnhshdr)));
+    while (scan->slot >= hdr.count) {
+        //entries past 2^(local depth) point at a bucket an earlier entry already visited
+        do {
+            scan->dir_idx++;
+            if (scan->dir_idx >= (1ULL << meta.depth)) {
+                *result = false;
+                return xn_ok();
+            }
+            xn_ensure(xnhs_dir_get(&scan->hs, scan->dir_idx, &scan->bucket));
+            xn_ensure(xnhsscan_read(scan, 0, (uint8_t*)&hdr, sizeof(struct xnhshdr)));
+        } while (scan->dir_idx >= (1ULL << hdr.depth));
+        scan->slot = 0;
+    }
+
+    *result = true;
+    return xn_ok();
+}
+
+xnresult_t xnhsscan_key(struct xnhsscan *scan, uint64_t *key) {
+    xnmm_init();
+    uint16_t off;
+    xn_ensure(xnhsscan_rec_offset(scan, &off));
+    xn_ensure(xnhsscan_read(scan, off, (uint8_t*)key, sizeof(uint64_t)));
+    return xn_ok();
+}
+
+xnresult_t xnhsscan_get_size(struct xnhsscan *scan, size_t *size) {
+    xnmm_init();
+    uint16_t off;
+    xn_ensure(xnhsscan_rec_offset(scan, &off));
+    uint16_t val_size;
+    xn_ensure(xnhsscan_read(scan, off + sizeof(uint64_t), (uint8_t*)&val_size, sizeof(uint16_t)));
+    *size = val_size;
+    return xn_ok();
+}
+
+xnresult_t xnhsscan_get(struct xnhsscan *scan, uint8_t *val, size_t size) {
+    xnmm_init();
+    uint16_t off;
+    xn_ensure(xnhsscan_rec_offset(scan, &off));
+    uint16_t val_size;
+    xn_ensure(xnhsscan_read(scan, off + sizeof(uint64_t), (uint8_t*)&val_size, sizeof(uint16_t)));
+    xn_ensure(size >= val_size);
+    xn_ensure(xnhsscan_read(scan, off + XNHS_REC_HDR_SZ, val, val_size));
+    return xn_ok();
+}
@@ -0,0 +1,56 @@
+#pragma once
+
+#include "file.h"
+#include "page.h"
+#include "util.h"
+#include "tx.h"
+
+#define XNHS_HDR_SZ 32
+
+//directory entries per directory page, and directory page indices per index page
+#define XNHS_DIR_ENTRIES (XNPG_SZ / sizeof(uint64_t))
+
+//the metadata page holds the global depth, the directory page count and the index page indices, and the index
+//pages hold the directory page indices.  The directory doubles, so its depth is capped at the largest power of
+//two those pages can address: 2^26 entries (2^17 directory pages) with 4KB pages.  A lookup reads the metadata
+//page, one index page, one directory page and one bucket
+#define XNHS_MAX_INDEX_PAGES ((XNPG_SZ - sizeof(uint64_t)) / sizeof(uint64_t))
+#define XNHS_MAX_DEPTH 26
+
+//values are stored inline in buckets.  Capped so a split can always make room
+#define XNHS_MAX_VAL_SZ 1024
+
+//bucket header.  Like a B+tree leaf, buckets keep an array of 2 byte record offsets after the header, and
+//records (8 byte key, 2 byte value size, value) grow down from the end of the page.  Slots are unsorted
+struct xnhshdr {
+    uint16_t depth;     //local depth - every key in the bucket shares its low depth hash bits
+    uint16_t count;
+    uint16_t ceil;
+    uint16_t unused;
+    uint64_t reserved[3];
+};
+
+struct xnhash {
+    struct xnpg meta;
+    struct xntx *tx;
+};
+
+struct xnhsscan {
+    struct xnhash hs;
+    uint64_t dir_idx;
+    uint64_t bucket;
+    int slot;
+    bool started;
+};
+
+xnresult_t xnhs_open(struct xnhash *hs, struct xnfile *file, bool create, struct xntx *tx);
+xnresult_t xnhs_put(struct xnhash *hs, uint64_t key, const uint8_t *val, size_t size);
+xnresult_t xnhs_get_size(struct xnhash *hs, uint64_t key, size_t *out_size, bool *found);
+xnresult_t xnhs_get(struct xnhash *hs, uint64_t key, uint8_t *val, size_t size, bool *found);
+xnresult_t xnhs_del(struct xnhash *hs, uint64_t key, bool *found);
+
+xnresult_t xnhsscan_open(struct xnhsscan *scan, struct xnhash hs);
+xnresult_t xnhsscan_next(struct xnhsscan *scan, bool *result);
+xnresult_t xnhsscan_key(struct xnhsscan *scan, uint64_t *key);
+xnresult_t xnhsscan_get_size(struct xnhsscan *scan, size_t *size);
+xnresult_t xnhsscan_get(struct xnhsscan *scan, uint8_t *val, size_t size);
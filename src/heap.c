@@ -1,4 +1,5 @@
 #include "heap.h"
+#include "pool.h"
 #include <string.h>
 
 
@@ -21,21 +22,18 @@ xnresult_t xnhp_open(struct xnhp *hp, struct xnfile *file, bool create, struct x
 		xn_ensure(xnctn_open(&meta_ctn, heap_meta_page, tx));
         xn_ensure(xnctn_init(&meta_ctn));
 
-        //first data container
+        //first data container, which the creating tx inserts into first
         struct xnpg data_page;
         xn_ensure(xnfile_allocate_page(hp->meta.file_handle, tx, &data_page)); 
         struct xnctn data_ctn;
 		xn_ensure(xnctn_open(&data_ctn, data_page, tx));
         xn_ensure(xnctn_init(&data_ctn));
+        xn_ensure(xntx_add_page(tx, &data_page, XNTXPG_INSERT));
 
-        //set heap file metadata (only 2 for now)
+        //set heap file metadata.  Scans start at the first container and run to the end of the allocated pages
         uint64_t start_ctn_idx = data_page.idx;
         struct xnitemid start_ctn_id;
         xn_ensure(xnctn_insert(&meta_ctn, (uint8_t*)&start_ctn_idx, sizeof(uint64_t), &start_ctn_id));
-
-        uint64_t cur_ctn_idx = start_ctn_idx;
-        struct xnitemid cur_ctn_id;
-        xn_ensure(xnctn_insert(&meta_ctn, (uint8_t*)&cur_ctn_idx, sizeof(uint64_t), &cur_ctn_id));
     }
 
     return xn_ok();
@@ -48,7 +46,7 @@ static xnresult_t xnhp_get_first_ctn(struct xnhp hp, struct xnctn *ctn) {
 	xn_ensure(xnctn_open(&meta_ctn, hp.meta, hp.tx));
 
     uint64_t first_page_idx;
-    struct xnitemid id = { .pg_idx = 1 /*heap metadata page*/, .arr_idx = 0 /*current container idx*/ }; 
+    struct xnitemid id = { .pg_idx = 1 /*heap metadata page*/, .arr_idx = 0 /*first container idx*/ }; 
     xn_ensure(xnctn_get(&meta_ctn, id, (uint8_t*)&first_page_idx, sizeof(uint64_t)));
 
 	struct xnpg first_pg = { .file_handle = hp.meta.file_handle, .idx = first_page_idx };
@@ -56,42 +54,41 @@ static xnresult_t xnhp_get_first_ctn(struct xnhp hp, struct xnctn *ctn) {
     return xn_ok();
 }
 
-static xnresult_t xnhp_get_current_ctn(struct xnhp *hp, struct xnctn* out_ctn) {
+//finds a container with room for size bytes that only this tx inserts into, so write txs inserting into the same
+//heap never modify the same page and don't conflict.  Tries the tx's own page, then a page an earlier tx left room
+//in, then a new page.  Full pages are dropped from the tx's insert pages, so they aren't offered again
+static xnresult_t xnhp_insert_ctn(struct xnhp *hp, size_t size, struct xnctn *out_ctn) {
     xnmm_init();
+    struct xnfile *file = hp->meta.file_handle;
+
+    bool can_fit = false;
+    int i = xntx_find_page(hp->tx, file, XNTX_ANY_PAGE, XNTXPG_INSERT);
+    if (i >= 0) {
+        xn_ensure(xnctn_open(out_ctn, hp->tx->pgs[i].page, hp->tx));
+        xn_ensure(xnctn_can_fit(out_ctn, size, &can_fit));
+        if (!can_fit)
+            xntx_remove_page(hp->tx, i);
+    }
 
-    struct xnctn meta_ctn;
-	xn_ensure(xnctn_open(&meta_ctn, hp->meta, hp->tx));
-
-    uint64_t cur_page_idx;
-    struct xnitemid id = { .pg_idx = 1 /*heap metadata page*/, .arr_idx = 1 /*current container idx*/ }; 
-    xn_ensure(xnctn_get(&meta_ctn, id, (uint8_t*)&cur_page_idx, sizeof(uint64_t)));
-
-	struct xnpg cur_pg = { .file_handle = hp->meta.file_handle, .idx = cur_page_idx };
-	xn_ensure(xnctn_open(out_ctn, cur_pg, hp->tx));
-    return xn_ok();
-}
-
-static xnresult_t xnhp_set_current_ctn(struct xnhp *hp, uint64_t cur_page_idx) {
-	xnmm_init();
-
-    struct xnctn meta_ctn;
-	xn_ensure(xnctn_open(&meta_ctn, hp->meta, hp->tx));
-	struct xnitemid new_id;
-    struct xnitemid id = { .pg_idx = 1 /*heap metadata page*/, .arr_idx = 1 /*current container idx*/ }; 
-	xn_ensure(xnctn_update(&meta_ctn, id, (uint8_t*)&cur_page_idx, sizeof(uint64_t), &new_id));
-	xn_ensure(id.pg_idx == new_id.pg_idx && id.arr_idx == new_id.arr_idx);
-
-	return xn_ok();
-}
-
-static xnresult_t xnhp_append_container(struct xnhp *hp, struct xnctn *out_ctn) {
-    xnmm_init();
+    if (!can_fit) {
+        struct xnpg page;
+        bool found;
+        xn_ensure(xnfile_take_insert_page(file, hp->tx, &page, &found));
+        if (found) {
+            xn_ensure(xnctn_open(out_ctn, page, hp->tx));
+            xn_ensure(xnctn_can_fit(out_ctn, size, &can_fit));
+            if (!can_fit)
+                xntx_remove_page(hp->tx, xntx_find_page(hp->tx, file, page.idx, XNTXPG_INSERT));
+        }
+    }
 
-    struct xnpg new_page;
-    xn_ensure(xnfile_allocate_page(hp->meta.file_handle, hp->tx, &new_page));
-	xn_ensure(xnctn_open(out_ctn, new_page, hp->tx));
-    xn_ensure(xnctn_init(out_ctn));
-	xn_ensure(xnhp_set_current_ctn(hp, new_page.idx));
+    if (!can_fit) {
+        struct xnpg new_page;
+        xn_ensure(xnfile_allocate_page(file, hp->tx, &new_page));
+        xn_ensure(xnctn_open(out_ctn, new_page, hp->tx));
+        xn_ensure(xnctn_init(out_ctn));
+        xn_ensure(xntx_add_page(hp->tx, &new_page, XNTXPG_INSERT));
+    }
 
     return xn_ok();
 }
@@ -110,14 +107,7 @@ xnresult_t xnhp_put(struct xnhp *hp, uint8_t *buf, size_t size, struct xnitemid
     xnmm_init();
 
     struct xnctn ctn;
-    xn_ensure(xnhp_get_current_ctn(hp, &ctn));
-
-    bool can_fit;
-    xn_ensure(xnctn_can_fit(&ctn, size, &can_fit));
-    if (!can_fit) {
-        xn_ensure(xnhp_append_container(hp, &ctn));
-    }
-
+    xn_ensure(xnhp_insert_ctn(hp, size, &ctn));
     xn_ensure(xnctn_insert(&ctn, buf, size, id));
 
     return xn_ok();
@@ -161,41 +151,46 @@ xnresult_t xnhpscan_open(struct xnhpscan *scan, struct xnhp hp) {
 	xn_ensure(xnhp_get_first_ctn(hp, &ctn));
 
 	xn_ensure(xnctnitr_init(&scan->ctnitr, ctn));
+    scan->prefetched = 0;
+    xn_ensure(xnfile_alloc_end(hp.meta.file_handle, hp.tx, &scan->end));
 
 	return xn_ok();
 }
 
+//txs insert into pages of their own, so containers aren't filled in page order and some are still empty.  Every
+//page from the first container to the end of the allocated pages is read, skipping the free map's pages
 xnresult_t xnhpscan_next(struct xnhpscan *scan, bool *result) {
 	xnmm_init();
 
 	bool ctn_result;
 	xn_ensure(xnctnitr_next(&scan->ctnitr, &ctn_result));
-	if (ctn_result) {
-		*result = true;
-		return xn_ok();
-	}
-
-	uint64_t next_pg_idx = scan->ctnitr.ctn.pg.idx + 1;
-    struct xnctn last_ctn;
-    xn_ensure(xnhp_get_current_ctn(&scan->hp, &last_ctn));
-
-	if (last_ctn.pg.idx < next_pg_idx) {
-		*result = false;
-		return xn_ok();
-	}
-
-	struct xnctn next_ctn;
-	struct xnpg next_pg = { .file_handle = scan->hp.meta.file_handle, .idx = next_pg_idx };
-	xn_ensure(xnctn_open(&next_ctn, next_pg, scan->hp.tx));
-
-	xn_ensure(xnctnitr_init(&scan->ctnitr, next_ctn));
-	xn_ensure(xnctnitr_next(&scan->ctnitr, &ctn_result));
-	if (ctn_result) {
-		*result = true;
-		return xn_ok();
+	while (!ctn_result) {
+        uint64_t next_pg_idx = scan->ctnitr.ctn.pg.idx + 1;
+        if (next_pg_idx % XNFILE_GROUP_PAGES == 0)
+            next_pg_idx++;
+        if (next_pg_idx >= scan->end) {
+            *result = false;
+            return xn_ok();
+        }
+
+        struct xnpg next_pg = { .file_handle = scan->hp.meta.file_handle, .idx = next_pg_idx };
+
+        //read the following pages in one batch rather than one page at a time
+        if (next_pg_idx >= scan->prefetched) {
+            uint64_t count = scan->end - next_pg_idx;
+            if (count > XNPOOL_READAHEAD)
+                count = XNPOOL_READAHEAD;
+            xn_ensure(xnpg_prefetch(&next_pg, scan->hp.tx, (int)count));
+            scan->prefetched = next_pg_idx + count;
+        }
+
+        struct xnctn next_ctn;
+        xn_ensure(xnctn_open(&next_ctn, next_pg, scan->hp.tx));
+        xn_ensure(xnctnitr_init(&scan->ctnitr, next_ctn));
+        xn_ensure(xnctnitr_next(&scan->ctnitr, &ctn_result));
 	}
 
-	*result = false;
+	*result = true;
 	return xn_ok();
 }
 
@@ -15,6 +15,8 @@ struct xnhp {
 struct xnhpscan {
     struct xnhp hp;
 	struct xnctnitr ctnitr;
+    uint64_t prefetched;    //pages before this index have already been read ahead
+    uint64_t end;           //one past the last allocated page when the scan was opened
 };
 
 xnresult_t xnhp_open(struct xnhp *hp, struct xnfile *file, bool create, struct xntx *tx);
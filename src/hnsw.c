@@ -0,0 +1,614 @@
+#include "hnsw.h"
+
+#include <math.h>
+#include <stddef.h>
+#include <string.h>
+
+#define XNHNSW_MAX_LEVEL 15
+
+//start of the metadata page
+struct xnhnswmeta {
+    uint32_t dim;
+    uint32_t m;
+    uint32_t ef_construction;
+    uint32_t metric;
+    uint32_t initialized;
+    uint32_t max_level;
+    uint64_t count;
+    uint64_t entry;     //reference to the entry point node, 0 while the graph is empty
+    uint64_t tail;      //container new items are appended to, 0 before the first insert
+};
+
+//a node item is this header, followed by a neighbor list reference for each of its levels 0 to level, then the
+//vector.  A neighbor list item is a uint64_t count followed by room for the most neighbors its level allows
+struct xnhnswnode {
+    uint64_t id;
+    uint32_t level;
+    uint32_t unused;
+};
+
+//nodes and neighbor lists are referenced by container item, with the level packed in so the item's size is known
+//before reading it.  Page 0 is the free-page bitmap, so 0 is never a valid reference
+static inline uint64_t xnhnsw_ref(struct xnitemid id, int level) {
+    return (id.pg_idx << 21) | ((uint64_t)level << 16) | id.arr_idx;
+}
+
+static inline struct xnitemid xnhnsw_itemid(uint64_t ref) {
+    struct xnitemid id = { .pg_idx = ref >> 21, .arr_idx = ref & 0xffff };
+    return id;
+}
+
+static inline int xnhnsw_level(uint64_t ref) {
+    return (ref >> 16) & 0x1f;
+}
+
+static inline int xnhnsw_max_neighbors(struct xnhnswmeta *meta, int level) {
+    return level == 0 ? 2 * meta->m : meta->m;
+}
+
+static inline size_t xnhnsw_list_size(struct xnhnswmeta *meta, int level) {
+    return sizeof(uint64_t) * (1 + xnhnsw_max_neighbors(meta, level));
+}
+
+static inline size_t xnhnsw_node_size(struct xnhnswmeta *meta, int level) {
+    return sizeof(struct xnhnswnode) + (level + 1) * sizeof(uint64_t) + meta->dim * sizeof(float);
+}
+
+static inline uint64_t *xnhnsw_node_lists(uint8_t *node) {
+    return (uint64_t*)(node + sizeof(struct xnhnswnode));
+}
+
+static inline float *xnhnsw_node_vec(uint8_t *node) {
+    return (float*)(node + sizeof(struct xnhnswnode) + (((struct xnhnswnode*)node)->level + 1) * sizeof(uint64_t));
+}
+
+struct xnhnswopts xnhnsw_default_opts(int dim) {
+    struct xnhnswopts opts = {
+        .dim = dim,
+        .m = 16,
+        .ef_construction = 100,
+        .metric = XNVM_L2,
+    };
+    return opts;
+}
+
+static xnresult_t xnhnsw_read_meta(struct xnhnsw *hnsw, struct xnhnswmeta *meta) {
+    xnmm_init();
+    xn_ensure(xnpg_read(&hnsw->meta, hnsw->tx, (uint8_t*)meta, 0, sizeof(struct xnhnswmeta)));
+    return xn_ok();
+}
+
+xnresult_t xnhnsw_open(struct xnhnsw *hnsw, struct xnfile *file, bool create, struct xntx *tx) {
+    xnmm_init();
+
+    hnsw->meta.file_handle = file;
+    hnsw->meta.idx = 1; //hard-coding metadata page
+    hnsw->tx = tx;
+
+    //an uninitialized graph is all zeroes, which the fresh metadata page already is
+    if (create) {
+        xn_ensure(xnfile_set_size(file, XNPG_SZ * 32));
+        xn_ensure(xnfile_init(file, tx));
+
+        struct xnpg meta_page;
+        xn_ensure(xnfile_allocate_page(file, tx, &meta_page));
+        xn_ensure(meta_page.idx == hnsw->meta.idx);
+    }
+
+    return xn_ok();
+}
+
+//sets the dimension, metric and graph degree.  Done once, before any vectors are added
+xnresult_t xnhnsw_init(struct xnhnsw *hnsw, struct xnhnswopts opts) {
+    xnmm_init();
+
+    struct xnhnswmeta meta;
+    xn_ensure(xnhnsw_read_meta(hnsw, &meta));
+    xn_ensure(!meta.initialized);
+    xn_ensure(opts.dim > 0 && opts.m > 1 && opts.ef_construction > 0);
+
+    meta.dim = opts.dim;
+    meta.m = opts.m;
+    meta.ef_construction = opts.ef_construction;
+    meta.metric = opts.metric;
+    meta.initialized = 1;
+    meta.max_level = 0;
+    meta.count = 0;
+    meta.entry = 0;
+    meta.tail = 0;
+
+    //the largest node and the level 0 list each have to fit in one container along with their slots
+    xn_ensure(xnhnsw_node_size(&meta, XNHNSW_MAX_LEVEL) + sizeof(uint32_t) <= XNPG_SZ - XNCTN_HDR_SZ);
+    xn_ensure(xnhnsw_list_size(&meta, 0) + sizeof(uint32_t) <= XNPG_SZ - XNCTN_HDR_SZ);
+
+    xn_ensure(xnpg_write(&hnsw->meta, hnsw->tx, (uint8_t*)&meta, 0, sizeof(struct xnhnswmeta), true));
+    return xn_ok();
+}
+
+static xnresult_t xnhnsw_read_item(struct xnhnsw *hnsw, uint64_t ref, uint8_t *buf, size_t size) {
+    xnmm_init();
+    struct xnitemid id = xnhnsw_itemid(ref);
+    struct xnpg page = { .file_handle = hnsw->meta.file_handle, .idx = id.pg_idx };
+    struct xnctn ctn;
+    xn_ensure(xnctn_open(&ctn, page, hnsw->tx));
+    xn_ensure(xnctn_get(&ctn, id, buf, size));
+    return xn_ok();
+}
+
+static xnresult_t xnhnsw_read_node(struct xnhnsw *hnsw, struct xnhnswmeta *meta, uint64_t ref, uint8_t *node) {
+    xnmm_init();
+    xn_ensure(xnhnsw_read_item(hnsw, ref, node, xnhnsw_node_size(meta, xnhnsw_level(ref))));
+    return xn_ok();
+}
+
+static xnresult_t xnhnsw_read_list(struct xnhnsw *hnsw, struct xnhnswmeta *meta, uint64_t ref, uint64_t *list) {
+    xnmm_init();
+    xn_ensure(xnhnsw_read_item(hnsw, ref, (uint8_t*)list, xnhnsw_list_size(meta, xnhnsw_level(ref))));
+    return xn_ok();
+}
+
+//lists never change size, so the update happens in place and the reference stays valid
+static xnresult_t xnhnsw_write_list(struct xnhnsw *hnsw, struct xnhnswmeta *meta, uint64_t ref, uint64_t *list) {
+    xnmm_init();
+    struct xnitemid id = xnhnsw_itemid(ref);
+    struct xnpg page = { .file_handle = hnsw->meta.file_handle, .idx = id.pg_idx };
+    struct xnctn ctn;
+    xn_ensure(xnctn_open(&ctn, page, hnsw->tx));
+    struct xnitemid new_id;
+    xn_ensure(xnctn_update(&ctn, id, (uint8_t*)list, xnhnsw_list_size(meta, xnhnsw_level(ref)), &new_id));
+    xn_ensure(new_id.pg_idx == id.pg_idx && new_id.arr_idx == id.arr_idx);
+    return xn_ok();
+}
+
+//appends to the tail container, starting a new one when it is full.  meta->tail is written with the rest of the
+//metadata at the end of xnhnsw_put
+static xnresult_t xnhnsw_append(struct xnhnsw *hnsw, struct xnhnswmeta *meta, const uint8_t *buf, size_t size, int level, uint64_t *out_ref) {
+    xnmm_init();
+
+    struct xnctn ctn;
+    bool can_fit = false;
+    if (meta->tail != 0) {
+        struct xnpg tail = { .file_handle = hnsw->meta.file_handle, .idx = meta->tail };
+        xn_ensure(xnctn_open(&ctn, tail, hnsw->tx));
+        xn_ensure(xnctn_can_fit(&ctn, size, &can_fit));
+    }
+
+    if (!can_fit) {
+        struct xnpg page;
+        xn_ensure(xnfile_allocate_page(hnsw->meta.file_handle, hnsw->tx, &page));
+        xn_ensure(xnctn_open(&ctn, page, hnsw->tx));
+        xn_ensure(xnctn_init(&ctn));
+        meta->tail = page.idx;
+    }
+
+    struct xnitemid id;
+    xn_ensure(xnctn_insert(&ctn, buf, size, &id));
+    *out_ref = xnhnsw_ref(id, level);
+    return xn_ok();
+}
+
+//candidate during a layer search.  list is the candidate's neighbor list on that layer
+struct xnhnswcand {
+    uint64_t ref;
+    uint64_t list;
+    float dist;
+};
+
+//scratch space for searches and inserts.  The candidate heap and the visited set grow as needed
+struct xnhnswctx {
+    struct xnhnswmeta *meta;
+    int ef;
+
+    struct xnhnswcand *heap;        //min-heap on dist
+    int heap_count;
+    int heap_cap;
+
+    uint64_t *visited;              //open addressing set of node references, 0 for empty slots
+    int visited_count;
+    int visited_cap;
+
+    uint64_t *w_ids;                //results of the last layer search, ef entries
+    float *w_dists;
+    uint64_t *eps;                  //entry points for the next layer, ef entries
+    uint8_t *node;
+    uint64_t *list;
+
+    //neighbor selection, for up to twice m plus one candidates
+    uint64_t *sel_refs;
+    float *sel_dists;
+    float *sel_vecs;
+};
+
+static bool xnhnsw_ctx_free(void **ptr) {
+    struct xnhnswctx *ctx = (struct xnhnswctx*)*ptr;
+    if (!ctx)
+        return true;
+    free(ctx->heap);
+    free(ctx->visited);
+    free(ctx->w_ids);
+    free(ctx->w_dists);
+    free(ctx->eps);
+    free(ctx->node);
+    free(ctx->list);
+    free(ctx->sel_refs);
+    free(ctx->sel_dists);
+    free(ctx->sel_vecs);
+    free(ctx);
+    *ptr = NULL;
+    return true;
+}
+
+static bool xnhnsw_ctx_create(void **ptr, struct xnhnswmeta *meta, int ef) {
+    struct xnhnswctx *ctx = calloc(1, sizeof(struct xnhnswctx));
+    *ptr = ctx;
+    if (!ctx)
+        return false;
+
+    int sel = 2 * meta->m + 1;
+    ctx->meta = meta;
+    ctx->ef = ef;
+    ctx->heap_cap = 64;
+    ctx->heap = malloc(ctx->heap_cap * sizeof(struct xnhnswcand));
+    ctx->visited_cap = 1024;
+    ctx->visited = malloc(ctx->visited_cap * sizeof(uint64_t));
+    ctx->w_ids = malloc(ef * sizeof(uint64_t));
+    ctx->w_dists = malloc(ef * sizeof(float));
+    ctx->eps = malloc(ef * sizeof(uint64_t));
+    ctx->node = malloc(xnhnsw_node_size(meta, XNHNSW_MAX_LEVEL));
+    ctx->list = malloc(xnhnsw_list_size(meta, 0));
+    ctx->sel_refs = malloc(sel * sizeof(uint64_t));
+    ctx->sel_dists = malloc(sel * sizeof(float));
+    ctx->sel_vecs = malloc((size_t)sel * meta->dim * sizeof(float));
+    return ctx->heap && ctx->visited && ctx->w_ids && ctx->w_dists && ctx->eps && ctx->node && ctx->list &&
+           ctx->sel_refs && ctx->sel_dists && ctx->sel_vecs;
+}
+
+static xnresult_t xnhnsw_heap_push(struct xnhnswctx *ctx, struct xnhnswcand cand) {
+    xnmm_init();
+
+    if (ctx->heap_count == ctx->heap_cap) {
+        struct xnhnswcand *heap = realloc(ctx->heap, 2 * ctx->heap_cap * sizeof(struct xnhnswcand));
+        xn_ensure(heap);
+        ctx->heap = heap;
+        ctx->heap_cap *= 2;
+    }
+
+    int i = ctx->heap_count++;
+    while (i > 0 && ctx->heap[(i - 1) / 2].dist > cand.dist) {
+        ctx->heap[i] = ctx->heap[(i - 1) / 2];
+        i = (i - 1) / 2;
+    }
+    ctx->heap[i] = cand;
+    return xn_ok();
+}
+
+static struct xnhnswcand xnhnsw_heap_pop(struct xnhnswctx *ctx) {
+    struct xnhnswcand top = ctx->heap[0];
+    struct xnhnswcand last = ctx->heap[--ctx->heap_count];
+    int i = 0;
+    while (true) {
+        int child = 2 * i + 1;
+        if (child >= ctx->heap_count)
+            break;
+        if (child + 1 < ctx->heap_count && ctx->heap[child + 1].dist < ctx->heap[child].dist)
+            child++;
+        if (ctx->heap[child].dist >= last.dist)
+            break;
+        ctx->heap[i] = ctx->heap[child];
+        i = child;
+    }
+    if (ctx->heap_count > 0)
+        ctx->heap[i] = last;
+    return top;
+}
+
+static inline uint64_t xnhnsw_hash(uint64_t ref) {
+    ref ^= ref >> 33;
+    ref *= 0xff51afd7ed558ccdULL;
+    ref ^= ref >> 33;
+    return ref;
+}
+
+//marks ref visited, setting seen if it already was.  The table doubles once it is half full
+static xnresult_t xnhnsw_visit(struct xnhnswctx *ctx, uint64_t ref, bool *seen) {
+    xnmm_init();
+
+    if (2 * (ctx->visited_count + 1) > ctx->visited_cap) {
+        int old_cap = ctx->visited_cap;
+        uint64_t *old = ctx->visited;
+        uint64_t *visited = calloc(2 * old_cap, sizeof(uint64_t));
+        xn_ensure(visited);
+        ctx->visited = visited;
+        ctx->visited_cap = 2 * old_cap;
+        for (int i = 0; i < old_cap; i++) {
+            if (old[i] == 0)
+                continue;
+            uint64_t slot = xnhnsw_hash(old[i]) & (ctx->visited_cap - 1);
+            while (ctx->visited[slot] != 0)
+                slot = (slot + 1) & (ctx->visited_cap - 1);
+            ctx->visited[slot] = old[i];
+        }
+        free(old);
+    }
+
+    uint64_t slot = xnhnsw_hash(ref) & (ctx->visited_cap - 1);
+    while (ctx->visited[slot] != 0) {
+        if (ctx->visited[slot] == ref) {
+            *seen = true;
+            return xn_ok();
+        }
+        slot = (slot + 1) & (ctx->visited_cap - 1);
+    }
+    ctx->visited[slot] = ref;
+    ctx->visited_count++;
+    *seen = false;
+    return xn_ok();
+}
+
+//best-first search of one level starting from eps.  Leaves the ef closest nodes found in w
+static xnresult_t xnhnsw_search_level(struct xnhnsw *hnsw, struct xnhnswctx *ctx, const float *query, int level,
+                                      const uint64_t *eps, int ep_count, int ef, struct xnvtopk *w) {
+    xnmm_init();
+
+    struct xnhnswmeta *meta = ctx->meta;
+    ctx->heap_count = 0;
+    ctx->visited_count = 0;
+    memset(ctx->visited, 0, ctx->visited_cap * sizeof(uint64_t));
+    xnvtopk_init(w, ef, ctx->w_ids, ctx->w_dists);
+
+    for (int i = 0; i < ep_count; i++) {
+        bool seen;
+        xn_ensure(xnhnsw_visit(ctx, eps[i], &seen));
+        if (seen)
+            continue;
+        xn_ensure(xnhnsw_read_node(hnsw, meta, eps[i], ctx->node));
+        float dist = xnvec_rank_distance(meta->metric, query, xnhnsw_node_vec(ctx->node), meta->dim);
+        struct xnhnswcand cand = { .ref = eps[i], .list = xnhnsw_node_lists(ctx->node)[level], .dist = dist };
+        xn_ensure(xnhnsw_heap_push(ctx, cand));
+        xnvtopk_push(w, eps[i], dist);
+    }
+
+    while (ctx->heap_count > 0) {
+        struct xnhnswcand c = xnhnsw_heap_pop(ctx);
+        if (w->count == ef && c.dist > w->dists[0])
+            break;
+
+        xn_ensure(xnhnsw_read_list(hnsw, meta, c.list, ctx->list));
+        uint64_t count = ctx->list[0];
+        for (uint64_t i = 0; i < count; i++) {
+            uint64_t ref = ctx->list[1 + i];
+            bool seen;
+            xn_ensure(xnhnsw_visit(ctx, ref, &seen));
+            if (seen)
+                continue;
+
+            xn_ensure(xnhnsw_read_node(hnsw, meta, ref, ctx->node));
+            float dist = xnvec_rank_distance(meta->metric, query, xnhnsw_node_vec(ctx->node), meta->dim);
+            if (w->count < ef || dist < w->dists[0]) {
+                struct xnhnswcand cand = { .ref = ref, .list = xnhnsw_node_lists(ctx->node)[level], .dist = dist };
+                xn_ensure(xnhnsw_heap_push(ctx, cand));
+                xnvtopk_push(w, ref, dist);
+            }
+        }
+    }
+
+    xnvtopk_sort(w);
+    return xn_ok();
+}
+
+//heuristic from the HNSW paper: a candidate is kept only if it is closer to the base than to every neighbor already
+//kept, which spreads neighbors in different directions.  Remaining slots go to the closest skipped candidates.
+//refs and dists are sorted closest first and are overwritten with the selection
+static xnresult_t xnhnsw_select(struct xnhnsw *hnsw, struct xnhnswctx *ctx, uint64_t *refs, float *dists, int count, int max, int *out_count) {
+    xnmm_init();
+
+    struct xnhnswmeta *meta = ctx->meta;
+    int kept = 0;
+    int skipped = 0;
+    uint64_t skipped_refs[count];
+    float skipped_dists[count];
+    for (int i = 0; i < count && kept < max; i++) {
+        xn_ensure(xnhnsw_read_node(hnsw, meta, refs[i], ctx->node));
+        float *vec = ctx->sel_vecs + (size_t)kept * meta->dim;
+        memcpy(vec, xnhnsw_node_vec(ctx->node), meta->dim * sizeof(float));
+
+        bool good = true;
+        for (int j = 0; j < kept && good; j++)
+            good = xnvec_rank_distance(meta->metric, vec, ctx->sel_vecs + (size_t)j * meta->dim, meta->dim) >= dists[i];
+
+        if (good) {
+            refs[kept] = refs[i];
+            dists[kept] = dists[i];
+            kept++;
+        } else {
+            skipped_refs[skipped] = refs[i];
+            skipped_dists[skipped] = dists[i];
+            skipped++;
+        }
+    }
+
+    for (int i = 0; i < skipped && kept < max; i++) {
+        refs[kept] = skipped_refs[i];
+        dists[kept] = skipped_dists[i];
+        kept++;
+    }
+
+    *out_count = kept;
+    return xn_ok();
+}
+
+//adds node to the neighbors of base on level.  A full list is pruned back down with the selection heuristic
+static xnresult_t xnhnsw_link(struct xnhnsw *hnsw, struct xnhnswctx *ctx, uint64_t base, uint64_t node, int level) {
+    xnmm_init();
+
+    struct xnhnswmeta *meta = ctx->meta;
+    int max = xnhnsw_max_neighbors(meta, level);
+    xn_ensure(xnhnsw_read_node(hnsw, meta, base, ctx->node));
+    uint64_t list_ref = xnhnsw_node_lists(ctx->node)[level];
+    xnmm_scoped_alloc(scoped_base_vec, xn_free, xn_malloc, &scoped_base_vec, meta->dim * sizeof(float));
+    float *base_vec = (float*)scoped_base_vec;
+    memcpy(base_vec, xnhnsw_node_vec(ctx->node), meta->dim * sizeof(float));
+
+    xn_ensure(xnhnsw_read_list(hnsw, meta, list_ref, ctx->list));
+    int count = (int)ctx->list[0];
+    if (count < max) {
+        ctx->list[1 + count] = node;
+        ctx->list[0] = count + 1;
+        xn_ensure(xnhnsw_write_list(hnsw, meta, list_ref, ctx->list));
+        return xn_ok();
+    }
+
+    //sort the old neighbors and the new node by distance to base, then select
+    int n = 0;
+    for (int i = 0; i <= count; i++) {
+        uint64_t ref = i < count ? ctx->list[1 + i] : node;
+        xn_ensure(xnhnsw_read_node(hnsw, meta, ref, ctx->node));
+        float dist = xnvec_rank_distance(meta->metric, base_vec, xnhnsw_node_vec(ctx->node), meta->dim);
+        int j = n++;
+        while (j > 0 && ctx->sel_dists[j - 1] > dist) {
+            ctx->sel_refs[j] = ctx->sel_refs[j - 1];
+            ctx->sel_dists[j] = ctx->sel_dists[j - 1];
+            j--;
+        }
+        ctx->sel_refs[j] = ref;
+        ctx->sel_dists[j] = dist;
+    }
+
+    int kept;
+    xn_ensure(xnhnsw_select(hnsw, ctx, ctx->sel_refs, ctx->sel_dists, n, max, &kept));
+    ctx->list[0] = kept;
+    memcpy(ctx->list + 1, ctx->sel_refs, kept * sizeof(uint64_t));
+    xn_ensure(xnhnsw_write_list(hnsw, meta, list_ref, ctx->list));
+    return xn_ok();
+}
+
+//levels are drawn from an exponential distribution so each level up holds about 1 / m as many nodes
+static int xnhnsw_random_level(struct xnhnswmeta *meta) {
+    unsigned int seed = (unsigned int)(meta->count * 2654435761u + 1);
+    double u = ((double)rand_r(&seed) + 1.0) / ((double)RAND_MAX + 1.0);
+    int level = (int)(-log(u) / log((double)meta->m));
+    return level > XNHNSW_MAX_LEVEL ? XNHNSW_MAX_LEVEL : level;
+}
+
+static xnresult_t xnhnsw_insert(struct xnhnsw *hnsw, struct xnhnswctx *ctx, uint64_t id, const float *vec) {
+    xnmm_init();
+
+    struct xnhnswmeta *meta = ctx->meta;
+    int level = xnhnsw_random_level(meta);
+
+    //empty neighbor lists first, so the node item can hold their references
+    memset(ctx->list, 0, xnhnsw_list_size(meta, 0));
+    uint8_t *node = ctx->node;
+    struct xnhnswnode hdr = { .id = id, .level = level, .unused = 0 };
+    memcpy(node, &hdr, sizeof(struct xnhnswnode));
+    for (int l = 0; l <= level; l++)
+        xn_ensure(xnhnsw_append(hnsw, meta, (uint8_t*)ctx->list, xnhnsw_list_size(meta, l), l, &xnhnsw_node_lists(node)[l]));
+    memcpy(xnhnsw_node_vec(node), vec, meta->dim * sizeof(float));
+    uint64_t ref;
+    xn_ensure(xnhnsw_append(hnsw, meta, node, xnhnsw_node_size(meta, level), level, &ref));
+
+    xnmm_scoped_alloc(scoped_lists, xn_free, xn_malloc, &scoped_lists, (level + 1) * sizeof(uint64_t));
+    uint64_t *lists = (uint64_t*)scoped_lists;
+    memcpy(lists, xnhnsw_node_lists(node), (level + 1) * sizeof(uint64_t));
+
+    if (meta->entry == 0) {
+        meta->entry = ref;
+        meta->max_level = level;
+        return xn_ok();
+    }
+
+    //greedy descent through the levels above the new node's
+    struct xnvtopk w;
+    ctx->eps[0] = meta->entry;
+    int ep_count = 1;
+    for (int l = meta->max_level; l > level; l--) {
+        xn_ensure(xnhnsw_search_level(hnsw, ctx, vec, l, ctx->eps, ep_count, 1, &w));
+        ctx->eps[0] = w.ids[0];
+    }
+
+    int top = level < (int)meta->max_level ? level : (int)meta->max_level;
+    for (int l = top; l >= 0; l--) {
+        xn_ensure(xnhnsw_search_level(hnsw, ctx, vec, l, ctx->eps, ep_count, meta->ef_construction, &w));
+        ep_count = w.count;
+        memcpy(ctx->eps, w.ids, w.count * sizeof(uint64_t));
+
+        int n = w.count < 2 * (int)meta->m + 1 ? w.count : 2 * (int)meta->m + 1;
+        memcpy(ctx->sel_refs, w.ids, n * sizeof(uint64_t));
+        memcpy(ctx->sel_dists, w.dists, n * sizeof(float));
+        int kept;
+        xn_ensure(xnhnsw_select(hnsw, ctx, ctx->sel_refs, ctx->sel_dists, n, meta->m, &kept));
+
+        //xnhnsw_link reuses the selection buffers
+        uint64_t neighbors[kept];
+        memcpy(neighbors, ctx->sel_refs, kept * sizeof(uint64_t));
+        memset(ctx->list, 0, xnhnsw_list_size(meta, l));
+        ctx->list[0] = kept;
+        memcpy(ctx->list + 1, neighbors, kept * sizeof(uint64_t));
+        xn_ensure(xnhnsw_write_list(hnsw, meta, lists[l], ctx->list));
+        for (int i = 0; i < kept; i++)
+            xn_ensure(xnhnsw_link(hnsw, ctx, neighbors[i], ref, l));
+    }
+
+    if (level > (int)meta->max_level) {
+        meta->entry = ref;
+        meta->max_level = level;
+    }
+    return xn_ok();
+}
+
+//adds count vectors to the graph.  Every insert updates the metadata page, so concurrent write transactions on the
+//same graph conflict and only the first to commit succeeds
+xnresult_t xnhnsw_put(struct xnhnsw *hnsw, int count, const uint64_t *ids, const float *vecs) {
+    xnmm_init();
+
+    struct xnhnswmeta meta;
+    xn_ensure(xnhnsw_read_meta(hnsw, &meta));
+    xn_ensure(meta.initialized);
+
+    xnmm_scoped_alloc(scoped_ctx, xnhnsw_ctx_free, xnhnsw_ctx_create, &scoped_ctx, &meta, meta.ef_construction);
+    struct xnhnswctx *ctx = (struct xnhnswctx*)scoped_ctx;
+    for (int i = 0; i < count; i++) {
+        xn_ensure(xnhnsw_insert(hnsw, ctx, ids[i], vecs + (size_t)i * meta.dim));
+        meta.count++;
+    }
+
+    xn_ensure(xnpg_write(&hnsw->meta, hnsw->tx, (uint8_t*)&meta, 0, sizeof(struct xnhnswmeta), true));
+    return xn_ok();
+}
+
+//returns the k closest vectors found, closest first, keeping ef candidates on the bottom level.  Larger ef raises
+//recall and costs time.  Searches only read, so any number can run at once from read transactions
+xnresult_t xnhnsw_search(struct xnhnsw *hnsw, const float *query, int k, int ef, uint64_t *out_ids, float *out_dists, int *out_count) {
+    xnmm_init();
+
+    struct xnhnswmeta meta;
+    xn_ensure(xnhnsw_read_meta(hnsw, &meta));
+    xn_ensure(meta.initialized);
+    xn_ensure(k > 0);
+    if (ef < k)
+        ef = k;
+
+    *out_count = 0;
+    if (meta.entry == 0)
+        return xn_ok();
+
+    xnmm_scoped_alloc(scoped_ctx, xnhnsw_ctx_free, xnhnsw_ctx_create, &scoped_ctx, &meta, ef);
+    struct xnhnswctx *ctx = (struct xnhnswctx*)scoped_ctx;
+
+    struct xnvtopk w;
+    ctx->eps[0] = meta.entry;
+    for (int l = meta.max_level; l > 0; l--) {
+        xn_ensure(xnhnsw_search_level(hnsw, ctx, query, l, ctx->eps, 1, 1, &w));
+        ctx->eps[0] = w.ids[0];
+    }
+    xn_ensure(xnhnsw_search_level(hnsw, ctx, query, 0, ctx->eps, 1, ef, &w));
+
+    int n = w.count < k ? w.count : k;
+    for (int i = 0; i < n; i++) {
+        xn_ensure(xnhnsw_read_node(hnsw, &meta, w.ids[i], ctx->node));
+        out_ids[i] = ((struct xnhnswnode*)ctx->node)->id;
+        out_dists[i] = xnvec_rank_to_distance(meta.metric, w.dists[i]);
+    }
+    *out_count = n;
+    return xn_ok();
+}
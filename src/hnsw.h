@@ -0,0 +1,26 @@
+#pragma once
+
+#include "file.h"
+#include "page.h"
+#include "util.h"
+#include "tx.h"
+#include "container.h"
+#include "vector.h"
+
+struct xnhnswopts {
+    int dim;
+    int m;                  //neighbors per node on upper levels.  Level 0 keeps twice as many
+    int ef_construction;    //candidates considered when picking the neighbors of a new node
+    enum xnvmetric metric;
+};
+
+struct xnhnsw {
+    struct xnpg meta;
+    struct xntx *tx;
+};
+
+struct xnhnswopts xnhnsw_default_opts(int dim);
+xnresult_t xnhnsw_open(struct xnhnsw *hnsw, struct xnfile *file, bool create, struct xntx *tx);
+xnresult_t xnhnsw_init(struct xnhnsw *hnsw, struct xnhnswopts opts);
+xnresult_t xnhnsw_put(struct xnhnsw *hnsw, int count, const uint64_t *ids, const float *vecs);
+xnresult_t xnhnsw_search(struct xnhnsw *hnsw, const float *query, int k, int ef, uint64_t *out_ids, float *out_dists, int *out_count);
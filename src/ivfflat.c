@@ -0,0 +1,514 @@
+#include "ivfflat.h"
+
+#include <stddef.h>
+#include <string.h>
+
+//posting pages are containers chained through the unused part of the container header
+#define XNIVF_NEXT_OFF 8
+
+//page indices per run index page, after the index of the next index page
+#define XNIVF_RUN_ENTRIES (XNPG_SZ / sizeof(uint64_t) - 1)
+
+//start of the metadata page
+struct xnivfmeta {
+    uint32_t dim;
+    uint32_t nlist;
+    uint32_t metric;
+    uint32_t trained;
+    uint64_t count;
+    uint64_t centroid_page;     //first index page of the run holding nlist * dim floats
+    uint64_t list_page;         //first index page of the run holding nlist list entries
+    uint32_t pq_m;              //bytes per product quantization code, 0 when vectors are stored as floats
+    uint32_t unused;
+    uint64_t codebook_page;     //first index page of the run holding the PQ codebooks
+};
+
+//a posting list.  head is 0 until the first vector is added
+struct xnivflist {
+    uint64_t head;
+    uint64_t tail;
+    uint64_t count;
+};
+
+#define XNIVF_LISTS_PER_PAGE (XNPG_SZ / sizeof(struct xnivflist))
+
+//posting entries are a uint64_t id followed by the vector, or by its PQ code
+static inline size_t xnivf_payload_size(int dim, int pq_m) {
+    return pq_m > 0 ? (size_t)pq_m : dim * sizeof(float);
+}
+
+static inline size_t xnivf_entry_size(int dim, int pq_m) {
+    return sizeof(uint64_t) + xnivf_payload_size(dim, pq_m);
+}
+
+struct xnivfopts xnivf_default_opts(int dim, int nlist) {
+    struct xnivfopts opts = {
+        .dim = dim,
+        .nlist = nlist,
+        .metric = XNVM_L2,
+        .iterations = 20,
+        .threads = 0,
+        .pq_m = 0,
+    };
+    return opts;
+}
+
+static xnresult_t xnivf_read_meta(struct xnivfflat *ivf, struct xnivfmeta *meta) {
+    xnmm_init();
+    xn_ensure(xnpg_read(&ivf->meta, ivf->tx, (uint8_t*)meta, 0, sizeof(struct xnivfmeta)));
+    return xn_ok();
+}
+
+//a run is a chain of index pages.  Each holds the index of the next one (0 on the last) followed by up to
+//XNIVF_RUN_ENTRIES page indices, so the pages of a run can be anywhere in the file.  Allocates the pages for size
+//bytes and writes buf to them, or leaves them zeroed if buf is NULL
+static xnresult_t xnivf_write_run(struct xnivfflat *ivf, const uint8_t *buf, size_t size, uint64_t *out_index) {
+    xnmm_init();
+    xnmm_scoped_alloc(scoped_ptr, xn_free, xn_malloc, &scoped_ptr, XNPG_SZ);
+    uint64_t *entries = (uint64_t*)scoped_ptr;
+
+    struct xnpg index;
+    xn_ensure(xnfile_allocate_page(ivf->meta.file_handle, ivf->tx, &index));
+    *out_index = index.idx;
+
+    size_t off = 0;
+    do {
+        memset(entries, 0, XNPG_SZ);
+        for (size_t i = 1; i <= XNIVF_RUN_ENTRIES && off < size; i++, off += XNPG_SZ) {
+            struct xnpg page;
+            xn_ensure(xnfile_allocate_page(ivf->meta.file_handle, ivf->tx, &page));
+            entries[i] = page.idx;
+            size_t len = size - off < XNPG_SZ ? size - off : XNPG_SZ;
+            if (buf)
+                xn_ensure(xnpg_write(&page, ivf->tx, buf + off, 0, len, true));
+        }
+
+        struct xnpg next = { .file_handle = ivf->meta.file_handle, .idx = 0 };
+        if (off < size)
+            xn_ensure(xnfile_allocate_page(ivf->meta.file_handle, ivf->tx, &next));
+        entries[0] = next.idx;
+        xn_ensure(xnpg_write(&index, ivf->tx, (uint8_t*)entries, 0, XNPG_SZ, true));
+        index = next;
+    } while (off < size);
+
+    return xn_ok();
+}
+
+static xnresult_t xnivf_read_run(struct xnivfflat *ivf, uint64_t first_index, uint8_t *buf, size_t size) {
+    xnmm_init();
+    xnmm_scoped_alloc(scoped_ptr, xn_free, xn_malloc, &scoped_ptr, XNPG_SZ);
+    uint64_t *entries = (uint64_t*)scoped_ptr;
+
+    struct xnpg index = { .file_handle = ivf->meta.file_handle, .idx = first_index };
+    size_t off = 0;
+    while (off < size) {
+        xn_ensure(index.idx != 0);
+        xn_ensure(xnpg_read(&index, ivf->tx, (uint8_t*)entries, 0, XNPG_SZ));
+        for (size_t i = 1; i <= XNIVF_RUN_ENTRIES && off < size; i++, off += XNPG_SZ) {
+            struct xnpg page = { .file_handle = ivf->meta.file_handle, .idx = entries[i] };
+            size_t len = size - off < XNPG_SZ ? size - off : XNPG_SZ;
+            xn_ensure(xnpg_read(&page, ivf->tx, buf + off, 0, len));
+        }
+        index.idx = entries[0];
+    }
+    return xn_ok();
+}
+
+//looks up page n of the run.  Runs longer than one index page are only walked this way for list entries, and
+//those need nlist above 86000 before a second index page is used
+static xnresult_t xnivf_run_page(struct xnivfflat *ivf, uint64_t first_index, uint64_t n, struct xnpg *out_page) {
+    xnmm_init();
+    struct xnpg index = { .file_handle = ivf->meta.file_handle, .idx = first_index };
+    for (uint64_t i = 0; i < n / XNIVF_RUN_ENTRIES; i++) {
+        xn_ensure(xnpg_read(&index, ivf->tx, (uint8_t*)&index.idx, 0, sizeof(uint64_t)));
+        xn_ensure(index.idx != 0);
+    }
+
+    out_page->file_handle = ivf->meta.file_handle;
+    xn_ensure(xnpg_read(&index, ivf->tx, (uint8_t*)&out_page->idx, (1 + n % XNIVF_RUN_ENTRIES) * sizeof(uint64_t), sizeof(uint64_t)));
+    xn_ensure(out_page->idx != 0);
+    return xn_ok();
+}
+
+static xnresult_t xnivf_read_list(struct xnivfflat *ivf, struct xnivfmeta *meta, int list, struct xnivflist *out) {
+    xnmm_init();
+    struct xnpg page;
+    xn_ensure(xnivf_run_page(ivf, meta->list_page, list / XNIVF_LISTS_PER_PAGE, &page));
+    xn_ensure(xnpg_read(&page, ivf->tx, (uint8_t*)out, (list % XNIVF_LISTS_PER_PAGE) * sizeof(struct xnivflist), sizeof(struct xnivflist)));
+    return xn_ok();
+}
+
+static xnresult_t xnivf_write_list(struct xnivfflat *ivf, struct xnivfmeta *meta, int list, struct xnivflist *l) {
+    xnmm_init();
+    struct xnpg page;
+    xn_ensure(xnivf_run_page(ivf, meta->list_page, list / XNIVF_LISTS_PER_PAGE, &page));
+    xn_ensure(xnpg_write(&page, ivf->tx, (uint8_t*)l, (list % XNIVF_LISTS_PER_PAGE) * sizeof(struct xnivflist), sizeof(struct xnivflist), true));
+    return xn_ok();
+}
+
+xnresult_t xnivf_open(struct xnivfflat *ivf, struct xnfile *file, bool create, struct xntx *tx) {
+    xnmm_init();
+
+    ivf->meta.file_handle = file;
+    ivf->meta.idx = 1; //hard-coding metadata page
+    ivf->tx = tx;
+
+    //an untrained index is all zeroes, which the fresh metadata page already is
+    if (create) {
+        xn_ensure(xnfile_set_size(file, XNPG_SZ * 32));
+        xn_ensure(xnfile_init(file, tx));
+
+        struct xnpg meta_page;
+        xn_ensure(xnfile_allocate_page(file, tx, &meta_page));
+        xn_ensure(meta_page.idx == ivf->meta.idx);
+    }
+
+    return xn_ok();
+}
+
+//PQ codes the residual from each vector to its centroid, which varies much less than the vectors do
+static xnresult_t xnivf_train_pq(struct xnivfflat *ivf, struct xnivfopts opts, const float *sample, int count, const float *centroids,
+                                 struct xnivfmeta *meta) {
+    xnmm_init();
+
+    xnmm_scoped_alloc(scoped_residuals, xn_free, xn_malloc, &scoped_residuals, (size_t)count * opts.dim * sizeof(float));
+    float *residuals = (float*)scoped_residuals;
+    for (int i = 0; i < count; i++) {
+        const float *v = sample + (size_t)i * opts.dim;
+        const float *c = centroids + (size_t)xnvec_nearest(opts.metric, v, centroids, opts.nlist, opts.dim) * opts.dim;
+        for (int d = 0; d < opts.dim; d++)
+            residuals[(size_t)i * opts.dim + d] = v[d] - c[d];
+    }
+
+    size_t codebooks_size = xnpq_codebooks_size(opts.dim);
+    xnmm_scoped_alloc(scoped_codebooks, xn_free, xn_malloc, &scoped_codebooks, codebooks_size);
+    struct xnpq pq;
+    xn_ensure(xnpq_init(&pq, opts.dim, opts.pq_m, (float*)scoped_codebooks));
+    xn_ensure(xnpq_train(&pq, residuals, count, opts.threads));
+
+    meta->pq_m = opts.pq_m;
+    xn_ensure(xnivf_write_run(ivf, (uint8_t*)scoped_codebooks, codebooks_size, &meta->codebook_page));
+    return xn_ok();
+}
+
+static xnresult_t xnivf_train_sample(struct xnivfflat *ivf, struct xnivfopts opts, const float *sample, int count) {
+    xnmm_init();
+
+    struct xnivfmeta meta;
+    xn_ensure(xnivf_read_meta(ivf, &meta));
+    xn_ensure(!meta.trained);
+    xn_ensure(opts.dim > 0 && opts.nlist > 0 && count >= opts.nlist);
+    //each posting entry has to fit in one container along with its slot
+    xn_ensure(xnivf_entry_size(opts.dim, opts.pq_m) + sizeof(uint32_t) <= XNPG_SZ - XNCTN_HDR_SZ);
+
+    size_t centroids_size = (size_t)opts.nlist * opts.dim * sizeof(float);
+    xnmm_scoped_alloc(scoped_ptr, xn_free, xn_malloc, &scoped_ptr, centroids_size);
+    float *centroids = (float*)scoped_ptr;
+    struct xnkmopts kmopts = xnvec_kmeans_default_opts(opts.nlist);
+    kmopts.iterations = opts.iterations;
+    kmopts.metric = opts.metric;
+    kmopts.threads = opts.threads;
+    xn_ensure(xnvec_kmeans(sample, count, opts.dim, kmopts, centroids, NULL));
+
+    meta.dim = opts.dim;
+    meta.nlist = opts.nlist;
+    meta.metric = opts.metric;
+    meta.trained = 1;
+    meta.count = 0;
+
+    xn_ensure(xnivf_write_run(ivf, (uint8_t*)centroids, centroids_size, &meta.centroid_page));
+
+    //new pages are zeroed by xnfile_allocate_page, so every list starts empty
+    xn_ensure(xnivf_write_run(ivf, NULL, (size_t)opts.nlist * sizeof(struct xnivflist), &meta.list_page));
+
+    if (opts.pq_m > 0)
+        xn_ensure(xnivf_train_pq(ivf, opts, sample, count, centroids, &meta));
+
+    xn_ensure(xnpg_write(&ivf->meta, ivf->tx, (uint8_t*)&meta, 0, sizeof(struct xnivfmeta), true));
+    return xn_ok();
+}
+
+//clusters the sample with k-means and stores the centroids with an empty posting list for each.  With opts.pq_m
+//set, a product quantizer is also trained on the residuals and vectors are stored as pq_m byte codes.  PQ
+//indexes using cosine distance work on normalized vectors.  An index is trained once, before any vectors are added
+xnresult_t xnivf_train(struct xnivfflat *ivf, struct xnivfopts opts, const float *sample, int count) {
+    xnmm_init();
+    xn_ensure(opts.pq_m >= 0);
+    xn_ensure(opts.pq_m == 0 || (opts.dim % opts.pq_m == 0 && count >= XNPQ_KSUB));
+
+    if (opts.pq_m == 0 || opts.metric != XNVM_COSINE) {
+        xn_ensure(xnivf_train_sample(ivf, opts, sample, count));
+        return xn_ok();
+    }
+
+    xnmm_scoped_alloc(scoped_normed, xn_free, xn_malloc, &scoped_normed, (size_t)count * opts.dim * sizeof(float));
+    float *normed = (float*)scoped_normed;
+    memcpy(normed, sample, (size_t)count * opts.dim * sizeof(float));
+    for (int i = 0; i < count; i++)
+        xnvec_normalize(normed + (size_t)i * opts.dim, opts.dim);
+    xn_ensure(xnivf_train_sample(ivf, opts, normed, count));
+    return xn_ok();
+}
+
+static xnresult_t xnivf_read_centroids(struct xnivfflat *ivf, struct xnivfmeta *meta, float *centroids) {
+    xnmm_init();
+    xn_ensure(xnivf_read_run(ivf, meta->centroid_page, (uint8_t*)centroids, (size_t)meta->nlist * meta->dim * sizeof(float)));
+    return xn_ok();
+}
+
+static xnresult_t xnivf_read_pq(struct xnivfflat *ivf, struct xnivfmeta *meta, float *codebooks, struct xnpq *pq) {
+    xnmm_init();
+    xn_ensure(xnivf_read_run(ivf, meta->codebook_page, (uint8_t*)codebooks, xnpq_codebooks_size(meta->dim)));
+    xn_ensure(xnpq_init(pq, meta->dim, meta->pq_m, codebooks));
+    return xn_ok();
+}
+
+//appends to the tail container of the list, chaining on a new container when the tail is full
+static xnresult_t xnivf_list_append(struct xnivfflat *ivf, struct xnivfmeta *meta, int list, const uint8_t *entry, size_t size) {
+    xnmm_init();
+
+    struct xnivflist l;
+    xn_ensure(xnivf_read_list(ivf, meta, list, &l));
+
+    struct xnctn ctn;
+    bool can_fit = false;
+    if (l.tail != 0) {
+        struct xnpg tail = { .file_handle = ivf->meta.file_handle, .idx = l.tail };
+        xn_ensure(xnctn_open(&ctn, tail, ivf->tx));
+        xn_ensure(xnctn_can_fit(&ctn, size, &can_fit));
+    }
+
+    if (!can_fit) {
+        struct xnpg page;
+        xn_ensure(xnfile_allocate_page(ivf->meta.file_handle, ivf->tx, &page));
+        xn_ensure(xnctn_open(&ctn, page, ivf->tx));
+        xn_ensure(xnctn_init(&ctn));
+        if (l.tail != 0) {
+            struct xnpg tail = { .file_handle = ivf->meta.file_handle, .idx = l.tail };
+            xn_ensure(xnpg_write(&tail, ivf->tx, (uint8_t*)&page.idx, XNIVF_NEXT_OFF, sizeof(uint64_t), true));
+        } else {
+            l.head = page.idx;
+        }
+        l.tail = page.idx;
+    }
+
+    struct xnitemid id;
+    xn_ensure(xnctn_insert(&ctn, entry, size, &id));
+    l.count++;
+    xn_ensure(xnivf_write_list(ivf, meta, list, &l));
+    return xn_ok();
+}
+
+static xnresult_t xnivf_put_pq(struct xnivfflat *ivf, struct xnivfmeta *meta, const float *centroids, int count, const uint64_t *ids,
+                               const float *vecs) {
+    xnmm_init();
+
+    xnmm_scoped_alloc(scoped_codebooks, xn_free, xn_malloc, &scoped_codebooks, xnpq_codebooks_size(meta->dim));
+    struct xnpq pq;
+    xn_ensure(xnivf_read_pq(ivf, meta, (float*)scoped_codebooks, &pq));
+
+    xnmm_scoped_alloc(scoped_vec, xn_free, xn_malloc, &scoped_vec, 2 * meta->dim * sizeof(float));
+    float *v = (float*)scoped_vec;
+    float *residual = v + meta->dim;
+    size_t size = xnivf_entry_size(meta->dim, meta->pq_m);
+    xnmm_scoped_alloc(scoped_entry, xn_free, xn_malloc, &scoped_entry, size);
+    uint8_t *entry = (uint8_t*)scoped_entry;
+
+    for (int i = 0; i < count; i++) {
+        memcpy(v, vecs + (size_t)i * meta->dim, meta->dim * sizeof(float));
+        if (meta->metric == XNVM_COSINE)
+            xnvec_normalize(v, meta->dim);
+        int list = xnvec_nearest(meta->metric, v, centroids, meta->nlist, meta->dim);
+        const float *c = centroids + (size_t)list * meta->dim;
+        for (int d = 0; d < meta->dim; d++)
+            residual[d] = v[d] - c[d];
+        memcpy(entry, &ids[i], sizeof(uint64_t));
+        xnpq_encode(&pq, residual, 1, entry + sizeof(uint64_t));
+        xn_ensure(xnivf_list_append(ivf, meta, list, entry, size));
+    }
+
+    return xn_ok();
+}
+
+//adds count vectors, each to the posting list of its nearest centroid.  Centroids are read once per call,
+//so bulk loads should pass many vectors at a time
+xnresult_t xnivf_put(struct xnivfflat *ivf, int count, const uint64_t *ids, const float *vecs) {
+    xnmm_init();
+
+    struct xnivfmeta meta;
+    xn_ensure(xnivf_read_meta(ivf, &meta));
+    xn_ensure(meta.trained);
+
+    xnmm_scoped_alloc(scoped_centroids, xn_free, xn_malloc, &scoped_centroids, (size_t)meta.nlist * meta.dim * sizeof(float));
+    float *centroids = (float*)scoped_centroids;
+    xn_ensure(xnivf_read_centroids(ivf, &meta, centroids));
+
+    if (meta.pq_m > 0) {
+        xn_ensure(xnivf_put_pq(ivf, &meta, centroids, count, ids, vecs));
+    } else {
+        size_t size = xnivf_entry_size(meta.dim, 0);
+        xnmm_scoped_alloc(scoped_entry, xn_free, xn_malloc, &scoped_entry, size);
+        uint8_t *entry = (uint8_t*)scoped_entry;
+
+        for (int i = 0; i < count; i++) {
+            const float *v = vecs + (size_t)i * meta.dim;
+            int list = xnvec_nearest(meta.metric, v, centroids, meta.nlist, meta.dim);
+            memcpy(entry, &ids[i], sizeof(uint64_t));
+            memcpy(entry + sizeof(uint64_t), v, meta.dim * sizeof(float));
+            xn_ensure(xnivf_list_append(ivf, &meta, list, entry, size));
+        }
+    }
+
+    meta.count += count;
+    xn_ensure(xnpg_write(&ivf->meta, ivf->tx, (uint8_t*)&meta.count, offsetof(struct xnivfmeta, count), sizeof(uint64_t), true));
+    return xn_ok();
+}
+
+//entries from a posting list are gathered into blocks of XNVEC_BLOCK and ranked a block at a time.  data holds
+//the vectors or PQ codes back to back
+struct xnivfblock {
+    uint8_t *entry;
+    uint64_t *ids;
+    uint8_t *data;
+    int count;
+};
+
+//what a list is ranked against.  PQ lists use a distance table and add offset to every distance
+struct xnivfprobe {
+    const float *query;
+    const float *table;
+    float offset;
+};
+
+static void xnivf_flush_block(struct xnivfmeta *meta, struct xnivfprobe *probe, struct xnivfblock *block, struct xnvtopk *topk) {
+    if (meta->pq_m == 0) {
+        xnvec_topk_block(meta->metric, probe->query, (float*)block->data, block->ids, block->count, meta->dim, topk);
+    } else {
+        float dists[XNVEC_BLOCK];
+        xnpq_adc(probe->table, meta->pq_m, block->data, block->count, dists);
+        for (int i = 0; i < block->count; i++)
+            xnvtopk_push(topk, block->ids[i], dists[i] + probe->offset);
+    }
+    block->count = 0;
+}
+
+static xnresult_t xnivf_scan_list(struct xnivfflat *ivf, struct xnivfmeta *meta, int list, struct xnivfprobe *probe, struct xnivfblock *block,
+                                  struct xnvtopk *topk) {
+    xnmm_init();
+
+    struct xnivflist l;
+    xn_ensure(xnivf_read_list(ivf, meta, list, &l));
+
+    size_t size = xnivf_entry_size(meta->dim, meta->pq_m);
+    size_t payload = xnivf_payload_size(meta->dim, meta->pq_m);
+    uint64_t page_idx = l.head;
+    while (page_idx != 0) {
+        struct xnpg page = { .file_handle = ivf->meta.file_handle, .idx = page_idx };
+        struct xnctn ctn;
+        xn_ensure(xnctn_open(&ctn, page, ivf->tx));
+        struct xnctnitr itr;
+        xn_ensure(xnctnitr_init(&itr, ctn));
+
+        bool valid;
+        while (true) {
+            xn_ensure(xnctnitr_next(&itr, &valid));
+            if (!valid)
+                break;
+            struct xnitemid id;
+            xn_ensure(xnctnitr_itemid(&itr, &id));
+            xn_ensure(xnctn_get(&ctn, id, block->entry, size));
+
+            memcpy(&block->ids[block->count], block->entry, sizeof(uint64_t));
+            memcpy(block->data + (size_t)block->count * payload, block->entry + sizeof(uint64_t), payload);
+            if (++block->count == XNVEC_BLOCK)
+                xnivf_flush_block(meta, probe, block, topk);
+        }
+
+        xn_ensure(xnpg_read(&page, ivf->tx, (uint8_t*)&page_idx, XNIVF_NEXT_OFF, sizeof(uint64_t)));
+    }
+
+    xnivf_flush_block(meta, probe, block, topk);
+    return xn_ok();
+}
+
+//codes hold residuals, so L2 needs a table per list for the query's residual to the list centroid.  Inner
+//product splits into q.c plus q.r, so one table serves every list and q.c becomes the offset
+static xnresult_t xnivf_search_pq(struct xnivfflat *ivf, struct xnivfmeta *meta, const float *centroids, const float *query,
+                                  struct xnvtopk *lists, struct xnivfblock *block, struct xnvtopk *topk) {
+    xnmm_init();
+
+    xnmm_scoped_alloc(scoped_codebooks, xn_free, xn_malloc, &scoped_codebooks, xnpq_codebooks_size(meta->dim));
+    struct xnpq pq;
+    xn_ensure(xnivf_read_pq(ivf, meta, (float*)scoped_codebooks, &pq));
+    xnmm_scoped_alloc(scoped_table, xn_free, xn_malloc, &scoped_table, (size_t)meta->pq_m * XNPQ_KSUB * sizeof(float));
+    float *table = (float*)scoped_table;
+    xnmm_scoped_alloc(scoped_query, xn_free, xn_malloc, &scoped_query, 2 * meta->dim * sizeof(float));
+    float *q = (float*)scoped_query;
+    float *residual = q + meta->dim;
+
+    memcpy(q, query, meta->dim * sizeof(float));
+    if (meta->metric == XNVM_COSINE)
+        xnvec_normalize(q, meta->dim);
+    if (meta->metric != XNVM_L2)
+        xnpq_table(&pq, meta->metric, q, table);
+
+    for (int i = 0; i < lists->count; i++) {
+        const float *c = centroids + (size_t)lists->ids[i] * meta->dim;
+        struct xnivfprobe probe = { .query = q, .table = table, .offset = 0.0f };
+        if (meta->metric == XNVM_L2) {
+            for (int d = 0; d < meta->dim; d++)
+                residual[d] = q[d] - c[d];
+            xnpq_table(&pq, meta->metric, residual, table);
+        } else {
+            probe.offset = xnvec_negative_inner_product(q, c, meta->dim) + (meta->metric == XNVM_COSINE ? 1.0f : 0.0f);
+        }
+        xn_ensure(xnivf_scan_list(ivf, meta, lists->ids[i], &probe, block, topk));
+    }
+
+    return xn_ok();
+}
+
+//finds the nprobe lists with the closest centroids and returns the k closest vectors in them, closest first.
+//out_ids and out_dists need room for k results, and out_count is less than k if the probed lists are small.
+//Distances from a PQ index are estimates from the codes
+xnresult_t xnivf_search(struct xnivfflat *ivf, const float *query, int k, int nprobe, uint64_t *out_ids, float *out_dists, int *out_count) {
+    xnmm_init();
+
+    struct xnivfmeta meta;
+    xn_ensure(xnivf_read_meta(ivf, &meta));
+    xn_ensure(meta.trained);
+    xn_ensure(k > 0 && nprobe > 0);
+    if (nprobe > meta.nlist)
+        nprobe = meta.nlist;
+
+    xnmm_scoped_alloc(scoped_centroids, xn_free, xn_malloc, &scoped_centroids, (size_t)meta.nlist * meta.dim * sizeof(float));
+    float *centroids = (float*)scoped_centroids;
+    xn_ensure(xnivf_read_centroids(ivf, &meta, centroids));
+
+    xnmm_scoped_alloc(scoped_list_ids, xn_free, xn_malloc, &scoped_list_ids, nprobe * sizeof(uint64_t));
+    xnmm_scoped_alloc(scoped_list_dists, xn_free, xn_malloc, &scoped_list_dists, nprobe * sizeof(float));
+    struct xnvtopk lists;
+    xnvtopk_init(&lists, nprobe, (uint64_t*)scoped_list_ids, (float*)scoped_list_dists);
+    xnvec_topk_block(meta.metric, query, centroids, NULL, meta.nlist, meta.dim, &lists);
+
+    xnmm_scoped_alloc(scoped_entry, xn_free, xn_malloc, &scoped_entry, xnivf_entry_size(meta.dim, meta.pq_m));
+    xnmm_scoped_alloc(scoped_block_ids, xn_free, xn_malloc, &scoped_block_ids, XNVEC_BLOCK * sizeof(uint64_t));
+    xnmm_scoped_alloc(scoped_block_data, xn_free, xn_malloc, &scoped_block_data, XNVEC_BLOCK * xnivf_payload_size(meta.dim, meta.pq_m));
+    struct xnivfblock block = { .entry = (uint8_t*)scoped_entry, .ids = (uint64_t*)scoped_block_ids, .data = (uint8_t*)scoped_block_data, .count = 0 };
+    struct xnvtopk topk;
+    xnvtopk_init(&topk, k, out_ids, out_dists);
+    if (meta.pq_m > 0) {
+        xn_ensure(xnivf_search_pq(ivf, &meta, centroids, query, &lists, &block, &topk));
+    } else {
+        struct xnivfprobe probe = { .query = query };
+        for (int i = 0; i < lists.count; i++)
+            xn_ensure(xnivf_scan_list(ivf, &meta, lists.ids[i], &probe, &block, &topk));
+    }
+
+    //estimated squared distances can come out slightly negative
+    xnvtopk_sort(&topk);
+    for (int i = 0; i < topk.count; i++)
+        out_dists[i] = xnvec_rank_to_distance(meta.metric, meta.metric == XNVM_L2 && out_dists[i] < 0.0f ? 0.0f : out_dists[i]);
+    *out_count = topk.count;
+    return xn_ok();
+}
@@ -0,0 +1,29 @@
+#pragma once
+
+#include "file.h"
+#include "page.h"
+#include "util.h"
+#include "tx.h"
+#include "container.h"
+#include "vector.h"
+#include "pq.h"
+
+struct xnivfopts {
+    int dim;
+    int nlist;              //number of k-means clusters, each with its own posting list
+    enum xnvmetric metric;
+    int iterations;         //most k-means iterations when training
+    int threads;            //k-means threads, 0 for every online cpu
+    int pq_m;               //stores vectors as pq_m byte PQ codes when set.  Has to divide dim
+};
+
+struct xnivfflat {
+    struct xnpg meta;
+    struct xntx *tx;
+};
+
+struct xnivfopts xnivf_default_opts(int dim, int nlist);
+xnresult_t xnivf_open(struct xnivfflat *ivf, struct xnfile *file, bool create, struct xntx *tx);
+xnresult_t xnivf_train(struct xnivfflat *ivf, struct xnivfopts opts, const float *sample, int count);
+xnresult_t xnivf_put(struct xnivfflat *ivf, int count, const uint64_t *ids, const float *vecs);
+xnresult_t xnivf_search(struct xnivfflat *ivf, const float *query, int k, int nprobe, uint64_t *out_ids, float *out_dists, int *out_count);
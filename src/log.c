@@ -2,16 +2,222 @@
 
 #include <stdlib.h>
 #include <string.h>
+#include <libgen.h>
 
-xnresult_t xnlog_create(struct xnlog **out_log, struct xnfile *file, bool create) {
+static inline uint64_t xnlog_lsn(struct xnlog *log) {
+    return log->page.idx * XNPG_SZ + log->page_off;
+}
+
+static inline uint8_t *xnlog_ring_page(struct xnlog *log, uint64_t page_idx) {
+    return log->buf + (page_idx % log->ring_pages) * XNPG_SZ;
+}
+
+//caller must hold log lock
+static inline bool xnlog_has_full_pages(struct xnlog *log) {
+    return log->flushed_lsn < log->page.idx * XNPG_SZ;
+}
+
+//writes pages [start, end) from the ring, and the staging copy of page end if partial is set, then syncs them.
+//Called without the log lock - only one thread writes at a time (log->flushing), and full pages in the ring are
+//not modified until they are written
+static xnresult_t xnlog_write_pages(struct xnlog *log, uint64_t start, uint64_t end, bool partial) {
+    xnmm_init();
+
+    int count = 0;
+    for (uint64_t idx = start; idx < end; idx++) {
+        log->flush_pages[count].idx = idx;
+        log->flush_pages[count].buf = xnlog_ring_page(log, idx);
+        count++;
+    }
+    if (partial) {
+        log->flush_pages[count].idx = end;
+        log->flush_pages[count].buf = log->staging;
+        count++;
+    }
+
+    xn_ensure(xnfile_writev_sync(log->page.file_handle, log->flush_pages, count));
+    return xn_ok();
+}
+
+//caller must hold log lock, and no other thread may be writing.  Writes all full pages
+//that are not yet durable, and if partial is set the current partial page too.  The lock is
+//released during I/O so appenders only stall if the ring fills up
+static xnresult_t xnlog_write_locked(struct xnlog *log, bool partial) {
+    xnmm_init();
+
+    uint64_t start = log->flushed_lsn / XNPG_SZ;
+    uint64_t end = log->page.idx;
+    uint64_t end_lsn = end * XNPG_SZ;
+    bool write_partial = partial && log->page_off > 0;
+
+    //the current page can change while the lock is released, so write a copy of it
+    if (write_partial) {
+        memcpy(log->staging, xnlog_ring_page(log, end), XNPG_SZ);
+        end_lsn = xnlog_lsn(log);
+    }
+
+    if (end_lsn <= log->flushed_lsn)
+        return xn_ok();
+
+    log->flushing = true;
+    xn_ensure(xn_mutex_unlock(log->lock));
+
+    //the partial page needs room in the file too.  The grower is asked for more room before the log reaches the
+    //end, so the file is usually big enough already
+    struct xnfile *file = log->page.file_handle;
+    uint64_t file_end = write_partial ? end + 1 : end;
+    bool ok = xnfile_grow(file, file_end * XNPG_SZ);
+    ok = ok && xnfile_grow_ahead(file, file_end * XNPG_SZ);
+
+    ok = ok && xnlog_write_pages(log, start, end, write_partial);
+
+    xn_ensure(xn_mutex_lock(log->lock));
+    log->flushing = false;
+    if (ok) {
+        log->flushed_lsn = end_lsn;
+        log->flush_count++;
+    } else {
+        log->failed = true;
+    }
+
+    //wakes committers waiting for durability, appenders waiting for ring space and the writer thread
+    xn_ensure(xn_cond_broadcast(&log->flushed_cv));
+    xn_ensure(xn_cond_signal(&log->writer_cv));
+    xn_ensure(ok);
+    return xn_ok();
+}
+
+//background writer drains full pages so appenders never wait on I/O unless the ring is full
+static void *xnlog_writer(void *arg) {
+    struct xnlog *log = (struct xnlog*)arg;
+
+    if (!xn_mutex_lock(log->lock))
+        return NULL;
+
+    bool ok = true;
+    while (ok && !log->stopping && !log->failed) {
+        if (log->flushing || !xnlog_has_full_pages(log)) {
+            ok = xn_cond_wait(&log->writer_cv, log->lock);
+            continue;
+        }
+
+        ok = xnlog_write_locked(log, false);
+    }
+
+    //appenders waiting for ring space check failed, so they don't wait on a writer that is gone
+    if (!ok)
+        log->failed = true;
+    if (!xn_mutex_unlock(log->lock))
+        log->failed = true;
+    return NULL;
+}
+
+//the checksum of a record is salted with its lsn, so a record read back at any other position fails its check
+static inline uint32_t xnlog_salt(uint64_t lsn) {
+    return (uint32_t)lsn ^ (uint32_t)(lsn >> 32);
+}
+
+static void xnlog_fill_header(uint8_t *buf, uint64_t checkpoint_lsn) {
+    uint32_t version = XNLOG_VERSION;
+    memset(buf, 0, XNPG_SZ);
+    memcpy(buf, &checkpoint_lsn, sizeof(uint64_t));
+    memcpy(buf + sizeof(uint64_t), &version, sizeof(uint32_t));
+}
+
+//a file table entry is a varint file id, a varint name length and the name.  File records hold one entry,
+//and checkpoint records hold one per file after the redo point
+static int xnlog_put_file(uint8_t *buf, uint64_t id, const char *name) {
+    size_t len = strlen(name);
+    int off = xn_varint_put(buf, id);
+    off += xn_varint_put(buf + off, len);
+    memcpy(buf + off, name, len);
+    return off + len;
+}
+
+static xnresult_t xnlog_parse_files(const uint8_t *buf, size_t size, struct xnlogfiles *files) {
+    xnmm_init();
+
+    size_t off = 0;
+    while (off < size) {
+        uint64_t id;
+        uint64_t len;
+        int n;
+        xn_ensure((n = xn_varint_get(buf + off, size - off, &id)) > 0);
+        off += n;
+        xn_ensure((n = xn_varint_get(buf + off, size - off, &len)) > 0);
+        off += n;
+        xn_ensure(id < XNLOG_MAX_FILES && len <= NAME_MAX && off + len <= size);
+
+        memcpy(files->names[id], buf + off, len);
+        files->names[id][len] = '\0';
+        files->named[id] = true;
+        off += len;
+    }
+
+    return xn_ok();
+}
+
+//reads the header page, and the redo point and file table from the checkpoint record it points to
+static xnresult_t xnlog_read_header(struct xnlog *log) {
     xnmm_init();
 
+    xnmm_scoped_alloc(scoped_ptr, xn_free, xn_aligned_malloc, &scoped_ptr, XNPG_SZ);
+    uint8_t *buf = (uint8_t*)scoped_ptr;
+    struct xnpg page = { .file_handle = log->page.file_handle, .idx = 0 };
+    xn_ensure(xnpg_copy(&page, buf));
+    memcpy(&log->checkpoint_lsn, buf, sizeof(uint64_t));
+
+    //logs written in another format can't be read
+    uint32_t version;
+    memcpy(&version, buf + sizeof(uint64_t), sizeof(uint32_t));
+    xn_ensure(version == XNLOG_VERSION);
+
+    log->redo_lsn = XNLOG_FIRST_LSN;
+    log->reclaimed_lsn = XNLOG_FIRST_LSN;
+    if (log->checkpoint_lsn == 0)
+        return xn_ok();
+
+    xnmm_scoped_alloc(scoped_itr, xnlogitr_free, xnlogitr_create, (struct xnlogitr**)&scoped_itr, log);
+    struct xnlogitr *itr = (struct xnlogitr*)scoped_itr;
+    xn_ensure(xnlogitr_seek(itr, log->checkpoint_lsn / XNPG_SZ, log->checkpoint_lsn % XNPG_SZ));
+
+    int tx_id;
+    enum xnlogt type;
+    size_t data_size;
+    xn_ensure(xnlogitr_read_header(itr, &tx_id, &type, &data_size));
+    xn_ensure(type == XNLOGT_CHECKPOINT);
+
+    xnmm_scoped_alloc(scoped_data, xn_free, xn_malloc, &scoped_data, data_size);
+    uint8_t *data = (uint8_t*)scoped_data;
+    xn_ensure(xnlogitr_read_data(itr, data, data_size));
+    int n;
+    xn_ensure((n = xn_varint_get(data, data_size, &log->redo_lsn)) > 0);
+    xn_ensure(xnlog_parse_files(data + n, data_size - n, &log->redo_files));
+
+    return xn_ok();
+}
+
+xnresult_t xnlog_create(struct xnlog **out_log, struct xnfile *file, bool create, int ring_pages) {
+    xnmm_init();
+    xn_ensure(ring_pages > 1);
+
     struct xnlog *log;
     xnmm_alloc(xn_free, xn_malloc, (void**)&log, sizeof(struct xnlog));
 
     log->page.file_handle = file;
+    memset(&log->files, 0, sizeof(struct xnlogfiles));
+    memset(&log->redo_files, 0, sizeof(struct xnlogfiles));
+
+    //a new log gets a header with no checkpoint
+    if (create) {
+        xnmm_scoped_alloc(scoped_ptr, xn_free, xn_aligned_malloc, &scoped_ptr, XNPG_SZ);
+        xnlog_fill_header((uint8_t*)scoped_ptr, 0);
+        struct xnfileiov page = { .idx = 0, .buf = (uint8_t*)scoped_ptr };
+        xn_ensure(xnfile_writev_sync(file, &page, 1));
+    }
+    xn_ensure(xnlog_read_header(log));
 
-    //find end of the log
+    //find end of the log, starting from the redo point since pages before it may have been reclaimed
     {
         xnmm_scoped_alloc(scoped_ptr, xnlogitr_free, xnlogitr_create, (struct xnlogitr**)&scoped_ptr, log);
         struct xnlogitr *itr = (struct xnlogitr*)scoped_ptr;
@@ -22,61 +228,344 @@ xnresult_t xnlog_create(struct xnlog **out_log, struct xnfile *file, bool create
         log->page_off = itr->page_off;
     }
 
-    xnmm_alloc(xn_free, xn_aligned_malloc, (void**)&log->buf, XNPG_SZ);
-    xn_ensure(xnpg_copy(&log->page, log->buf));
+    log->ring_pages = ring_pages;
+    xnmm_alloc(xn_free, xn_aligned_malloc, (void**)&log->buf, XNPG_SZ * ring_pages);
+    xnmm_alloc(xn_free, xn_aligned_malloc, (void**)&log->staging, XNPG_SZ);
+    xnmm_alloc(xn_free, xn_malloc, (void**)&log->flush_pages, (ring_pages + 1) * sizeof(struct xnfileiov));
+    memset(log->buf, 0, XNPG_SZ * ring_pages);
+    xn_ensure(xnpg_copy(&log->page, xnlog_ring_page(log, log->page.idx)));
     
     log->highest_tx_flushed = -1;
 
+    xnmm_alloc(xnmtx_free, xnmtx_create, &log->lock);
+    xn_ensure(pthread_cond_init(&log->flushed_cv, NULL) == 0);
+    xn_ensure(pthread_cond_init(&log->batch_cv, NULL) == 0);
+    xn_ensure(pthread_cond_init(&log->writer_cv, NULL) == 0);
+    log->flushed_lsn = xnlog_lsn(log);
+    log->flushing = false;
+    log->stopping = false;
+    log->failed = false;
+    log->waiting = 0;
+    log->commit_wait_us = 0;
+    log->commit_batch = XNLOG_DEFAULT_COMMIT_BATCH;
+    log->flush_count = 0;
+    log->stall_count = 0;
+
+    //started last since nothing after this can fail
+    xn_ensure(pthread_create(&log->writer, NULL, xnlog_writer, log) == 0);
+
     *out_log = log;
     return xn_ok();
 }
 
-
+//stops the writer thread and writes out everything left in the ring
 xnresult_t xnlog_free(void **l) {
     xnmm_init();
     struct xnlog *log = (struct xnlog*)(*l);
+
+    xn_ensure(xn_mutex_lock(log->lock));
+    log->stopping = true;
+    xn_ensure(xn_cond_signal(&log->writer_cv));
+    xn_ensure(xn_mutex_unlock(log->lock));
+    xn_ensure(pthread_join(log->writer, NULL) == 0);
+
+    bool ok = !log->failed;
+    if (ok) {
+        xn_ensure(xn_mutex_lock(log->lock));
+        while (log->flushing)
+            xn_ensure(xn_cond_wait(&log->flushed_cv, log->lock));
+        ok = xnlog_write_locked(log, true);
+        xn_ensure(xn_mutex_unlock(log->lock));
+    }
+
+    xn_ensure(xnmtx_free((void**)&log->lock));
+    pthread_cond_destroy(&log->flushed_cv);
+    pthread_cond_destroy(&log->batch_cv);
+    pthread_cond_destroy(&log->writer_cv);
+    free(log->flush_pages);
+    free(log->staging);
     free(log->buf);
     free(log);
+    xn_ensure(ok);
     return xn_ok();
 }
 
 xnresult_t xnlog_flush(struct xnlog *log) {
     xnmm_init();
-    if (log->page.idx >= log->page.file_handle->size / XNPG_SZ)
-        xn_ensure(xnfile_grow(log->page.file_handle));
-    xn_ensure(xnpg_flush(&log->page, log->buf));
-    //don't need to call xnfile_sync since log files are opend with O_DATASYNC flag
+    xn_ensure(xn_mutex_lock(log->lock));
+    bool ok = true;
+    while (ok && log->flushing)
+        ok = xn_cond_wait(&log->flushed_cv, log->lock);
+    ok = ok && !log->failed && xnlog_write_locked(log, true);
+    xn_ensure(xn_mutex_unlock(log->lock));
+    xn_ensure(ok);
+    return xn_ok();
+}
+
+//bytes appended to the log that are not yet on stable storage
+xnresult_t xnlog_backlog(struct xnlog *log, uint64_t *out_bytes) {
+    xnmm_init();
+    xn_ensure(xn_mutex_lock(log->lock));
+    *out_bytes = xnlog_lsn(log) - log->flushed_lsn;
+    xn_ensure(xn_mutex_unlock(log->lock));
+    return xn_ok();
+}
+
+xnresult_t xnlog_end_lsn(struct xnlog *log, uint64_t *out_lsn) {
+    xnmm_init();
+    xn_ensure(xn_mutex_lock(log->lock));
+    *out_lsn = xnlog_lsn(log);
+    xn_ensure(xn_mutex_unlock(log->lock));
+    return xn_ok();
+}
+
+//bytes of log that recovery would scan if the system failed now
+xnresult_t xnlog_redo_bytes(struct xnlog *log, uint64_t *out_bytes) {
+    xnmm_init();
+    xn_ensure(xn_mutex_lock(log->lock));
+    *out_bytes = xnlog_lsn(log) - log->redo_lsn;
+    xn_ensure(xn_mutex_unlock(log->lock));
+    return xn_ok();
+}
+
+//caller must hold log lock.  Takes over the flushing role while writing the header page so the
+//write does not interleave with the writer thread or a group commit
+static xnresult_t xnlog_write_header_locked(struct xnlog *log, uint64_t checkpoint_lsn, uint8_t *buf) {
+    xnmm_init();
+
+    while (log->flushing)
+        xn_ensure(xn_cond_wait(&log->flushed_cv, log->lock));
+    xn_ensure(!log->failed);
+
+    log->flushing = true;
+    xn_ensure(xn_mutex_unlock(log->lock));
+
+    xnlog_fill_header(buf, checkpoint_lsn);
+    struct xnfileiov page = { .idx = 0, .buf = buf };
+    bool ok = xnfile_writev_sync(log->page.file_handle, &page, 1);
+
+    xn_ensure(xn_mutex_lock(log->lock));
+    log->flushing = false;
+    xn_ensure(xn_cond_broadcast(&log->flushed_cv));
+    xn_ensure(xn_cond_signal(&log->writer_cv));
+    xn_ensure(ok);
+    return xn_ok();
+}
+
+//appends a checkpoint record holding redo_lsn and the file table, points the header at it once the record is
+//durable, then reclaims the log pages before redo_lsn.  The caller must have made every update logged before
+//redo_lsn durable, and only one checkpoint may run at a time
+xnresult_t xnlog_checkpoint(struct xnlog *log, int tx_id, uint64_t redo_lsn) {
+    xnmm_init();
+
+    //files named after the table is copied are named in file records after redo_lsn
+    size_t max_size = XN_VARINT_MAX + XNLOG_MAX_FILES * (XN_VARINT_MAX * 2 + NAME_MAX);
+    xnmm_scoped_alloc(scoped_data, xn_free, xn_malloc, &scoped_data, max_size);
+    uint8_t *data = (uint8_t*)scoped_data;
+    size_t data_size = xn_varint_put(data, redo_lsn);
+    xn_ensure(xn_mutex_lock(log->lock));
+    for (int i = 0; i < XNLOG_MAX_FILES; i++) {
+        if (log->files.named[i])
+            data_size += xnlog_put_file(data + data_size, i, log->files.names[i]);
+    }
+    xn_ensure(xn_mutex_unlock(log->lock));
+
+    size_t rec_size = xnlog_record_size(tx_id, data_size);
+    xnmm_scoped_alloc(scoped_ptr, xn_free, xn_malloc, &scoped_ptr, rec_size);
+    uint8_t *rec = (uint8_t*)scoped_ptr;
+    xn_ensure(xnlog_serialize_record(tx_id, XNLOGT_CHECKPOINT, data_size, data, rec));
+
+    uint64_t checkpoint_lsn;
+    xn_ensure(xnlog_append(log, rec, rec_size, &checkpoint_lsn));
+    xn_ensure(xnlog_flush(log));
+
+    xnmm_scoped_alloc(scoped_buf, xn_free, xn_aligned_malloc, &scoped_buf, XNPG_SZ);
+    xn_ensure(xn_mutex_lock(log->lock));
+    bool ok = xnlog_write_header_locked(log, checkpoint_lsn, (uint8_t*)scoped_buf);
+    if (ok) {
+        log->checkpoint_lsn = checkpoint_lsn;
+        log->redo_lsn = redo_lsn;
+    }
+    xn_ensure(xn_mutex_unlock(log->lock));
+    xn_ensure(ok);
+
+    //recovery never reads before redo_lsn again, so the disk space behind those pages can be freed.
+    //Lsns stay byte offsets into the file, so the file keeps its size and the reclaimed range reads as zeroes
+    uint64_t reclaim_end = redo_lsn / XNPG_SZ * XNPG_SZ;
+    if (reclaim_end > log->reclaimed_lsn) {
+        xn_ensure(xnfile_punch_hole(log->page.file_handle, log->reclaimed_lsn, reclaim_end - log->reclaimed_lsn));
+        log->reclaimed_lsn = reclaim_end;
+    }
+
     return xn_ok();
 }
 
-xnresult_t xnlog_append(struct xnlog *log, const uint8_t *log_record, size_t size) {
+//caller must hold log lock.  Only copies into the ring - full pages are handed off to the
+//writer thread, and the appender only waits if the ring has no free pages
+static xnresult_t xnlog_copy_locked(struct xnlog *log, const uint8_t *buf, size_t size) {
     xnmm_init();
     size_t written = 0;
     while (written < size) {
         size_t to_write = size - written;
         size_t remaining = XNPG_SZ - log->page_off;
         size_t s = remaining < to_write ? remaining : to_write;
-        memcpy(log->buf + log->page_off, log_record + written, s);
+        memcpy(xnlog_ring_page(log, log->page.idx) + log->page_off, buf + written, s);
 
         log->page_off += s;
         written += s;
 
         if (log->page_off == XNPG_SZ) {
-            xn_ensure(xnlog_flush(log));
+            xn_ensure(xn_cond_signal(&log->writer_cv));
+            while (log->page.idx + 1 - log->flushed_lsn / XNPG_SZ >= log->ring_pages) {
+                xn_ensure(!log->failed);
+                log->stall_count++;
+                xn_ensure(xn_cond_wait(&log->flushed_cv, log->lock));
+            }
             log->page.idx++;
             log->page_off = 0;
+            //clear old page so stale records are not mistaken for the end of the log
+            memset(xnlog_ring_page(log, log->page.idx), 0, XNPG_SZ);
         }
     }
 
     return xn_ok();
 }
 
-size_t xnlog_record_size(size_t data_size) {
-    size_t size = sizeof(int);      //tx id
-    size += sizeof(enum xnlogt);    //log type
-    size += sizeof(size_t);         //data size 
-    size += data_size;              //data
-    size += sizeof(uint32_t);       //checksum
+//caller must hold log lock.  Salts the record's checksum with the lsn it lands at
+static xnresult_t xnlog_append_locked(struct xnlog *log, const uint8_t *log_record, size_t size) {
+    xnmm_init();
+    xn_ensure(size > sizeof(uint32_t));
+    xn_ensure(!log->failed);
+
+    uint32_t checksum;
+    memcpy(&checksum, log_record + size - sizeof(uint32_t), sizeof(uint32_t));
+    checksum ^= xnlog_salt(xnlog_lsn(log));
+
+    xn_ensure(xnlog_copy_locked(log, log_record, size - sizeof(uint32_t)));
+    xn_ensure(xnlog_copy_locked(log, (uint8_t*)&checksum, sizeof(uint32_t)));
+    return xn_ok();
+}
+
+//out_lsn (optional) is set to the lsn of the start of the record
+xnresult_t xnlog_append(struct xnlog *log, const uint8_t *log_record, size_t size, uint64_t *out_lsn) {
+    xnmm_init();
+    xn_ensure(xn_mutex_lock(log->lock));
+    if (out_lsn)
+        *out_lsn = xnlog_lsn(log);
+    bool ok = xnlog_append_locked(log, log_record, size);
+    xn_ensure(xn_mutex_unlock(log->lock));
+    xn_ensure(ok);
+    return xn_ok();
+}
+
+//caller must hold log lock.  Waits until the log is durable up to lsn.  The first
+//committer to arrive becomes the leader: it waits up to commit_wait_us for up to
+//commit_batch committers to append their records, then issues a single write for
+//all of them.  Committers arriving while the leader is writing wait for the next batch
+static xnresult_t xnlog_wait_durable_locked(struct xnlog *log, uint64_t lsn) {
+    xnmm_init();
+
+    while (log->flushed_lsn < lsn) {
+        xn_ensure(!log->failed);
+
+        if (log->flushing) {
+            xn_ensure(xn_cond_wait(&log->flushed_cv, log->lock));
+            continue;
+        }
+
+        log->flushing = true;
+        bool timed_out = false;
+        bool ok = true;
+        while (ok && log->commit_wait_us > 0 && log->waiting < log->commit_batch && !timed_out) {
+            ok = xn_cond_timedwait(&log->batch_cv, log->lock, log->commit_wait_us, &timed_out);
+        }
+        log->flushing = false;
+        xn_ensure(ok);
+
+        xn_ensure(xnlog_write_locked(log, true));
+    }
+
+    return xn_ok();
+}
+
+//caller must hold log lock
+static xnresult_t xnlog_join_batch_locked(struct xnlog *log, uint64_t lsn) {
+    xnmm_init();
+    log->waiting++;
+    bool ok = true;
+    if (log->waiting >= log->commit_batch)
+        ok = xn_cond_signal(&log->batch_cv);
+    ok = ok && xnlog_wait_durable_locked(log, lsn);
+    log->waiting--;
+    xn_ensure(ok);
+    return xn_ok();
+}
+
+//appends a commit record and returns once it is on stable storage
+xnresult_t xnlog_commit(struct xnlog *log, const uint8_t *log_record, size_t size) {
+    xnmm_init();
+    xn_ensure(xn_mutex_lock(log->lock));
+
+    bool ok = xnlog_append_locked(log, log_record, size) && xnlog_join_batch_locked(log, xnlog_lsn(log));
+    xn_ensure(xn_mutex_unlock(log->lock));
+    xn_ensure(ok);
+    return xn_ok();
+}
+
+//waits until the log is durable up to lsn, as part of a group commit batch.  For committers that
+//appended their commit record with xnlog_append
+xnresult_t xnlog_wait_durable(struct xnlog *log, uint64_t lsn) {
+    xnmm_init();
+    xn_ensure(xn_mutex_lock(log->lock));
+    bool ok = xnlog_join_batch_locked(log, lsn);
+    xn_ensure(xn_mutex_unlock(log->lock));
+    xn_ensure(ok);
+    return xn_ok();
+}
+
+//sets out_id to the id update records name file by.  The first time a file is logged, a file record mapping its id
+//to its name is appended first, so recovery can find the file from any later record
+xnresult_t xnlog_file_id(struct xnlog *log, int tx_id, struct xnfile *file, uint64_t *out_id) {
+    xnmm_init();
+    xn_ensure(file->id < XNLOG_MAX_FILES);
+    *out_id = file->id;
+
+    //names are only ever added, so once the flag is set the file record is in the log
+    if (__atomic_load_n(&log->files.named[file->id], __ATOMIC_SEQ_CST))
+        return xn_ok();
+
+    //files are named by their file name, since the database directory can move
+    char path_buf[strlen(file->path) + 1];
+    memcpy(path_buf, file->path, strlen(file->path) + 1);
+    char *name = basename(path_buf);
+    xn_ensure(strlen(name) <= NAME_MAX);
+
+    uint8_t data[XN_VARINT_MAX * 2 + NAME_MAX];
+    size_t data_size = xnlog_put_file(data, file->id, name);
+    size_t rec_size = xnlog_record_size(tx_id, data_size);
+    uint8_t rec[rec_size];
+    xn_ensure(xnlog_serialize_record(tx_id, XNLOGT_FILE, data_size, data, rec));
+
+    xn_ensure(xn_mutex_lock(log->lock));
+    bool ok = true;
+    if (!log->files.named[file->id]) {
+        ok = xnlog_append_locked(log, rec, rec_size);
+        if (ok) {
+            strcpy(log->files.names[file->id], name);
+            __atomic_store_n(&log->files.named[file->id], true, __ATOMIC_SEQ_CST);
+        }
+    }
+    xn_ensure(xn_mutex_unlock(log->lock));
+    xn_ensure(ok);
+    return xn_ok();
+}
+
+size_t xnlog_record_size(int tx_id, size_t data_size) {
+    size_t size = 1;                        //log type
+    size += xn_varint_size(tx_id);          //tx id
+    size += xn_varint_size(data_size);      //data size
+    size += data_size;                      //data
+    size += sizeof(uint32_t);               //checksum
     return size;
 }
 
@@ -86,16 +575,14 @@ xnresult_t xnlog_serialize_record(int tx_id,
                                   uint8_t *data, 
                                   uint8_t *buf) {
     xnmm_init();
+    xn_ensure(tx_id >= 0);
     off_t off = 0;
-    memcpy(buf + off, &tx_id, sizeof(int));
-    off += sizeof(int);
-    memcpy(buf + off, &type, sizeof(enum xnlogt));
-    off += sizeof(enum xnlogt);
-    memcpy(buf + off, &data_size, sizeof(size_t));
-    off += sizeof(size_t);
+    buf[off++] = type;
+    off += xn_varint_put(buf + off, tx_id);
+    off += xn_varint_put(buf + off, data_size);
     memcpy(buf + off, data, data_size);
     off += data_size;
-    uint32_t checksum = xn_hash(buf, off);
+    uint32_t checksum = xn_crc32c(0, buf, off);
     memcpy(buf + off, &checksum, sizeof(uint32_t));
     off += sizeof(uint32_t);
 
@@ -106,106 +593,184 @@ xnresult_t xnlogitr_create(struct xnlogitr **out_itr, struct xnlog *log) {
     xnmm_init();
     struct xnlogitr *itr;
     xnmm_alloc(xn_free, xn_malloc, (void**)&itr, sizeof(struct xnlogitr));
-    xnmm_alloc(xn_free, xn_aligned_malloc, (void**)&itr->buf, XNPG_SZ);
+    xnmm_alloc(xn_free, xn_aligned_malloc, (void**)&itr->buf, XNPG_SZ * XNLOGITR_READAHEAD);
 
+    //starts at the redo point - everything recovery needs is after it
     itr->page = log->page;
-    itr->page.idx = 0;
-    itr->page_off = -1;
-    xn_ensure(xnpg_copy(&itr->page, itr->buf));
+    itr->page.idx = log->redo_lsn / XNPG_SZ;
+    itr->page_off = log->redo_lsn % XNPG_SZ;
+    itr->started = false;
+    itr->parsed = false;
+    itr->buf_start = 0;
+    itr->buf_pages = 0;
 
     *out_itr = itr;
     return xn_ok();
 }
 
+//gets a pointer to a page in the read-ahead window, reading the window starting at that page
+//if it is not loaded.  Pages past the end of the file read as zeroes, which marks the end of the log
+static xnresult_t xnlogitr_page(struct xnlogitr *itr, uint64_t page_idx, uint8_t **out_ptr) {
+    xnmm_init();
+
+    if (page_idx < itr->buf_start || page_idx >= itr->buf_start + itr->buf_pages) {
+        uint64_t file_pages = itr->page.file_handle->size / XNPG_SZ;
+        uint64_t count = 0;
+        if (page_idx < file_pages)
+            count = file_pages - page_idx < XNLOGITR_READAHEAD ? file_pages - page_idx : XNLOGITR_READAHEAD;
+
+        if (count > 0)
+            xn_ensure(xnfile_read(itr->page.file_handle, (char*)itr->buf, page_idx * XNPG_SZ, count * XNPG_SZ));
+        memset(itr->buf + count * XNPG_SZ, 0, (XNLOGITR_READAHEAD - count) * XNPG_SZ);
+
+        itr->buf_start = page_idx;
+        itr->buf_pages = XNLOGITR_READAHEAD;
+    }
+
+    *out_ptr = itr->buf + (page_idx - itr->buf_start) * XNPG_SZ;
+    return xn_ok();
+}
+
+//the next call to xnlogitr_next stays on the record at page_idx/page_off
 xnresult_t xnlogitr_seek(struct xnlogitr *itr, uint64_t page_idx, int page_off) {
     xnmm_init();
     itr->page.idx = page_idx;
     itr->page_off = page_off;
-    xn_ensure(xnpg_copy(&itr->page, itr->buf));
+    itr->started = false;
+    itr->parsed = false;
     return xn_ok();
 }
 
-xnresult_t xnlogitr_read_span(const struct xnlogitr *itr, uint8_t *buf, off_t off, size_t size) {
+xnresult_t xnlogitr_read_span(struct xnlogitr *itr, uint8_t *buf, off_t off, size_t size) {
     xnmm_init();
-    struct xnpg page = itr->page;
-    xnmm_scoped_alloc(scoped_ptr, xn_free, xn_aligned_malloc, &scoped_ptr, XNPG_SZ);
-    uint8_t *page_buf = (uint8_t*)scoped_ptr;
-
-    int page_off = itr->page_off + off;
-    if (page_off >= XNPG_SZ) {
-        page_off -= XNPG_SZ;
-        page.idx++;
-    }
-
-    xn_ensure(xnpg_copy(&page, page_buf));
 
+    uint64_t pos = itr->page.idx * XNPG_SZ + itr->page_off + off;
     size_t nread = 0;
     while (nread < size) {
+        uint8_t *page_buf;
+        xn_ensure(xnlogitr_page(itr, pos / XNPG_SZ, &page_buf));
+
         size_t to_read = size - nread;
-        size_t remaining = XNPG_SZ - page_off;
+        size_t remaining = XNPG_SZ - pos % XNPG_SZ;
         size_t s = to_read < remaining ? to_read : remaining;
-        memcpy(buf + nread, page_buf + page_off, s);
+        memcpy(buf + nread, page_buf + pos % XNPG_SZ, s);
 
         nread += s;
-        page_off += s;
+        pos += s;
+    }
 
-        if (page_off == XNPG_SZ) {
-            page_off = 0;
-            page.idx++;
-            xn_ensure(xnpg_copy(&page, page_buf));
-        }
+    return xn_ok();
+}
+
+//crc32c of size bytes starting at the iterator, read a page at a time from the read-ahead window
+static xnresult_t xnlogitr_checksum(struct xnlogitr *itr, size_t size, uint32_t *out_crc) {
+    xnmm_init();
+
+    uint64_t pos = itr->page.idx * XNPG_SZ + itr->page_off;
+    uint32_t crc = 0;
+    while (size > 0) {
+        uint8_t *page_buf;
+        xn_ensure(xnlogitr_page(itr, pos / XNPG_SZ, &page_buf));
+
+        size_t remaining = XNPG_SZ - pos % XNPG_SZ;
+        size_t s = size < remaining ? size : remaining;
+        crc = xn_crc32c(crc, page_buf + pos % XNPG_SZ, s);
+        size -= s;
+        pos += s;
     }
 
+    *out_crc = crc;
     return xn_ok();
 }
 
-xnresult_t xnlogitr_read_data(struct xnlogitr *itr, uint8_t *buf, size_t size) {
+//parses the header of the record the iterator is on and checks the record's checksum.  Zeroed pages past the
+//last record, and a record torn by a crash during a log write, mark the end of the log
+static xnresult_t xnlogitr_parse(struct xnlogitr *itr) {
     xnmm_init();
-    const off_t header_size = sizeof(int) + sizeof(enum xnlogt) + sizeof(size_t);
-    xn_ensure(xnlogitr_read_span(itr, buf, header_size, size));
+    if (itr->parsed)
+        return xn_ok();
+
+    uint8_t hdr_buf[XNLOG_MAX_HEADER];
+    xn_ensure(xnlogitr_read_span(itr, hdr_buf, 0, XNLOG_MAX_HEADER));
+
+    uint64_t tx_id = 0;
+    uint64_t data_size = 0;
+    int off = 1;
+    int n = xn_varint_get(hdr_buf + off, XNLOG_MAX_HEADER - off, &tx_id);
+    off += n;
+    int m = n > 0 ? xn_varint_get(hdr_buf + off, XNLOG_MAX_HEADER - off, &data_size) : 0;
+    off += m;
+
+    uint64_t lsn = itr->page.idx * XNPG_SZ + itr->page_off;
+    itr->hdr_valid = n > 0 && m > 0 && tx_id != 0 && tx_id <= INT_MAX && hdr_buf[0] <= XNLOGT_FREE &&
+                     lsn + off + data_size + sizeof(uint32_t) <= itr->page.file_handle->size;
+    itr->hdr_size = off;
+    itr->tx_id = tx_id;
+    itr->type = hdr_buf[0];
+    itr->data_size = data_size;
+
+    if (itr->hdr_valid) {
+        uint32_t crc;
+        uint32_t checksum;
+        xn_ensure(xnlogitr_checksum(itr, off + data_size, &crc));
+        xn_ensure(xnlogitr_read_span(itr, (uint8_t*)&checksum, off + data_size, sizeof(uint32_t)));
+        itr->hdr_valid = (checksum ^ xnlog_salt(lsn)) == crc;
+    }
 
+    itr->parsed = true;
     return xn_ok();
 }
 
-xnresult_t xnlogitr_read_header(const struct xnlogitr *itr, int *tx_id, enum xnlogt *type, size_t *data_size) {
+xnresult_t xnlogitr_read_data(struct xnlogitr *itr, uint8_t *buf, size_t size) {
     xnmm_init();
-    const size_t header_size = sizeof(int) + sizeof(enum xnlogt) + sizeof(size_t);
-    uint8_t hdr_buf[header_size];
+    xn_ensure(xnlogitr_parse(itr));
+    xn_ensure(itr->hdr_valid && size <= itr->data_size);
+    xn_ensure(xnlogitr_read_span(itr, buf, itr->hdr_size, size));
+
+    return xn_ok();
+}
 
-    xn_ensure(xnlogitr_read_span(itr, hdr_buf, 0, header_size));
+xnresult_t xnlogitr_read_header(struct xnlogitr *itr, int *tx_id, enum xnlogt *type, size_t *data_size) {
+    xnmm_init();
+    xn_ensure(xnlogitr_parse(itr));
+    xn_ensure(itr->hdr_valid);
 
-    *tx_id = *((int*)hdr_buf);
-    *type = *((enum xnlogt*)(hdr_buf + sizeof(int)));
-    *data_size = *((size_t*)(hdr_buf + sizeof(int) + sizeof(enum xnlogt)));
+    *tx_id = itr->tx_id;
+    *type = itr->type;
+    *data_size = itr->data_size;
 
     return xn_ok();
 }
 
-size_t xnlog_record_size(size_t data_size);
+//adds the file table entry in a file record to files
+xnresult_t xnlogitr_read_file(struct xnlogitr *itr, struct xnlogfiles *files) {
+    xnmm_init();
+    xn_ensure(xnlogitr_parse(itr));
+    xn_ensure(itr->hdr_valid && itr->type == XNLOGT_FILE && itr->data_size <= XN_VARINT_MAX * 2 + NAME_MAX);
+
+    uint8_t buf[XN_VARINT_MAX * 2 + NAME_MAX];
+    xn_ensure(xnlogitr_read_span(itr, buf, itr->hdr_size, itr->data_size));
+    xn_ensure(xnlog_parse_files(buf, itr->data_size, files));
+    return xn_ok();
+}
 
 xnresult_t xnlogitr_next(struct xnlogitr *itr, bool* valid) {
     xnmm_init();
-    if (itr->page_off == -1) {
-        itr->page_off = 0;
+    //the first call stays on the starting record
+    if (!itr->started) {
+        itr->started = true;
     } else {
-        int tx_id;
-        enum xnlogt type;
-        size_t data_size;
-        xn_ensure(xnlogitr_read_header(itr, &tx_id, &type, &data_size));
-
-        itr->page_off += xnlog_record_size(data_size);
-        while (itr->page_off >= XNPG_SZ) {
-            itr->page_off -= XNPG_SZ;
-            itr->page.idx++;
-        }
-        xn_ensure(xnpg_copy(&itr->page, itr->buf));
+        xn_ensure(xnlogitr_parse(itr));
+        xn_ensure(itr->hdr_valid);
+
+        itr->page_off += itr->hdr_size + itr->data_size + sizeof(uint32_t);
+        itr->page.idx += itr->page_off / XNPG_SZ;
+        itr->page_off %= XNPG_SZ;
+        itr->parsed = false;
     }
 
-    int tx_id;
-    enum xnlogt type;
-    size_t data_size;
-    xn_ensure(xnlogitr_read_header(itr, &tx_id, &type, &data_size));
-    *valid = tx_id != 0;
+    xn_ensure(xnlogitr_parse(itr));
+    *valid = itr->hdr_valid;
     return xn_ok();
 }
 
@@ -2,37 +2,122 @@
 
 #include "page.h"
 
+#include <limits.h>
+
 enum xnlogt {
     XNLOGT_START,
     XNLOGT_UPDATE,
-    XNLOGT_COMMIT
+    XNLOGT_COMMIT,
+    XNLOGT_CHECKPOINT,
+    XNLOGT_FILE,
+    XNLOGT_ALLOC,   //a free-map bit, set or cleared in place.  Redone whether or not the tx commits
+    XNLOGT_FREE     //a page the tx frees.  Redone only if the tx commits, like updates
 };
 
+//page 0 of the log file is the header, which holds the lsn of the most recent checkpoint record and the
+//record format version.  Records start on page 1
+#define XNLOG_FIRST_LSN XNPG_SZ
+#define XNLOG_VERSION 3
+
+//a record is a type byte, a varint tx id and a varint data size, then the data and a checksum.  The checksum
+//is salted with the record's lsn when it is appended
+#define XNLOG_MAX_HEADER (1 + XN_VARINT_MAX * 2)
+
+//update records name their file by id.  A file record maps an id to a file name the first time the id is logged,
+//and every checkpoint record holds the whole table, so recovery starting at the redo point knows every id
+#define XNLOG_MAX_FILES 32
+
+struct xnlogfiles {
+    bool named[XNLOG_MAX_FILES];
+    char names[XNLOG_MAX_FILES][NAME_MAX + 1];
+};
+
+#define XNLOG_DEFAULT_COMMIT_BATCH 16
+#define XNLOG_DEFAULT_RING_PAGES 16
+
+//buf is a ring of ring_pages log pages.  Appenders copy records into the ring, and a
+//writer thread writes out full pages in the background
 struct xnlog {
     uint8_t *buf;
+    uint8_t *staging;
+    struct xnfileiov *flush_pages;  //pages of one flush, ring_pages + 1 entries
+    int ring_pages;
     int page_off;
 
     int highest_tx_flushed;
     struct xnpg page;
+
+    //lsns are byte offsets into the log file
+    pthread_mutex_t *lock;
+    pthread_cond_t flushed_cv;
+    pthread_cond_t batch_cv;
+    pthread_cond_t writer_cv;
+    pthread_t writer;
+    uint64_t flushed_lsn;
+    bool flushing;
+    bool stopping;
+    bool failed;
+
+    //group commit
+    int waiting;
+    int commit_wait_us;
+    int commit_batch;
+
+    //checkpoints.  Recovery starts at redo_lsn, and log pages before reclaimed_lsn have been
+    //handed back to the filesystem
+    uint64_t checkpoint_lsn;
+    uint64_t redo_lsn;
+    uint64_t reclaimed_lsn;
+
+    //files named in this log since it was opened, and the file table as of redo_lsn, read from the checkpoint record
+    struct xnlogfiles files;
+    struct xnlogfiles redo_files;
+
+    //metrics
+    uint64_t flush_count;
+    uint64_t stall_count;
 };
 
+#define XNLOGITR_READAHEAD 16
+
+//buf holds a window of XNLOGITR_READAHEAD log pages starting at buf_start, so
+//sequential scans read the log in large chunks
 struct xnlogitr {
     struct xnpg page;
     int page_off;
+    bool started;
     uint8_t *buf;
+    uint64_t buf_start;
+    int buf_pages;
+
+    //header of the record at page/page_off, parsed once per record
+    bool parsed;
+    bool hdr_valid;
+    int hdr_size;
+    int tx_id;
+    enum xnlogt type;
+    size_t data_size;
 };
 
-xnresult_t xnlog_create(struct xnlog **out_log, struct xnfile *file, bool create);
+xnresult_t xnlog_create(struct xnlog **out_log, struct xnfile *file, bool create, int ring_pages);
 xnresult_t xnlog_free(void **log);
 xnresult_t xnlog_flush(struct xnlog *log);
-xnresult_t xnlog_append(struct xnlog *log, const uint8_t *log_record, size_t size);
-size_t xnlog_record_size(size_t data_size);
+xnresult_t xnlog_append(struct xnlog *log, const uint8_t *log_record, size_t size, uint64_t *out_lsn);
+xnresult_t xnlog_commit(struct xnlog *log, const uint8_t *log_record, size_t size);
+xnresult_t xnlog_wait_durable(struct xnlog *log, uint64_t lsn);
+xnresult_t xnlog_backlog(struct xnlog *log, uint64_t *out_bytes);
+xnresult_t xnlog_end_lsn(struct xnlog *log, uint64_t *out_lsn);
+xnresult_t xnlog_redo_bytes(struct xnlog *log, uint64_t *out_bytes);
+xnresult_t xnlog_checkpoint(struct xnlog *log, int tx_id, uint64_t redo_lsn);
+xnresult_t xnlog_file_id(struct xnlog *log, int tx_id, struct xnfile *file, uint64_t *out_id);
+size_t xnlog_record_size(int tx_id, size_t data_size);
 xnresult_t xnlog_serialize_record(int tx_id, enum xnlogt type, size_t data_size, uint8_t *data, uint8_t *buf);
 
 xnresult_t xnlogitr_create(struct xnlogitr **out_itr, struct xnlog *log);
 xnresult_t xnlogitr_seek(struct xnlogitr *itr, uint64_t page_idx, int page_off);
-xnresult_t xnlogitr_read_span(const struct xnlogitr *itr, uint8_t *buf, off_t off, size_t size);
+xnresult_t xnlogitr_read_span(struct xnlogitr *itr, uint8_t *buf, off_t off, size_t size);
 xnresult_t xnlogitr_read_data(struct xnlogitr *itr, uint8_t *buf, size_t size);
-xnresult_t xnlogitr_read_header(const struct xnlogitr *itr, int *tx_id, enum xnlogt *type, size_t *data_size);
+xnresult_t xnlogitr_read_header(struct xnlogitr *itr, int *tx_id, enum xnlogt *type, size_t *data_size);
+xnresult_t xnlogitr_read_file(struct xnlogitr *itr, struct xnlogfiles *files);
 xnresult_t xnlogitr_next(struct xnlogitr *itr, bool* valid);
 bool xnlogitr_free(void **i);
@@ -0,0 +1,292 @@
+#include "mvcc.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+xnresult_t xnmvcc_create(struct xnmvcc **out_mvcc) {
+    xnmm_init();
+
+    struct xnmvcc *mvcc;
+    xnmm_alloc(xn_free, xn_malloc, (void**)&mvcc, sizeof(struct xnmvcc));
+    xnmm_alloc(xntbl_free, xntbl_create, &mvcc->versions, false);
+    xnmm_alloc(xnmtx_free, xnmtx_create, &mvcc->lock);
+
+    mvcc->next_seq = 0;
+    mvcc->visible_seq = 0;
+    mvcc->oldest = NULL;
+    mvcc->newest = NULL;
+
+    *out_mvcc = mvcc;
+    return xn_ok();
+}
+
+static void xnmvcc_free_chain(struct xnversion *v) {
+    while (v) {
+        struct xnversion *next = v->next;
+        free(v->data);
+        free(v);
+        v = next;
+    }
+}
+
+//versions still in the store are dropped without being written back - call xnmvcc_gc first
+xnresult_t xnmvcc_free(void **m) {
+    xnmm_init();
+    struct xnmvcc *mvcc = (struct xnmvcc*)(*m);
+
+    //the table would only free the head of each chain, and it is freed right after so the entries can be cleared in place
+    for (int i = 0; i < mvcc->versions->capacity; i++) {
+        struct xnentry *entry = &mvcc->versions->entries[i];
+        xnmvcc_free_chain((struct xnversion*)entry->val);
+        entry->val = NULL;
+    }
+
+    xn_ensure(xntbl_free((void**)&mvcc->versions));
+    xn_ensure(xnmtx_free((void**)&mvcc->lock));
+    free(mvcc);
+    return xn_ok();
+}
+
+//tx sees everything made visible so far.  Snapshots only move forward, so appending keeps the list oldest first
+xnresult_t xnmvcc_begin(struct xnmvcc *mvcc, struct xntx *tx) {
+    xnmm_init();
+    xn_ensure(xn_mutex_lock(mvcc->lock));
+
+    tx->snapshot = mvcc->visible_seq;
+    tx->snap_prev = mvcc->newest;
+    tx->snap_next = NULL;
+    if (mvcc->newest)
+        mvcc->newest->snap_next = tx;
+    else
+        mvcc->oldest = tx;
+    mvcc->newest = tx;
+
+    xn_ensure(xn_mutex_unlock(mvcc->lock));
+    return xn_ok();
+}
+
+//out_was_oldest is set if tx was holding back gc
+xnresult_t xnmvcc_end(struct xnmvcc *mvcc, struct xntx *tx, bool *out_was_oldest) {
+    xnmm_init();
+    xn_ensure(xn_mutex_lock(mvcc->lock));
+
+    *out_was_oldest = mvcc->oldest == tx;
+    if (tx->snap_prev)
+        tx->snap_prev->snap_next = tx->snap_next;
+    else
+        mvcc->oldest = tx->snap_next;
+    if (tx->snap_next)
+        tx->snap_next->snap_prev = tx->snap_prev;
+    else
+        mvcc->newest = tx->snap_prev;
+
+    xn_ensure(xn_mutex_unlock(mvcc->lock));
+    return xn_ok();
+}
+
+//the pool read happens outside the lock.  That is safe since gc only writes a version into the pool if it is at
+//or before every active snapshot, and a version like that would have been found here instead
+xnresult_t xnmvcc_read(struct xnmvcc *mvcc, struct xnpool *pool, struct xnpg *page, uint64_t snapshot, uint8_t *buf, int offset, size_t size) {
+    xnmm_init();
+    xn_ensure(offset + size <= XNPG_SZ);
+
+    xn_ensure(xn_mutex_lock(mvcc->lock));
+    struct xnversion *v = (struct xnversion*)xntbl_find(mvcc->versions, page);
+    while (v && v->seq > snapshot)
+        v = v->next;
+    if (v)
+        memcpy(buf, v->data + offset, size);
+    xn_ensure(xn_mutex_unlock(mvcc->lock));
+
+    if (!v)
+        xn_ensure(xnpool_read(pool, page, buf, offset, size));
+
+    return xn_ok();
+}
+
+//caller must hold mvcc lock.  First committer wins: tx conflicts if any page it modified has a version
+//newer than its snapshot, including versions of txs that are still waiting for their commit record to be durable
+bool xnmvcc_conflicts_locked(struct xnmvcc *mvcc, struct xntx *tx) {
+    for (int i = 0; i < tx->mod_pgs->capacity; i++) {
+        struct xnentry *entry = &tx->mod_pgs->entries[i];
+        if (!entry->val)
+            continue;
+        struct xnversion *head = (struct xnversion*)xntbl_find(mvcc->versions, &entry->page);
+        if (head && head->seq > tx->snapshot)
+            return true;
+    }
+    return false;
+}
+
+//out_changed is set if a commit after snapshot installed a version of page, whether or not it is published yet
+xnresult_t xnmvcc_changed_since(struct xnmvcc *mvcc, struct xnpg *page, uint64_t snapshot, bool *out_changed) {
+    xnmm_init();
+    xn_ensure(xn_mutex_lock(mvcc->lock));
+    struct xnversion *head = (struct xnversion*)xntbl_find(mvcc->versions, page);
+    *out_changed = head && head->seq > snapshot;
+    xn_ensure(xn_mutex_unlock(mvcc->lock));
+    return xn_ok();
+}
+
+static xnresult_t xnmvcc_version_create(struct xnversion **out_v, uint64_t seq, uint64_t start_lsn, const uint8_t *data) {
+    xnmm_init();
+
+    struct xnversion *v;
+    xnmm_alloc(xn_free, xn_malloc, (void**)&v, sizeof(struct xnversion));
+    xnmm_alloc(xn_free, xn_malloc, (void**)&v->data, XNPG_SZ);
+    memcpy(v->data, data, XNPG_SZ);
+    v->seq = seq;
+    v->start_lsn = start_lsn;
+    v->next = NULL;
+
+    *out_v = v;
+    return xn_ok();
+}
+
+//caller must hold mvcc lock.  Copies the pages modified by tx into the store as versions tagged with seq.
+//They are not seen by any snapshot until seq is published
+xnresult_t xnmvcc_install_locked(struct xnmvcc *mvcc, struct xntx *tx, uint64_t seq) {
+    xnmm_init();
+
+    for (int i = 0; i < tx->mod_pgs->capacity; i++) {
+        struct xnentry *entry = &tx->mod_pgs->entries[i];
+        if (!entry->val)
+            continue;
+
+        struct xnversion *v;
+        xn_ensure(xnmvcc_version_create(&v, seq, tx->start_lsn, entry->val));
+        v->next = (struct xnversion*)xntbl_find(mvcc->versions, &entry->page);
+        if (v->next)
+            xn_ensure(xntbl_remove(mvcc->versions, &entry->page));
+        xn_ensure(xntbl_insert(mvcc->versions, &entry->page, (uint8_t*)v));
+    }
+
+    return xn_ok();
+}
+
+//caller must hold mvcc lock.  Removes the versions of tx's pages tagged seq, after an install or the commit
+//record append failed.  Nothing else can install while the lock is held, so they are at the head of each chain,
+//and seq is handed back so the next commit can't publish them
+xnresult_t xnmvcc_uninstall_locked(struct xnmvcc *mvcc, struct xntx *tx, uint64_t seq) {
+    xnmm_init();
+
+    for (int i = 0; i < tx->mod_pgs->capacity; i++) {
+        struct xnentry *entry = &tx->mod_pgs->entries[i];
+        if (!entry->val)
+            continue;
+
+        struct xnversion *v = (struct xnversion*)xntbl_find(mvcc->versions, &entry->page);
+        if (!v || v->seq != seq)
+            continue;
+
+        xn_ensure(xntbl_remove(mvcc->versions, &entry->page));
+        if (v->next)
+            xn_ensure(xntbl_insert(mvcc->versions, &entry->page, (uint8_t*)v->next));
+        free(v->data);
+        free(v);
+    }
+
+    xn_ensure(mvcc->next_seq == seq);
+    mvcc->next_seq--;
+    return xn_ok();
+}
+
+//commits up to seq are durable, so new snapshots can see them
+xnresult_t xnmvcc_publish(struct xnmvcc *mvcc, uint64_t seq) {
+    xnmm_init();
+    xn_ensure(xn_mutex_lock(mvcc->lock));
+    if (seq > mvcc->visible_seq)
+        mvcc->visible_seq = seq;
+    xn_ensure(xn_mutex_unlock(mvcc->lock));
+    return xn_ok();
+}
+
+//a version gc is moving into the pool
+struct xnmvccgc {
+    struct xnpg page;
+    struct xnversion *v;
+};
+
+static int xnmvcc_compare_gc(const void *a, const void *b) {
+    return xnpg_compare(&((struct xnmvccgc*)a)->page, &((struct xnmvccgc*)b)->page);
+}
+
+//caller must hold mvcc lock.  Versions are written into the pool sorted by file and page index, and the pool is
+//flushed every half pool of pages, so a large commit is written back in long sequential runs rather than by
+//single-page evictions in hash order
+static xnresult_t xnmvcc_gc_locked(struct xnmvcc *mvcc, struct xnpool *pool) {
+    xnmm_init();
+
+    uint64_t horizon = mvcc->oldest ? mvcc->oldest->snapshot : mvcc->visible_seq;
+    if (mvcc->versions->count == 0)
+        return xn_ok();
+
+    xnmm_scoped_alloc(scoped_gc, xn_free, xn_malloc, &scoped_gc, mvcc->versions->count * sizeof(struct xnmvccgc));
+    struct xnmvccgc *gc = (struct xnmvccgc*)scoped_gc;
+    int count = 0;
+    for (int i = 0; i < mvcc->versions->capacity; i++) {
+        struct xnentry *entry = &mvcc->versions->entries[i];
+        struct xnversion *v = (struct xnversion*)entry->val;
+        while (v && v->seq > horizon)
+            v = v->next;
+        if (v) {
+            gc[count].page = entry->page;
+            gc[count].v = v;
+            count++;
+        }
+    }
+    qsort(gc, count, sizeof(struct xnmvccgc), xnmvcc_compare_gc);
+
+    int chunk = pool->capacity / 2 > 0 ? pool->capacity / 2 : 1;
+    for (int i = 0; i < count; i++) {
+        xn_ensure(xnpool_write(pool, &gc[i].page, gc[i].v->data));
+        if ((i + 1) % chunk == 0 && i + 1 < count)
+            xn_ensure(xnpool_flush(pool));
+    }
+
+    //the versions are in the pool, so unlink them and everything older
+    for (int i = 0; i < count; i++) {
+        struct xnversion *head = (struct xnversion*)xntbl_find(mvcc->versions, &gc[i].page);
+        if (head == gc[i].v) {
+            xn_ensure(xntbl_remove(mvcc->versions, &gc[i].page));
+        } else {
+            struct xnversion *prev = head;
+            while (prev->next != gc[i].v)
+                prev = prev->next;
+            prev->next = NULL;
+        }
+        xnmvcc_free_chain(gc[i].v);
+    }
+
+    return xn_ok();
+}
+
+//writes the newest version of each page that is at or before every active snapshot into the buffer pool,
+//and frees it along with all older versions of the page.  Those snapshots now read the same image from the pool
+xnresult_t xnmvcc_gc(struct xnmvcc *mvcc, struct xnpool *pool) {
+    xnmm_init();
+    xn_ensure(xn_mutex_lock(mvcc->lock));
+    bool ok = xnmvcc_gc_locked(mvcc, pool);
+    xn_ensure(xn_mutex_unlock(mvcc->lock));
+    xn_ensure(ok);
+    return xn_ok();
+}
+
+//lsn of the oldest start record with updates that are only in the store, or UINT64_MAX if there are none
+xnresult_t xnmvcc_oldest_lsn(struct xnmvcc *mvcc, uint64_t *out_lsn) {
+    xnmm_init();
+    xn_ensure(xn_mutex_lock(mvcc->lock));
+
+    uint64_t lsn = UINT64_MAX;
+    for (int i = 0; i < mvcc->versions->capacity; i++) {
+        struct xnversion *v = (struct xnversion*)mvcc->versions->entries[i].val;
+        for (; v; v = v->next) {
+            if (v->start_lsn < lsn)
+                lsn = v->start_lsn;
+        }
+    }
+
+    xn_ensure(xn_mutex_unlock(mvcc->lock));
+    *out_lsn = lsn;
+    return xn_ok();
+}
@@ -0,0 +1,40 @@
+#pragma once
+
+#include "pool.h"
+#include "table.h"
+#include "tx.h"
+
+//a committed image of a page.  Versions of a page are chained newest first
+struct xnversion {
+    uint64_t seq;
+    uint64_t start_lsn; //start record of the tx that wrote it - redo needs the log from here until the version is in the pool
+    uint8_t *data;
+    struct xnversion *next;
+};
+
+//multi-version page store.  Each committing write tx gets the next sequence number, and the pages it modified
+//become versions tagged with it.  A tx reads the newest version at or before its snapshot, or the buffer pool if
+//there is none.  Versions that every active snapshot can see are written into the buffer pool by xnmvcc_gc
+struct xnmvcc {
+    pthread_mutex_t *lock;
+    struct xntbl *versions;
+    uint64_t next_seq;
+    uint64_t visible_seq;
+
+    //active snapshots, oldest first
+    struct xntx *oldest;
+    struct xntx *newest;
+};
+
+xnresult_t xnmvcc_create(struct xnmvcc **out_mvcc);
+xnresult_t xnmvcc_free(void **m);
+xnresult_t xnmvcc_begin(struct xnmvcc *mvcc, struct xntx *tx);
+xnresult_t xnmvcc_end(struct xnmvcc *mvcc, struct xntx *tx, bool *out_was_oldest);
+xnresult_t xnmvcc_read(struct xnmvcc *mvcc, struct xnpool *pool, struct xnpg *page, uint64_t snapshot, uint8_t *buf, int offset, size_t size);
+bool xnmvcc_conflicts_locked(struct xnmvcc *mvcc, struct xntx *tx);
+xnresult_t xnmvcc_changed_since(struct xnmvcc *mvcc, struct xnpg *page, uint64_t snapshot, bool *out_changed);
+xnresult_t xnmvcc_install_locked(struct xnmvcc *mvcc, struct xntx *tx, uint64_t seq);
+xnresult_t xnmvcc_uninstall_locked(struct xnmvcc *mvcc, struct xntx *tx, uint64_t seq);
+xnresult_t xnmvcc_publish(struct xnmvcc *mvcc, uint64_t seq);
+xnresult_t xnmvcc_gc(struct xnmvcc *mvcc, struct xnpool *pool);
+xnresult_t xnmvcc_oldest_lsn(struct xnmvcc *mvcc, uint64_t *out_lsn);
@@ -4,9 +4,19 @@
 #include "tx.h"
 #include "log.h"
 #include "db.h"
+#include "pool.h"
+#include "mvcc.h"
 
 #include <string.h>
-#include <libgen.h>
+
+//orders pages by file, then by position in the file.  Writing pages in this order turns adjacent pages into runs
+int xnpg_compare(const struct xnpg *a, const struct xnpg *b) {
+    if (a->file_handle->id != b->file_handle->id)
+        return a->file_handle->id < b->file_handle->id ? -1 : 1;
+    if (a->idx != b->idx)
+        return a->idx < b->idx ? -1 : 1;
+    return 0;
+}
 
 xnresult_t xnpg_flush(struct xnpg *page, const uint8_t *buf) {
     xnmm_init();
@@ -36,7 +46,9 @@ xnresult_t xnpg_munmap(uint8_t *ptr) {
 }
 
 
-xnresult_t xnpg_write(struct xnpg *page, struct xntx *tx, const uint8_t *buf, int offset, size_t size, bool log) {
+//caller must be a write tx.  The tx's private copy of the page, read from its snapshot the first time the tx
+//touches the page unless the caller is about to overwrite all of it
+static xnresult_t xnpg_tx_copy(struct xnpg *page, struct xntx *tx, bool whole, uint8_t **out_cpy) {
     xnmm_init();
     xn_ensure(tx->mode == XNTXMODE_WR);
 
@@ -44,42 +56,155 @@ xnresult_t xnpg_write(struct xnpg *page, struct xntx *tx, const uint8_t *buf, in
 
     if (!(cpy = xntbl_find(tx->mod_pgs, page))) {
         xnmm_alloc(xn_free, xn_malloc, (void**)&cpy, XNPG_SZ);
-        xn_ensure(xnpg_copy(page, cpy));
+        if (!whole)
+            xn_ensure(xnmvcc_read(tx->db->mvcc, tx->db->pool, page, tx->snapshot, cpy, 0, XNPG_SZ));
         xn_ensure(xntbl_insert(tx->mod_pgs, page, cpy));
     }
 
+    *out_cpy = cpy;
+    return xn_ok();
+}
+
+static bool xnpg_is_zero(const uint8_t *buf, size_t size) {
+    for (size_t i = 0; i < size; i++) {
+        if (buf[i])
+            return false;
+    }
+    return true;
+}
+
+//appends one update record with the given ranges of the tx's copy of the page.  The record holds the file id, the
+//page index and a range count as varints, then per range a varint offset, a varint length shifted left by one
+//and the bytes.  Ranges of zeroes, such as freshly allocated pages, set XNPG_RANGE_ZERO in the length and leave
+//the bytes out
+static xnresult_t xnpg_log(struct xnpg *page, struct xntx *tx, const uint8_t *cpy, const struct xnpgrange *ranges, int count) {
+    xnmm_init();
+    xn_ensure(count > 0);
+
+    uint64_t file_id;
+    xn_ensure(xnlog_file_id(tx->db->log, tx->id, page->file_handle, &file_id));
+
+    size_t max_size = XN_VARINT_MAX * 3;
+    for (int i = 0; i < count; i++) {
+        xn_ensure(ranges[i].offset >= 0 && ranges[i].offset + ranges[i].size <= XNPG_SZ);
+        max_size += XN_VARINT_MAX * 2 + ranges[i].size;
+    }
+
+    xnmm_scoped_alloc(scoped_ptr1, xn_free, xn_malloc, &scoped_ptr1, max_size);
+    uint8_t *update_data = (uint8_t*)scoped_ptr1;
+
+    uint8_t *ptr = update_data;
+    ptr += xn_varint_put(ptr, file_id);
+    ptr += xn_varint_put(ptr, page->idx);
+    ptr += xn_varint_put(ptr, count);
+    for (int i = 0; i < count; i++) {
+        bool zero = xnpg_is_zero(cpy + ranges[i].offset, ranges[i].size);
+        ptr += xn_varint_put(ptr, ranges[i].offset);
+        ptr += xn_varint_put(ptr, (ranges[i].size << 1) | (zero ? XNPG_RANGE_ZERO : 0));
+        if (!zero) {
+            memcpy(ptr, cpy + ranges[i].offset, ranges[i].size);
+            ptr += ranges[i].size;
+        }
+    }
+    size_t data_size = ptr - update_data;
+
+    size_t rec_size = xnlog_record_size(tx->id, data_size);
+    xnmm_scoped_alloc(scoped_ptr2, xn_free, xn_malloc, &scoped_ptr2, rec_size);
+    uint8_t *rec = (uint8_t*)scoped_ptr2;
+    xn_ensure(xnlog_serialize_record(tx->id, XNLOGT_UPDATE, data_size, update_data, rec));
+    xn_ensure(xnlog_append(tx->db->log, rec, rec_size, NULL));
+
+    return xn_ok();
+}
+
+xnresult_t xnpg_write(struct xnpg *page, struct xntx *tx, const uint8_t *buf, int offset, size_t size, bool log) {
+    xnmm_init();
+    xn_ensure(offset + size <= XNPG_SZ);
+
+    uint8_t *cpy;
+    xn_ensure(xnpg_tx_copy(page, tx, offset == 0 && size == XNPG_SZ, &cpy));
     memcpy(cpy + offset, buf, size);
 
     if (log) {
-        //get filename from absolute file path
-        char filename_buf[strlen(page->file_handle->path) + 1];
-        memcpy(filename_buf, page->file_handle->path, strlen(page->file_handle->path) + 1);
-        char *filename = basename(filename_buf);
-        
-        uint64_t path_size = strlen(filename);
-        size_t data_size = sizeof(uint64_t) + path_size + sizeof(uint64_t) + sizeof(int) + size; //uint64_t = path size, uint64_t = page_idx, int = offset
-        xnmm_scoped_alloc(scoped_ptr1, xn_free, xn_malloc, &scoped_ptr1, data_size);
-        uint8_t *update_data = (uint8_t*)scoped_ptr1;
-
-        memcpy(update_data, (uint8_t*)&path_size, sizeof(uint64_t));
-        memcpy(update_data + sizeof(uint64_t), (uint8_t*)filename, path_size);
-        memcpy(update_data + sizeof(uint64_t) + path_size, &page->idx, sizeof(uint64_t));
-        memcpy(update_data + sizeof(uint64_t) * 2 + path_size, &offset, sizeof(int));
-        memcpy(update_data + sizeof(uint64_t) * 2 + path_size + sizeof(int), buf, size);
-
-        size_t rec_size = xnlog_record_size(data_size);
-        xnmm_scoped_alloc(scoped_ptr2, xn_free, xn_malloc, &scoped_ptr2, rec_size);
-        uint8_t *rec = (uint8_t*)scoped_ptr2;
-        xn_ensure(xnlog_serialize_record(tx->id, XNLOGT_UPDATE, data_size, update_data, rec));
-        xn_ensure(xnlog_append(tx->db->log, rec, rec_size));
+        struct xnpgrange range = { .offset = offset, .size = size };
+        xn_ensure(xnpg_log(page, tx, cpy, &range, 1));
     }
 
     return xn_ok();
 }
 
+//pins the write tx's private copy of the page and returns a pointer to it, so callers can read and modify
+//several fields without a table lookup and copy each.  The copy belongs to the tx, so the pointer stays valid
+//until the tx ends and there is nothing to unpin.  Every change has to be reported with xnpg_mark_dirty
+xnresult_t xnpg_pin(struct xnpg *page, struct xntx *tx, uint8_t **out_data) {
+    xnmm_init();
+    xn_ensure(xnpg_tx_copy(page, tx, false, out_data));
+    return xn_ok();
+}
+
+//pins the page like xnpg_pin for a caller about to overwrite all of it, so a page the tx hasn't touched yet is
+//not read from its snapshot first.  The bytes are undefined until the caller writes them
+xnresult_t xnpg_pin_overwrite(struct xnpg *page, struct xntx *tx, uint8_t **out_data) {
+    xnmm_init();
+    xn_ensure(xnpg_tx_copy(page, tx, true, out_data));
+    return xn_ok();
+}
+
+//logs the ranges of a page modified through xnpg_pin as one record, so an operation that touches several
+//fields of a page costs one log append
+xnresult_t xnpg_mark_dirty(struct xnpg *page, struct xntx *tx, const struct xnpgrange *ranges, int count) {
+    xnmm_init();
+    xn_ensure(tx->mode == XNTXMODE_WR);
+
+    uint8_t *cpy;
+    xn_ensure((cpy = xntbl_find(tx->mod_pgs, page)));
+    xn_ensure(xnpg_log(page, tx, cpy, ranges, count));
+    return xn_ok();
+}
+
+//writes the byte ranges where buf differs from old, and logs them all in one record, so a change to a node read
+//into memory logs a few slots and records rather than the whole page
+xnresult_t xnpg_write_diff(struct xnpg *page, struct xntx *tx, const uint8_t *old, const uint8_t *buf) {
+    xnmm_init();
+
+    xnmm_scoped_alloc(scoped_ptr, xn_free, xn_malloc, &scoped_ptr, XNPG_MAX_RANGES * sizeof(struct xnpgrange));
+    struct xnpgrange *ranges = (struct xnpgrange*)scoped_ptr;
+    int count = 0;
+
+    int i = 0;
+    while (i < XNPG_SZ) {
+        if (old[i] == buf[i]) {
+            i++;
+            continue;
+        }
+
+        int end = i + 1;
+        for (int j = end; j < XNPG_SZ && j - end < XNPG_DIFF_GAP; j++) {
+            if (old[j] != buf[j])
+                end = j + 1;
+        }
+
+        ranges[count].offset = i;
+        ranges[count].size = end - i;
+        count++;
+        i = end;
+    }
+
+    if (count == 0)
+        return xn_ok();
+
+    uint8_t *cpy;
+    xn_ensure(xnpg_tx_copy(page, tx, false, &cpy));
+    for (int r = 0; r < count; r++)
+        memcpy(cpy + ranges[r].offset, buf + ranges[r].offset, ranges[r].size);
+    xn_ensure(xnpg_log(page, tx, cpy, ranges, count));
+
+    return xn_ok();
+}
+
 xnresult_t xnpg_read(struct xnpg *page, struct xntx *tx, uint8_t *buf, int offset, size_t size) {
     xnmm_init();
-    if (tx->mode == XNTXMODE_WR || tx->mod_pgs) {
+    if (tx->mode == XNTXMODE_WR) {
         uint8_t *cpy;
 
         if ((cpy = xntbl_find(tx->mod_pgs, page))) {
@@ -88,14 +213,15 @@ xnresult_t xnpg_read(struct xnpg *page, struct xntx *tx, uint8_t *buf, int offse
         }
     }
 
-    uint8_t *ptr;
-    if (!(ptr = xntbl_find(tx->db->pg_tbl, page))) {
-        xn_ensure(xnpg_mmap(page, &ptr));
-        xn_ensure(xntbl_insert(tx->db->pg_tbl, page, ptr));
-    }
-
-    memcpy(buf, ptr + offset, size);
+    xn_ensure(xnmvcc_read(tx->db->mvcc, tx->db->pool, page, tx->snapshot, buf, offset, size));
 
     return xn_ok();
 }
 
+
+//hint that the pages [first, first + count) will be read soon.  Reads them into the buffer pool in one batch
+xnresult_t xnpg_prefetch(struct xnpg *first, struct xntx *tx, int count) {
+    xnmm_init();
+    xn_ensure(xnpool_prefetch(tx->db->pool, first, count));
+    return xn_ok();
+}
@@ -5,15 +5,37 @@
 
 #define XNPG_SZ 4096
 
+//differing bytes closer than this are logged as one range, since each range in an update record has a header of
+//up to 4 bytes
+#define XNPG_DIFF_GAP 4
+
+//set in the low bit of the length of a logged range that is all zeroes, whose bytes are left out of the record
+#define XNPG_RANGE_ZERO 1
+
+//most ranges xnpg_write_diff can find in a page
+#define XNPG_MAX_RANGES (XNPG_SZ / (XNPG_DIFF_GAP + 1) + 1)
+
 struct xntx;
 struct xnpg {
     struct xnfile *file_handle;
     uint64_t idx;
 };
 
+//bytes [offset, offset + size) of a page
+struct xnpgrange {
+    int offset;
+    size_t size;
+};
+
+int xnpg_compare(const struct xnpg *a, const struct xnpg *b);
 xnresult_t xnpg_flush(struct xnpg *page, const uint8_t *buf);
 xnresult_t xnpg_copy(struct xnpg *page, uint8_t *buf);
 xnresult_t xnpg_mmap(struct xnpg *page, uint8_t **ptr);
 xnresult_t xnpg_munmap(uint8_t *ptr);
 xnresult_t xnpg_write(struct xnpg *page, struct xntx *tx, const uint8_t *buf, int offset, size_t size, bool log);
+xnresult_t xnpg_write_diff(struct xnpg *page, struct xntx *tx, const uint8_t *old, const uint8_t *buf);
+xnresult_t xnpg_pin(struct xnpg *page, struct xntx *tx, uint8_t **out_data);
+xnresult_t xnpg_pin_overwrite(struct xnpg *page, struct xntx *tx, uint8_t **out_data);
+xnresult_t xnpg_mark_dirty(struct xnpg *page, struct xntx *tx, const struct xnpgrange *ranges, int count);
 xnresult_t xnpg_read(struct xnpg *page, struct xntx *tx, uint8_t *buf, int offset, size_t size);
+xnresult_t xnpg_prefetch(struct xnpg *first, struct xntx *tx, int count);
@@ -0,0 +1,340 @@
+#include "pool.h"
+#include "log.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+xnresult_t xnpool_create(struct xnpool **out_pool, int capacity) {
+    xnmm_init();
+    xn_ensure(capacity > 0);
+
+    struct xnpool *pool;
+    xnmm_alloc(xn_free, xn_malloc, (void**)&pool, sizeof(struct xnpool));
+    xnmm_alloc(xn_free, xn_malloc, (void**)&pool->frames, sizeof(struct xnframe) * capacity);
+    xnmm_alloc(xn_free, xn_aligned_malloc, (void**)&pool->buf, XNPG_SZ * capacity);
+    xnmm_alloc(xntbl_free, xntbl_create, &pool->tbl, false);
+    xnmm_alloc(xnmtx_free, xnmtx_create, &pool->lock);
+
+    for (int i = 0; i < capacity; i++) {
+        struct xnframe *frame = &pool->frames[i];
+        frame->data = pool->buf + i * XNPG_SZ;
+        frame->pin_count = 0;
+        frame->valid = false;
+        frame->dirty = false;
+        frame->referenced = false;
+        frame->lsn = 0;
+    }
+
+    pool->capacity = capacity;
+    pool->clock_hand = 0;
+    pool->log = NULL;
+
+    *out_pool = pool;
+    return xn_ok();
+}
+
+//dirty frames are not written back here - call xnpool_flush first
+xnresult_t xnpool_free(void **p) {
+    xnmm_init();
+    struct xnpool *pool = (struct xnpool*)(*p);
+
+    //table does not own the frames, so remove entries before freeing it
+    for (int i = 0; i < pool->capacity; i++) {
+        struct xnframe *frame = &pool->frames[i];
+        if (frame->valid)
+            xn_ensure(xntbl_remove(pool->tbl, &frame->page));
+    }
+
+    xn_ensure(xntbl_free((void**)&pool->tbl));
+    xn_ensure(xnmtx_free((void**)&pool->lock));
+    free(pool->buf);
+    free(pool->frames);
+    free(pool);
+    return xn_ok();
+}
+
+//clock (second-chance) replacement.  Two sweeps clears the reference bit of every
+//unpinned frame, so if no victim is found by then all frames are pinned
+static xnresult_t xnpool_find_victim(struct xnpool *pool, struct xnframe **out_frame) {
+    xnmm_init();
+
+    for (int i = 0; i < pool->capacity * 2; i++) {
+        struct xnframe *frame = &pool->frames[pool->clock_hand];
+        pool->clock_hand = (pool->clock_hand + 1) % pool->capacity;
+
+        if (!frame->valid) {
+            *out_frame = frame;
+            return xn_ok();
+        }
+
+        if (frame->pin_count > 0)
+            continue;
+
+        if (frame->referenced) {
+            frame->referenced = false;
+            continue;
+        }
+
+        *out_frame = frame;
+        return xn_ok();
+    }
+
+    xn_ensure(false);
+    return xn_ok();
+}
+
+//caller must hold pool lock.  Pages changed in place rather than through versions, like the free map, carry the lsn
+//of their log records, and write-ahead logging means those records have to be durable before the page is written
+static xnresult_t xnpool_wait_logged(struct xnpool *pool, uint64_t lsn) {
+    xnmm_init();
+    if (lsn > 0 && pool->log)
+        xn_ensure(xnlog_wait_durable(pool->log, lsn));
+    return xn_ok();
+}
+
+//caller must hold pool lock
+static xnresult_t xnpool_evict(struct xnpool *pool, struct xnframe *frame) {
+    xnmm_init();
+    if (frame->dirty) {
+        xn_ensure(xnpool_wait_logged(pool, frame->lsn));
+        xn_ensure(xnpg_flush(&frame->page, frame->data));
+    }
+    xn_ensure(xntbl_remove(pool->tbl, &frame->page));
+    frame->valid = false;
+    frame->dirty = false;
+    frame->lsn = 0;
+    return xn_ok();
+}
+
+//caller must hold pool lock
+static xnresult_t xnpool_load(struct xnpool *pool, struct xnpg *page, struct xnframe **out_frame) {
+    xnmm_init();
+
+    struct xnframe *frame;
+    xn_ensure(xnpool_find_victim(pool, &frame));
+
+    if (frame->valid)
+        xn_ensure(xnpool_evict(pool, frame));
+
+    xn_ensure(xnpg_copy(page, frame->data));
+    xn_ensure(xntbl_insert(pool->tbl, page, (uint8_t*)frame));
+    frame->page = *page;
+    frame->valid = true;
+
+    *out_frame = frame;
+    return xn_ok();
+}
+
+//caller must hold pool lock
+static xnresult_t xnpool_pin_locked(struct xnpool *pool, struct xnpg *page, struct xnframe **out_frame) {
+    xnmm_init();
+
+    struct xnframe *frame;
+    if (!(frame = (struct xnframe*)xntbl_find(pool->tbl, page))) {
+        xn_ensure(xnpool_load(pool, page, &frame));
+    }
+
+    frame->pin_count++;
+    frame->referenced = true;
+
+    *out_frame = frame;
+    return xn_ok();
+}
+
+//pinned frames are never evicted, so frame->data is valid until xnpool_unpin is called
+xnresult_t xnpool_pin(struct xnpool *pool, struct xnpg *page, struct xnframe **out_frame) {
+    xnmm_init();
+    xn_ensure(xn_mutex_lock(pool->lock));
+    bool ok = xnpool_pin_locked(pool, page, out_frame);
+    xn_ensure(xn_mutex_unlock(pool->lock));
+    xn_ensure(ok);
+    return xn_ok();
+}
+
+xnresult_t xnpool_unpin(struct xnpool *pool, struct xnframe *frame, bool dirty) {
+    xnmm_init();
+    xn_ensure(xn_mutex_lock(pool->lock));
+    frame->pin_count--;
+    frame->dirty |= dirty;
+    xn_ensure(xn_mutex_unlock(pool->lock));
+    return xn_ok();
+}
+
+//unpins a frame changed in place after appending the log records that end at lsn.  The frame isn't written back
+//until they are durable
+xnresult_t xnpool_unpin_logged(struct xnpool *pool, struct xnframe *frame, uint64_t lsn) {
+    xnmm_init();
+    xn_ensure(xn_mutex_lock(pool->lock));
+    frame->pin_count--;
+    frame->dirty = true;
+    if (lsn > frame->lsn)
+        frame->lsn = lsn;
+    xn_ensure(xn_mutex_unlock(pool->lock));
+    return xn_ok();
+}
+
+xnresult_t xnpool_read(struct xnpool *pool, struct xnpg *page, uint8_t *buf, int offset, size_t size) {
+    xnmm_init();
+    xn_ensure(offset + size <= XNPG_SZ);
+
+    struct xnframe *frame;
+    xn_ensure(xnpool_pin(pool, page, &frame));
+    memcpy(buf, frame->data + offset, size);
+    xn_ensure(xnpool_unpin(pool, frame, false));
+
+    return xn_ok();
+}
+
+//overwrites the entire page in the pool.  The page is only written to disk when evicted or flushed
+xnresult_t xnpool_write(struct xnpool *pool, struct xnpg *page, const uint8_t *buf) {
+    xnmm_init();
+
+    struct xnframe *frame;
+    xn_ensure(xnpool_pin(pool, page, &frame));
+    memcpy(frame->data, buf, XNPG_SZ);
+    xn_ensure(xnpool_unpin(pool, frame, true));
+
+    return xn_ok();
+}
+
+//caller must hold pool lock
+static xnresult_t xnpool_write_back(struct xnframe **frames, struct xnfileiov *pages, int count) {
+    xnmm_init();
+    if (count == 0)
+        return xn_ok();
+
+    xn_ensure(xnfile_writev(frames[0]->page.file_handle, pages, count));
+    for (int i = 0; i < count; i++) {
+        frames[i]->dirty = false;
+        frames[i]->lsn = 0;
+    }
+
+    return xn_ok();
+}
+
+static int xnpool_compare_frames(const void *a, const void *b) {
+    return xnpg_compare(&(*(struct xnframe**)a)->page, &(*(struct xnframe**)b)->page);
+}
+
+//caller must hold pool lock.  Dirty frames are sorted by file and page index, so each file gets one
+//xnfile_writev call and every run of adjacent pages is written with a single pwritev
+static xnresult_t xnpool_flush_locked(struct xnpool *pool) {
+    xnmm_init();
+
+    xnmm_scoped_alloc(scoped_frames, xn_free, xn_malloc, &scoped_frames, pool->capacity * sizeof(struct xnframe*));
+    struct xnframe **frames = (struct xnframe**)scoped_frames;
+    xnmm_scoped_alloc(scoped_pages, xn_free, xn_malloc, &scoped_pages, pool->capacity * sizeof(struct xnfileiov));
+    struct xnfileiov *pages = (struct xnfileiov*)scoped_pages;
+
+    int count = 0;
+    uint64_t lsn = 0;
+    for (int i = 0; i < pool->capacity; i++) {
+        struct xnframe *frame = &pool->frames[i];
+        if (frame->valid && frame->dirty) {
+            frames[count++] = frame;
+            if (frame->lsn > lsn)
+                lsn = frame->lsn;
+        }
+    }
+    qsort(frames, count, sizeof(struct xnframe*), xnpool_compare_frames);
+    xn_ensure(xnpool_wait_logged(pool, lsn));
+
+    int start = 0;
+    for (int i = 0; i < count; i++) {
+        pages[i].idx = frames[i]->page.idx;
+        pages[i].buf = frames[i]->data;
+        if (i + 1 == count || frames[i + 1]->page.file_handle != frames[start]->page.file_handle) {
+            xn_ensure(xnpool_write_back(frames + start, pages + start, i + 1 - start));
+            start = i + 1;
+        }
+    }
+
+    return xn_ok();
+}
+
+//write all dirty frames back to disk
+xnresult_t xnpool_flush(struct xnpool *pool) {
+    xnmm_init();
+    xn_ensure(xn_mutex_lock(pool->lock));
+    bool ok = xnpool_flush_locked(pool);
+    xn_ensure(xn_mutex_unlock(pool->lock));
+    xn_ensure(ok);
+    return xn_ok();
+}
+
+//caller must hold pool lock.  Frames are claimed, pinned and put in the table before the read, so the clock can't
+//hand the same frame out twice.  *out_n counts the frames claimed so far, so the caller can release them if this
+//fails partway
+static xnresult_t xnpool_claim_frames_locked(struct xnpool *pool, struct xnpg *first, int count, struct xnframe **frames, struct xnfileiov *pages, int *out_n) {
+    xnmm_init();
+
+    for (int i = 0; i < count; i++) {
+        struct xnpg page = { .file_handle = first->file_handle, .idx = first->idx + i };
+        if ((page.idx + 1) * XNPG_SZ > page.file_handle->size)
+            break;
+        if (xntbl_find(pool->tbl, &page))
+            continue;
+
+        struct xnframe *frame;
+        xn_ensure(xnpool_find_victim(pool, &frame));
+        if (frame->valid)
+            xn_ensure(xnpool_evict(pool, frame));
+
+        xn_ensure(xntbl_insert(pool->tbl, &page, (uint8_t*)frame));
+        frame->page = page;
+        frame->valid = true;
+        frame->referenced = false;
+        frame->pin_count++;
+        frames[*out_n] = frame;
+        pages[*out_n].idx = page.idx;
+        pages[*out_n].buf = frame->data;
+        (*out_n)++;
+    }
+
+    return xn_ok();
+}
+
+//caller must hold pool lock.  The lock is held throughout, so no one else sees the claimed frames before the
+//data arrives.  If claiming or the read fails, every claimed frame is unpinned and dropped from the table, so
+//none is left pinned or serving a page that was never read
+static xnresult_t xnpool_prefetch_locked(struct xnpool *pool, struct xnpg *first, int count, struct xnframe **frames, struct xnfileiov *pages) {
+    xnmm_init();
+
+    int n = 0;
+    bool ok = xnpool_claim_frames_locked(pool, first, count, frames, pages, &n) &&
+              xnfile_readv(first->file_handle, pages, n);
+    bool removed = true;
+    for (int i = 0; i < n; i++) {
+        frames[i]->pin_count--;
+        if (!ok) {
+            removed = xntbl_remove(pool->tbl, &frames[i]->page) && removed;
+            frames[i]->valid = false;
+        }
+    }
+    xn_ensure(removed);
+    xn_ensure(ok);
+
+    return xn_ok();
+}
+
+//loads the pages [first, first + count) that aren't already in the pool with one batch of reads, so a sequential
+//scan pays for one I/O per run rather than one per page.  Pages past the end of the file are skipped
+xnresult_t xnpool_prefetch(struct xnpool *pool, struct xnpg *first, int count) {
+    xnmm_init();
+
+    if (count > pool->capacity / 4)
+        count = pool->capacity / 4;
+    if (count <= 0)
+        return xn_ok();
+
+    xnmm_scoped_alloc(scoped_frames, xn_free, xn_malloc, &scoped_frames, count * sizeof(struct xnframe*));
+    struct xnframe **frames = (struct xnframe**)scoped_frames;
+    xnmm_scoped_alloc(scoped_pages, xn_free, xn_malloc, &scoped_pages, count * sizeof(struct xnfileiov));
+    struct xnfileiov *pages = (struct xnfileiov*)scoped_pages;
+
+    xn_ensure(xn_mutex_lock(pool->lock));
+    bool ok = xnpool_prefetch_locked(pool, first, count, frames, pages);
+    xn_ensure(xn_mutex_unlock(pool->lock));
+    xn_ensure(ok);
+    return xn_ok();
+}
@@ -0,0 +1,41 @@
+#pragma once
+
+#include "page.h"
+#include "table.h"
+
+#define XNPOOL_DEFAULT_FRAMES 1024
+
+//pages read ahead by one prefetch.  Capped at a quarter of the pool so read-ahead can't push out the working set
+#define XNPOOL_READAHEAD 32
+
+struct xnlog;
+
+struct xnframe {
+    struct xnpg page;
+    uint8_t *data;
+    int pin_count;
+    bool valid;
+    bool dirty;
+    bool referenced;
+    uint64_t lsn;       //log end the frame's changes were recorded up to, or 0.  Written back only once that is durable
+};
+
+struct xnpool {
+    struct xnframe *frames;
+    int capacity;
+    int clock_hand;
+    uint8_t *buf;
+    struct xntbl *tbl;
+    pthread_mutex_t *lock;
+    struct xnlog *log;  //waited on before writing back frames with an lsn, if set.  Not owned
+};
+
+xnresult_t xnpool_create(struct xnpool **out_pool, int capacity);
+xnresult_t xnpool_free(void **p);
+xnresult_t xnpool_pin(struct xnpool *pool, struct xnpg *page, struct xnframe **out_frame);
+xnresult_t xnpool_unpin(struct xnpool *pool, struct xnframe *frame, bool dirty);
+xnresult_t xnpool_unpin_logged(struct xnpool *pool, struct xnframe *frame, uint64_t lsn);
+xnresult_t xnpool_read(struct xnpool *pool, struct xnpg *page, uint8_t *buf, int offset, size_t size);
+xnresult_t xnpool_write(struct xnpool *pool, struct xnpg *page, const uint8_t *buf);
+xnresult_t xnpool_flush(struct xnpool *pool);
+xnresult_t xnpool_prefetch(struct xnpool *pool, struct xnpg *first, int count);
@@ -0,0 +1,119 @@
+#include "pq.h"
+
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define XNPQ_X86
+#include <immintrin.h>
+#endif
+
+size_t xnpq_codebooks_size(int dim) {
+    return (size_t)XNPQ_KSUB * dim * sizeof(float);
+}
+
+xnresult_t xnpq_init(struct xnpq *pq, int dim, int m, float *codebooks) {
+    xnmm_init();
+    xn_ensure(dim > 0 && m > 0 && dim % m == 0);
+
+    pq->dim = dim;
+    pq->m = m;
+    pq->dsub = dim / m;
+    pq->codebooks = codebooks;
+    return xn_ok();
+}
+
+//runs k-means separately in each subspace.  Needs at least XNPQ_KSUB training vectors
+xnresult_t xnpq_train(struct xnpq *pq, const float *data, int count, int threads) {
+    xnmm_init();
+    xn_ensure(count >= XNPQ_KSUB);
+
+    xnmm_scoped_alloc(scoped_sub, xn_free, xn_malloc, &scoped_sub, (size_t)count * pq->dsub * sizeof(float));
+    float *sub = (float*)scoped_sub;
+    struct xnkmopts opts = xnvec_kmeans_default_opts(XNPQ_KSUB);
+    opts.threads = threads;
+
+    for (int j = 0; j < pq->m; j++) {
+        for (int i = 0; i < count; i++)
+            memcpy(sub + (size_t)i * pq->dsub, data + (size_t)i * pq->dim + j * pq->dsub, pq->dsub * sizeof(float));
+        xn_ensure(xnvec_kmeans(sub, count, pq->dsub, opts, pq->codebooks + (size_t)j * XNPQ_KSUB * pq->dsub, NULL));
+    }
+
+    return xn_ok();
+}
+
+void xnpq_encode(const struct xnpq *pq, const float *vecs, int count, uint8_t *codes) {
+    for (int i = 0; i < count; i++) {
+        const float *v = vecs + (size_t)i * pq->dim;
+        for (int j = 0; j < pq->m; j++) {
+            const float *codebook = pq->codebooks + (size_t)j * XNPQ_KSUB * pq->dsub;
+            codes[(size_t)i * pq->m + j] = xnvec_nearest(XNVM_L2, v + j * pq->dsub, codebook, XNPQ_KSUB, pq->dsub);
+        }
+    }
+}
+
+void xnpq_decode(const struct xnpq *pq, const uint8_t *codes, int count, float *vecs) {
+    for (int i = 0; i < count; i++) {
+        for (int j = 0; j < pq->m; j++) {
+            const float *centroid = pq->codebooks + ((size_t)j * XNPQ_KSUB + codes[(size_t)i * pq->m + j]) * pq->dsub;
+            memcpy(vecs + (size_t)i * pq->dim + j * pq->dsub, centroid, pq->dsub * sizeof(float));
+        }
+    }
+}
+
+//fills table with m * XNPQ_KSUB distances from each query subvector to each centroid of its subspace.  Summing
+//one entry per subspace gives the distance to a coded vector: squared L2 for XNVM_L2, negative inner product
+//for the others.  Cosine callers normalize vectors first and add 1
+void xnpq_table(const struct xnpq *pq, enum xnvmetric metric, const float *query, float *table) {
+    enum xnvmetric sub_metric = metric == XNVM_L2 ? XNVM_L2 : XNVM_IP;
+    for (int j = 0; j < pq->m; j++) {
+        xnvec_rank_distances(sub_metric, query + j * pq->dsub, pq->codebooks + (size_t)j * XNPQ_KSUB * pq->dsub,
+                             XNPQ_KSUB, pq->dsub, table + (size_t)j * XNPQ_KSUB);
+    }
+}
+
+static void xnpq_adc_scalar(const float *table, int m, const uint8_t *codes, int count, float *out_dists) {
+    for (int i = 0; i < count; i++) {
+        const uint8_t *code = codes + (size_t)i * m;
+        float dist = 0.0f;
+        for (int j = 0; j < m; j++)
+            dist += table[j * XNPQ_KSUB + code[j]];
+        out_dists[i] = dist;
+    }
+}
+
+#ifdef XNPQ_X86
+
+//eight codes at a time, gathering one table entry per code for each subspace
+__attribute__((target("avx2")))
+static void xnpq_adc_avx2(const float *table, int m, const uint8_t *codes, int count, float *out_dists) {
+    int i = 0;
+    for (; i + 8 <= count; i += 8) {
+        const uint8_t *c = codes + (size_t)i * m;
+        __m256 acc = _mm256_setzero_ps();
+        for (int j = 0; j < m; j++) {
+            __m256i idx = _mm256_setr_epi32(c[j], c[m + j], c[2 * m + j], c[3 * m + j],
+                                            c[4 * m + j], c[5 * m + j], c[6 * m + j], c[7 * m + j]);
+            acc = _mm256_add_ps(acc, _mm256_i32gather_ps(table + j * XNPQ_KSUB, idx, 4));
+        }
+        _mm256_storeu_ps(out_dists + i, acc);
+    }
+    xnpq_adc_scalar(table, m, codes + (size_t)i * m, count - i, out_dists + i);
+}
+
+#endif
+
+//distances from the query a table was built for to count codes, using the instruction set chosen in vector.c.
+//16-wide AVX-512 gathers measured slower than scalar lookups, so AVX-512 cpus use the AVX2 loop
+void xnpq_adc(const float *table, int m, const uint8_t *codes, int count, float *out_dists) {
+    switch (xnvec_isa()) {
+#ifdef XNPQ_X86
+        case XNVISA_AVX512:
+        case XNVISA_AVX2:
+            xnpq_adc_avx2(table, m, codes, count, out_dists);
+            return;
+#endif
+        default:
+            xnpq_adc_scalar(table, m, codes, count, out_dists);
+            return;
+    }
+}
@@ -0,0 +1,25 @@
+#pragma once
+
+#include "util.h"
+#include "vector.h"
+
+//centroids per subquantizer, so each subvector is coded in one byte
+#define XNPQ_KSUB 256
+
+//product quantizer.  A vector is split into m subvectors of dim / m floats, and each is replaced by the index
+//of its nearest centroid in that subspace's codebook, giving an m byte code.  codebooks is caller-owned and
+//holds m * XNPQ_KSUB * dsub floats - codebook j starts at j * XNPQ_KSUB * dsub
+struct xnpq {
+    int dim;
+    int m;
+    int dsub;
+    float *codebooks;
+};
+
+size_t xnpq_codebooks_size(int dim);
+xnresult_t xnpq_init(struct xnpq *pq, int dim, int m, float *codebooks);
+xnresult_t xnpq_train(struct xnpq *pq, const float *data, int count, int threads);
+void xnpq_encode(const struct xnpq *pq, const float *vecs, int count, uint8_t *codes);
+void xnpq_decode(const struct xnpq *pq, const uint8_t *codes, int count, float *vecs);
+void xnpq_table(const struct xnpq *pq, enum xnvmetric metric, const float *query, float *table);
+void xnpq_adc(const float *table, int m, const uint8_t *codes, int count, float *out_dists);
@@ -3,14 +3,35 @@
 #include <stdlib.h>
 #include <string.h>
 
+static inline unsigned __int128 xntbl_key(struct xnpg *page) {
+    return ((unsigned __int128)page->file_handle->id << 64) | page->idx;
+}
+
+//64-bit finalizer from MurmurHash3 applied to both halves of the key
+static inline uint64_t xntbl_hash(unsigned __int128 key) {
+    uint64_t h = (uint64_t)key ^ ((uint64_t)(key >> 64) * 0x9e3779b97f4a7c15ull);
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdull;
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53ull;
+    h ^= h >> 33;
+    return h;
+}
+
+static inline int xntbl_slot(struct xntbl *tbl, unsigned __int128 key) {
+    return xntbl_hash(key) & (tbl->capacity - 1);
+}
+
 xnresult_t xntbl_create(struct xntbl **out_tbl, bool mapped) {
     xnmm_init();
 
     struct xntbl *tbl;
     xnmm_alloc(xn_free, xn_malloc, (void**)&tbl, sizeof(struct xntbl));
-    xnmm_alloc(xn_free, xn_malloc, (void**)&tbl->entries, sizeof(struct xnentry*) * XNTBL_MAX_BUCKETS);
+    xnmm_alloc(xn_free, xn_malloc, (void**)&tbl->entries, sizeof(struct xnentry) * XNTBL_INIT_CAPACITY);
 
-    memset(tbl->entries, 0, sizeof(struct xnentry*) * XNTBL_MAX_BUCKETS);
+    memset(tbl->entries, 0, sizeof(struct xnentry) * XNTBL_INIT_CAPACITY);
+    tbl->count = 0;
+    tbl->capacity = XNTBL_INIT_CAPACITY;
     tbl->mapped = mapped;
 
     *out_tbl = tbl;
@@ -20,17 +41,15 @@ xnresult_t xntbl_create(struct xntbl **out_tbl, bool mapped) {
 xnresult_t xntbl_free(void **t) {
     xnmm_init();
     struct xntbl* tbl = (struct xntbl*)(*t);
-    for (int i = 0; i < XNTBL_MAX_BUCKETS; i++) {
-        struct xnentry *cur = tbl->entries[i];
-        while (cur) {
-            struct xnentry *next = cur->next;
-            if (tbl->mapped) {
-                xn_ensure(xnpg_munmap(cur->val));
-            } else {
-                free(cur->val);
-            }
-            free(cur);
-            cur = next;
+    for (int i = 0; i < tbl->capacity; i++) {
+        struct xnentry *entry = &tbl->entries[i];
+        if (!entry->val)
+            continue;
+
+        if (tbl->mapped) {
+            xn_ensure(xnpg_munmap(entry->val));
+        } else {
+            free(entry->val);
         }
     }
     free(tbl->entries);
@@ -40,60 +59,104 @@ xnresult_t xntbl_free(void **t) {
 }
 
 uint8_t* xntbl_find(struct xntbl *tbl, struct xnpg *page) {
-    xnmm_init();
-    size_t path_size = strlen(page->file_handle->path);
-    size_t size = path_size + sizeof(uint64_t);
-    xnmm_scoped_alloc(scoped_ptr, xn_free, xn_malloc, &scoped_ptr, size);
-    uint8_t *buf = (uint8_t*)scoped_ptr;  
-    memcpy(buf, page->file_handle->path, path_size);
-    memcpy(buf + path_size, &page->idx, sizeof(uint64_t));
-    uint32_t hash = xn_hash(buf, size);
-    uint32_t bucket = hash % XNTBL_MAX_BUCKETS;
-    struct xnentry* cur = tbl->entries[bucket];
-
-    while (cur) {
-        if (cur->page.idx == page->idx && strcmp(cur->page.file_handle->path, page->file_handle->path) == 0) {
-            xnmm_cleanup_all();
-            return cur->val;
-        }
+    unsigned __int128 key = xntbl_key(page);
+    int mask = tbl->capacity - 1;
 
-        cur = cur->next;
+    for (int i = xntbl_slot(tbl, key); tbl->entries[i].val; i = (i + 1) & mask) {
+        if (tbl->entries[i].key == key)
+            return tbl->entries[i].val;
     }
 
-    xnmm_cleanup_all();
     return NULL;
 }
 
+static xnresult_t xntbl_grow(struct xntbl *tbl) {
+    xnmm_init();
+
+    struct xnentry *old_entries = tbl->entries;
+    int old_capacity = tbl->capacity;
+    int capacity = old_capacity * 2;
+
+    struct xnentry *entries;
+    xn_ensure(xn_malloc((void**)&entries, sizeof(struct xnentry) * capacity));
+    memset(entries, 0, sizeof(struct xnentry) * capacity);
+
+    tbl->entries = entries;
+    tbl->capacity = capacity;
+
+    //rehash existing entries - keys are unique so no need to check for duplicates
+    for (int i = 0; i < old_capacity; i++) {
+        if (!old_entries[i].val)
+            continue;
+
+        int j = xntbl_slot(tbl, old_entries[i].key);
+        while (entries[j].val)
+            j = (j + 1) & (capacity - 1);
+        entries[j] = old_entries[i];
+    }
+
+    free(old_entries);
+    return xn_ok();
+}
+
 xnresult_t xntbl_insert(struct xntbl *tbl, struct xnpg *page, uint8_t *val) {
     xnmm_init();
-    size_t path_size = strlen(page->file_handle->path);
-    size_t size = path_size + sizeof(uint64_t);
-    xnmm_scoped_alloc(scoped_ptr, xn_free, xn_malloc, &scoped_ptr, size);
-    uint8_t *buf = (uint8_t*)scoped_ptr;  
-    memcpy(buf, page->file_handle->path, path_size);
-    memcpy(buf + path_size, &page->idx, sizeof(uint64_t));
-    uint32_t hash = xn_hash(buf, size);
-    uint32_t bucket = hash % XNTBL_MAX_BUCKETS;
-    struct xnentry* cur = tbl->entries[bucket];
-
-    while (cur) {
-        if (cur->page.idx == page->idx && strcmp(cur->page.file_handle->path, page->file_handle->path) == 0) {
-            cur->val = val;
+    xn_ensure(val != NULL);
+
+    if ((tbl->count + 1) * 2 > tbl->capacity)
+        xn_ensure(xntbl_grow(tbl));
+
+    unsigned __int128 key = xntbl_key(page);
+    int mask = tbl->capacity - 1;
+    int i;
+
+    for (i = xntbl_slot(tbl, key); tbl->entries[i].val; i = (i + 1) & mask) {
+        if (tbl->entries[i].key == key) {
+            tbl->entries[i].val = val;
             return xn_ok();
         }
-            
-        cur = cur->next;
     }
 
-    //insert at beginning of linked-list
-    struct xnentry* head = tbl->entries[bucket];
-    struct xnentry* entry;
-    xnmm_alloc(xn_free, xn_malloc, (void**)&entry, sizeof(struct xnentry));
+    tbl->entries[i].key = key;
+    tbl->entries[i].page = *page;
+    tbl->entries[i].val = val;
+    tbl->count++;
+
+    return xn_ok();
+}
+
+//removes the entry but does not free the value - caller is responsible for it.
+//Uses backward shift deletion so probe sequences never need tombstones
+xnresult_t xntbl_remove(struct xntbl *tbl, struct xnpg *page) {
+    xnmm_init();
+
+    unsigned __int128 key = xntbl_key(page);
+    int mask = tbl->capacity - 1;
+    int i;
+
+    for (i = xntbl_slot(tbl, key); tbl->entries[i].val; i = (i + 1) & mask) {
+        if (tbl->entries[i].key == key)
+            break;
+    }
+
+    xn_ensure(tbl->entries[i].val != NULL);
+
+    int j = i;
+    while (true) {
+        j = (j + 1) & mask;
+        if (!tbl->entries[j].val)
+            break;
+
+        //entry at j can fill the hole at i only if its home slot is not cyclically in (i, j]
+        int home = xntbl_slot(tbl, tbl->entries[j].key);
+        if (((j - home) & mask) >= ((j - i) & mask)) {
+            tbl->entries[i] = tbl->entries[j];
+            i = j;
+        }
+    }
 
-    entry->next = head;
-    entry->page = *page;
-    entry->val = val;
-    tbl->entries[bucket] = entry;
+    memset(&tbl->entries[i], 0, sizeof(struct xnentry));
+    tbl->count--;
 
     return xn_ok();
 }
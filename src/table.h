@@ -2,16 +2,19 @@
 
 #include "page.h"
 
-#define XNTBL_MAX_BUCKETS 128
+#define XNTBL_INIT_CAPACITY 64
 
+//empty slots have a NULL val
 struct xnentry {
+    unsigned __int128 key;
     struct xnpg page;
     uint8_t *val;
-    struct xnentry *next;
 };
 
+//open addressing with linear probing.  Capacity is always a power of two
+//and the table doubles in size when it is half full
 struct xntbl {
-    struct xnentry **entries;
+    struct xnentry *entries;
     int count;
     int capacity;
     bool mapped;
@@ -21,3 +24,4 @@ xnresult_t xntbl_create(struct xntbl **out_tbl, bool mapped);
 xnresult_t xntbl_free(void **tbl);
 uint8_t* xntbl_find(struct xntbl *tbl, struct xnpg *page);
 xnresult_t xntbl_insert(struct xntbl *tbl, struct xnpg *page, uint8_t *val);
+xnresult_t xntbl_remove(struct xntbl *tbl, struct xnpg *page);
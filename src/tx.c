@@ -1,15 +1,14 @@
 #include "tx.h"
 #include "log.h"
 #include "db.h"
+#include "pool.h"
+#include "mvcc.h"
 
 #include <assert.h>
 #include <stdint.h>
 #include <stdlib.h>
 
 
-pthread_cond_t disk_rdtxs_cv = PTHREAD_COND_INITIALIZER;
-pthread_cond_t mem_rdtxs_cv = PTHREAD_COND_INITIALIZER;
-
 xnresult_t xntx_create(struct xntx **out_tx, struct xndb *db, enum xntxmode mode) {
     xnmm_init();
     struct xntx *tx;
@@ -20,127 +19,175 @@ xnresult_t xntx_create(struct xntx **out_tx, struct xndb *db, enum xntxmode mode
     xn_ensure(xn_mutex_unlock(db->tx_id_counter_lock));
 
     tx->db = db;
-    tx->rdtx_count = 0;
-    xnmm_alloc(xnmtx_free, xnmtx_create, &tx->rdtx_count_lock);
+    tx->mod_pgs = NULL;
+    tx->pgs = NULL;
+    tx->pg_count = 0;
+    tx->pg_capacity = 0;
     if (mode == XNTXMODE_WR) {
-        xn_ensure(xn_mutex_lock(db->wrtx_lock)); //TODO need to unlock if function fails - putting responsibility on caller is confusing and to complex
+        xn_ensure(xndb_check_flusher(db));
+
+        //any number of write txs can be in the writing stage - each one collects its modified pages privately
         xnmm_alloc(xntbl_free, xntbl_create, &tx->mod_pgs, false);
 
-        size_t rec_size = xnlog_record_size(0);
+        size_t rec_size = xnlog_record_size(tx->id, 0);
         xnmm_scoped_alloc(scoped_ptr, xn_free, xn_malloc, &scoped_ptr, rec_size);
         uint8_t *rec = (uint8_t*)scoped_ptr;
 
         xn_ensure(xnlog_serialize_record(tx->id, XNLOGT_START, 0, NULL, rec));
-        xn_ensure(xnlog_append(db->log, rec, rec_size));
-    } else { //XNTXMODE_RD
-        xn_ensure(xn_mutex_lock(db->committed_wrtx_lock)); //TODO need to unlock if function fails
-        if (db->committed_wrtx) {
-            tx->mod_pgs = db->committed_wrtx->mod_pgs;
-            xn_ensure(xn_atomic_increment(&db->committed_wrtx->rdtx_count, db->committed_wrtx->rdtx_count_lock));
-        } else {
-            tx->mod_pgs = NULL;
-            xn_ensure(xn_atomic_increment(&db->rdtx_count, db->rdtx_count_lock));
+
+        //appended under the list lock so a checkpoint can't pick a redo point past this record
+        //before the tx is in the list
+        xn_ensure(xn_mutex_lock(db->wrtx_list_lock));
+        bool ok = xnlog_append(db->log, rec, rec_size, &tx->start_lsn);
+        if (ok) {
+            tx->next = db->wrtx_list;
+            db->wrtx_list = tx;
         }
-        xn_ensure(xn_mutex_unlock(db->committed_wrtx_lock));
+        xn_ensure(xn_mutex_unlock(db->wrtx_list_lock));
+        xn_ensure(ok);
     }
     tx->mode = mode;
+
+    xn_ensure(xnmvcc_begin(db->mvcc, tx));
+
     *out_tx = tx;
     return xn_ok();
 }
 
-xnresult_t xntx_flush_writes(struct xntx *tx) {
+//releases the snapshot.  If it was the oldest, the versions it was holding in memory can now be written back
+static xnresult_t xntx_end_snapshot(struct xntx *tx) {
     xnmm_init();
-    xn_ensure(tx->mode == XNTXMODE_WR);
-
-    //struct xnpg page = {.file_handle = tx->db->file_handle, .idx = -1};
-    for (int i = 0; i < XNTBL_MAX_BUCKETS; i++) {
-        struct xnentry *cur = tx->mod_pgs->entries[i];
-        while (cur) {
-            //page.idx = cur->page.idx;
-            //TODO should this use mmap and mprotect???
-            xn_ensure(xnpg_flush(&cur->page, cur->val));
-            cur = cur->next;
-        }
-    }
-    //TODO need to sync ALL files that were modified
-    //xn_ensure(xnfile_sync(tx->db->file_handle));
-
+    bool was_oldest;
+    xn_ensure(xnmvcc_end(tx->db->mvcc, tx, &was_oldest));
+    if (was_oldest)
+        xndb_wake_flusher(tx->db);
     return xn_ok();
 }
 
-//called by xntx_commit and xntx_rollback to free write txs
-static xnresult_t xntx_free(struct xntx *tx) {
+//called by xntx_commit and xntx_rollback to free write txs.  Pages claimed and freed outside the tx's private
+//copies are settled while the tx is still in the list, so a checkpoint can't move the redo point past their records
+static xnresult_t xntx_free(struct xntx *tx, bool committed) {
     xnmm_init();
 
     xn_ensure(tx->mode == XNTXMODE_WR);
+    xn_ensure(xnfile_end_tx(tx, committed));
 
+    xn_ensure(xn_mutex_lock(tx->db->wrtx_list_lock));
+    struct xntx **link = &tx->db->wrtx_list;
+    while (*link != tx)
+        link = &(*link)->next;
+    *link = tx->next;
+    xn_ensure(xn_mutex_unlock(tx->db->wrtx_list_lock));
+
+    xn_ensure(xntx_end_snapshot(tx));
     xn_ensure(xntbl_free((void**)&tx->mod_pgs));
-    xn_ensure(xnmtx_free((void**)&tx->rdtx_count_lock));
+    free(tx->pgs);
     free(tx);
 
     return xn_ok();
 }
 
+xnresult_t xntx_add_page(struct xntx *tx, struct xnpg *page, enum xntxpgop op) {
+    xnmm_init();
+    xn_ensure(tx->mode == XNTXMODE_WR);
+
+    if (tx->pg_count == tx->pg_capacity) {
+        int capacity = tx->pg_capacity == 0 ? 8 : tx->pg_capacity * 2;
+        struct xntxpg *pgs;
+        xn_ensure((pgs = realloc(tx->pgs, sizeof(struct xntxpg) * capacity)) != NULL);
+        tx->pgs = pgs;
+        tx->pg_capacity = capacity;
+    }
+
+    tx->pgs[tx->pg_count++] = (struct xntxpg){ .page = *page, .op = op };
+    return xn_ok();
+}
+
+//index of the entry for page idx of file (or any page of file if idx is XNTX_ANY_PAGE), or -1 if there is none
+int xntx_find_page(struct xntx *tx, struct xnfile *file, uint64_t idx, enum xntxpgop op) {
+    for (int i = 0; i < tx->pg_count; i++) {
+        struct xntxpg *pg = &tx->pgs[i];
+        if (pg->op == op && pg->page.file_handle == file && (idx == XNTX_ANY_PAGE || pg->page.idx == idx))
+            return i;
+    }
+    return -1;
+}
+
+void xntx_remove_page(struct xntx *tx, int i) {
+    tx->pgs[i] = tx->pgs[--tx->pg_count];
+}
+
 //close and free read txs
 xnresult_t xntx_close(void **t) {
     xnmm_init();
     struct xntx *tx = (struct xntx*)(*t);
     assert(tx->mode == XNTXMODE_RD);
 
-    if (tx->mod_pgs) {
-        xn_ensure(xn_atomic_decrement_and_signal(&tx->db->committed_wrtx->rdtx_count, tx->db->committed_wrtx->rdtx_count_lock, &mem_rdtxs_cv));
-    } else {
-        xn_ensure(xn_atomic_decrement_and_signal(&tx->db->rdtx_count, tx->db->rdtx_count_lock, &disk_rdtxs_cv));
-    }
+    xn_ensure(xntx_end_snapshot(tx));
     free(tx);
     return xn_ok();
 }
 
-xnresult_t xntx_commit(struct xntx *tx) {
+//write tx stages: [writing][committing][committed] and then [gc] in the background flusher
+//Validation, sequence numbers and commit records are ordered by the mvcc lock, so commit records are in sequence
+//order in the log, and once a commit record is durable every commit with a lower sequence number is durable too.
+//Returns with out_committed set to false if another tx committed a page this tx modified after its snapshot was
+//taken.  The tx is rolled back in that case and the caller can retry it in a new tx
+xnresult_t xntx_try_commit(struct xntx *tx, bool *out_committed) {
     xnmm_init();
     assert(tx->mode == XNTXMODE_WR);
-
-    //append commit log record and flush log
-    {
-        xn_ensure(xn_mutex_lock(tx->db->committed_wrtx_lock)); //TODO need to unlock if function fails
-
-        size_t rec_size = xnlog_record_size(0);
-        xnmm_scoped_alloc(scoped_ptr, xn_free, xn_malloc, &scoped_ptr, rec_size);
-        uint8_t *rec = (uint8_t*)scoped_ptr;
-
-        xn_ensure(xnlog_serialize_record(tx->id, XNLOGT_COMMIT, 0, NULL, rec));
-        xn_ensure(xnlog_append(tx->db->log, rec, rec_size));
-        tx->db->committed_wrtx = tx;
-        xn_ensure(xnlog_flush(tx->db->log));
-
-        xn_ensure(xn_mutex_unlock(tx->db->committed_wrtx_lock));
+    struct xndb *db = tx->db;
+
+    size_t rec_size = xnlog_record_size(tx->id, 0);
+    xnmm_scoped_alloc(scoped_ptr, xn_free, xn_malloc, &scoped_ptr, rec_size);
+    uint8_t *rec = (uint8_t*)scoped_ptr;
+    xn_ensure(xnlog_serialize_record(tx->id, XNLOGT_COMMIT, 0, NULL, rec));
+
+    //committing: validate, then install the modified pages as versions no snapshot can see yet
+    uint64_t seq = 0;
+    uint64_t lsn = 0;
+    xn_ensure(xn_mutex_lock(db->mvcc->lock));
+    bool conflict = xnmvcc_conflicts_locked(db->mvcc, tx);
+    bool ok = true;
+    bool removed = true;
+    if (!conflict) {
+        seq = ++db->mvcc->next_seq;
+        ok = xnmvcc_install_locked(db->mvcc, tx, seq) && xnlog_append(db->log, rec, rec_size, &lsn);
+
+        //versions without a commit record must not outlive the lock, or the next commit would publish them
+        if (!ok)
+            removed = xnmvcc_uninstall_locked(db->mvcc, tx, seq);
     }
-
-    //Single-writer mutex can be unlocked here to improve concurrency, but will make handling overlapping writer txs a bit more complex.
-    //Only a single writer can be modifying data at a time, but this allows writers in the commit/flushed stages to not interfere with
-    //write tx in the writing stage.  Reader txs handling is also more complex since they will reference the most recently committed
-    //writer tx snapshot.
-    //write tx stages: [creating][writing][committed][flushed][gc]
-    //Only the 'writing' stage allows a single write tx - all stages before and after can have multiple write txs active.
-  
-    //write to disk when there are no more downstream reader txs
-    {
-        xn_ensure(xn_wait_until_zero(&tx->db->rdtx_count, tx->db->rdtx_count_lock, &disk_rdtxs_cv));
-        xn_ensure(xntx_flush_writes(tx));
+    xn_ensure(xn_mutex_unlock(db->mvcc->lock));
+    xn_ensure(removed);
+    xn_ensure(ok);
+
+    if (conflict) {
+        xn_ensure(xntx_free(tx, false));
+        *out_committed = false;
+        return xn_ok();
     }
 
-    //free tx when there are no more upstream readers, and any upstream writer has committed
-    {
-        xn_ensure(xn_wait_until_zero(&tx->rdtx_count, tx->rdtx_count_lock, &mem_rdtxs_cv));
-        xn_ensure(xn_mutex_lock(tx->db->committed_wrtx_lock)); //TODO need to unlock if function fails
-        tx->db->committed_wrtx = NULL;
-        xn_ensure(xn_mutex_unlock(tx->db->committed_wrtx_lock));
+    //committed: once the commit record is durable new snapshots can see the versions.  Readers with older
+    //snapshots keep reading older versions, so nothing here waits for them
+    xn_ensure(xnlog_wait_durable(db->log, lsn + rec_size));
+    xn_ensure(xnmvcc_publish(db->mvcc, seq));
 
-        //unlocking single-writer mutex here to keep things simple for now
-        xn_ensure(xn_mutex_unlock(tx->db->wrtx_lock));
-        xn_ensure(xntx_free(tx));
-    }
+    //gc: the flusher moves versions every active snapshot can see to the buffer pool and writes them back,
+    //so commit returns as soon as the log is durable.  The tx is committed by now, so a flusher error isn't returned
+    //here - the next write tx reports it
+    xn_ensure(xntx_free(tx, true));
+    xndb_wake_flusher(db);
 
+    *out_committed = true;
+    return xn_ok();
+}
+
+xnresult_t xntx_commit(struct xntx *tx) {
+    xnmm_init();
+    bool committed;
+    xn_ensure(xntx_try_commit(tx, &committed));
+    xn_ensure(committed);
     return xn_ok();
 }
 
@@ -148,8 +195,7 @@ xnresult_t xntx_rollback(void **t) {
     xnmm_init();
     struct xntx *tx = (struct xntx*)(*t);
     assert(tx->mode == XNTXMODE_WR);
-    xn_ensure(xn_mutex_unlock(tx->db->wrtx_lock));
-    xn_ensure(xntx_free(tx));
+    xn_ensure(xntx_free(tx, false));
 
     return xn_ok();
 }
@@ -2,6 +2,7 @@
 
 #include "util.h"
 #include "table.h"
+#include "page.h"
 
 enum xntxmode {
     XNTXMODE_RD,
@@ -10,20 +11,48 @@ enum xntxmode {
 
 struct xndb;
 
+//what a write tx did with a page outside its private copies.  Settled by xnfile_end_tx when the tx ends
+enum xntxpgop {
+    XNTXPG_CLAIMED,     //taken from the free map, and given back if the tx doesn't commit
+    XNTXPG_FREED,       //given back to the free map once the tx commits
+    XNTXPG_INSERT       //heap page only this tx inserts into, offered to later txs once it ends
+};
+
+//matches every page of a file in xntx_find_page
+#define XNTX_ANY_PAGE UINT64_MAX
+
+struct xntxpg {
+    struct xnpg page;
+    enum xntxpgop op;
+};
+
 struct xntx {
     enum xntxmode mode;
     struct xntbl *mod_pgs;
     struct xndb *db;
-
-    pthread_mutex_t *rdtx_count_lock;
-    int rdtx_count;
-    
     int id;
+
+    //sequence number of the last commit this tx can see, and link in the list of active snapshots
+    uint64_t snapshot;
+    struct xntx *snap_prev;
+    struct xntx *snap_next;
+
+    //write txs only - lsn of the start record, and link in db->wrtx_list
+    uint64_t start_lsn;
+    struct xntx *next;
+
+    //write txs only - pages claimed, freed and inserted into
+    struct xntxpg *pgs;
+    int pg_count;
+    int pg_capacity;
 };
 
 
 xnresult_t xntx_create(struct xntx **out_tx, struct xndb *db, enum xntxmode mode);
-xnresult_t xntx_flush_writes(struct xntx *tx);
+xnresult_t xntx_try_commit(struct xntx *tx, bool *out_committed);
 xnresult_t xntx_commit(struct xntx *tx);
 xnresult_t xntx_rollback(void **t);
 xnresult_t xntx_close(void **t);
+xnresult_t xntx_add_page(struct xntx *tx, struct xnpg *page, enum xntxpgop op);
+int xntx_find_page(struct xntx *tx, struct xnfile *file, uint64_t idx, enum xntxpgop op);
+void xntx_remove_page(struct xntx *tx, int i);
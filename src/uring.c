@@ -0,0 +1,259 @@
+#include "uring.h"
+
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <errno.h>
+
+static int xnuring_setup(unsigned entries, struct io_uring_params *params) {
+    return (int)syscall(__NR_io_uring_setup, entries, params);
+}
+
+static int xnuring_enter(int fd, unsigned to_submit, unsigned min_complete, unsigned flags) {
+    return (int)syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, NULL, 0);
+}
+
+//kernels without io_uring, or with it disabled by seccomp or sysctl, fail the setup call
+bool xnuring_supported() {
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(struct io_uring_params));
+    int fd = xnuring_setup(1, &params);
+    if (fd < 0)
+        return false;
+    close(fd);
+    return true;
+}
+
+bool xnuring_free(void **ptr) {
+    struct xnuring *ring = (struct xnuring*)*ptr;
+    if (!ring)
+        return true;
+    if (ring->sqes)
+        munmap(ring->sqes, ring->sqes_size);
+    if (ring->cq_ptr && ring->cq_ptr != ring->sq_ptr)
+        munmap(ring->cq_ptr, ring->cq_size);
+    if (ring->sq_ptr)
+        munmap(ring->sq_ptr, ring->sq_size);
+    if (ring->fd >= 0)
+        close(ring->fd);
+    bool ok = !ring->lock || xnmtx_free((void**)&ring->lock);
+    if (ring->cv_ready)
+        pthread_cond_destroy(&ring->cv);
+    free(ring);
+    *ptr = NULL;
+    return ok;
+}
+
+static bool xnuring_map(struct xnuring *ring, unsigned entries) {
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(struct io_uring_params));
+    if ((ring->fd = xnuring_setup(entries, &params)) < 0)
+        return false;
+
+    ring->sq_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    ring->cq_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    bool single = params.features & IORING_FEAT_SINGLE_MMAP;
+    if (single && ring->cq_size > ring->sq_size)
+        ring->sq_size = ring->cq_size;
+
+    void *sq_ptr = mmap(NULL, ring->sq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQ_RING);
+    if (sq_ptr == MAP_FAILED)
+        return false;
+    ring->sq_ptr = sq_ptr;
+
+    if (single) {
+        ring->cq_ptr = sq_ptr;
+    } else {
+        void *cq_ptr = mmap(NULL, ring->cq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_CQ_RING);
+        if (cq_ptr == MAP_FAILED)
+            return false;
+        ring->cq_ptr = cq_ptr;
+    }
+
+    ring->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+    void *sqes = mmap(NULL, ring->sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQES);
+    if (sqes == MAP_FAILED)
+        return false;
+    ring->sqes = sqes;
+
+    uint8_t *sq = ring->sq_ptr;
+    uint8_t *cq = ring->cq_ptr;
+    ring->sq_entries = params.sq_entries;
+    ring->sq_head = (unsigned*)(sq + params.sq_off.head);
+    ring->sq_tail = (unsigned*)(sq + params.sq_off.tail);
+    ring->sq_mask = (unsigned*)(sq + params.sq_off.ring_mask);
+    ring->sq_array = (unsigned*)(sq + params.sq_off.array);
+    ring->cq_head = (unsigned*)(cq + params.cq_off.head);
+    ring->cq_tail = (unsigned*)(cq + params.cq_off.tail);
+    ring->cq_mask = (unsigned*)(cq + params.cq_off.ring_mask);
+    ring->cqes = (struct io_uring_cqe*)(cq + params.cq_off.cqes);
+    return true;
+}
+
+static bool xnuring_alloc(void **ptr, unsigned entries) {
+    struct xnuring *ring = calloc(1, sizeof(struct xnuring));
+    *ptr = ring;
+    if (!ring)
+        return false;
+    ring->fd = -1;
+    ring->cv_ready = pthread_cond_init(&ring->cv, NULL) == 0;
+    return ring->cv_ready && xnmtx_create(&ring->lock) && xnuring_map(ring, entries);
+}
+
+xnresult_t xnuring_create(struct xnuring **out_ring, unsigned entries) {
+    xnmm_init();
+    xnmm_scoped_alloc(scoped_ring, xnuring_free, xnuring_alloc, &scoped_ring, entries);
+    *out_ring = (struct xnuring*)scoped_ring;
+    scoped_ring = NULL;
+    return xn_ok();
+}
+
+//number of ops from ops[0] up to and including the first one that doesn't link to the next
+static int xnuring_chain_length(struct xnuringop *ops, int count) {
+    int n = 1;
+    while (n < count && ops[n - 1].link)
+        n++;
+    return n;
+}
+
+static void xnuring_prep(struct xnuring *ring, struct xnuringop *op) {
+    unsigned tail = *ring->sq_tail;
+    unsigned idx = tail & *ring->sq_mask;
+    struct io_uring_sqe *sqe = &ring->sqes[idx];
+    memset(sqe, 0, sizeof(struct io_uring_sqe));
+
+    switch (op->opcode) {
+        case XNURING_READV:
+            sqe->opcode = IORING_OP_READV;
+            break;
+        case XNURING_WRITEV:
+            sqe->opcode = IORING_OP_WRITEV;
+            break;
+        case XNURING_FDATASYNC:
+            sqe->opcode = IORING_OP_FSYNC;
+            sqe->fsync_flags = IORING_FSYNC_DATASYNC;
+            break;
+    }
+    sqe->fd = op->fd;
+    if (op->opcode != XNURING_FDATASYNC) {
+        sqe->addr = (uint64_t)(uintptr_t)op->iov;
+        sqe->len = op->iov_count;
+        sqe->off = op->off;
+    }
+    if (op->link)
+        sqe->flags |= IOSQE_IO_LINK;
+    if (op->drain)
+        sqe->flags |= IOSQE_IO_DRAIN;
+    sqe->user_data = (uint64_t)(uintptr_t)op;
+
+    ring->sq_array[idx] = idx;
+    __atomic_store_n(ring->sq_tail, tail + 1, __ATOMIC_RELEASE);
+}
+
+//caller must hold ring lock.  Completions can belong to any thread's batch, so each one is counted off the
+//batch its op points to
+static void xnuring_reap(struct xnuring *ring) {
+    unsigned head = *ring->cq_head;
+    unsigned tail = __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE);
+    while (head != tail) {
+        struct io_uring_cqe *cqe = &ring->cqes[head & *ring->cq_mask];
+        struct xnuringop *op = (struct xnuringop*)(uintptr_t)cqe->user_data;
+        op->res = cqe->res;
+        (*op->pending)--;
+        ring->inflight--;
+        head++;
+    }
+    __atomic_store_n(ring->cq_head, head, __ATOMIC_RELEASE);
+}
+
+//caller must hold ring lock.  Queues the chains starting at *next that fit next to the ops already in flight,
+//so the completion queue can't overflow, and submits them without waiting.  A linked chain has to go in one
+//submission, or the kernel ends the chain early.  Returns false if a chain is longer than the ring, after
+//submitting the ops before it, or if the kernel refused entries - those are taken back out of the queue, so no
+//later submission can hand the kernel ops whose batch has given up
+static bool xnuring_submit_locked(struct xnuring *ring, struct xnuringop *ops, int count, int *next) {
+    unsigned queued = 0;
+    bool fits = true;
+    while (*next < count) {
+        int chain = xnuring_chain_length(ops + *next, count - *next);
+        if ((unsigned)chain > ring->sq_entries) {
+            fits = false;
+            break;
+        }
+        if (ring->inflight + queued + chain > ring->sq_entries)
+            break;
+        for (int i = 0; i < chain; i++)
+            xnuring_prep(ring, &ops[*next + i]);
+        *next += chain;
+        queued += chain;
+    }
+
+    //the kernel can take fewer entries than offered, so keep submitting until all are in flight
+    while (queued > 0) {
+        int res = xnuring_enter(ring->fd, queued, 0, 0);
+        if (res < 0 && errno != EINTR && errno != EAGAIN && errno != EBUSY) {
+            //a failed call took nothing, so every entry past the kernel's head is still ours to take back.  If an
+            //earlier call took the start of a chain, the kernel ends that chain early, as it would for a failed op
+            unsigned head = __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE);
+            *next -= *ring->sq_tail - head;
+            __atomic_store_n(ring->sq_tail, head, __ATOMIC_RELEASE);
+            return false;
+        }
+        if (res < 0) {
+            //the completion queue is full, so make room
+            xnuring_reap(ring);
+            res = 0;
+        }
+        ring->inflight += res;
+        queued -= res;
+    }
+    return fits;
+}
+
+//submits count ops and waits until all of them complete.  Ops in different chains may run in any order.
+//Failed ops are not an error here - check each op's res.  If the ops can't all be submitted, the ones that
+//were are still waited for before returning the error, since the kernel writes into their buffers and completes
+//them through pointers into ops.  The rest are set to -ECANCELED
+xnresult_t xnuring_run(struct xnuring *ring, struct xnuringop *ops, int count) {
+    xnmm_init();
+
+    int pending = count;
+    for (int i = 0; i < count; i++)
+        ops[i].pending = &pending;
+
+    xn_ensure(xn_mutex_lock(ring->lock));
+    bool ok = true;
+    int next = 0;
+    while (pending > 0) {
+        if (ok && next < count)
+            ok = xnuring_submit_locked(ring, ops, count, &next);
+        if (!ok && next < count) {
+            for (int i = next; i < count; i++)
+                ops[i].res = -ECANCELED;
+            pending -= count - next;
+            next = count;
+        }
+        if (pending == 0)
+            break;
+
+        //only one thread waits in the kernel, so no completion can be reaped by one thread while another sleeps
+        //waiting for it.  A failed wait is retried, since ops are still in flight
+        if (!ring->reaping) {
+            ring->reaping = true;
+            pthread_mutex_unlock(ring->lock);
+            xnuring_enter(ring->fd, 0, 1, IORING_ENTER_GETEVENTS);
+            pthread_mutex_lock(ring->lock);
+            ring->reaping = false;
+            xnuring_reap(ring);
+            pthread_cond_broadcast(&ring->cv);
+        } else {
+            pthread_cond_wait(&ring->cv, ring->lock);
+        }
+    }
+    xn_ensure(xn_mutex_unlock(ring->lock));
+    xn_ensure(ok);
+    return xn_ok();
+}
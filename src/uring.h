@@ -0,0 +1,62 @@
+#pragma once
+
+#include "util.h"
+
+#include <sys/uio.h>
+
+//submission queue entries per ring.  Longer batches are submitted in pieces as completions free up room
+#define XNURING_DEPTH 64
+
+//io_uring instance driven with raw syscalls, shared by any number of threads.  The lock is only held to fill the
+//submission queue and to reap completions, so batches from different threads are in flight together.  One thread
+//at a time waits in the kernel for completions and reaps them for everyone, and the rest wait on cv
+struct xnuring {
+    int fd;
+    unsigned sq_entries;
+    unsigned *sq_head;
+    unsigned *sq_tail;
+    unsigned *sq_mask;
+    unsigned *sq_array;
+    struct io_uring_sqe *sqes;
+    unsigned *cq_head;
+    unsigned *cq_tail;
+    unsigned *cq_mask;
+    struct io_uring_cqe *cqes;
+
+    void *sq_ptr;
+    size_t sq_size;
+    void *cq_ptr;
+    size_t cq_size;
+    size_t sqes_size;
+    pthread_mutex_t *lock;
+    pthread_cond_t cv;
+    bool cv_ready;
+    bool reaping;           //a thread is waiting in the kernel for completions
+    unsigned inflight;      //submitted and not yet reaped, across all batches
+};
+
+enum xnuringopcode {
+    XNURING_READV,
+    XNURING_WRITEV,
+    XNURING_FDATASYNC
+};
+
+//one I/O in a batch.  If link is set, the next op starts only once this one completes successfully.  If drain
+//is set, this op starts only once every op submitted before it has completed, including other threads' ops.
+//res is set on completion to the bytes transferred, or a negative errno.  pending is set by xnuring_run
+struct xnuringop {
+    enum xnuringopcode opcode;
+    int fd;
+    struct iovec *iov;
+    int iov_count;
+    off_t off;
+    bool link;
+    bool drain;
+    int res;
+    int *pending;
+};
+
+bool xnuring_supported();
+xnresult_t xnuring_create(struct xnuring **out_ring, unsigned entries);
+bool xnuring_free(void **ring);
+xnresult_t xnuring_run(struct xnuring *ring, struct xnuringop *ops, int count);
@@ -5,6 +5,11 @@
 #include <errno.h>
 #include <string.h>
 #include <fcntl.h>
+#include <time.h>
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
 
 bool xn_free(void **ptr) {
     free(*ptr);
@@ -80,6 +85,29 @@ xnresult_t xn_cond_wait(pthread_cond_t *cv, pthread_mutex_t *lock) {
     return xn_ok();
 }
 
+xnresult_t xn_cond_timedwait(pthread_cond_t *cv, pthread_mutex_t *lock, int timeout_us, bool *timed_out) {
+    xnmm_init();
+    struct timespec ts;
+    xn_ensure(clock_gettime(CLOCK_REALTIME, &ts) == 0);
+    ts.tv_sec += timeout_us / 1000000;
+    ts.tv_nsec += (timeout_us % 1000000) * 1000;
+    if (ts.tv_nsec >= 1000000000) {
+        ts.tv_sec++;
+        ts.tv_nsec -= 1000000000;
+    }
+
+    int res = pthread_cond_timedwait(cv, lock, &ts);
+    xn_ensure(res == 0 || res == ETIMEDOUT);
+    *timed_out = res == ETIMEDOUT;
+    return xn_ok();
+}
+
+xnresult_t xn_cond_broadcast(pthread_cond_t *cv) {
+    xnmm_init();
+    xn_ensure(pthread_cond_broadcast(cv) == 0);
+    return xn_ok();
+}
+
 xnresult_t xn_atomic_increment(int *i, pthread_mutex_t *lock) {
     xnmm_init();
     xn_ensure(xn_mutex_lock(lock));
@@ -154,3 +182,152 @@ uint32_t xn_hash(const uint8_t *buf, int length) {
     return hash;
 }
 
+
+//slice-by-8 tables for the reflected crc32c polynomial.  Table k maps a byte to its crc followed by k zero bytes
+static uint32_t xn_crc32c_table[8][256];
+
+static uint32_t xn_crc32c_u64_sw(uint32_t crc, uint64_t v) {
+    v ^= crc;
+    return xn_crc32c_table[7][v & 0xff] ^ xn_crc32c_table[6][(v >> 8) & 0xff] ^
+           xn_crc32c_table[5][(v >> 16) & 0xff] ^ xn_crc32c_table[4][(v >> 24) & 0xff] ^
+           xn_crc32c_table[3][(v >> 32) & 0xff] ^ xn_crc32c_table[2][(v >> 40) & 0xff] ^
+           xn_crc32c_table[1][(v >> 48) & 0xff] ^ xn_crc32c_table[0][v >> 56];
+}
+
+uint32_t xn_crc32c_sw(uint32_t crc, const uint8_t *buf, size_t size) {
+    crc = ~crc;
+    for (; size >= 8; size -= 8, buf += 8) {
+        uint64_t v;
+        memcpy(&v, buf, sizeof(uint64_t));
+        crc = xn_crc32c_u64_sw(crc, v);
+    }
+    for (; size > 0; size--, buf++)
+        crc = xn_crc32c_table[0][(crc ^ *buf) & 0xff] ^ (crc >> 8);
+    return ~crc;
+}
+
+#if defined(__x86_64__)
+//long buffers are checksummed as three interleaved blocks, since each crc32 instruction waits on the one before
+//it in the same stream.  The block crcs are combined by shifting the earlier ones past the block bytes after them,
+//using a table of the shift for each byte of a crc
+#define XN_CRC32C_BLOCK 256
+static uint32_t xn_crc32c_shift_table[4][256];
+
+static uint32_t xn_crc32c_shift(uint32_t crc) {
+    return xn_crc32c_shift_table[0][crc & 0xff] ^ xn_crc32c_shift_table[1][(crc >> 8) & 0xff] ^
+           xn_crc32c_shift_table[2][(crc >> 16) & 0xff] ^ xn_crc32c_shift_table[3][crc >> 24];
+}
+
+//crc register after XN_CRC32C_BLOCK zero bytes
+__attribute__((target("sse4.2")))
+static uint32_t xn_crc32c_zeros_sse42(uint32_t crc) {
+    uint64_t c = crc;
+    for (int i = 0; i < XN_CRC32C_BLOCK / 8; i++)
+        c = _mm_crc32_u64(c, 0);
+    return c;
+}
+
+__attribute__((target("sse4.2")))
+static uint32_t xn_crc32c_sse42(uint32_t crc, const uint8_t *buf, size_t size) {
+    uint64_t c0 = (uint32_t)~crc;
+    for (; size >= XN_CRC32C_BLOCK * 3; size -= XN_CRC32C_BLOCK * 3, buf += XN_CRC32C_BLOCK * 3) {
+        uint64_t c1 = 0;
+        uint64_t c2 = 0;
+        for (int i = 0; i < XN_CRC32C_BLOCK; i += 8) {
+            uint64_t v0, v1, v2;
+            memcpy(&v0, buf + i, sizeof(uint64_t));
+            memcpy(&v1, buf + XN_CRC32C_BLOCK + i, sizeof(uint64_t));
+            memcpy(&v2, buf + XN_CRC32C_BLOCK * 2 + i, sizeof(uint64_t));
+            c0 = _mm_crc32_u64(c0, v0);
+            c1 = _mm_crc32_u64(c1, v1);
+            c2 = _mm_crc32_u64(c2, v2);
+        }
+        c0 = xn_crc32c_shift(c0) ^ c1;
+        c0 = xn_crc32c_shift(c0) ^ c2;
+    }
+    for (; size >= 8; size -= 8, buf += 8) {
+        uint64_t v;
+        memcpy(&v, buf, sizeof(uint64_t));
+        c0 = _mm_crc32_u64(c0, v);
+    }
+    uint32_t c = c0;
+    for (; size > 0; size--, buf++)
+        c = _mm_crc32_u8(c, *buf);
+    return ~c;
+}
+#endif
+
+static uint32_t (*xn_crc32c_fcn)(uint32_t, const uint8_t*, size_t) = xn_crc32c_sw;
+
+//builds the tables and picks the sse4.2 version if the cpu has it when the library is loaded
+__attribute__((constructor))
+static void xn_crc32c_init() {
+    for (uint32_t i = 0; i < 256; i++) {
+        uint32_t crc = i;
+        for (int j = 0; j < 8; j++)
+            crc = (crc >> 1) ^ (crc & 1 ? 0x82f63b78 : 0);
+        xn_crc32c_table[0][i] = crc;
+    }
+    for (uint32_t i = 0; i < 256; i++) {
+        for (int k = 1; k < 8; k++) {
+            uint32_t prev = xn_crc32c_table[k - 1][i];
+            xn_crc32c_table[k][i] = xn_crc32c_table[0][prev & 0xff] ^ (prev >> 8);
+        }
+    }
+
+#if defined(__x86_64__)
+    if (xn_crc32c_hw()) {
+        for (int k = 0; k < 4; k++) {
+            for (uint32_t i = 0; i < 256; i++)
+                xn_crc32c_shift_table[k][i] = xn_crc32c_zeros_sse42(i << (8 * k));
+        }
+        xn_crc32c_fcn = xn_crc32c_sse42;
+    }
+#endif
+}
+
+bool xn_crc32c_hw() {
+#if defined(__x86_64__)
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("sse4.2");
+#else
+    return false;
+#endif
+}
+
+uint32_t xn_crc32c(uint32_t crc, const uint8_t *buf, size_t size) {
+    return xn_crc32c_fcn(crc, buf, size);
+}
+
+int xn_varint_size(uint64_t v) {
+    int size = 1;
+    while (v >= 0x80) {
+        v >>= 7;
+        size++;
+    }
+    return size;
+}
+
+//returns the number of bytes written
+int xn_varint_put(uint8_t *buf, uint64_t v) {
+    int i = 0;
+    while (v >= 0x80) {
+        buf[i++] = (uint8_t)v | 0x80;
+        v >>= 7;
+    }
+    buf[i++] = (uint8_t)v;
+    return i;
+}
+
+//returns the number of bytes read, or 0 if the first size bytes of buf don't hold a whole varint
+int xn_varint_get(const uint8_t *buf, size_t size, uint64_t *v) {
+    uint64_t result = 0;
+    for (int i = 0; i < XN_VARINT_MAX && (size_t)i < size; i++) {
+        result |= (uint64_t)(buf[i] & 0x7f) << (7 * i);
+        if (!(buf[i] & 0x80)) {
+            *v = result;
+            return i + 1;
+        }
+    }
+    return 0;
+}
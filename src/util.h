@@ -57,6 +57,8 @@ xnresult_t xn_mutex_lock(pthread_mutex_t *lock);
 xnresult_t xn_mutex_unlock(pthread_mutex_t *lock);
 xnresult_t xn_cond_signal(pthread_cond_t *cv);
 xnresult_t xn_cond_wait(pthread_cond_t *cv, pthread_mutex_t *lock);
+xnresult_t xn_cond_timedwait(pthread_cond_t *cv, pthread_mutex_t *lock, int timeout_us, bool *timed_out);
+xnresult_t xn_cond_broadcast(pthread_cond_t *cv);
 xnresult_t xn_atomic_increment(int *i, pthread_mutex_t *lock);
 xnresult_t xn_atomic_decrement_and_signal(int *i, pthread_mutex_t *lock, pthread_cond_t *cv);
 xnresult_t xn_atomic_decrement(int *i, pthread_mutex_t *lock);
@@ -67,3 +69,14 @@ xnresult_t xnmtx_create(pthread_mutex_t **mtx);
 xnresult_t xnmtx_free(void **mtx);
 
 uint32_t xn_hash(const uint8_t *buf, int length);
+
+//crc32c (Castagnoli).  crc is the crc of the bytes before buf, or 0 to start, so a buffer can be checksummed in pieces
+uint32_t xn_crc32c(uint32_t crc, const uint8_t *buf, size_t size);
+uint32_t xn_crc32c_sw(uint32_t crc, const uint8_t *buf, size_t size);
+bool xn_crc32c_hw();
+
+//varints hold 7 bits per byte, low bits first, with the high bit set on every byte but the last
+#define XN_VARINT_MAX 10
+int xn_varint_size(uint64_t v);
+int xn_varint_put(uint8_t *buf, uint64_t v);
+int xn_varint_get(const uint8_t *buf, size_t size, uint64_t *v);
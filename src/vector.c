@@ -1,114 +1,796 @@
-#include <stdio.h>
+#include "vector.h"
+
 #include <math.h>
-#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define XNVEC_X86
+#include <immintrin.h>
+#endif
 
 //test these functions using the test examples in the vectordb tutorial
 //compare my computation with theirs
 
-float compute_distance(float (*fcn)(float*, float*, int), float *v1, float *v2, int count) {
-	return fcn(v1, v2, count);
-}
+//kernels for each instruction set.  dot3 computes a.b, a.a and b.b in one pass for cosine similarity.
+//batch holds one-to-many rank distance loops indexed by xnvmetric
+struct xnvkernels {
+	float (*dot)(const float*, const float*, int);
+	float (*l2sq)(const float*, const float*, int);
+	void (*dot3)(const float*, const float*, int, float*);
+	void (*batch[3])(const float*, const float*, int, int, float*);
+};
 
-float euclidean(float *v1, float *v2, int count) {
+static float xnvec_dot_scalar(const float *v1, const float *v2, int count) {
 	float result = 0.0f;
 	for (int i = 0; i < count; i++) {
-		result += powf(*(v1 + i) - *(v2 + i), 2.0f);	
+		result += *(v1 + i) * *(v2 + i);
 	}
-	return sqrt(result);	
+	return result;
 }
 
-float inner_product(float *v1, float *v2, int count) {
+static float xnvec_l2sq_scalar(const float *v1, const float *v2, int count) {
 	float result = 0.0f;
 	for (int i = 0; i < count; i++) {
-		result += *(v1 + i) * *(v2 + i);
+		float d = *(v1 + i) - *(v2 + i);
+		result += d * d;
 	}
 	return result;
 }
 
-float magnitude(float *v, int count) {
-	float ssum = 0.0f;
+static void xnvec_dot3_scalar(const float *v1, const float *v2, int count, float *out) {
+	float ab = 0.0f;
+	float aa = 0.0f;
+	float bb = 0.0f;
 	for (int i = 0; i < count; i++) {
-		ssum += powf(*(v + i), 2.0f);
+		ab += v1[i] * v2[i];
+		aa += v1[i] * v1[i];
+		bb += v2[i] * v2[i];
 	}
-	return sqrt(ssum);
+	out[0] = ab;
+	out[1] = aa;
+	out[2] = bb;
 }
 
-float negative_inner_product(float *v1, float *v2, int count) {
-	return -inner_product(v1, v2, count);
+static void xnvec_dot2_scalar(const float *v1, const float *v2, int count, float *out) {
+	float ab = 0.0f;
+	float bb = 0.0f;
+	for (int i = 0; i < count; i++) {
+		ab += v1[i] * v2[i];
+		bb += v2[i] * v2[i];
+	}
+	out[0] = ab;
+	out[1] = bb;
 }
 
-float cosine_similarity(float *v1, float *v2, int count) {
-	return 1.0f - (inner_product(v1, v2, count) / (magnitude(v1, count) * magnitude(v2, count)));
+//one-to-many rank distances from a query to count contiguous vectors.  Each metric and instruction set gets its
+//own loop with the kernel called directly, so the compiler can inline it instead of going through a pointer per pair.
+//Cosine takes the query's norm once and only computes a.b and b.b per vector (dot2)
+#define XNVEC_BATCH(isa, target) \
+target static void xnvec_batch_l2_##isa(const float *query, const float *vecs, int count, int dim, float *out) { \
+	for (int i = 0; i < count; i++) \
+		out[i] = xnvec_l2sq_##isa(query, vecs + (size_t)i * dim, dim); \
+} \
+target static void xnvec_batch_ip_##isa(const float *query, const float *vecs, int count, int dim, float *out) { \
+	for (int i = 0; i < count; i++) \
+		out[i] = -xnvec_dot_##isa(query, vecs + (size_t)i * dim, dim); \
+} \
+target static void xnvec_batch_cos_##isa(const float *query, const float *vecs, int count, int dim, float *out) { \
+	float qq = xnvec_dot_##isa(query, query, dim); \
+	float dots[2]; \
+	for (int i = 0; i < count; i++) { \
+		xnvec_dot2_##isa(query, vecs + (size_t)i * dim, dim, dots); \
+		out[i] = 1.0f - dots[0] / sqrtf(qq * dots[1]); \
+	} \
 }
 
-struct vec3 {
-	float values[3];
-};
+XNVEC_BATCH(scalar, )
 
-struct vec3_list {
-	int count;
-	struct vec3 *vectors;
-};
+#ifdef XNVEC_X86
 
-struct vec3_list random_sample(struct vec3_list *data_to_index, int bucket_count) {
-	struct vec3_list out_vl;
-	out_vl.count = bucket_count;
-	out_vl.vectors = malloc(sizeof(struct vec3) * out_vl.count);
+//SSE2 is part of x86-64, so this is the baseline.  Two accumulators hide the add latency
+static inline float xnvec_hsum_sse(__m128 v) {
+	__m128 t = _mm_add_ps(v, _mm_movehl_ps(v, v));
+	t = _mm_add_ss(t, _mm_shuffle_ps(t, t, 1));
+	return _mm_cvtss_f32(t);
+}
 
-	//choosing buckets as first and last vector in data for now
-	out_vl.vectors[0] = data_to_index->vectors[0];
-	int last_idx = data_to_index->count;
-	out_vl.vectors[last_idx] = data_to_index->vectors[last_idx];
+static float xnvec_dot_sse(const float *v1, const float *v2, int count) {
+	__m128 acc0 = _mm_setzero_ps();
+	__m128 acc1 = _mm_setzero_ps();
+	int i = 0;
+	for (; i + 8 <= count; i += 8) {
+		acc0 = _mm_add_ps(acc0, _mm_mul_ps(_mm_loadu_ps(v1 + i), _mm_loadu_ps(v2 + i)));
+		acc1 = _mm_add_ps(acc1, _mm_mul_ps(_mm_loadu_ps(v1 + i + 4), _mm_loadu_ps(v2 + i + 4)));
+	}
+	float result = xnvec_hsum_sse(_mm_add_ps(acc0, acc1));
+	for (; i < count; i++)
+		result += v1[i] * v2[i];
+	return result;
+}
 
-	return out_vl;
+static float xnvec_l2sq_sse(const float *v1, const float *v2, int count) {
+	__m128 acc0 = _mm_setzero_ps();
+	__m128 acc1 = _mm_setzero_ps();
+	int i = 0;
+	for (; i + 8 <= count; i += 8) {
+		__m128 d0 = _mm_sub_ps(_mm_loadu_ps(v1 + i), _mm_loadu_ps(v2 + i));
+		__m128 d1 = _mm_sub_ps(_mm_loadu_ps(v1 + i + 4), _mm_loadu_ps(v2 + i + 4));
+		acc0 = _mm_add_ps(acc0, _mm_mul_ps(d0, d0));
+		acc1 = _mm_add_ps(acc1, _mm_mul_ps(d1, d1));
+	}
+	float result = xnvec_hsum_sse(_mm_add_ps(acc0, acc1));
+	for (; i < count; i++) {
+		float d = v1[i] - v2[i];
+		result += d * d;
+	}
+	return result;
 }
 
-struct vec3_list find_centroids(struct vec3_list *data, struct vec3_list *prev_centroids) {
-	struct vec3_list buckets[prev_centroids->count];
-	//go through each data point and put into existing bucket from previous centroids
-	//compute average of all points in new buckets, and use that as new centroids
-	//return new buckets
+static void xnvec_dot3_sse(const float *v1, const float *v2, int count, float *out) {
+	__m128 ab = _mm_setzero_ps();
+	__m128 aa = _mm_setzero_ps();
+	__m128 bb = _mm_setzero_ps();
+	int i = 0;
+	for (; i + 4 <= count; i += 4) {
+		__m128 a = _mm_loadu_ps(v1 + i);
+		__m128 b = _mm_loadu_ps(v2 + i);
+		ab = _mm_add_ps(ab, _mm_mul_ps(a, b));
+		aa = _mm_add_ps(aa, _mm_mul_ps(a, a));
+		bb = _mm_add_ps(bb, _mm_mul_ps(b, b));
+	}
+	out[0] = xnvec_hsum_sse(ab);
+	out[1] = xnvec_hsum_sse(aa);
+	out[2] = xnvec_hsum_sse(bb);
+	for (; i < count; i++) {
+		out[0] += v1[i] * v2[i];
+		out[1] += v1[i] * v1[i];
+		out[2] += v2[i] * v2[i];
+	}
 }
 
-int main() {
-/*
-	float vs[][4] = { { 1.0f, 1.0f, 1.0f },
-				      { 2.0f, 1.0f, 1.0f },
-				      { 3.0f, 1.0f, 1.0f },
-				      { 4.0f, 1.0f, 1.0f } };
+static void xnvec_dot2_sse(const float *v1, const float *v2, int count, float *out) {
+	__m128 ab = _mm_setzero_ps();
+	__m128 bb = _mm_setzero_ps();
+	int i = 0;
+	for (; i + 4 <= count; i += 4) {
+		__m128 a = _mm_loadu_ps(v1 + i);
+		__m128 b = _mm_loadu_ps(v2 + i);
+		ab = _mm_add_ps(ab, _mm_mul_ps(a, b));
+		bb = _mm_add_ps(bb, _mm_mul_ps(b, b));
+	}
+	out[0] = xnvec_hsum_sse(ab);
+	out[1] = xnvec_hsum_sse(bb);
+	for (; i < count; i++) {
+		out[0] += v1[i] * v2[i];
+		out[1] += v2[i] * v2[i];
+	}
+}
 
-	float v[] = { 1.0f, 1.0f, 1.0f };
+__attribute__((target("avx2,fma")))
+static inline float xnvec_hsum_avx2(__m256 v) {
+	return xnvec_hsum_sse(_mm_add_ps(_mm256_castps256_ps128(v), _mm256_extractf128_ps(v, 1)));
+}
 
-    printf("v euclidean vs:\n");
-	for (int i = 0; i < 4; i++) {
-		printf("%f\n", compute_distance(euclidean, v, vs[i], 3));
+//four accumulators cover the FMA latency
+__attribute__((target("avx2,fma")))
+static float xnvec_dot_avx2(const float *v1, const float *v2, int count) {
+	__m256 acc0 = _mm256_setzero_ps();
+	__m256 acc1 = _mm256_setzero_ps();
+	__m256 acc2 = _mm256_setzero_ps();
+	__m256 acc3 = _mm256_setzero_ps();
+	int i = 0;
+	for (; i + 32 <= count; i += 32) {
+		acc0 = _mm256_fmadd_ps(_mm256_loadu_ps(v1 + i), _mm256_loadu_ps(v2 + i), acc0);
+		acc1 = _mm256_fmadd_ps(_mm256_loadu_ps(v1 + i + 8), _mm256_loadu_ps(v2 + i + 8), acc1);
+		acc2 = _mm256_fmadd_ps(_mm256_loadu_ps(v1 + i + 16), _mm256_loadu_ps(v2 + i + 16), acc2);
+		acc3 = _mm256_fmadd_ps(_mm256_loadu_ps(v1 + i + 24), _mm256_loadu_ps(v2 + i + 24), acc3);
 	}
+	for (; i + 8 <= count; i += 8)
+		acc0 = _mm256_fmadd_ps(_mm256_loadu_ps(v1 + i), _mm256_loadu_ps(v2 + i), acc0);
+	float result = xnvec_hsum_avx2(_mm256_add_ps(_mm256_add_ps(acc0, acc1), _mm256_add_ps(acc2, acc3)));
+	for (; i < count; i++)
+		result += v1[i] * v2[i];
+	return result;
+}
 
-    printf("v cosine_similarity vs:\n");
-	for (int i = 0; i < 4; i++) {
-		printf("%f\n", compute_distance(cosine_similarity, v, vs[i], 3));
+__attribute__((target("avx2,fma")))
+static float xnvec_l2sq_avx2(const float *v1, const float *v2, int count) {
+	__m256 acc0 = _mm256_setzero_ps();
+	__m256 acc1 = _mm256_setzero_ps();
+	__m256 acc2 = _mm256_setzero_ps();
+	__m256 acc3 = _mm256_setzero_ps();
+	int i = 0;
+	for (; i + 32 <= count; i += 32) {
+		__m256 d0 = _mm256_sub_ps(_mm256_loadu_ps(v1 + i), _mm256_loadu_ps(v2 + i));
+		__m256 d1 = _mm256_sub_ps(_mm256_loadu_ps(v1 + i + 8), _mm256_loadu_ps(v2 + i + 8));
+		__m256 d2 = _mm256_sub_ps(_mm256_loadu_ps(v1 + i + 16), _mm256_loadu_ps(v2 + i + 16));
+		__m256 d3 = _mm256_sub_ps(_mm256_loadu_ps(v1 + i + 24), _mm256_loadu_ps(v2 + i + 24));
+		acc0 = _mm256_fmadd_ps(d0, d0, acc0);
+		acc1 = _mm256_fmadd_ps(d1, d1, acc1);
+		acc2 = _mm256_fmadd_ps(d2, d2, acc2);
+		acc3 = _mm256_fmadd_ps(d3, d3, acc3);
+	}
+	for (; i + 8 <= count; i += 8) {
+		__m256 d = _mm256_sub_ps(_mm256_loadu_ps(v1 + i), _mm256_loadu_ps(v2 + i));
+		acc0 = _mm256_fmadd_ps(d, d, acc0);
 	}
+	float result = xnvec_hsum_avx2(_mm256_add_ps(_mm256_add_ps(acc0, acc1), _mm256_add_ps(acc2, acc3)));
+	for (; i < count; i++) {
+		float d = v1[i] - v2[i];
+		result += d * d;
+	}
+	return result;
+}
 
-    printf("v inner product vs:\n");
+__attribute__((target("avx2,fma")))
+static void xnvec_dot3_avx2(const float *v1, const float *v2, int count, float *out) {
+	__m256 ab = _mm256_setzero_ps();
+	__m256 aa = _mm256_setzero_ps();
+	__m256 bb = _mm256_setzero_ps();
+	int i = 0;
+	for (; i + 8 <= count; i += 8) {
+		__m256 a = _mm256_loadu_ps(v1 + i);
+		__m256 b = _mm256_loadu_ps(v2 + i);
+		ab = _mm256_fmadd_ps(a, b, ab);
+		aa = _mm256_fmadd_ps(a, a, aa);
+		bb = _mm256_fmadd_ps(b, b, bb);
+	}
+	out[0] = xnvec_hsum_avx2(ab);
+	out[1] = xnvec_hsum_avx2(aa);
+	out[2] = xnvec_hsum_avx2(bb);
+	for (; i < count; i++) {
+		out[0] += v1[i] * v2[i];
+		out[1] += v1[i] * v1[i];
+		out[2] += v2[i] * v2[i];
+	}
+}
+
+__attribute__((target("avx2,fma")))
+static void xnvec_dot2_avx2(const float *v1, const float *v2, int count, float *out) {
+	__m256 ab = _mm256_setzero_ps();
+	__m256 bb = _mm256_setzero_ps();
+	int i = 0;
+	for (; i + 8 <= count; i += 8) {
+		__m256 a = _mm256_loadu_ps(v1 + i);
+		__m256 b = _mm256_loadu_ps(v2 + i);
+		ab = _mm256_fmadd_ps(a, b, ab);
+		bb = _mm256_fmadd_ps(b, b, bb);
+	}
+	out[0] = xnvec_hsum_avx2(ab);
+	out[1] = xnvec_hsum_avx2(bb);
+	for (; i < count; i++) {
+		out[0] += v1[i] * v2[i];
+		out[1] += v2[i] * v2[i];
+	}
+}
+
+//the tail is a masked load, so there is no scalar remainder loop
+__attribute__((target("avx512f")))
+static float xnvec_dot_avx512(const float *v1, const float *v2, int count) {
+	__m512 acc0 = _mm512_setzero_ps();
+	__m512 acc1 = _mm512_setzero_ps();
+	__m512 acc2 = _mm512_setzero_ps();
+	__m512 acc3 = _mm512_setzero_ps();
+	int i = 0;
+	for (; i + 64 <= count; i += 64) {
+		acc0 = _mm512_fmadd_ps(_mm512_loadu_ps(v1 + i), _mm512_loadu_ps(v2 + i), acc0);
+		acc1 = _mm512_fmadd_ps(_mm512_loadu_ps(v1 + i + 16), _mm512_loadu_ps(v2 + i + 16), acc1);
+		acc2 = _mm512_fmadd_ps(_mm512_loadu_ps(v1 + i + 32), _mm512_loadu_ps(v2 + i + 32), acc2);
+		acc3 = _mm512_fmadd_ps(_mm512_loadu_ps(v1 + i + 48), _mm512_loadu_ps(v2 + i + 48), acc3);
+	}
+	for (; i + 16 <= count; i += 16)
+		acc0 = _mm512_fmadd_ps(_mm512_loadu_ps(v1 + i), _mm512_loadu_ps(v2 + i), acc0);
+	if (i < count) {
+		__mmask16 mask = (1u << (count - i)) - 1;
+		acc1 = _mm512_fmadd_ps(_mm512_maskz_loadu_ps(mask, v1 + i), _mm512_maskz_loadu_ps(mask, v2 + i), acc1);
+	}
+	return _mm512_reduce_add_ps(_mm512_add_ps(_mm512_add_ps(acc0, acc1), _mm512_add_ps(acc2, acc3)));
+}
+
+__attribute__((target("avx512f")))
+static float xnvec_l2sq_avx512(const float *v1, const float *v2, int count) {
+	__m512 acc0 = _mm512_setzero_ps();
+	__m512 acc1 = _mm512_setzero_ps();
+	__m512 acc2 = _mm512_setzero_ps();
+	__m512 acc3 = _mm512_setzero_ps();
+	int i = 0;
+	for (; i + 64 <= count; i += 64) {
+		__m512 d0 = _mm512_sub_ps(_mm512_loadu_ps(v1 + i), _mm512_loadu_ps(v2 + i));
+		__m512 d1 = _mm512_sub_ps(_mm512_loadu_ps(v1 + i + 16), _mm512_loadu_ps(v2 + i + 16));
+		__m512 d2 = _mm512_sub_ps(_mm512_loadu_ps(v1 + i + 32), _mm512_loadu_ps(v2 + i + 32));
+		__m512 d3 = _mm512_sub_ps(_mm512_loadu_ps(v1 + i + 48), _mm512_loadu_ps(v2 + i + 48));
+		acc0 = _mm512_fmadd_ps(d0, d0, acc0);
+		acc1 = _mm512_fmadd_ps(d1, d1, acc1);
+		acc2 = _mm512_fmadd_ps(d2, d2, acc2);
+		acc3 = _mm512_fmadd_ps(d3, d3, acc3);
+	}
+	for (; i + 16 <= count; i += 16) {
+		__m512 d = _mm512_sub_ps(_mm512_loadu_ps(v1 + i), _mm512_loadu_ps(v2 + i));
+		acc0 = _mm512_fmadd_ps(d, d, acc0);
+	}
+	if (i < count) {
+		__mmask16 mask = (1u << (count - i)) - 1;
+		__m512 d = _mm512_sub_ps(_mm512_maskz_loadu_ps(mask, v1 + i), _mm512_maskz_loadu_ps(mask, v2 + i));
+		acc1 = _mm512_fmadd_ps(d, d, acc1);
+	}
+	return _mm512_reduce_add_ps(_mm512_add_ps(_mm512_add_ps(acc0, acc1), _mm512_add_ps(acc2, acc3)));
+}
+
+__attribute__((target("avx512f")))
+static void xnvec_dot3_avx512(const float *v1, const float *v2, int count, float *out) {
+	__m512 ab = _mm512_setzero_ps();
+	__m512 aa = _mm512_setzero_ps();
+	__m512 bb = _mm512_setzero_ps();
+	for (int i = 0; i < count; i += 16) {
+		__mmask16 mask = count - i >= 16 ? 0xffff : (1u << (count - i)) - 1;
+		__m512 a = _mm512_maskz_loadu_ps(mask, v1 + i);
+		__m512 b = _mm512_maskz_loadu_ps(mask, v2 + i);
+		ab = _mm512_fmadd_ps(a, b, ab);
+		aa = _mm512_fmadd_ps(a, a, aa);
+		bb = _mm512_fmadd_ps(b, b, bb);
+	}
+	out[0] = _mm512_reduce_add_ps(ab);
+	out[1] = _mm512_reduce_add_ps(aa);
+	out[2] = _mm512_reduce_add_ps(bb);
+}
+
+__attribute__((target("avx512f")))
+static void xnvec_dot2_avx512(const float *v1, const float *v2, int count, float *out) {
+	__m512 ab = _mm512_setzero_ps();
+	__m512 bb = _mm512_setzero_ps();
+	for (int i = 0; i < count; i += 16) {
+		__mmask16 mask = count - i >= 16 ? 0xffff : (1u << (count - i)) - 1;
+		__m512 a = _mm512_maskz_loadu_ps(mask, v1 + i);
+		__m512 b = _mm512_maskz_loadu_ps(mask, v2 + i);
+		ab = _mm512_fmadd_ps(a, b, ab);
+		bb = _mm512_fmadd_ps(b, b, bb);
+	}
+	out[0] = _mm512_reduce_add_ps(ab);
+	out[1] = _mm512_reduce_add_ps(bb);
+}
+
+XNVEC_BATCH(sse, )
+XNVEC_BATCH(avx2, __attribute__((target("avx2,fma"))))
+XNVEC_BATCH(avx512, __attribute__((target("avx512f"))))
+
+#endif
+
+#define XNVEC_KERNELS(isa) \
+	(struct xnvkernels){ xnvec_dot_##isa, xnvec_l2sq_##isa, xnvec_dot3_##isa, \
+	                     { xnvec_batch_l2_##isa, xnvec_batch_ip_##isa, xnvec_batch_cos_##isa } }
+
+static struct xnvkernels xnvec_kernels_for(enum xnvisa isa) {
+	switch (isa) {
+#ifdef XNVEC_X86
+		case XNVISA_AVX512:
+			return XNVEC_KERNELS(avx512);
+		case XNVISA_AVX2:
+			return XNVEC_KERNELS(avx2);
+		case XNVISA_SSE:
+			return XNVEC_KERNELS(sse);
+#endif
+		case XNVISA_SCALAR:
+		default:
+			return XNVEC_KERNELS(scalar);
+	}
+}
+
+static enum xnvisa xnvec_cur_isa = XNVISA_SCALAR;
+static struct xnvkernels xnvec_kernels = XNVEC_KERNELS(scalar);
+
+bool xnvec_isa_supported(enum xnvisa isa) {
+#ifdef XNVEC_X86
+	__builtin_cpu_init();
+	switch (isa) {
+		case XNVISA_AVX512:
+			return __builtin_cpu_supports("avx512f");
+		case XNVISA_AVX2:
+			return __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+		case XNVISA_SSE:
+			return __builtin_cpu_supports("sse2");
+		case XNVISA_SCALAR:
+			return true;
+	}
+	return false;
+#else
+	return isa == XNVISA_SCALAR;
+#endif
+}
+
+//picks the widest instruction set the cpu supports when the library is loaded
+__attribute__((constructor))
+static void xnvec_select_isa() {
+	enum xnvisa isas[] = { XNVISA_AVX512, XNVISA_AVX2, XNVISA_SSE, XNVISA_SCALAR };
 	for (int i = 0; i < 4; i++) {
-		printf("%f\n", compute_distance(negative_inner_product, v, vs[i], 3));
-	}*/
-
-	struct vec3 vs[4][3] = { { 1.0f, 1.0f, 1.0f },
-				       		 { 2.0f, 1.0f, 1.0f },
-				      		 { 3.0f, 1.0f, 1.0f },
-				      		 { 4.0f, 1.0f, 1.0f } };
-	struct vec3_list vectors;
-	vectors.count = 4;
-	vectors.vectors = (struct vec3*)vs;
-
-	struct vec3_list centroids;
-	centroids = random_sample(&vectors, 2);
-	centroids = find_centroids(&vectors, &centroids);
-
-	//centroid is a vector of the same dimensions as in the input vectors
-	//centroids = random_sample(vectors, bucket_count);
-	//for i in range(500):
-	//	centroids = find_centroids(vectors, centroids);
-	//return centroids;
+		if (xnvec_isa_supported(isas[i])) {
+			xnvec_cur_isa = isas[i];
+			xnvec_kernels = xnvec_kernels_for(isas[i]);
+			return;
+		}
+	}
+}
+
+enum xnvisa xnvec_isa() {
+	return xnvec_cur_isa;
+}
+
+//not thread safe.  Meant for benchmarks and tests that compare instruction sets
+xnresult_t xnvec_set_isa(enum xnvisa isa) {
+	xnmm_init();
+	xn_ensure(xnvec_isa_supported(isa));
+	xnvec_cur_isa = isa;
+	xnvec_kernels = xnvec_kernels_for(isa);
+	return xn_ok();
+}
+
+float xnvec_compute_distance(float (*fcn)(const float*, const float*, int), const float *v1, const float *v2, int count) {
+	return fcn(v1, v2, count);
+}
+
+float xnvec_l2sq(const float *v1, const float *v2, int count) {
+	return xnvec_kernels.l2sq(v1, v2, count);
+}
+
+float xnvec_euclidean(const float *v1, const float *v2, int count) {
+	return sqrtf(xnvec_kernels.l2sq(v1, v2, count));
+}
+
+float xnvec_inner_product(const float *v1, const float *v2, int count) {
+	return xnvec_kernels.dot(v1, v2, count);
+}
+
+float xnvec_magnitude(const float *v, int count) {
+	return sqrtf(xnvec_kernels.dot(v, v, count));
+}
+
+//scales v to unit length.  A zero vector is left alone
+void xnvec_normalize(float *v, int count) {
+	float mag = xnvec_magnitude(v, count);
+	if (mag == 0.0f)
+		return;
+	for (int i = 0; i < count; i++)
+		v[i] /= mag;
+}
+
+float xnvec_negative_inner_product(const float *v1, const float *v2, int count) {
+	return -xnvec_inner_product(v1, v2, count);
+}
+
+//one pass over both vectors rather than three
+float xnvec_cosine_similarity(const float *v1, const float *v2, int count) {
+	float dots[3];
+	xnvec_kernels.dot3(v1, v2, count, dots);
+	return 1.0f - dots[0] / sqrtf(dots[1] * dots[2]);
+}
+
+float xnvec_distance(enum xnvmetric metric, const float *v1, const float *v2, int count) {
+	switch (metric) {
+		case XNVM_L2:
+			return xnvec_euclidean(v1, v2, count);
+		case XNVM_IP:
+			return xnvec_negative_inner_product(v1, v2, count);
+		case XNVM_COSINE:
+		default:
+			return xnvec_cosine_similarity(v1, v2, count);
+	}
+}
+
+//orders vectors the same way as xnvec_distance, but L2 skips the sqrt.  Searches rank candidates by this
+//and convert only the results with xnvec_rank_to_distance
+float xnvec_rank_distance(enum xnvmetric metric, const float *v1, const float *v2, int count) {
+	if (metric == XNVM_L2)
+		return xnvec_l2sq(v1, v2, count);
+	return xnvec_distance(metric, v1, v2, count);
+}
+
+float xnvec_rank_to_distance(enum xnvmetric metric, float rank) {
+	return metric == XNVM_L2 ? sqrtf(rank) : rank;
+}
+
+void xnvec_rank_distances(enum xnvmetric metric, const float *query, const float *vecs, int count, int dim, float *out_dists) {
+	xnvec_kernels.batch[metric](query, vecs, count, dim, out_dists);
+}
+
+static void xnvtopk_swap(struct xnvtopk *topk, int a, int b) {
+	uint64_t id = topk->ids[a];
+	float dist = topk->dists[a];
+	topk->ids[a] = topk->ids[b];
+	topk->dists[a] = topk->dists[b];
+	topk->ids[b] = id;
+	topk->dists[b] = dist;
+}
+
+static void xnvtopk_sift_down(struct xnvtopk *topk, int i, int count) {
+	while (true) {
+		int largest = i;
+		int l = 2 * i + 1;
+		int r = 2 * i + 2;
+		if (l < count && topk->dists[l] > topk->dists[largest])
+			largest = l;
+		if (r < count && topk->dists[r] > topk->dists[largest])
+			largest = r;
+		if (largest == i)
+			return;
+		xnvtopk_swap(topk, i, largest);
+		i = largest;
+	}
+}
+
+void xnvtopk_init(struct xnvtopk *topk, int k, uint64_t *ids, float *dists) {
+	topk->k = k;
+	topk->count = 0;
+	topk->ids = ids;
+	topk->dists = dists;
+}
+
+//the root is the worst of the k best, so most candidates are rejected with one comparison
+void xnvtopk_push(struct xnvtopk *topk, uint64_t id, float dist) {
+	if (topk->count < topk->k) {
+		int i = topk->count++;
+		topk->ids[i] = id;
+		topk->dists[i] = dist;
+		while (i > 0 && topk->dists[(i - 1) / 2] < topk->dists[i]) {
+			xnvtopk_swap(topk, i, (i - 1) / 2);
+			i = (i - 1) / 2;
+		}
+		return;
+	}
+
+	if (topk->k == 0 || dist >= topk->dists[0])
+		return;
+	topk->ids[0] = id;
+	topk->dists[0] = dist;
+	xnvtopk_sift_down(topk, 0, topk->count);
+}
+
+//heapsort in place, leaving the results closest first
+void xnvtopk_sort(struct xnvtopk *topk) {
+	for (int end = topk->count - 1; end > 0; end--) {
+		xnvtopk_swap(topk, 0, end);
+		xnvtopk_sift_down(topk, 0, end);
+	}
+}
+
+//pushes count contiguous vectors into topk with rank distances.  ids is NULL to use each vector's position
+void xnvec_topk_block(enum xnvmetric metric, const float *query, const float *vecs, const uint64_t *ids, int count, int dim, struct xnvtopk *topk) {
+	float dists[XNVEC_BLOCK];
+	for (int start = 0; start < count; start += XNVEC_BLOCK) {
+		int n = count - start < XNVEC_BLOCK ? count - start : XNVEC_BLOCK;
+		xnvec_kernels.batch[metric](query, vecs + (size_t)start * dim, n, dim, dists);
+		for (int i = 0; i < n; i++)
+			xnvtopk_push(topk, ids ? ids[start + i] : (uint64_t)(start + i), dists[i]);
+	}
+}
+
+//every query against every vector, with topks holding one heap per query.  Vectors are visited a block at a
+//time with all queries run against each block, so a block is read from memory once rather than once per query
+void xnvec_topk_block_many(enum xnvmetric metric, const float *queries, int query_count, const float *vecs, const uint64_t *ids,
+                           int count, int dim, struct xnvtopk *topks) {
+	float dists[XNVEC_BLOCK];
+	for (int start = 0; start < count; start += XNVEC_BLOCK) {
+		int n = count - start < XNVEC_BLOCK ? count - start : XNVEC_BLOCK;
+		for (int q = 0; q < query_count; q++) {
+			xnvec_kernels.batch[metric](queries + (size_t)q * dim, vecs + (size_t)start * dim, n, dim, dists);
+			for (int i = 0; i < n; i++)
+				xnvtopk_push(&topks[q], ids ? ids[start + i] : (uint64_t)(start + i), dists[i]);
+		}
+	}
+}
+
+int xnvec_nearest(enum xnvmetric metric, const float *v, const float *centroids, int k, int dim) {
+	float dists[XNVEC_BLOCK];
+	int best = 0;
+	float best_dist = INFINITY;
+	for (int start = 0; start < k; start += XNVEC_BLOCK) {
+		int n = k - start < XNVEC_BLOCK ? k - start : XNVEC_BLOCK;
+		xnvec_kernels.batch[metric](v, centroids + (size_t)start * dim, n, dim, dists);
+		for (int i = 0; i < n; i++) {
+			if (dists[i] < best_dist) {
+				best_dist = dists[i];
+				best = start + i;
+			}
+		}
+	}
+	return best;
+}
+
+struct xnkmopts xnvec_kmeans_default_opts(int k) {
+	struct xnkmopts opts = {
+		.k = k,
+		.iterations = 20,
+		.metric = XNVM_L2,
+		.threads = 0,
+		.tolerance = 1e-4f,
+		.seed = 42,
+	};
+	return opts;
+}
+
+//each worker owns a contiguous range of the data.  Seeding updates the distance from each point to the newest
+//centroid, and Lloyd iterations assign points and accumulate per-worker sums that are merged afterwards
+struct xnkmworker {
+	const float *data;
+	int dim;
+	enum xnvmetric metric;
+	int start;
+	int end;
+	bool seeding;
+	const float *centroids;
+	int centroid_count;
+	float *min_dists;
+	double total;
+	double *sums;
+	int *counts;
+};
+
+//seeding weights points by squared distance.  Inner product distances can be negative, so they seed by L2
+static inline float xnvec_seed_distance(enum xnvmetric metric, const float *v1, const float *v2, int dim) {
+	return metric == XNVM_COSINE ? xnvec_cosine_similarity(v1, v2, dim) : xnvec_l2sq(v1, v2, dim);
+}
+
+static void *xnvec_kmeans_work(void *arg) {
+	struct xnkmworker *w = (struct xnkmworker*)arg;
+	if (w->seeding) {
+		const float *newest = w->centroids + (size_t)(w->centroid_count - 1) * w->dim;
+		w->total = 0.0;
+		for (int i = w->start; i < w->end; i++) {
+			float dist = xnvec_seed_distance(w->metric, w->data + (size_t)i * w->dim, newest, w->dim);
+			if (dist < w->min_dists[i])
+				w->min_dists[i] = dist;
+			w->total += w->min_dists[i];
+		}
+		return NULL;
+	}
+
+	memset(w->sums, 0, (size_t)w->centroid_count * w->dim * sizeof(double));
+	memset(w->counts, 0, w->centroid_count * sizeof(int));
+	for (int i = w->start; i < w->end; i++) {
+		const float *v = w->data + (size_t)i * w->dim;
+		int c = xnvec_nearest(w->metric, v, w->centroids, w->centroid_count, w->dim);
+		w->counts[c]++;
+		double *sum = w->sums + (size_t)c * w->dim;
+		for (int d = 0; d < w->dim; d++)
+			sum[d] += v[d];
+	}
+	return NULL;
+}
+
+//runs worker 0 on the calling thread and the rest on their own threads
+static xnresult_t xnvec_kmeans_run(struct xnkmworker *workers, int threads) {
+	xnmm_init();
+
+	pthread_t tids[XNVEC_MAX_THREADS];
+	int created = 1;
+	while (created < threads && pthread_create(&tids[created], NULL, xnvec_kmeans_work, &workers[created]) == 0)
+		created++;
+	xnvec_kmeans_work(&workers[0]);
+	for (int i = 1; i < created; i++)
+		pthread_join(tids[i], NULL);
+	xn_ensure(created == threads);
+
+	return xn_ok();
+}
+
+static int xnvec_kmeans_threads(int requested, int count) {
+	int threads = requested > 0 ? requested : (int)sysconf(_SC_NPROCESSORS_ONLN);
+	if (threads > XNVEC_MAX_THREADS)
+		threads = XNVEC_MAX_THREADS;
+	if (threads > count / XNVEC_MIN_THREAD_POINTS)
+		threads = count / XNVEC_MIN_THREAD_POINTS;
+	return threads < 1 ? 1 : threads;
+}
+
+//k-means++: the first centroid is a random point, and each next one is a point picked with probability
+//proportional to its distance from the nearest centroid chosen so far
+static xnresult_t xnvec_kmeans_seed(const float *data, int count, int dim, struct xnkmopts opts, struct xnkmworker *workers, int threads,
+                                    unsigned int *seed, float *out_centroids) {
+	xnmm_init();
+
+	xnmm_scoped_alloc(scoped_min_dists, xn_free, xn_malloc, &scoped_min_dists, count * sizeof(float));
+	float *min_dists = (float*)scoped_min_dists;
+	for (int i = 0; i < count; i++)
+		min_dists[i] = INFINITY;
+
+	memcpy(out_centroids, data + (size_t)(rand_r(seed) % count) * dim, dim * sizeof(float));
+	for (int c = 1; c < opts.k; c++) {
+		double total = 0.0;
+		for (int t = 0; t < threads; t++) {
+			workers[t].seeding = true;
+			workers[t].centroid_count = c;
+			workers[t].min_dists = min_dists;
+		}
+		xn_ensure(xnvec_kmeans_run(workers, threads));
+		for (int t = 0; t < threads; t++)
+			total += workers[t].total;
+
+		//every point already sits on a centroid, so fall back to a uniform pick
+		int pick = rand_r(seed) % count;
+		if (total > 0.0) {
+			double r = ((double)rand_r(seed) / ((double)RAND_MAX + 1.0)) * total;
+			for (int i = 0; i < count; i++) {
+				r -= min_dists[i];
+				if (r < 0.0 || i == count - 1) {
+					pick = i;
+					break;
+				}
+			}
+		}
+		memcpy(out_centroids + (size_t)c * dim, data + (size_t)pick * dim, dim * sizeof(float));
+	}
+
+	return xn_ok();
+}
+
+//k-means++ seeding followed by Lloyd iterations, with the points split across opts.threads threads (0 uses
+//every online cpu).  Stops early once the centroids move less than opts.tolerance relative to their size.
+//A centroid left with no points is moved to a random point.  Sums are doubles so large samples don't lose
+//precision.  out_iterations may be NULL
+xnresult_t xnvec_kmeans(const float *data, int count, int dim, struct xnkmopts opts, float *out_centroids, int *out_iterations) {
+	xnmm_init();
+	xn_ensure(opts.k > 0 && count >= opts.k);
+
+	int k = opts.k;
+	int threads = xnvec_kmeans_threads(opts.threads, count);
+	unsigned int seed = opts.seed;
+
+	xnmm_scoped_alloc(scoped_workers, xn_free, xn_malloc, &scoped_workers, threads * sizeof(struct xnkmworker));
+	struct xnkmworker *workers = (struct xnkmworker*)scoped_workers;
+	xnmm_scoped_alloc(scoped_sums, xn_free, xn_malloc, &scoped_sums, (size_t)threads * k * dim * sizeof(double));
+	xnmm_scoped_alloc(scoped_counts, xn_free, xn_malloc, &scoped_counts, (size_t)threads * k * sizeof(int));
+	for (int t = 0; t < threads; t++) {
+		workers[t] = (struct xnkmworker){
+			.data = data,
+			.dim = dim,
+			.metric = opts.metric,
+			.start = (int)((int64_t)count * t / threads),
+			.end = (int)((int64_t)count * (t + 1) / threads),
+			.centroids = out_centroids,
+			.sums = (double*)scoped_sums + (size_t)t * k * dim,
+			.counts = (int*)scoped_counts + (size_t)t * k,
+		};
+	}
+
+	xn_ensure(xnvec_kmeans_seed(data, count, dim, opts, workers, threads, &seed, out_centroids));
+
+	double *sums = workers[0].sums;
+	int *counts = workers[0].counts;
+	int it = 0;
+	while (it < opts.iterations) {
+		it++;
+		for (int t = 0; t < threads; t++) {
+			workers[t].seeding = false;
+			workers[t].centroid_count = k;
+		}
+		xn_ensure(xnvec_kmeans_run(workers, threads));
+		for (int t = 1; t < threads; t++) {
+			for (size_t i = 0; i < (size_t)k * dim; i++)
+				sums[i] += workers[t].sums[i];
+			for (int c = 0; c < k; c++)
+				counts[c] += workers[t].counts[c];
+		}
+
+		double shift = 0.0;
+		double norm = 0.0;
+		for (int c = 0; c < k; c++) {
+			float *centroid = out_centroids + (size_t)c * dim;
+			if (counts[c] == 0) {
+				memcpy(centroid, data + (size_t)(rand_r(&seed) % count) * dim, dim * sizeof(float));
+				shift = INFINITY;
+				continue;
+			}
+			for (int d = 0; d < dim; d++) {
+				float mean = sums[(size_t)c * dim + d] / counts[c];
+				shift += (double)(mean - centroid[d]) * (mean - centroid[d]);
+				norm += (double)mean * mean;
+				centroid[d] = mean;
+			}
+		}
+		if (shift <= (double)opts.tolerance * opts.tolerance * norm)
+			break;
+	}
+
+	if (out_iterations)
+		*out_iterations = it;
+	return xn_ok();
 }
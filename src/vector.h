@@ -0,0 +1,70 @@
+#pragma once
+
+#include "util.h"
+
+//vectors per block in the one-to-many distance functions
+#define XNVEC_BLOCK 256
+
+//k-means threads, and the fewest points worth giving a thread of its own
+#define XNVEC_MAX_THREADS 64
+#define XNVEC_MIN_THREAD_POINTS 1024
+
+//distances are oriented so that smaller is closer for every metric
+enum xnvmetric {
+    XNVM_L2,
+    XNVM_IP,        //negative inner product
+    XNVM_COSINE     //1 - cosine similarity
+};
+
+//kernel instruction sets, narrowest first.  The widest one the cpu supports is used by default
+enum xnvisa {
+    XNVISA_SCALAR,
+    XNVISA_SSE,
+    XNVISA_AVX2,    //with FMA
+    XNVISA_AVX512
+};
+
+//bounded max-heap keeping the k smallest distances pushed so far.  ids and dists are caller-owned arrays of k entries
+struct xnvtopk {
+    int k;
+    int count;
+    uint64_t *ids;
+    float *dists;
+};
+
+struct xnkmopts {
+    int k;
+    int iterations;         //upper bound on Lloyd iterations
+    enum xnvmetric metric;
+    int threads;            //0 uses every online cpu
+    float tolerance;        //stops once the centroids move less than this fraction of their length
+    unsigned int seed;
+};
+
+bool xnvec_isa_supported(enum xnvisa isa);
+enum xnvisa xnvec_isa();
+xnresult_t xnvec_set_isa(enum xnvisa isa);
+
+float xnvec_compute_distance(float (*fcn)(const float*, const float*, int), const float *v1, const float *v2, int count);
+float xnvec_l2sq(const float *v1, const float *v2, int count);
+float xnvec_euclidean(const float *v1, const float *v2, int count);
+float xnvec_inner_product(const float *v1, const float *v2, int count);
+float xnvec_magnitude(const float *v, int count);
+void xnvec_normalize(float *v, int count);
+float xnvec_negative_inner_product(const float *v1, const float *v2, int count);
+float xnvec_cosine_similarity(const float *v1, const float *v2, int count);
+float xnvec_distance(enum xnvmetric metric, const float *v1, const float *v2, int count);
+float xnvec_rank_distance(enum xnvmetric metric, const float *v1, const float *v2, int count);
+float xnvec_rank_to_distance(enum xnvmetric metric, float rank);
+void xnvec_rank_distances(enum xnvmetric metric, const float *query, const float *vecs, int count, int dim, float *out_dists);
+void xnvec_topk_block(enum xnvmetric metric, const float *query, const float *vecs, const uint64_t *ids, int count, int dim, struct xnvtopk *topk);
+void xnvec_topk_block_many(enum xnvmetric metric, const float *queries, int query_count, const float *vecs, const uint64_t *ids,
+                           int count, int dim, struct xnvtopk *topks);
+int xnvec_nearest(enum xnvmetric metric, const float *v, const float *centroids, int k, int dim);
+
+void xnvtopk_init(struct xnvtopk *topk, int k, uint64_t *ids, float *dists);
+void xnvtopk_push(struct xnvtopk *topk, uint64_t id, float dist);
+void xnvtopk_sort(struct xnvtopk *topk);
+
+struct xnkmopts xnvec_kmeans_default_opts(int k);
+xnresult_t xnvec_kmeans(const float *data, int count, int dim, struct xnkmopts opts, float *out_centroids, int *out_iterations);
@@ -0,0 +1,246 @@
+#pragma once
+
+#include "test.h"
+#include "db.h"
+
+//shuffled keys 0 to count - 1, so inserts land all over the tree
+void btree_shuffle(uint64_t *keys, int count) {
+    for (int i = 0; i < count; i++)
+        keys[i] = i;
+    srand(42);
+    for (int i = count - 1; i > 0; i--) {
+        int j = rand() % (i + 1);
+        uint64_t tmp = keys[i];
+        keys[i] = keys[j];
+        keys[j] = tmp;
+    }
+}
+
+void btree_put_get() {
+    struct xndb *db;
+    assert(xndb_create("dummy", true, &db));
+    struct xntx *tx;
+    assert(xntx_create(&tx, db, XNTXMODE_WR));
+
+    struct xnrs rs;
+    assert(xnrs_open(&rs, db, "data", true, XNRST_BTREE, tx));
+
+    float vectors[2][3] = { { 1.0f, 2.0f, 3.0f },
+                            { 4.0f, 5.0f, 6.0f } };
+    assert(xnrs_put_key(rs, 7, sizeof(vectors), (uint8_t*)vectors));
+
+    size_t size;
+    bool found;
+    assert(xnrs_get_key_size(rs, 7, &size, &found));
+    assert(found);
+    assert(size == sizeof(vectors));
+    uint8_t *buf = malloc(size);
+    assert(xnrs_get_key(rs, 7, buf, size, &found));
+    assert(found);
+    assert(memcmp(vectors, buf, size) == 0);
+    free(buf);
+
+    assert(xnrs_get_key_size(rs, 8, &size, &found));
+    assert(!found);
+
+    //putting an existing key replaces its value
+    int val = 42;
+    assert(xnrs_put_key(rs, 7, sizeof(int), (uint8_t*)&val));
+    assert(xnrs_get_key_size(rs, 7, &size, &found));
+    assert(found && size == sizeof(int));
+    val = 0;
+    assert(xnrs_get_key(rs, 7, (uint8_t*)&val, sizeof(int), &found));
+    assert(found && val == 42);
+
+    assert(xntx_commit(tx));
+    assert(xndb_free(db));
+}
+
+void btree_split() {
+    struct xndb *db;
+    assert(xndb_create("dummy", true, &db));
+    struct xntx *tx;
+    assert(xntx_create(&tx, db, XNTXMODE_WR));
+
+    struct xnrs rs;
+    assert(xnrs_open(&rs, db, "data", true, XNRST_BTREE, tx));
+
+    //enough keys to split leaves and internal nodes
+    const int COUNT = 50000;
+    uint64_t *keys = malloc(COUNT * sizeof(uint64_t));
+    btree_shuffle(keys, COUNT);
+    for (int i = 0; i < COUNT; i++) {
+        assert(xnrs_put_key(rs, keys[i], sizeof(uint64_t), (uint8_t*)&keys[i]));
+    }
+
+    bool ok = true;
+    for (uint64_t k = 0; k < COUNT; k++) {
+        uint64_t val;
+        bool found;
+        ok = ok && xnrs_get_key(rs, k, (uint8_t*)&val, sizeof(uint64_t), &found) && found && val == k;
+    }
+    assert(ok);
+    free(keys);
+
+    assert(xntx_commit(tx));
+    assert(xndb_free(db));
+}
+
+void btree_del() {
+    struct xndb *db;
+    assert(xndb_create("dummy", true, &db));
+    struct xntx *tx;
+    assert(xntx_create(&tx, db, XNTXMODE_WR));
+
+    struct xnrs rs;
+    assert(xnrs_open(&rs, db, "data", true, XNRST_BTREE, tx));
+
+    const int COUNT = 5000;
+    for (uint64_t k = 0; k < COUNT; k++) {
+        assert(xnrs_put_key(rs, k, sizeof(uint64_t), (uint8_t*)&k));
+    }
+    bool found;
+    for (uint64_t k = 0; k < COUNT; k += 2) {
+        assert(xnrs_del_key(rs, k, &found));
+        assert(found);
+    }
+    assert(xnrs_del_key(rs, 0, &found));
+    assert(!found);
+
+    bool ok = true;
+    for (uint64_t k = 0; k < COUNT; k++) {
+        size_t size;
+        ok = ok && xnrs_get_key_size(rs, k, &size, &found) && found == (k % 2 == 1);
+    }
+    assert(ok);
+
+    //space left by deleted records is reused
+    for (uint64_t k = 0; k < COUNT; k += 2) {
+        assert(xnrs_put_key(rs, k, sizeof(uint64_t), (uint8_t*)&k));
+    }
+    for (uint64_t k = 0; k < COUNT; k++) {
+        uint64_t val;
+        ok = ok && xnrs_get_key(rs, k, (uint8_t*)&val, sizeof(uint64_t), &found) && found && val == k;
+    }
+    assert(ok);
+
+    assert(xntx_commit(tx));
+    assert(xndb_free(db));
+}
+
+void btree_scan() {
+    struct xndb *db;
+    assert(xndb_create("dummy", true, &db));
+    struct xntx *tx;
+    assert(xntx_create(&tx, db, XNTXMODE_WR));
+
+    struct xnrs rs;
+    assert(xnrs_open(&rs, db, "data", true, XNRST_BTREE, tx));
+
+    //even keys only
+    const int COUNT = 10000;
+    uint64_t *keys = malloc(COUNT * sizeof(uint64_t));
+    btree_shuffle(keys, COUNT);
+    for (int i = 0; i < COUNT; i++) {
+        uint64_t k = keys[i] * 2;
+        assert(xnrs_put_key(rs, k, sizeof(uint64_t), (uint8_t*)&k));
+    }
+    free(keys);
+
+    //full scan is in key order
+    {
+        struct xnrsscan scan;
+        assert(xnrsscan_open(&scan, rs));
+        uint64_t expected = 0;
+        bool more;
+        bool ok = true;
+        while (ok) {
+            ok = xnrsscan_next(&scan, &more);
+            if (!more)
+                break;
+            uint64_t key;
+            uint64_t val;
+            size_t size;
+            ok = ok && xnrsscan_key(&scan, &key) && key == expected;
+            ok = ok && xnrsscan_get_size(&scan, &size) && size == sizeof(uint64_t);
+            ok = ok && xnrsscan_get(&scan, (uint8_t*)&val, size) && val == key;
+            expected += 2;
+        }
+        assert(ok);
+        assert(expected == COUNT * 2);
+    }
+
+    //range bounds that fall between keys
+    {
+        struct xnrsscan scan;
+        assert(xnrsscan_open_range(&scan, rs, 1001, 3001));
+        uint64_t expected = 1002;
+        bool more;
+        bool ok = true;
+        while (ok) {
+            ok = xnrsscan_next(&scan, &more);
+            if (!more)
+                break;
+            uint64_t key;
+            ok = ok && xnrsscan_key(&scan, &key) && key == expected;
+            expected += 2;
+        }
+        assert(ok);
+        assert(expected == 3002);
+    }
+
+    //a range past the last key is empty
+    {
+        struct xnrsscan scan;
+        assert(xnrsscan_open_range(&scan, rs, COUNT * 2, UINT64_MAX));
+        bool more;
+        assert(xnrsscan_next(&scan, &more));
+        assert(!more);
+    }
+
+    assert(xntx_commit(tx));
+    assert(xndb_free(db));
+}
+
+void btree_reopen() {
+    const int COUNT = 2000;
+    {
+        struct xndb *db;
+        assert(xndb_create("dummy", true, &db));
+        struct xntx *tx;
+        assert(xntx_create(&tx, db, XNTXMODE_WR));
+        struct xnrs rs;
+        assert(xnrs_open(&rs, db, "data", true, XNRST_BTREE, tx));
+        for (uint64_t k = 0; k < COUNT; k++) {
+            assert(xnrs_put_key(rs, k, sizeof(uint64_t), (uint8_t*)&k));
+        }
+        assert(xntx_commit(tx));
+        assert(xndb_free(db));
+    }
+
+    {
+        struct xndb *db;
+        assert(xndb_create("dummy", false, &db));
+        struct xntx *tx;
+        assert(xntx_create(&tx, db, XNTXMODE_RD));
+        struct xnrs rs;
+        assert(xnrs_open(&rs, db, "data", false, XNRST_BTREE, tx));
+        bool ok = true;
+        for (uint64_t k = 0; k < COUNT; k++) {
+            uint64_t val;
+            bool found;
+            ok = ok && xnrs_get_key(rs, k, (uint8_t*)&val, sizeof(uint64_t), &found) && found && val == k;
+        }
+        assert(ok);
+        assert(xntx_close((void**)&tx));
+        assert(xndb_free(db));
+    }
+}
+
+void btree_tests() {
+    append_test(btree_put_get);
+    append_test(btree_split);
+    append_test(btree_del);
+    append_test(btree_scan);
+    append_test(btree_reopen);
+}
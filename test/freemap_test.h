@@ -0,0 +1,131 @@
+#pragma once
+
+#include "test.h"
+#include "db.h"
+
+//allocates count pages in write txs of 1024 pages each, and checks they come back in order starting at first
+bool freemap_allocate(struct xndb *db, struct xnfile *file, uint64_t first, int count) {
+    bool ok = true;
+    uint64_t expected = first;
+    for (int done = 0; ok && done < count; done += 1024) {
+        struct xntx *tx;
+        ok = xntx_create(&tx, db, XNTXMODE_WR);
+        for (int i = done; ok && i < count && i < done + 1024; i++) {
+            //the first page of every group holds its bitmap
+            if (expected % XNFILE_GROUP_PAGES == 0)
+                expected++;
+            struct xnpg page;
+            ok = xnfile_allocate_page(file, tx, &page) && page.idx == expected;
+            expected++;
+        }
+        ok = ok && xntx_commit(tx);
+    }
+    return ok;
+}
+
+void freemap_allocate_free() {
+    struct xndb *db;
+    assert(xndb_create("dummy", true, &db));
+    struct xntx *tx;
+    assert(xntx_create(&tx, db, XNTXMODE_WR));
+    //the heap takes pages 1 and 2
+    struct xnrs rs;
+    assert(xnrs_open(&rs, db, "data", true, XNRST_HEAP, tx));
+    assert(xntx_commit(tx));
+    assert(freemap_allocate(db, rs.file, 3, 3));
+
+    assert(xntx_create(&tx, db, XNTXMODE_WR));
+    struct xnpg page = { .file_handle = rs.file, .idx = 4 };
+    assert(xnfile_free_page(rs.file, tx, &page));
+
+    //already free, the map page, and a page no group covers
+    assert(!xnfile_free_page(rs.file, tx, &page));
+    page.idx = 0;
+    assert(!xnfile_free_page(rs.file, tx, &page));
+    page.idx = XNFILE_GROUP_PAGES + 1;
+    assert(!xnfile_free_page(rs.file, tx, &page));
+
+    //the lowest free page is reused first
+    assert(xnfile_allocate_page(rs.file, tx, &page));
+    assert(page.idx == 4);
+    assert(xnfile_allocate_page(rs.file, tx, &page));
+    assert(page.idx == 6);
+    assert(xntx_commit(tx));
+    assert(xndb_free(db));
+}
+
+//fills the first two groups, which is more than one bitmap page could track, and reuses a freed page in an
+//earlier group once the map is reopened
+void freemap_many_groups() {
+    struct xndb *db;
+    assert(xndb_create("dummy", true, &db));
+    struct xntx *tx;
+    assert(xntx_create(&tx, db, XNTXMODE_WR));
+    struct xnrs rs;
+    assert(xnrs_open(&rs, db, "data", true, XNRST_HEAP, tx));
+    assert(xntx_commit(tx));
+
+    assert(freemap_allocate(db, rs.file, 3, XNFILE_GROUP_PAGES * 2 - 4));
+
+    assert(xntx_create(&tx, db, XNTXMODE_WR));
+    struct xnpg page = { .file_handle = rs.file, .idx = 100 };
+    assert(xnfile_free_page(rs.file, tx, &page));
+    assert(xntx_commit(tx));
+    assert(xndb_free(db));
+
+    assert(xndb_create("dummy", false, &db));
+    assert(xntx_create(&tx, db, XNTXMODE_WR));
+    assert(xnrs_open(&rs, db, "data", false, XNRST_HEAP, tx));
+    assert(xnfile_allocate_page(rs.file, tx, &page));
+    assert(page.idx == 100);
+
+    //both groups are full, so a third one starts
+    assert(xnfile_allocate_page(rs.file, tx, &page));
+    assert(page.idx == XNFILE_GROUP_PAGES * 2 + 1);
+    assert(rs.file->size > XNPG_SZ * XNPG_SZ * 8);
+    assert(xntx_commit(tx));
+    assert(xndb_free(db));
+}
+
+//pages claimed by a tx that rolls back go back to the map, and pages freed by a tx stay in use until it commits
+void freemap_tx_end() {
+    struct xndb *db;
+    assert(xndb_create("dummy", true, &db));
+    struct xntx *tx;
+    assert(xntx_create(&tx, db, XNTXMODE_WR));
+    struct xnrs rs;
+    assert(xnrs_open(&rs, db, "data", true, XNRST_HEAP, tx));
+    assert(xntx_commit(tx));
+
+    struct xnpg page;
+    assert(xntx_create(&tx, db, XNTXMODE_WR));
+    assert(xnfile_allocate_page(rs.file, tx, &page));
+    assert(page.idx == 3);
+    assert(xntx_rollback((void**)&tx));
+
+    struct xntx *freer;
+    assert(xntx_create(&tx, db, XNTXMODE_WR));
+    assert(xnfile_allocate_page(rs.file, tx, &page));
+    assert(page.idx == 3);
+    assert(xntx_commit(tx));
+    assert(xntx_create(&freer, db, XNTXMODE_WR));
+    assert(xnfile_free_page(rs.file, freer, &page));
+
+    //other txs can't have the page until the freeing tx commits
+    assert(xntx_create(&tx, db, XNTXMODE_WR));
+    assert(xnfile_allocate_page(rs.file, tx, &page));
+    assert(page.idx == 4);
+    assert(xntx_commit(tx));
+    assert(xntx_commit(freer));
+    assert(xntx_create(&tx, db, XNTXMODE_WR));
+    assert(xnfile_allocate_page(rs.file, tx, &page));
+    assert(page.idx == 3);
+    assert(xntx_commit(tx));
+    assert(xndb_free(db));
+}
+
+void freemap_tests() {
+    append_test(freemap_allocate_free);
+    append_test(freemap_many_groups);
+    append_test(freemap_tx_end);
+}
@@ -0,0 +1,150 @@
+#pragma once
+
+#include <pthread.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "test.h"
+#include "db.h"
+
+void growth_policy() {
+    struct xnfile *handle;
+    assert(xnfile_create(&handle, "dummy", 0, true, false));
+    handle->growth = (struct xngrowth){ .chunk = XNPG_SZ * 4, .percent = 0.5f, .max = XNPG_SZ * 8 };
+    assert(xnfile_set_size(handle, XNPG_SZ * 2));
+
+    //half of 2 pages is below the chunk
+    assert(xnfile_grow(handle, XNPG_SZ * 3));
+    assert(handle->size == XNPG_SZ * 6);
+
+    //already big enough
+    assert(xnfile_grow(handle, XNPG_SZ * 6));
+    assert(handle->size == XNPG_SZ * 6);
+
+    //half of 6 pages is still below the chunk, half of 10 is not
+    assert(xnfile_grow(handle, XNPG_SZ * 11));
+    assert(handle->size == XNPG_SZ * 15);
+
+    //half of 15 pages is rounded up to 8, and half of 23 is capped at 8
+    assert(xnfile_grow(handle, XNPG_SZ * 24));
+    assert(handle->size == XNPG_SZ * 31);
+
+    //the file really is that big, and the new pages read back as zeroes
+    struct stat s;
+    assert(stat("dummy", &s) == 0 && s.st_size == XNPG_SZ * 31);
+    char c = 1;
+    assert(xnfile_read(handle, &c, XNPG_SZ * 30, 1));
+    assert(c == 0);
+    assert(handle->unsynced);
+
+    assert(xnfile_close((void**)&handle));
+}
+
+void growth_ahead() {
+    struct xngrower *grower;
+    assert(xngrower_create(&grower));
+    struct xnfile *handle;
+    assert(xnfile_create(&handle, "dummy", 0, true, false));
+    handle->growth = (struct xngrowth){ .chunk = XNPG_SZ * 8, .percent = 0.0f, .max = 0 };
+    handle->grower = grower;
+    assert(xnfile_set_size(handle, XNPG_SZ * 16));
+
+    //more than half a step left, so nothing is queued
+    assert(xnfile_grow_ahead(handle, XNPG_SZ * 10));
+    assert(handle->grow_target == 0);
+
+    //repeated requests for the same file are merged
+    assert(xnfile_grow_ahead(handle, XNPG_SZ * 13));
+    assert(xnfile_grow_ahead(handle, XNPG_SZ * 14));
+
+    //freeing the grower finishes the queued growth
+    assert(xngrower_free((void**)&grower));
+    assert(handle->size == XNPG_SZ * 24);
+    assert(handle->grow_target == 0);
+    assert(!handle->unsynced);
+
+    assert(xnfile_close((void**)&handle));
+}
+
+struct growth_sync_arg {
+    struct xnfile *handle;
+    bool done;
+    bool ok;
+};
+
+void *growth_sync_fcn(void *arg) {
+    struct growth_sync_arg *a = (struct growth_sync_arg*)arg;
+    a->ok = xnfile_sync_written(a->handle);
+    __atomic_store_n(&a->done, true, __ATOMIC_SEQ_CST);
+    return NULL;
+}
+
+//a sync that has cleared the flag but not finished its fdatasync (held here by taking the sync lock, as the grower
+//does mid-sync) must not let xnfile_sync_written return early
+void growth_sync_in_progress() {
+    struct xnfile *handle;
+    assert(xnfile_create(&handle, "dummy", 0, true, false));
+    assert(xnfile_set_size(handle, XNPG_SZ * 2));
+
+    assert(xn_mutex_lock(handle->sync_lock));
+    handle->unsynced = false;
+    pthread_t thread;
+    struct growth_sync_arg arg = { .handle = handle, .done = false, .ok = false };
+    pthread_create(&thread, NULL, growth_sync_fcn, &arg);
+    usleep(20000);
+    assert(!__atomic_load_n(&arg.done, __ATOMIC_SEQ_CST));
+    assert(xn_mutex_unlock(handle->sync_lock));
+    pthread_join(thread, NULL);
+    assert(arg.done && arg.ok);
+
+    assert(xnfile_close((void**)&handle));
+}
+
+//a tiny growth step, so the data file and the log both grow many times while records are written
+void growth_db() {
+    const int COUNT = 3000;
+    struct xndbopts opts = xndb_default_opts();
+    opts.growth = (struct xngrowth){ .chunk = XNPG_SZ, .percent = 0.0f, .max = XNPG_SZ * 2 };
+    uint8_t val[200];
+
+    struct xndb *db;
+    assert(xndb_create_opts("dummy", true, opts, &db));
+    struct xntx *tx;
+    assert(xntx_create(&tx, db, XNTXMODE_WR));
+    struct xnrs rs;
+    assert(xnrs_open(&rs, db, "data", true, XNRST_HEAP, tx));
+    for (int i = 0; i < COUNT; i++) {
+        memset(val, i % 256, sizeof(val));
+        struct xnitemid id;
+        assert(xnrs_put(rs, sizeof(val), val, &id));
+    }
+    assert(xntx_commit(tx));
+    assert(rs.file->size > XNPG_SZ * 32);
+    assert(xndb_free(db));
+
+    assert(xndb_create_opts("dummy", false, opts, &db));
+    assert(xntx_create(&tx, db, XNTXMODE_RD));
+    assert(xnrs_open(&rs, db, "data", false, XNRST_HEAP, tx));
+    struct xnrsscan scan;
+    assert(xnrsscan_open(&scan, rs));
+    int count = 0;
+    bool more;
+    while (true) {
+        assert(xnrsscan_next(&scan, &more));
+        if (!more)
+            break;
+        assert(xnrsscan_get(&scan, val, sizeof(val)));
+        assert(val[0] == count % 256 && val[sizeof(val) - 1] == count % 256);
+        count++;
+    }
+    assert(count == COUNT);
+    assert(xntx_close((void**)&tx));
+    assert(xndb_free(db));
+}
+
+void growth_tests() {
+    append_test(growth_policy);
+    append_test(growth_ahead);
+    append_test(growth_sync_in_progress);
+    append_test(growth_db);
+}
@@ -0,0 +1,206 @@
+#pragma once
+
+#include "test.h"
+#include "db.h"
+
+void hash_put_get() {
+    struct xndb *db;
+    assert(xndb_create("dummy", true, &db));
+    struct xntx *tx;
+    assert(xntx_create(&tx, db, XNTXMODE_WR));
+
+    struct xnrs rs;
+    assert(xnrs_open(&rs, db, "data", true, XNRST_HASH, tx));
+
+    float vectors[2][3] = { { 1.0f, 2.0f, 3.0f },
+                            { 4.0f, 5.0f, 6.0f } };
+    assert(xnrs_put_key(rs, 7, sizeof(vectors), (uint8_t*)vectors));
+
+    size_t size;
+    bool found;
+    assert(xnrs_get_key_size(rs, 7, &size, &found));
+    assert(found);
+    assert(size == sizeof(vectors));
+    uint8_t *buf = malloc(size);
+    assert(xnrs_get_key(rs, 7, buf, size, &found));
+    assert(found);
+    assert(memcmp(vectors, buf, size) == 0);
+    free(buf);
+
+    assert(xnrs_get_key_size(rs, 8, &size, &found));
+    assert(!found);
+
+    //putting an existing key replaces its value
+    int val = 42;
+    assert(xnrs_put_key(rs, 7, sizeof(int), (uint8_t*)&val));
+    assert(xnrs_get_key_size(rs, 7, &size, &found));
+    assert(found && size == sizeof(int));
+    val = 0;
+    assert(xnrs_get_key(rs, 7, (uint8_t*)&val, sizeof(int), &found));
+    assert(found && val == 42);
+
+    assert(xntx_commit(tx));
+    assert(xndb_free(db));
+}
+
+void hash_split() {
+    struct xndb *db;
+    assert(xndb_create("dummy", true, &db));
+    struct xntx *tx;
+    assert(xntx_create(&tx, db, XNTXMODE_WR));
+
+    struct xnrs rs;
+    assert(xnrs_open(&rs, db, "data", true, XNRST_HASH, tx));
+
+    //enough keys for the directory to outgrow its first page
+    const int COUNT = 150000;
+    for (uint64_t k = 0; k < COUNT; k++) {
+        assert(xnrs_put_key(rs, k, sizeof(uint64_t), (uint8_t*)&k));
+    }
+
+    bool ok = true;
+    for (uint64_t k = 0; k < COUNT; k++) {
+        uint64_t val;
+        bool found;
+        ok = ok && xnrs_get_key(rs, k, (uint8_t*)&val, sizeof(uint64_t), &found) && found && val == k;
+    }
+    assert(ok);
+    uint32_t meta[2];
+    assert(xnpg_read(&rs.as.hs.meta, tx, (uint8_t*)meta, 0, sizeof(meta)));
+    assert((1 << meta[0]) > XNHS_DIR_ENTRIES);
+    assert(meta[1] == (1 << meta[0]) / XNHS_DIR_ENTRIES);
+
+    assert(xntx_commit(tx));
+    assert(xndb_free(db));
+}
+
+void hash_del() {
+    struct xndb *db;
+    assert(xndb_create("dummy", true, &db));
+    struct xntx *tx;
+    assert(xntx_create(&tx, db, XNTXMODE_WR));
+
+    struct xnrs rs;
+    assert(xnrs_open(&rs, db, "data", true, XNRST_HASH, tx));
+
+    const int COUNT = 5000;
+    for (uint64_t k = 0; k < COUNT; k++) {
+        assert(xnrs_put_key(rs, k, sizeof(uint64_t), (uint8_t*)&k));
+    }
+    bool found;
+    for (uint64_t k = 0; k < COUNT; k += 2) {
+        assert(xnrs_del_key(rs, k, &found));
+        assert(found);
+    }
+    assert(xnrs_del_key(rs, 0, &found));
+    assert(!found);
+
+    bool ok = true;
+    for (uint64_t k = 0; k < COUNT; k++) {
+        size_t size;
+        ok = ok && xnrs_get_key_size(rs, k, &size, &found) && found == (k % 2 == 1);
+    }
+    assert(ok);
+
+    //space left by deleted records is reused
+    for (uint64_t k = 0; k < COUNT; k += 2) {
+        assert(xnrs_put_key(rs, k, sizeof(uint64_t), (uint8_t*)&k));
+    }
+    for (uint64_t k = 0; k < COUNT; k++) {
+        uint64_t val;
+        ok = ok && xnrs_get_key(rs, k, (uint8_t*)&val, sizeof(uint64_t), &found) && found && val == k;
+    }
+    assert(ok);
+
+    assert(xntx_commit(tx));
+    assert(xndb_free(db));
+}
+
+void hash_scan() {
+    struct xndb *db;
+    assert(xndb_create("dummy", true, &db));
+    struct xntx *tx;
+    assert(xntx_create(&tx, db, XNTXMODE_WR));
+
+    struct xnrs rs;
+    assert(xnrs_open(&rs, db, "data", true, XNRST_HASH, tx));
+
+    const int COUNT = 10000;
+    for (uint64_t k = 0; k < COUNT; k++) {
+        assert(xnrs_put_key(rs, k, sizeof(uint64_t), (uint8_t*)&k));
+    }
+
+    //every key exactly once, in no particular order
+    uint8_t *seen = calloc(COUNT, 1);
+    struct xnrsscan scan;
+    assert(xnrsscan_open(&scan, rs));
+    int count = 0;
+    bool more;
+    bool ok = true;
+    while (ok) {
+        ok = xnrsscan_next(&scan, &more);
+        if (!more)
+            break;
+        uint64_t key;
+        uint64_t val;
+        size_t size;
+        ok = ok && xnrsscan_key(&scan, &key) && key < COUNT && !seen[key];
+        ok = ok && xnrsscan_get_size(&scan, &size) && size == sizeof(uint64_t);
+        ok = ok && xnrsscan_get(&scan, (uint8_t*)&val, size) && val == key;
+        if (ok)
+            seen[key] = 1;
+        count++;
+    }
+    assert(ok);
+    assert(count == COUNT);
+    free(seen);
+
+    //hash record stores are unordered
+    assert(!xnrsscan_open_range(&scan, rs, 0, 10));
+
+    assert(xntx_commit(tx));
+    assert(xndb_free(db));
+}
+
+void hash_reopen() {
+    const int COUNT = 2000;
+    {
+        struct xndb *db;
+        assert(xndb_create("dummy", true, &db));
+        struct xntx *tx;
+        assert(xntx_create(&tx, db, XNTXMODE_WR));
+        struct xnrs rs;
+        assert(xnrs_open(&rs, db, "data", true, XNRST_HASH, tx));
+        for (uint64_t k = 0; k < COUNT; k++) {
+            assert(xnrs_put_key(rs, k, sizeof(uint64_t), (uint8_t*)&k));
+        }
+        assert(xntx_commit(tx));
+        assert(xndb_free(db));
+    }
+
+    {
+        struct xndb *db;
+        assert(xndb_create("dummy", false, &db));
+        struct xntx *tx;
+        assert(xntx_create(&tx, db, XNTXMODE_RD));
+        struct xnrs rs;
+        assert(xnrs_open(&rs, db, "data", false, XNRST_HASH, tx));
+        bool ok = true;
+        for (uint64_t k = 0; k < COUNT; k++) {
+            uint64_t val;
+            bool found;
+            ok = ok && xnrs_get_key(rs, k, (uint8_t*)&val, sizeof(uint64_t), &found) && found && val == k;
+        }
+        assert(ok);
+        assert(xntx_close((void**)&tx));
+        assert(xndb_free(db));
+    }
+}
+
+void hash_tests() {
+    append_test(hash_put_get);
+    append_test(hash_split);
+    append_test(hash_del);
+    append_test(hash_scan);
+    append_test(hash_reopen);
+}
@@ -0,0 +1,67 @@
+#include "db.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+//measures xnhp_put throughput for a few record sizes.
+//usage: ./heap_bench [records]
+//
+//Records are put through the heap directly, committing every BATCH records, so the time is spent in the heap,
+//container and page layers and in the log.
+
+#define BATCH 10000
+
+static double elapsed(struct timespec start, struct timespec end) {
+    return (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+}
+
+static bool put(struct xndb *db, int records, size_t size) {
+    uint8_t *val = malloc(size);
+    memset(val, 'x', size);
+    bool ok = true;
+    for (int k = 0; ok && k < records; k += BATCH) {
+        struct xntx *tx;
+        ok = xntx_create(&tx, db, XNTXMODE_WR);
+        struct xnrs rs;
+        ok = ok && xnrs_open(&rs, db, "data", k == 0, XNRST_HEAP, tx);
+        for (int i = k; ok && i < k + BATCH && i < records; i++) {
+            struct xnitemid id;
+            memcpy(val, &i, sizeof(int));
+            ok = xnhp_put(&rs.as.hp, val, size, &id);
+        }
+        ok = ok && xntx_commit(tx);
+    }
+    free(val);
+    return ok;
+}
+
+int main(int argc, char **argv) {
+    int records = argc > 1 ? atoi(argv[1]) : 1000000;
+    size_t sizes[] = { 8, 100, 400 };
+
+    for (int i = 0; i < 3; i++) {
+        system("rm -rf bench");
+        struct xndb *db;
+        if (!xndb_create("bench", true, &db)) {
+            printf("xndb_create failed\n");
+            return 1;
+        }
+
+        struct timespec start, end;
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        bool ok = put(db, records, sizes[i]);
+        clock_gettime(CLOCK_MONOTONIC, &end);
+
+        if (!xndb_free(db) || !ok) {
+            printf("%4zu byte records: put failed\n", sizes[i]);
+            return 1;
+        }
+        double secs = elapsed(start, end);
+        printf("%4zu byte records: %d puts in %6.2fs, %10.1f puts/sec\n", sizes[i], records, secs, records / secs);
+    }
+
+    system("rm -rf bench");
+    return 0;
+}
@@ -0,0 +1,122 @@
+#include "db.h"
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+//measures HNSW build time, query latency and recall@10 at different ef settings.
+//usage: ./hnsw_bench [vectors dim m ef_construction]
+//
+//Vectors and queries are clustered around the same random centers.  Recall is measured against a brute force search.
+
+#define BATCH 1000
+#define QUERIES 100
+#define K 10
+#define CENTERS 64
+
+static double elapsed(struct timespec start, struct timespec end) {
+    return (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+}
+
+static void make_vectors(float *vecs, int count, int dim, unsigned int seed) {
+    float *centers = malloc((size_t)CENTERS * dim * sizeof(float));
+    for (int i = 0; i < CENTERS * dim; i++)
+        centers[i] = (float)rand_r(&seed) / RAND_MAX;
+    for (int i = 0; i < count; i++) {
+        int c = rand_r(&seed) % CENTERS;
+        for (int d = 0; d < dim; d++)
+            vecs[(size_t)i * dim + d] = centers[c * dim + d] + 0.1f * ((float)rand_r(&seed) / RAND_MAX - 0.5f);
+    }
+    free(centers);
+}
+
+static void brute_force(const float *vecs, int count, int dim, const float *query, uint64_t *ids) {
+    float dists[K];
+    struct xnvtopk topk;
+    xnvtopk_init(&topk, K, ids, dists);
+    for (int i = 0; i < count; i++)
+        xnvtopk_push(&topk, i, xnvec_euclidean(query, vecs + (size_t)i * dim, dim));
+}
+
+static void fail(const char *msg) {
+    printf("%s failed\n", msg);
+    exit(1);
+}
+
+int main(int argc, char **argv) {
+    int count = argc > 1 ? atoi(argv[1]) : 20000;
+    int dim = argc > 2 ? atoi(argv[2]) : 128;
+    struct xnhnswopts opts = xnhnsw_default_opts(dim);
+    opts.m = argc > 3 ? atoi(argv[3]) : opts.m;
+    opts.ef_construction = argc > 4 ? atoi(argv[4]) : opts.ef_construction;
+
+    //queries come from the same clusters as the data, and aren't inserted
+    float *vecs = malloc((size_t)(count + QUERIES) * dim * sizeof(float));
+    uint64_t *ids = malloc(count * sizeof(uint64_t));
+    make_vectors(vecs, count + QUERIES, dim, 1);
+    for (int i = 0; i < count; i++)
+        ids[i] = i;
+    float *queries = vecs + (size_t)count * dim;
+
+    system("rm -rf bench");
+    struct xndb *db;
+    if (!xndb_create("bench", true, &db))
+        fail("xndb_create");
+
+    struct timespec start, end;
+    struct xntx *tx;
+    struct xnrs rs;
+    if (!xntx_create(&tx, db, XNTXMODE_WR) || !xnrs_open(&rs, db, "vecs", true, XNRST_HNSW, tx))
+        fail("xnrs_open");
+    if (!xnrs_init_hnsw(rs, opts) || !xntx_commit(tx))
+        fail("xnrs_init_hnsw");
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (int i = 0; i < count; i += BATCH) {
+        int n = count - i < BATCH ? count - i : BATCH;
+        if (!xntx_create(&tx, db, XNTXMODE_WR) || !xnrs_open(&rs, db, "vecs", false, XNRST_HNSW, tx))
+            fail("xnrs_open");
+        if (!xnrs_put_vecs(rs, n, ids + i, vecs + (size_t)i * dim) || !xntx_commit(tx))
+            fail("xnrs_put_vecs");
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    printf("%d x %d vectors, m %d, ef_construction %d\n", count, dim, opts.m, opts.ef_construction);
+    printf("build %8.2fs\n", elapsed(start, end));
+
+    uint64_t *truth = malloc((size_t)QUERIES * K * sizeof(uint64_t));
+    for (int q = 0; q < QUERIES; q++)
+        brute_force(vecs, count, dim, queries + (size_t)q * dim, truth + q * K);
+
+    if (!xntx_create(&tx, db, XNTXMODE_RD) || !xnrs_open(&rs, db, "vecs", false, XNRST_HNSW, tx))
+        fail("xnrs_open");
+
+    int efs[] = { 10, 32, 64, 128 };
+    for (int e = 0; e < 4; e++) {
+        int hits = 0;
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        for (int q = 0; q < QUERIES; q++) {
+            uint64_t out_ids[K];
+            float out_dists[K];
+            int out_count;
+            if (!xnrs_search(rs, queries + (size_t)q * dim, K, efs[e], out_ids, out_dists, &out_count))
+                fail("xnrs_search");
+            for (int i = 0; i < out_count; i++) {
+                for (int j = 0; j < K; j++) {
+                    if (out_ids[i] == truth[q * K + j])
+                        hits++;
+                }
+            }
+        }
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        printf("ef %4d: %8.3f ms/query, recall@%d %.3f\n", efs[e], elapsed(start, end) * 1000 / QUERIES, K, (double)hits / (QUERIES * K));
+    }
+
+    if (!xntx_close((void**)&tx) || !xndb_free(db))
+        fail("xndb_free");
+    system("rm -rf bench");
+    free(vecs);
+    free(ids);
+    free(truth);
+    return 0;
+}
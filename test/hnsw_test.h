@@ -0,0 +1,233 @@
+#pragma once
+
+#include <pthread.h>
+
+#include "test.h"
+#include "db.h"
+
+#define HNSW_DIM 16
+
+//finds the 10 nearest neighbors of every 20th vector and counts how many brute force agrees with
+bool hnsw_recall(struct xnrs rs, enum xnvmetric metric, const float *vecs, int count, int ef, int *found) {
+    bool ok = true;
+    *found = 0;
+    for (int q = 0; q < count; q += 20) {
+        const float *query = vecs + (size_t)q * HNSW_DIM;
+        uint64_t truth[10];
+        float truth_dists[10];
+        struct xnvtopk topk;
+        xnvtopk_init(&topk, 10, truth, truth_dists);
+        xnvec_topk_block(metric, query, vecs, NULL, count, HNSW_DIM, &topk);
+
+        uint64_t out_ids[10];
+        float out_dists[10];
+        int out_count = 0;
+        ok = ok && xnrs_search(rs, query, 10, ef, out_ids, out_dists, &out_count);
+        ok = ok && out_count == 10;
+        for (int i = 0; i < out_count; i++) {
+            ok = ok && (i == 0 || out_dists[i - 1] <= out_dists[i]);
+            for (int j = 0; j < 10; j++)
+                *found += out_ids[i] == truth[j];
+        }
+    }
+    return ok;
+}
+
+bool hnsw_build(enum xnvmetric metric) {
+    const int COUNT = 2000;
+    float *vecs = malloc(COUNT * HNSW_DIM * sizeof(float));
+    uint64_t *ids = malloc(COUNT * sizeof(uint64_t));
+    ivf_make_vectors(vecs, COUNT, HNSW_DIM, 11);
+    for (int i = 0; i < COUNT; i++)
+        ids[i] = i;
+
+    struct xndb *db;
+    bool ok = xndb_create("dummy", true, &db);
+    struct xntx *tx;
+    ok = ok && xntx_create(&tx, db, XNTXMODE_WR);
+    struct xnrs rs;
+    ok = ok && xnrs_open(&rs, db, "vecs", true, XNRST_HNSW, tx);
+
+    //vectors can't be added before the options are set, and the options are only set once
+    ok = ok && !xnrs_put_vecs(rs, 1, ids, vecs);
+    struct xnhnswopts opts = xnhnsw_default_opts(HNSW_DIM);
+    opts.metric = metric;
+    ok = ok && xnrs_init_hnsw(rs, opts);
+    ok = ok && !xnrs_init_hnsw(rs, opts);
+
+    uint64_t out_ids[10];
+    float out_dists[10];
+    int out_count = -1;
+    ok = ok && xnrs_search(rs, vecs, 10, 10, out_ids, out_dists, &out_count);
+    ok = ok && out_count == 0;
+    ok = ok && xntx_commit(tx);
+
+    //inserted over several transactions, since the graph grows incrementally
+    for (int i = 0; i < COUNT; i += 500) {
+        ok = ok && xntx_create(&tx, db, XNTXMODE_WR);
+        ok = ok && xnrs_open(&rs, db, "vecs", false, XNRST_HNSW, tx);
+        ok = ok && xnrs_put_vecs(rs, 500, ids + i, vecs + (size_t)i * HNSW_DIM);
+        ok = ok && xntx_commit(tx);
+    }
+
+    ok = ok && xntx_create(&tx, db, XNTXMODE_RD);
+    ok = ok && xnrs_open(&rs, db, "vecs", false, XNRST_HNSW, tx);
+    int found;
+    ok = ok && hnsw_recall(rs, metric, vecs, COUNT, 64, &found);
+    ok = ok && found >= 950;
+    ok = ok && xntx_close((void**)&tx);
+    ok = ok && xndb_free(db);
+
+    free(vecs);
+    free(ids);
+    return ok;
+}
+
+void hnsw_build_l2() {
+    assert(hnsw_build(XNVM_L2));
+}
+
+void hnsw_build_cosine() {
+    assert(hnsw_build(XNVM_COSINE));
+}
+
+void hnsw_reopen() {
+    const int COUNT = 300;
+    float vecs[COUNT * HNSW_DIM];
+    uint64_t ids[COUNT];
+    ivf_make_vectors(vecs, COUNT, HNSW_DIM, 12);
+    for (int i = 0; i < COUNT; i++)
+        ids[i] = 1000 + i;
+
+    {
+        struct xndb *db;
+        assert(xndb_create("dummy", true, &db));
+        struct xntx *tx;
+        assert(xntx_create(&tx, db, XNTXMODE_WR));
+        struct xnrs rs;
+        assert(xnrs_open(&rs, db, "vecs", true, XNRST_HNSW, tx));
+        assert(xnrs_init_hnsw(rs, xnhnsw_default_opts(HNSW_DIM)));
+        assert(xnrs_put_vecs(rs, COUNT, ids, vecs));
+        assert(xntx_commit(tx));
+        assert(xndb_free(db));
+    }
+
+    {
+        struct xndb *db;
+        assert(xndb_create("dummy", false, &db));
+        struct xntx *tx;
+        assert(xntx_create(&tx, db, XNTXMODE_RD));
+        struct xnrs rs;
+        assert(xnrs_open(&rs, db, "vecs", false, XNRST_HNSW, tx));
+
+        //every stored vector finds itself first
+        bool all_found = true;
+        for (int i = 0; i < COUNT; i++) {
+            uint64_t out_ids[4];
+            float out_dists[4];
+            int out_count;
+            assert(xnrs_search(rs, vecs + i * HNSW_DIM, 4, 32, out_ids, out_dists, &out_count));
+            all_found = all_found && out_count == 4 && out_ids[0] == ids[i] && out_dists[0] < 1e-3f;
+        }
+        assert(all_found);
+        assert(xntx_close((void**)&tx));
+        assert(xndb_free(db));
+    }
+}
+
+struct hnsw_reader_arg {
+    struct xndb *db;
+    const float *vecs;
+    int searches;
+    bool ok;
+};
+
+//each search runs in its own read transaction, and sees a whole number of the writer's batches
+void *hnsw_reader_fcn(void *arg) {
+    struct hnsw_reader_arg *a = (struct hnsw_reader_arg*)arg;
+    for (int i = 0; i < a->searches && a->ok; i++) {
+        struct xntx *tx;
+        struct xnrs rs;
+        uint64_t out_ids[5];
+        float out_dists[5];
+        int out_count;
+        a->ok = a->ok && xntx_create(&tx, a->db, XNTXMODE_RD);
+        a->ok = a->ok && xnrs_open(&rs, a->db, "vecs", false, XNRST_HNSW, tx);
+        a->ok = a->ok && xnrs_search(rs, a->vecs + (i % 100) * HNSW_DIM, 5, 16, out_ids, out_dists, &out_count);
+        a->ok = a->ok && out_count == 5;
+        for (int j = 0; j < out_count; j++)
+            a->ok = a->ok && out_ids[j] < 1000 && (j == 0 || out_dists[j - 1] <= out_dists[j]);
+        a->ok = a->ok && xntx_close((void**)&tx);
+    }
+    return NULL;
+}
+
+void hnsw_concurrent_readers() {
+    const int COUNT = 1000;
+    const int BATCH = 100;
+    float *vecs = malloc(COUNT * HNSW_DIM * sizeof(float));
+    uint64_t ids[COUNT];
+    ivf_make_vectors(vecs, COUNT, HNSW_DIM, 13);
+    for (int i = 0; i < COUNT; i++)
+        ids[i] = i;
+
+    struct xndb *db;
+    assert(xndb_create("dummy", true, &db));
+    struct xntx *tx;
+    struct xnrs rs;
+    assert(xntx_create(&tx, db, XNTXMODE_WR));
+    assert(xnrs_open(&rs, db, "vecs", true, XNRST_HNSW, tx));
+    assert(xnrs_init_hnsw(rs, xnhnsw_default_opts(HNSW_DIM)));
+    assert(xnrs_put_vecs(rs, BATCH, ids, vecs));
+    assert(xntx_commit(tx));
+
+    const int THREAD_COUNT = 4;
+    struct hnsw_reader_arg args[THREAD_COUNT];
+    pthread_t threads[THREAD_COUNT];
+    for (int i = 0; i < THREAD_COUNT; i++) {
+        args[i].db = db;
+        args[i].vecs = vecs;
+        args[i].searches = 200;
+        args[i].ok = true;
+        pthread_create(&threads[i], NULL, hnsw_reader_fcn, &args[i]);
+    }
+
+    for (int i = BATCH; i < COUNT; i += BATCH) {
+        assert(xntx_create(&tx, db, XNTXMODE_WR));
+        assert(xnrs_open(&rs, db, "vecs", false, XNRST_HNSW, tx));
+        assert(xnrs_put_vecs(rs, BATCH, ids + i, vecs + (size_t)i * HNSW_DIM));
+        assert(xntx_commit(tx));
+    }
+
+    for (int i = 0; i < THREAD_COUNT; i++) {
+        pthread_join(threads[i], NULL);
+        assert(args[i].ok);
+    }
+
+    //a second writer that started before the first committed loses the race on the metadata page
+    struct xntx *tx1;
+    struct xntx *tx2;
+    struct xnrs rs1;
+    struct xnrs rs2;
+    assert(xntx_create(&tx1, db, XNTXMODE_WR));
+    assert(xntx_create(&tx2, db, XNTXMODE_WR));
+    assert(xnrs_open(&rs1, db, "vecs", false, XNRST_HNSW, tx1));
+    assert(xnrs_open(&rs2, db, "vecs", false, XNRST_HNSW, tx2));
+    assert(xnrs_put_vecs(rs1, 1, ids, vecs));
+    assert(xnrs_put_vecs(rs2, 1, ids, vecs));
+    bool committed1;
+    bool committed2;
+    assert(xntx_try_commit(tx1, &committed1));
+    assert(xntx_try_commit(tx2, &committed2));
+    assert(committed1 && !committed2);
+
+    assert(xndb_free(db));
+    free(vecs);
+}
+
+void hnsw_tests() {
+    append_test(hnsw_build_l2);
+    append_test(hnsw_build_cosine);
+    append_test(hnsw_reopen);
+    append_test(hnsw_concurrent_readers);
+}
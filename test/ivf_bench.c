@@ -0,0 +1,133 @@
+#include "db.h"
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+//measures IVF-Flat query latency and recall@10 at different nprobe settings.
+//usage: ./ivf_bench [vectors dim nlist threads pq_m]
+//
+//pq_m stores vectors as pq_m byte product quantization codes instead of floats.
+//
+//Vectors are clustered around random centers.  Recall is measured against a brute force search.
+
+#define BATCH 5000
+#define QUERIES 100
+#define K 10
+#define CENTERS 64
+
+static double elapsed(struct timespec start, struct timespec end) {
+    return (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+}
+
+static void make_vectors(float *vecs, int count, int dim, unsigned int seed) {
+    float *centers = malloc((size_t)CENTERS * dim * sizeof(float));
+    for (int i = 0; i < CENTERS * dim; i++)
+        centers[i] = (float)rand_r(&seed) / RAND_MAX;
+    for (int i = 0; i < count; i++) {
+        int c = rand_r(&seed) % CENTERS;
+        for (int d = 0; d < dim; d++)
+            vecs[(size_t)i * dim + d] = centers[c * dim + d] + 0.1f * ((float)rand_r(&seed) / RAND_MAX - 0.5f);
+    }
+    free(centers);
+}
+
+static void brute_force(const float *vecs, int count, int dim, const float *query, uint64_t *ids) {
+    float dists[K];
+    struct xnvtopk topk;
+    xnvtopk_init(&topk, K, ids, dists);
+    for (int i = 0; i < count; i++)
+        xnvtopk_push(&topk, i, xnvec_euclidean(query, vecs + (size_t)i * dim, dim));
+}
+
+static void fail(const char *msg) {
+    printf("%s failed\n", msg);
+    exit(1);
+}
+
+int main(int argc, char **argv) {
+    int count = argc > 1 ? atoi(argv[1]) : 100000;
+    int dim = argc > 2 ? atoi(argv[2]) : 128;
+    int nlist = argc > 3 ? atoi(argv[3]) : (int)sqrt(count);
+    int threads = argc > 4 ? atoi(argv[4]) : 0;
+    int pq_m = argc > 5 ? atoi(argv[5]) : 0;
+
+    float *vecs = malloc((size_t)count * dim * sizeof(float));
+    uint64_t *ids = malloc(count * sizeof(uint64_t));
+    make_vectors(vecs, count, dim, 1);
+    for (int i = 0; i < count; i++)
+        ids[i] = i;
+    float *queries = malloc((size_t)QUERIES * dim * sizeof(float));
+    make_vectors(queries, QUERIES, dim, 2);
+
+    system("rm -rf bench");
+    struct xndb *db;
+    if (!xndb_create("bench", true, &db))
+        fail("xndb_create");
+
+    //train on a sample of up to 50 vectors per list
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    struct xntx *tx;
+    struct xnrs rs;
+    int sample = nlist * 50 < count ? nlist * 50 : count;
+    if (!xntx_create(&tx, db, XNTXMODE_WR) || !xnrs_open(&rs, db, "vecs", true, XNRST_IVFFLAT, tx))
+        fail("xnrs_open");
+    struct xnivfopts opts = xnivf_default_opts(dim, nlist);
+    opts.threads = threads;
+    opts.pq_m = pq_m;
+    if (!xnrs_train(rs, opts, vecs, sample) || !xntx_commit(tx))
+        fail("xnrs_train");
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    printf("%d x %d vectors, %d lists, %d bytes per stored vector\n", count, dim, nlist, pq_m > 0 ? pq_m : dim * (int)sizeof(float));
+    printf("train %8.2fs (%d samples)\n", elapsed(start, end), sample);
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (int i = 0; i < count; i += BATCH) {
+        int n = count - i < BATCH ? count - i : BATCH;
+        if (!xntx_create(&tx, db, XNTXMODE_WR) || !xnrs_open(&rs, db, "vecs", false, XNRST_IVFFLAT, tx))
+            fail("xnrs_open");
+        if (!xnrs_put_vecs(rs, n, ids + i, vecs + (size_t)i * dim) || !xntx_commit(tx))
+            fail("xnrs_put_vecs");
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    printf("load  %8.2fs\n", elapsed(start, end));
+
+    uint64_t *truth = malloc((size_t)QUERIES * K * sizeof(uint64_t));
+    for (int q = 0; q < QUERIES; q++)
+        brute_force(vecs, count, dim, queries + (size_t)q * dim, truth + q * K);
+
+    if (!xntx_create(&tx, db, XNTXMODE_RD) || !xnrs_open(&rs, db, "vecs", false, XNRST_IVFFLAT, tx))
+        fail("xnrs_open");
+
+    int nprobes[] = { 1, 4, 16, 64 };
+    for (int p = 0; p < 4 && nprobes[p] <= nlist; p++) {
+        int hits = 0;
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        for (int q = 0; q < QUERIES; q++) {
+            uint64_t out_ids[K];
+            float out_dists[K];
+            int out_count;
+            if (!xnrs_search(rs, queries + (size_t)q * dim, K, nprobes[p], out_ids, out_dists, &out_count))
+                fail("xnrs_search");
+            for (int i = 0; i < out_count; i++) {
+                for (int j = 0; j < K; j++) {
+                    if (out_ids[i] == truth[q * K + j])
+                        hits++;
+                }
+            }
+        }
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        printf("nprobe %3d: %8.3f ms/query, recall@%d %.3f\n", nprobes[p], elapsed(start, end) * 1000 / QUERIES, K, (double)hits / (QUERIES * K));
+    }
+
+    if (!xntx_close((void**)&tx) || !xndb_free(db))
+        fail("xndb_free");
+    system("rm -rf bench");
+    free(vecs);
+    free(ids);
+    free(queries);
+    free(truth);
+    return 0;
+}
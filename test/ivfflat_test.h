@@ -0,0 +1,320 @@
+#pragma once
+
+#include "test.h"
+#include "db.h"
+
+#define IVF_DIM 16
+
+//vectors clustered around a few random centers, so k-means has structure to find
+void ivf_make_vectors(float *vecs, int count, int dim, unsigned int seed) {
+    float centers[8][IVF_DIM];
+    for (int c = 0; c < 8; c++) {
+        for (int d = 0; d < dim; d++)
+            centers[c][d] = (float)(rand_r(&seed) % 1000) / 10.0f;
+    }
+    for (int i = 0; i < count; i++) {
+        for (int d = 0; d < dim; d++)
+            vecs[(size_t)i * dim + d] = centers[i % 8][d] + (float)(rand_r(&seed) % 100) / 50.0f;
+    }
+}
+
+//exact nearest neighbor by brute force
+uint64_t ivf_brute_force(const float *vecs, int count, int dim, const float *query) {
+    uint64_t best = 0;
+    float best_dist = INFINITY;
+    for (int i = 0; i < count; i++) {
+        float dist = xnvec_euclidean(query, vecs + (size_t)i * dim, dim);
+        if (dist < best_dist) {
+            best_dist = dist;
+            best = i;
+        }
+    }
+    return best;
+}
+
+void ivf_train_search() {
+    struct xndb *db;
+    assert(xndb_create("dummy", true, &db));
+    struct xntx *tx;
+    assert(xntx_create(&tx, db, XNTXMODE_WR));
+
+    struct xnrs rs;
+    assert(xnrs_open(&rs, db, "vecs", true, XNRST_IVFFLAT, tx));
+
+    const int COUNT = 2000;
+    float *vecs = malloc(COUNT * IVF_DIM * sizeof(float));
+    uint64_t *ids = malloc(COUNT * sizeof(uint64_t));
+    ivf_make_vectors(vecs, COUNT, IVF_DIM, 1);
+    for (int i = 0; i < COUNT; i++)
+        ids[i] = i;
+
+    //searching before training fails
+    uint64_t out_ids[10];
+    float out_dists[10];
+    int out_count;
+    assert(!xnrs_search(rs, vecs, 10, 1, out_ids, out_dists, &out_count));
+
+    assert(xnrs_train(rs, xnivf_default_opts(IVF_DIM, 16), vecs, 500));
+    assert(!xnrs_train(rs, xnivf_default_opts(IVF_DIM, 16), vecs, 500));
+    assert(xnrs_put_vecs(rs, COUNT, ids, vecs));
+
+    //probing every list is an exact search
+    bool ok = true;
+    for (int q = 0; q < 20; q++) {
+        const float *query = vecs + (size_t)q * 97 * IVF_DIM;
+        ok = ok && xnrs_search(rs, query, 10, 16, out_ids, out_dists, &out_count);
+        ok = ok && out_count == 10 && out_ids[0] == ivf_brute_force(vecs, COUNT, IVF_DIM, query) && out_dists[0] == 0.0f;
+        for (int i = 1; i < out_count; i++)
+            ok = ok && out_dists[i - 1] <= out_dists[i];
+    }
+    assert(ok);
+
+    //a query for a stored vector finds it in its own list
+    ok = true;
+    for (int q = 0; q < 20; q++) {
+        const float *query = vecs + (size_t)q * 97 * IVF_DIM;
+        ok = ok && xnrs_search(rs, query, 1, 1, out_ids, out_dists, &out_count);
+        ok = ok && out_count == 1 && out_ids[0] == q * 97;
+    }
+    assert(ok);
+
+    free(vecs);
+    free(ids);
+    assert(xntx_commit(tx));
+    assert(xndb_free(db));
+}
+
+void ivf_reopen() {
+    const int COUNT = 1000;
+    float *vecs = malloc(COUNT * IVF_DIM * sizeof(float));
+    uint64_t *ids = malloc(COUNT * sizeof(uint64_t));
+    ivf_make_vectors(vecs, COUNT, IVF_DIM, 2);
+    for (int i = 0; i < COUNT; i++)
+        ids[i] = i + 1000;
+
+    {
+        struct xndb *db;
+        assert(xndb_create("dummy", true, &db));
+        struct xntx *tx;
+        assert(xntx_create(&tx, db, XNTXMODE_WR));
+        struct xnrs rs;
+        assert(xnrs_open(&rs, db, "vecs", true, XNRST_IVFFLAT, tx));
+        struct xnivfopts opts = xnivf_default_opts(IVF_DIM, 8);
+        opts.metric = XNVM_COSINE;
+        assert(xnrs_train(rs, opts, vecs, COUNT));
+        assert(xntx_commit(tx));
+
+        //vectors added over several transactions
+        for (int i = 0; i < COUNT; i += 250) {
+            assert(xntx_create(&tx, db, XNTXMODE_WR));
+            assert(xnrs_open(&rs, db, "vecs", false, XNRST_IVFFLAT, tx));
+            assert(xnrs_put_vecs(rs, 250, ids + i, vecs + (size_t)i * IVF_DIM));
+            assert(xntx_commit(tx));
+        }
+        assert(xndb_free(db));
+    }
+
+    {
+        struct xndb *db;
+        assert(xndb_create("dummy", false, &db));
+        struct xntx *tx;
+        assert(xntx_create(&tx, db, XNTXMODE_RD));
+        struct xnrs rs;
+        assert(xnrs_open(&rs, db, "vecs", false, XNRST_IVFFLAT, tx));
+        bool ok = true;
+        for (int q = 0; q < COUNT; q += 50) {
+            uint64_t out_id;
+            float out_dist;
+            int out_count;
+            ok = ok && xnrs_search(rs, vecs + (size_t)q * IVF_DIM, 1, 8, &out_id, &out_dist, &out_count);
+            ok = ok && out_count == 1 && out_id == q + 1000 && out_dist < 1e-5f;
+        }
+        assert(ok);
+        assert(xntx_close((void**)&tx));
+        assert(xndb_free(db));
+    }
+
+    free(vecs);
+    free(ids);
+}
+
+//trains from vectors stored in a heap record store rather than an in-memory sample
+void ivf_train_scan() {
+    struct xndb *db;
+    assert(xndb_create("dummy", true, &db));
+    struct xntx *tx;
+    assert(xntx_create(&tx, db, XNTXMODE_WR));
+
+    const int COUNT = 1000;
+    float *vecs = malloc(COUNT * IVF_DIM * sizeof(float));
+    uint64_t *ids = malloc(COUNT * sizeof(uint64_t));
+    ivf_make_vectors(vecs, COUNT, IVF_DIM, 3);
+    struct xnrs heap;
+    assert(xnrs_open(&heap, db, "train", true, XNRST_HEAP, tx));
+    for (int i = 0; i < COUNT; i++) {
+        struct xnitemid id;
+        assert(xnrs_put(heap, IVF_DIM * sizeof(float), (uint8_t*)(vecs + (size_t)i * IVF_DIM), &id));
+        ids[i] = i;
+    }
+
+    struct xnrs rs;
+    assert(xnrs_open(&rs, db, "vecs", true, XNRST_IVFFLAT, tx));
+    struct xnrsscan scan;
+    assert(xnrsscan_open(&scan, heap));
+    assert(!xnrs_train_scan(rs, xnivf_default_opts(IVF_DIM + 1, 8), &scan, 200));
+    assert(xnrsscan_open(&scan, heap));
+    assert(xnrs_train_scan(rs, xnivf_default_opts(IVF_DIM, 8), &scan, 200));
+    assert(xnrs_put_vecs(rs, COUNT, ids, vecs));
+
+    bool ok = true;
+    for (int q = 0; q < COUNT; q += 50) {
+        uint64_t out_id;
+        float out_dist;
+        int out_count;
+        ok = ok && xnrs_search(rs, vecs + (size_t)q * IVF_DIM, 1, 8, &out_id, &out_dist, &out_count);
+        ok = ok && out_count == 1 && out_id == q && out_dist == 0.0f;
+    }
+    assert(ok);
+
+    free(vecs);
+    free(ids);
+    assert(xntx_commit(tx));
+    assert(xndb_free(db));
+}
+
+//PQ indexes store codes instead of vectors, so results are approximate.  Probing every list, most of the
+//exact top 10 should still come back
+bool ivf_pq(enum xnvmetric metric) {
+    const int COUNT = 2000;
+    float *vecs = malloc(COUNT * IVF_DIM * sizeof(float));
+    uint64_t *ids = malloc(COUNT * sizeof(uint64_t));
+    unsigned int seed = 4;
+    for (int i = 0; i < COUNT * IVF_DIM; i++)
+        vecs[i] = (float)rand_r(&seed) / RAND_MAX - 0.5f + (i / IVF_DIM % 4 == i % 4 ? 2.0f : 0.0f);
+    for (int i = 0; i < COUNT; i++)
+        ids[i] = i;
+
+    struct xndb *db;
+    bool ok = xndb_create("dummy", true, &db);
+    struct xntx *tx;
+    ok = ok && xntx_create(&tx, db, XNTXMODE_WR);
+    struct xnrs rs;
+    ok = ok && xnrs_open(&rs, db, "vecs", true, XNRST_IVFFLAT, tx);
+
+    struct xnivfopts opts = xnivf_default_opts(IVF_DIM, 8);
+    opts.metric = metric;
+    opts.pq_m = 3;
+    ok = ok && !xnrs_train(rs, opts, vecs, COUNT);
+    opts.pq_m = 8;
+    ok = ok && !xnrs_train(rs, opts, vecs, XNPQ_KSUB - 1);
+    ok = ok && xnrs_train(rs, opts, vecs, COUNT);
+    ok = ok && xnrs_put_vecs(rs, COUNT, ids, vecs);
+    ok = ok && xntx_commit(tx);
+
+    ok = ok && xntx_create(&tx, db, XNTXMODE_RD);
+    ok = ok && xnrs_open(&rs, db, "vecs", false, XNRST_IVFFLAT, tx);
+    int found = 0;
+    for (int q = 0; q < COUNT; q += 20) {
+        const float *query = vecs + (size_t)q * IVF_DIM;
+        uint64_t truth[10];
+        float truth_dists[10];
+        struct xnvtopk topk;
+        xnvtopk_init(&topk, 10, truth, truth_dists);
+        xnvec_topk_block(metric, query, vecs, NULL, COUNT, IVF_DIM, &topk);
+
+        uint64_t out_ids[10];
+        float out_dists[10];
+        int out_count = 0;
+        ok = ok && xnrs_search(rs, query, 10, 8, out_ids, out_dists, &out_count);
+        ok = ok && out_count == 10;
+        for (int i = 0; i < out_count; i++) {
+            ok = ok && (i == 0 || out_dists[i - 1] <= out_dists[i]);
+            for (int j = 0; j < 10; j++)
+                found += out_ids[i] == truth[j];
+        }
+    }
+    ok = ok && found >= 600;
+    ok = ok && xntx_close((void**)&tx);
+    ok = ok && xndb_free(db);
+
+    free(vecs);
+    free(ids);
+    return ok;
+}
+
+void ivf_pq_l2() {
+    assert(ivf_pq(XNVM_L2));
+}
+
+void ivf_pq_ip() {
+    assert(ivf_pq(XNVM_IP));
+}
+
+void ivf_pq_cosine() {
+    assert(ivf_pq(XNVM_COSINE));
+}
+
+//training takes whatever pages are free, so the centroid and list pages end up scattered between pages still in use
+void ivf_scattered_pages() {
+    struct xndb *db;
+    assert(xndb_create("dummy", true, &db));
+    struct xntx *tx;
+    assert(xntx_create(&tx, db, XNTXMODE_WR));
+    struct xnrs rs;
+    assert(xnrs_open(&rs, db, "vecs", true, XNRST_IVFFLAT, tx));
+    struct xnpg pages[40];
+    for (int i = 0; i < 40; i++) {
+        assert(xnfile_allocate_page(rs.file, tx, &pages[i]));
+    }
+    assert(xntx_commit(tx));
+
+    assert(xntx_create(&tx, db, XNTXMODE_WR));
+    for (int i = 0; i < 40; i += 2) {
+        assert(xnfile_free_page(rs.file, tx, &pages[i]));
+    }
+    assert(xntx_commit(tx));
+
+    const int COUNT = 2000;
+    const int NLIST = 400;
+    float *vecs = malloc(COUNT * IVF_DIM * sizeof(float));
+    uint64_t *ids = malloc(COUNT * sizeof(uint64_t));
+    ivf_make_vectors(vecs, COUNT, IVF_DIM, 4);
+    for (int i = 0; i < COUNT; i++)
+        ids[i] = i;
+
+    assert(xntx_create(&tx, db, XNTXMODE_WR));
+    assert(xnrs_open(&rs, db, "vecs", false, XNRST_IVFFLAT, tx));
+    struct xnivfopts opts = xnivf_default_opts(IVF_DIM, NLIST);
+    opts.iterations = 5;
+    assert(xnrs_train(rs, opts, vecs, COUNT));
+    assert(xnrs_put_vecs(rs, COUNT, ids, vecs));
+    assert(xntx_commit(tx));
+
+    assert(xntx_create(&tx, db, XNTXMODE_RD));
+    assert(xnrs_open(&rs, db, "vecs", false, XNRST_IVFFLAT, tx));
+    bool ok = true;
+    for (int q = 0; q < 20; q++) {
+        const float *query = vecs + (size_t)q * 97 * IVF_DIM;
+        uint64_t out_id;
+        float out_dist;
+        int out_count;
+        ok = ok && xnrs_search(rs, query, 1, NLIST, &out_id, &out_dist, &out_count);
+        ok = ok && out_count == 1 && out_id == ivf_brute_force(vecs, COUNT, IVF_DIM, query) && out_dist == 0.0f;
+    }
+    assert(ok);
+    assert(xntx_close((void**)&tx));
+
+    free(vecs);
+    free(ids);
+    assert(xndb_free(db));
+}
+
+void ivfflat_tests() {
+    append_test(ivf_train_search);
+    append_test(ivf_reopen);
+    append_test(ivf_train_scan);
+    append_test(ivf_pq_l2);
+    append_test(ivf_pq_ip);
+    append_test(ivf_pq_cosine);
+    append_test(ivf_scattered_pages);
+}
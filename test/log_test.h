@@ -116,3 +116,276 @@ void log_tests() {
 }
 */
 
+
+//creates a zeroed log file the same way xndb_create does
+bool log_create_file(struct xnfile **out_file) {
+    if (!xnfile_create(out_file, "dummy", 0, true, true))
+        return false;
+    if (!xnfile_set_size(*out_file, 32 * XNPG_SZ))
+        return false;
+    uint8_t *buf;
+    if (!xn_aligned_malloc((void**)&buf, XNPG_SZ))
+        return false;
+    memset(buf, 0, XNPG_SZ);
+    for (int i = 0; i < 32; i++) {
+        if (!xnfile_write(*out_file, buf, i * XNPG_SZ, XNPG_SZ))
+            return false;
+    }
+    free(buf);
+    return true;
+}
+
+struct log_commit_arg {
+    struct xnlog *log;
+    int tx_id;
+    int commits;
+    bool ok;
+};
+
+void *log_commit_fcn(void *arg) {
+    struct log_commit_arg *a = (struct log_commit_arg*)arg;
+    size_t rec_size = xnlog_record_size(a->tx_id, 0);
+    uint8_t rec[rec_size];
+    a->ok = xnlog_serialize_record(a->tx_id, XNLOGT_COMMIT, 0, NULL, rec);
+    for (int i = 0; i < a->commits && a->ok; i++) {
+        a->ok = xnlog_commit(a->log, rec, rec_size);
+    }
+    return NULL;
+}
+
+void log_group_commit() {
+    struct xnfile *file;
+    assert(log_create_file(&file));
+    struct xnlog *log;
+    assert(xnlog_create(&log, file, true, XNLOG_DEFAULT_RING_PAGES));
+    log->commit_wait_us = 2000;
+    log->commit_batch = 4;
+
+    const int THREAD_COUNT = 8;
+    const int COMMITS = 20;
+    pthread_t threads[THREAD_COUNT];
+    struct log_commit_arg args[THREAD_COUNT];
+    for (int i = 0; i < THREAD_COUNT; i++) {
+        args[i].log = log;
+        args[i].tx_id = i + 1;
+        args[i].commits = COMMITS;
+        pthread_create(&threads[i], NULL, log_commit_fcn, &args[i]);
+    }
+
+    for (int i = 0; i < THREAD_COUNT; i++) {
+        pthread_join(threads[i], NULL);
+        assert(args[i].ok);
+    }
+
+    //every commit is durable, but commits were batched into fewer log writes
+    assert(log->flushed_lsn == XNLOG_FIRST_LSN + xnlog_record_size(1, 0) * THREAD_COUNT * COMMITS);
+    assert(log->flush_count < THREAD_COUNT * COMMITS);
+
+    struct xnlogitr *itr;
+    assert(xnlogitr_create(&itr, log));
+    int count = 0;
+    bool valid;
+    while (true) {
+        assert(xnlogitr_next(itr, &valid));
+        if (!valid)
+            break;
+        count++;
+    }
+    assert(count == THREAD_COUNT * COMMITS);
+
+    assert(xnlogitr_free((void**)&itr));
+    assert(xnlog_free((void**)&log));
+    assert(xnfile_close((void**)&file));
+}
+
+void log_ring_wraparound() {
+    struct xnfile *file;
+    assert(log_create_file(&file));
+    struct xnlog *log;
+    assert(xnlog_create(&log, file, true, 2));
+
+    //enough records to wrap around a two page ring many times
+    const int RECS = 2000;
+    size_t rec_size = xnlog_record_size(1, sizeof(int));
+    uint8_t *rec = malloc(rec_size);
+    for (int i = 0; i < RECS; i++) {
+        assert(xnlog_serialize_record(1, XNLOGT_UPDATE, sizeof(int), (uint8_t*)&i, rec));
+        assert(xnlog_append(log, rec, rec_size, NULL));
+    }
+    assert(xnlog_serialize_record(1, XNLOGT_COMMIT, 0, NULL, rec));
+    assert(xnlog_commit(log, rec, xnlog_record_size(1, 0)));
+
+    uint64_t backlog;
+    assert(xnlog_backlog(log, &backlog));
+    assert(backlog == 0);
+
+    //records are in order on disk
+    struct xnlogitr *itr;
+    assert(xnlogitr_create(&itr, log));
+    int count = 0;
+    bool valid;
+    while (true) {
+        assert(xnlogitr_next(itr, &valid));
+        if (!valid)
+            break;
+        int tx_id;
+        enum xnlogt type;
+        size_t data_size;
+        assert(xnlogitr_read_header(itr, &tx_id, &type, &data_size));
+        if (type == XNLOGT_UPDATE) {
+            int val;
+            assert(xnlogitr_read_data(itr, (uint8_t*)&val, sizeof(int)));
+            assert(val == count);
+        }
+        count++;
+    }
+    assert(count == RECS + 1);
+
+    free(rec);
+    assert(xnlogitr_free((void**)&itr));
+    assert(xnlog_free((void**)&log));
+    assert(xnfile_close((void**)&file));
+}
+
+void log_varint() {
+    uint64_t vals[] = { 0, 1, 127, 128, 16383, 16384, UINT32_MAX, UINT64_MAX };
+    for (int i = 0; i < 8; i++) {
+        uint8_t buf[XN_VARINT_MAX];
+        int size = xn_varint_put(buf, vals[i]);
+        assert(size == xn_varint_size(vals[i]));
+        uint64_t v;
+        assert(xn_varint_get(buf, size, &v) == size);
+        assert(v == vals[i]);
+        //a cut off varint doesn't parse
+        assert(size == 1 || xn_varint_get(buf, size - 1, &v) == 0);
+    }
+}
+
+//records with small tx ids and sizes have a 3 byte header, and the header and data read back through the iterator
+void log_record_format() {
+    assert(xnlog_record_size(1, 0) == 7);
+    assert(xnlog_record_size(300, 200) == 1 + 2 + 2 + 200 + 4);
+
+    struct xnfile *file;
+    assert(log_create_file(&file));
+    struct xnlog *log;
+    assert(xnlog_create(&log, file, true, XNLOG_DEFAULT_RING_PAGES));
+
+    uint8_t data[200];
+    memset(data, 'x', 200);
+    size_t rec_size = xnlog_record_size(300, 200);
+    uint8_t rec[rec_size];
+    assert(xnlog_serialize_record(300, XNLOGT_UPDATE, 200, data, rec));
+    assert(xnlog_append(log, rec, rec_size, NULL));
+    assert(xnlog_append(log, rec, rec_size, NULL));
+    assert(xnlog_flush(log));
+
+    struct xnlogitr *itr;
+    assert(xnlogitr_create(&itr, log));
+    int count = 0;
+    bool valid;
+    while (true) {
+        assert(xnlogitr_next(itr, &valid));
+        if (!valid)
+            break;
+        int tx_id;
+        enum xnlogt type;
+        size_t data_size;
+        assert(xnlogitr_read_header(itr, &tx_id, &type, &data_size));
+        assert(tx_id == 300 && type == XNLOGT_UPDATE && data_size == 200);
+        uint8_t buf[200];
+        assert(xnlogitr_read_data(itr, buf, 200));
+        assert(memcmp(buf, data, 200) == 0);
+        count++;
+    }
+    assert(count == 2);
+
+    assert(xnlogitr_free((void**)&itr));
+    assert(xnlog_free((void**)&log));
+    assert(xnfile_close((void**)&file));
+}
+
+//a log without a header in the current format is rejected
+void log_version() {
+    struct xnfile *file;
+    assert(log_create_file(&file));
+    struct xnlog *log;
+    assert(!xnlog_create(&log, file, false, XNLOG_DEFAULT_RING_PAGES));
+    assert(xnlog_create(&log, file, true, XNLOG_DEFAULT_RING_PAGES));
+    assert(xnlog_free((void**)&log));
+    assert(xnlog_create(&log, file, false, XNLOG_DEFAULT_RING_PAGES));
+    assert(xnlog_free((void**)&log));
+    assert(xnfile_close((void**)&file));
+}
+
+//the hardware and table versions agree on every length and alignment, and checksumming in pieces gives the same crc
+void log_crc32c() {
+    assert(xn_crc32c(0, (const uint8_t*)"123456789", 9) == 0xe3069283);
+    assert(xn_crc32c_sw(0, (const uint8_t*)"123456789", 9) == 0xe3069283);
+
+    uint8_t buf[4096 + 8];
+    for (int i = 0; i < 4096 + 8; i++)
+        buf[i] = i * 7 + (i >> 5);
+    for (size_t size = 0; size <= 4096; size = size * 2 + 1) {
+        for (int align = 0; align < 8; align++) {
+            uint32_t crc = xn_crc32c(0, buf + align, size);
+            assert(crc == xn_crc32c_sw(0, buf + align, size));
+            assert(crc == xn_crc32c(xn_crc32c(0, buf + align, size / 3), buf + align + size / 3, size - size / 3));
+        }
+    }
+}
+
+//a record with a bad checksum is treated as the end of the log, and new records go where it was
+void log_torn_record() {
+    struct xnfile *file;
+    assert(log_create_file(&file));
+    struct xnlog *log;
+    assert(xnlog_create(&log, file, true, XNLOG_DEFAULT_RING_PAGES));
+
+    size_t rec_size = xnlog_record_size(1, 0);
+    uint8_t rec[rec_size];
+    assert(xnlog_serialize_record(1, XNLOGT_COMMIT, 0, NULL, rec));
+    for (int i = 0; i < 3; i++) {
+        assert(xnlog_append(log, rec, rec_size, NULL));
+    }
+    assert(xnlog_free((void**)&log));
+
+    //flip a bit in the data size of the last record
+    uint8_t *page;
+    assert(xn_aligned_malloc((void**)&page, XNPG_SZ));
+    assert(xnfile_read(file, page, XNLOG_FIRST_LSN, XNPG_SZ));
+    page[rec_size * 2 + 2] ^= 1;
+    assert(xnfile_write(file, page, XNLOG_FIRST_LSN, XNPG_SZ));
+    free(page);
+
+    assert(xnlog_create(&log, file, false, XNLOG_DEFAULT_RING_PAGES));
+    assert(log->page.idx * XNPG_SZ + log->page_off == XNLOG_FIRST_LSN + rec_size * 2);
+    assert(xnlog_append(log, rec, rec_size, NULL));
+    assert(xnlog_flush(log));
+
+    struct xnlogitr *itr;
+    assert(xnlogitr_create(&itr, log));
+    int count = 0;
+    bool valid;
+    while (true) {
+        assert(xnlogitr_next(itr, &valid));
+        if (!valid)
+            break;
+        count++;
+    }
+    assert(count == 3);
+
+    assert(xnlogitr_free((void**)&itr));
+    assert(xnlog_free((void**)&log));
+    assert(xnfile_close((void**)&file));
+}
+
+void log_commit_tests() {
+    append_test(log_group_commit);
+    append_test(log_ring_wraparound);
+    append_test(log_varint);
+    append_test(log_record_format);
+    append_test(log_version);
+    append_test(log_crc32c);
+    append_test(log_torn_record);
+}
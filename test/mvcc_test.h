@@ -0,0 +1,349 @@
+#pragma once
+
+#include "test.h"
+#include "db.h"
+
+#include <pthread.h>
+#include <unistd.h>
+
+//counts the ints in a heap record store as seen by tx
+bool mvcc_count(struct xndb *db, struct xntx *tx, const char *filename, int *out_count) {
+    struct xnrs rs;
+    if (!xnrs_open(&rs, db, filename, false, XNRST_HEAP, tx))
+        return false;
+    struct xnrsscan scan;
+    if (!xnrsscan_open(&scan, rs))
+        return false;
+
+    int count = 0;
+    bool more;
+    while (true) {
+        if (!xnrsscan_next(&scan, &more))
+            return false;
+        if (!more)
+            break;
+        count++;
+    }
+
+    *out_count = count;
+    return true;
+}
+
+bool mvcc_put(struct xndb *db, const char *filename, bool create, int count) {
+    struct xntx *tx;
+    if (!xntx_create(&tx, db, XNTXMODE_WR))
+        return false;
+    struct xnrs rs;
+    if (!xnrs_open(&rs, db, filename, create, XNRST_HEAP, tx))
+        return false;
+    for (int i = 0; i < count; i++) {
+        struct xnitemid id;
+        if (!xnrs_put(rs, sizeof(int), (uint8_t*)&i, &id))
+            return false;
+    }
+    return xntx_commit(tx);
+}
+
+void mvcc_snapshot_isolation() {
+    struct xndb *db;
+    assert(xndb_create("dummy", true, &db));
+    assert(mvcc_put(db, "data", true, 10));
+
+    //reader pinned to a snapshot before the second commit
+    struct xntx *old_rdtx;
+    assert(xntx_create(&old_rdtx, db, XNTXMODE_RD));
+
+    assert(mvcc_put(db, "data", false, 10));
+
+    struct xntx *new_rdtx;
+    assert(xntx_create(&new_rdtx, db, XNTXMODE_RD));
+
+    int count;
+    assert(mvcc_count(db, old_rdtx, "data", &count));
+    assert(count == 10);
+    assert(mvcc_count(db, new_rdtx, "data", &count));
+    assert(count == 20);
+
+    //versions the old reader needs are kept until it closes
+    assert(db->mvcc->versions->count > 0);
+    assert(xntx_close((void**)&new_rdtx));
+    assert(xntx_close((void**)&old_rdtx));
+    assert(xndb_flush(db));
+    assert(db->mvcc->versions->count == 0);
+
+    assert(xndb_free(db));
+}
+
+void mvcc_write_conflict() {
+    struct xndb *db;
+    assert(xndb_create("dummy", true, &db));
+
+    struct xntx *tx;
+    assert(xntx_create(&tx, db, XNTXMODE_WR));
+    struct xnrs rs;
+    assert(xnrs_open(&rs, db, "data", true, XNRST_HEAP, tx));
+    int val = 1;
+    struct xnitemid id;
+    assert(xnrs_put(rs, sizeof(int), (uint8_t*)&val, &id));
+    assert(xnrs_put(rs, sizeof(int), (uint8_t*)&val, &id));
+    assert(xntx_commit(tx));
+
+    //two writers deleting from the same heap page
+    struct xntx *tx1;
+    struct xntx *tx2;
+    assert(xntx_create(&tx1, db, XNTXMODE_WR));
+    assert(xntx_create(&tx2, db, XNTXMODE_WR));
+    struct xnrs rs1;
+    struct xnrs rs2;
+    assert(xnrs_open(&rs1, db, "data", false, XNRST_HEAP, tx1));
+    assert(xnrs_open(&rs2, db, "data", false, XNRST_HEAP, tx2));
+    assert(xnrs_del(rs1, id));
+    assert(xnrs_del(rs2, id));
+
+    //first committer wins
+    bool committed;
+    assert(xntx_try_commit(tx1, &committed));
+    assert(committed);
+    assert(xntx_try_commit(tx2, &committed));
+    assert(!committed);
+
+    struct xntx *rdtx;
+    assert(xntx_create(&rdtx, db, XNTXMODE_RD));
+    int count;
+    assert(mvcc_count(db, rdtx, "data", &count));
+    assert(count == 1);
+    assert(xntx_close((void**)&rdtx));
+
+    assert(xndb_free(db));
+}
+
+void mvcc_background_flush() {
+    struct xndb *db;
+    assert(xndb_create("dummy", true, &db));
+
+    //a long-running reader does not hold up commits
+    struct xntx *rdtx;
+    assert(xntx_create(&rdtx, db, XNTXMODE_RD));
+    assert(mvcc_put(db, "data", true, 10));
+    assert(db->mvcc->versions->count > 0);
+
+    //once the reader ends the flusher writes the versions back on its own
+    assert(xntx_close((void**)&rdtx));
+    int versions = -1;
+    for (int i = 0; i < 1000 && versions != 0; i++) {
+        assert(xn_mutex_lock(db->mvcc->lock));
+        versions = db->mvcc->versions->count;
+        assert(xn_mutex_unlock(db->mvcc->lock));
+        usleep(1000);
+    }
+    assert(versions == 0);
+
+    assert(xndb_free(db));
+}
+
+struct mvcc_writer_arg {
+    struct xndb *db;
+    char filename[32];
+    int commits;
+    bool ok;
+    int conflicts;
+};
+
+void *mvcc_writer_fcn(void *arg) {
+    struct mvcc_writer_arg *a = (struct mvcc_writer_arg*)arg;
+    for (int i = 0; i < a->commits && a->ok; i++) {
+        a->ok = mvcc_put(a->db, a->filename, false, 10);
+    }
+    return NULL;
+}
+
+//like mvcc_put, but counts conflicts instead of failing on them
+void *mvcc_try_writer_fcn(void *arg) {
+    struct mvcc_writer_arg *a = (struct mvcc_writer_arg*)arg;
+    for (int i = 0; i < a->commits && a->ok; i++) {
+        struct xntx *tx;
+        struct xnrs rs;
+        a->ok = xntx_create(&tx, a->db, XNTXMODE_WR) && xnrs_open(&rs, a->db, a->filename, false, XNRST_HEAP, tx);
+        for (int j = 0; j < 10 && a->ok; j++) {
+            struct xnitemid id;
+            a->ok = xnrs_put(rs, sizeof(int), (uint8_t*)&j, &id);
+        }
+        bool committed;
+        a->ok = a->ok && xntx_try_commit(tx, &committed);
+        if (a->ok && !committed)
+            a->conflicts++;
+    }
+    return NULL;
+}
+
+void mvcc_concurrent_writers() {
+    struct xndb *db;
+    assert(xndb_create("dummy", true, &db));
+
+    const int THREAD_COUNT = 8;
+    const int COMMITS = 20;
+    struct mvcc_writer_arg args[THREAD_COUNT];
+    for (int i = 0; i < THREAD_COUNT; i++) {
+        args[i].db = db;
+        sprintf(args[i].filename, "data%d", i);
+        args[i].commits = COMMITS;
+        args[i].ok = true;
+        args[i].conflicts = 0;
+        assert(mvcc_put(db, args[i].filename, true, 0));
+    }
+
+    //writers on different record stores don't conflict, and no longer wait on each other
+    pthread_t threads[THREAD_COUNT];
+    for (int i = 0; i < THREAD_COUNT; i++) {
+        pthread_create(&threads[i], NULL, mvcc_writer_fcn, &args[i]);
+    }
+    for (int i = 0; i < THREAD_COUNT; i++) {
+        pthread_join(threads[i], NULL);
+        assert(args[i].ok);
+    }
+
+    struct xntx *rdtx;
+    assert(xntx_create(&rdtx, db, XNTXMODE_RD));
+    for (int i = 0; i < THREAD_COUNT; i++) {
+        int count;
+        assert(mvcc_count(db, rdtx, args[i].filename, &count));
+        assert(count == COMMITS * 10);
+    }
+    assert(xntx_close((void**)&rdtx));
+
+    assert(xndb_free(db));
+}
+
+//writers inserting into the same heap each fill pages of their own, and pages come from the free map without
+//touching a tx's private copies, so none of them conflict
+void mvcc_shared_heap_writers() {
+    struct xndb *db;
+    assert(xndb_create("dummy", true, &db));
+    assert(mvcc_put(db, "data", true, 0));
+
+    const int THREAD_COUNT = 8;
+    const int COMMITS = 20;
+    struct mvcc_writer_arg args[THREAD_COUNT];
+    for (int i = 0; i < THREAD_COUNT; i++) {
+        args[i].db = db;
+        strcpy(args[i].filename, "data");
+        args[i].commits = COMMITS;
+        args[i].ok = true;
+        args[i].conflicts = 0;
+    }
+
+    pthread_t threads[THREAD_COUNT];
+    for (int i = 0; i < THREAD_COUNT; i++) {
+        pthread_create(&threads[i], NULL, mvcc_try_writer_fcn, &args[i]);
+    }
+    for (int i = 0; i < THREAD_COUNT; i++) {
+        pthread_join(threads[i], NULL);
+        assert(args[i].ok);
+        assert(args[i].conflicts == 0);
+    }
+
+    struct xntx *rdtx;
+    assert(xntx_create(&rdtx, db, XNTXMODE_RD));
+    int count;
+    assert(mvcc_count(db, rdtx, "data", &count));
+    assert(count == THREAD_COUNT * COMMITS * 10);
+    assert(xntx_close((void**)&rdtx));
+    assert(xndb_free(db));
+
+    //the records and the free map come back after recovery, and new pages don't land on pages in use
+    assert(xndb_create("dummy", false, &db));
+    assert(mvcc_put(db, "data", false, 10));
+    assert(xntx_create(&rdtx, db, XNTXMODE_RD));
+    assert(mvcc_count(db, rdtx, "data", &count));
+    assert(count == THREAD_COUNT * COMMITS * 10 + 10);
+    assert(xntx_close((void**)&rdtx));
+    assert(xndb_free(db));
+}
+
+//a flusher error doesn't fail a tx that has already committed, and new write txs report it
+void mvcc_flusher_failed() {
+    struct xndb *db;
+    assert(xndb_create("dummy", true, &db));
+    assert(mvcc_put(db, "data", true, 1));
+
+    struct xntx *tx;
+    assert(xntx_create(&tx, db, XNTXMODE_WR));
+    struct xnrs rs;
+    assert(xnrs_open(&rs, db, "data", false, XNRST_HEAP, tx));
+    int val = 1;
+    struct xnitemid id;
+    assert(xnrs_put(rs, sizeof(int), (uint8_t*)&val, &id));
+
+    assert(xn_mutex_lock(db->flusher_lock));
+    db->flusher_failed = true;
+    assert(xn_mutex_unlock(db->flusher_lock));
+
+    assert(xntx_commit(tx));
+    assert(!xntx_create(&tx, db, XNTXMODE_WR));
+
+    //read txs still work, and see the commit
+    struct xntx *rdtx;
+    assert(xntx_create(&rdtx, db, XNTXMODE_RD));
+    int count;
+    assert(mvcc_count(db, rdtx, "data", &count));
+    assert(count == 2);
+    assert(xntx_close((void**)&rdtx));
+
+    //the flusher stopped when it saw the flag, so it has to be cleared before the database can close
+    assert(xn_mutex_lock(db->flusher_lock));
+    db->flusher_failed = false;
+    assert(xn_mutex_unlock(db->flusher_lock));
+    assert(xndb_free(db));
+}
+
+//a commit that can't append its commit record leaves no versions behind for the next commit to publish
+void mvcc_commit_append_failed() {
+    struct xndb *db;
+    assert(xndb_create("dummy", true, &db));
+    assert(mvcc_put(db, "data", true, 1));
+    assert(xndb_flush(db));
+
+    struct xntx *tx;
+    assert(xntx_create(&tx, db, XNTXMODE_WR));
+    struct xnrs rs;
+    assert(xnrs_open(&rs, db, "data", false, XNRST_HEAP, tx));
+    int val = 1;
+    struct xnitemid id;
+    assert(xnrs_put(rs, sizeof(int), (uint8_t*)&val, &id));
+
+    uint64_t next_seq = db->mvcc->next_seq;
+    assert(xn_mutex_lock(db->log->lock));
+    db->log->failed = true;
+    assert(xn_mutex_unlock(db->log->lock));
+
+    bool committed;
+    assert(!xntx_try_commit(tx, &committed));
+    assert(db->mvcc->versions->count == 0);
+    assert(db->mvcc->next_seq == next_seq);
+
+    assert(xn_mutex_lock(db->log->lock));
+    db->log->failed = false;
+    assert(xn_mutex_unlock(db->log->lock));
+    assert(xntx_rollback((void**)&tx));
+
+    //the next commit only publishes its own record
+    assert(mvcc_put(db, "data", false, 1));
+    struct xntx *rdtx;
+    assert(xntx_create(&rdtx, db, XNTXMODE_RD));
+    int count;
+    assert(mvcc_count(db, rdtx, "data", &count));
+    assert(count == 2);
+    assert(xntx_close((void**)&rdtx));
+
+    assert(xndb_free(db));
+}
+
+void mvcc_tests() {
+    append_test(mvcc_snapshot_isolation);
+    append_test(mvcc_write_conflict);
+    append_test(mvcc_background_flush);
+    append_test(mvcc_concurrent_writers);
+    append_test(mvcc_shared_heap_writers);
+    append_test(mvcc_flusher_failed);
+    append_test(mvcc_commit_append_failed);
+}
@@ -0,0 +1,272 @@
+#pragma once
+
+#include "test.h"
+#include "pool.h"
+#include "db.h"
+
+void pool_create_free() {
+    struct xnpool *pool;
+    assert(xnpool_create(&pool, 4));
+    assert(xnpool_free((void**)&pool));
+}
+
+void pool_read_write() {
+    struct xnfile *handle;
+    assert(xnfile_create(&handle, "dummy", 0, true, false));
+    assert(xnfile_set_size(handle, XNPG_SZ * 2));
+
+    struct xnpool *pool;
+    assert(xnpool_create(&pool, 4));
+
+    struct xnpg page = { .file_handle = handle, .idx = 1 };
+    uint8_t *buf = malloc(XNPG_SZ);
+    memset(buf, 'x', XNPG_SZ);
+    assert(xnpool_write(pool, &page, buf));
+
+    //page is dirty in the pool, but not on disk yet
+    char c;
+    assert(xnpool_read(pool, &page, (uint8_t*)&c, 100, sizeof(char)));
+    assert(c == 'x');
+    assert(xnfile_read(handle, &c, XNPG_SZ + 100, sizeof(char)));
+    assert(c == 0);
+
+    assert(xnpool_flush(pool));
+    assert(xnfile_read(handle, &c, XNPG_SZ + 100, sizeof(char)));
+    assert(c == 'x');
+
+    free(buf);
+    assert(xnpool_free((void**)&pool));
+    assert(xnfile_close((void**)&handle));
+}
+
+void pool_eviction() {
+    struct xnfile *handle;
+    assert(xnfile_create(&handle, "dummy", 0, true, false));
+    assert(xnfile_set_size(handle, XNPG_SZ * 8));
+
+    struct xnpool *pool;
+    assert(xnpool_create(&pool, 2));
+
+    //writing more pages than frames forces dirty pages to be written back on eviction
+    uint8_t *buf = malloc(XNPG_SZ);
+    for (int i = 0; i < 8; i++) {
+        struct xnpg page = { .file_handle = handle, .idx = i };
+        memset(buf, 'a' + i, XNPG_SZ);
+        assert(xnpool_write(pool, &page, buf));
+    }
+
+    for (int i = 0; i < 8; i++) {
+        struct xnpg page = { .file_handle = handle, .idx = i };
+        char c;
+        assert(xnpool_read(pool, &page, (uint8_t*)&c, 0, sizeof(char)));
+        assert(c == 'a' + i);
+    }
+
+    free(buf);
+    assert(xnpool_flush(pool));
+    assert(xnpool_free((void**)&pool));
+    assert(xnfile_close((void**)&handle));
+}
+
+void pool_flush_runs() {
+    struct xnfile *handle;
+    assert(xnfile_create(&handle, "dummy", 0, true, false));
+    assert(xnfile_set_size(handle, XNPG_SZ * 12));
+
+    struct xnpool *pool;
+    assert(xnpool_create(&pool, 8));
+
+    //two runs of adjacent pages with a gap between them, written out of order
+    int idxs[] = { 2, 3, 4, 9, 10, 8 };
+    uint8_t *buf = malloc(XNPG_SZ);
+    for (int i = 0; i < 6; i++) {
+        struct xnpg page = { .file_handle = handle, .idx = idxs[i] };
+        memset(buf, 'a' + idxs[i], XNPG_SZ);
+        assert(xnpool_write(pool, &page, buf));
+    }
+    assert(xnpool_flush(pool));
+
+    //read every page back with one vectored read.  Pages never written stay zeroed
+    uint8_t *data = malloc(XNPG_SZ * 12);
+    struct xnfileiov pages[12];
+    for (int i = 0; i < 12; i++) {
+        pages[i].idx = i;
+        pages[i].buf = data + i * XNPG_SZ;
+    }
+    assert(xnfile_readv(handle, pages, 12));
+    bool match = true;
+    for (int i = 0; i < 12; i++) {
+        bool written = (i >= 2 && i <= 4) || (i >= 8 && i <= 10);
+        for (int j = 0; j < XNPG_SZ; j++)
+            match = match && data[i * XNPG_SZ + j] == (written ? 'a' + i : 0);
+    }
+    assert(match);
+
+    //pages past the end of the file are rejected before anything is written
+    struct xnfileiov past = { .idx = 12, .buf = buf };
+    assert(!xnfile_writev(handle, &past, 1));
+
+    free(data);
+    free(buf);
+    assert(xnpool_free((void**)&pool));
+    assert(xnfile_close((void**)&handle));
+}
+
+void pool_sync_written() {
+    struct xnfile *handle;
+    assert(xnfile_create(&handle, "dummy", 0, true, false));
+    assert(xnfile_set_size(handle, XNPG_SZ * 4));
+
+    //a new size is only durable after the next sync
+    assert(handle->unsynced);
+    assert(xnfile_sync_written(handle));
+    assert(!handle->unsynced);
+
+    struct xnpool *pool;
+    assert(xnpool_create(&pool, 4));
+    struct xnpg page = { .file_handle = handle, .idx = 3 };
+    uint8_t *buf = malloc(XNPG_SZ);
+    memset(buf, 'x', XNPG_SZ);
+    assert(xnpool_write(pool, &page, buf));
+
+    //only a flushed page marks the file as needing a sync
+    assert(!handle->unsynced);
+    assert(xnpool_flush(pool));
+    assert(handle->unsynced);
+    assert(xnfile_sync_written(handle));
+    assert(!handle->unsynced);
+
+    //writes that sync themselves leave nothing to sync
+    struct xnfileiov iov = { .idx = 2, .buf = buf };
+    assert(xnfile_writev_sync(handle, &iov, 1));
+    assert(!handle->unsynced);
+
+    free(buf);
+    assert(xnpool_free((void**)&pool));
+    assert(xnfile_close((void**)&handle));
+}
+
+void pool_all_pinned() {
+    struct xnfile *handle;
+    assert(xnfile_create(&handle, "dummy", 0, true, false));
+    assert(xnfile_set_size(handle, XNPG_SZ * 3));
+
+    struct xnpool *pool;
+    assert(xnpool_create(&pool, 2));
+
+    struct xnpg page0 = { .file_handle = handle, .idx = 0 };
+    struct xnpg page1 = { .file_handle = handle, .idx = 1 };
+    struct xnpg page2 = { .file_handle = handle, .idx = 2 };
+    struct xnframe *frame0;
+    struct xnframe *frame1;
+    struct xnframe *frame2;
+    assert(xnpool_pin(pool, &page0, &frame0));
+    assert(xnpool_pin(pool, &page1, &frame1));
+
+    //no unpinned frames left to evict
+    assert(!xnpool_pin(pool, &page2, &frame2));
+
+    assert(xnpool_unpin(pool, frame0, false));
+    assert(xnpool_pin(pool, &page2, &frame2));
+    assert(frame2 == frame0);
+
+    assert(xnpool_unpin(pool, frame1, false));
+    assert(xnpool_unpin(pool, frame2, false));
+    assert(xnpool_free((void**)&pool));
+    assert(xnfile_close((void**)&handle));
+}
+
+//a prefetch that runs out of frames partway releases the frames it already claimed, so none stays pinned or
+//hands out a page that was never read
+void pool_prefetch_failed() {
+    struct xnfile *handle;
+    assert(xnfile_create(&handle, "dummy", 0, true, false));
+    assert(xnfile_set_size(handle, XNPG_SZ * 12));
+    char c = 'z';
+    assert(xnfile_write(handle, &c, XNPG_SZ * 8, 1));
+
+    struct xnpool *pool;
+    assert(xnpool_create(&pool, 8));
+    struct xnframe *frames[7];
+    for (int i = 0; i < 7; i++) {
+        struct xnpg page = { .file_handle = handle, .idx = i };
+        assert(xnpool_pin(pool, &page, &frames[i]));
+    }
+
+    //one free frame for two pages
+    struct xnpg first = { .file_handle = handle, .idx = 8 };
+    assert(!xnpool_prefetch(pool, &first, 2));
+    assert(!xntbl_find(pool->tbl, &first));
+    for (int i = 0; i < pool->capacity; i++) {
+        struct xnframe *frame = &pool->frames[i];
+        assert(frame->valid == (frame->pin_count == 1));
+    }
+
+    struct xnframe *frame;
+    assert(xnpool_pin(pool, &first, &frame));
+    assert(frame->data[0] == 'z');
+    assert(xnpool_unpin(pool, frame, false));
+
+    for (int i = 0; i < 7; i++) {
+        assert(xnpool_unpin(pool, frames[i], false));
+    }
+    assert(xnpool_free((void**)&pool));
+    assert(xnfile_close((void**)&handle));
+}
+
+void pool_small_db() {
+    struct xndbopts opts = xndb_default_opts();
+    opts.pool_frames = 4;
+    struct xndb *db;
+    assert(xndb_create_opts("dummy", true, opts, &db));
+
+    int count = 500;
+    {
+        struct xntx *tx;
+        assert(xntx_create(&tx, db, XNTXMODE_WR));
+        struct xnrs rs;
+        assert(xnrs_open(&rs, db, "data", true, XNRST_HEAP, tx));
+        for (int i = 0; i < count; i++) {
+            struct xnitemid id;
+            assert(xnrs_put(rs, sizeof(int), (uint8_t*)&i, &id));
+        }
+        assert(xntx_commit(tx));
+    }
+
+    {
+        struct xntx *tx;
+        assert(xntx_create(&tx, db, XNTXMODE_RD));
+        struct xnrs rs;
+        assert(xnrs_open(&rs, db, "data", false, XNRST_HEAP, tx));
+        struct xnrsscan scan;
+        assert(xnrsscan_open(&scan, rs));
+        int i = 0;
+        bool more;
+        while (true) {
+            assert(xnrsscan_next(&scan, &more));
+            if (!more)
+                break;
+            struct xnitemid id;
+            assert(xnrsscan_itemid(&scan, &id));
+            int val;
+            assert(xnrs_get(rs, id, (uint8_t*)&val, sizeof(int)));
+            assert(val == i);
+            i++;
+        }
+        assert(i == count);
+        assert(xntx_close((void**)&tx));
+    }
+
+    assert(xndb_free(db));
+}
+
+void pool_tests() {
+    append_test(pool_create_free);
+    append_test(pool_read_write);
+    append_test(pool_eviction);
+    append_test(pool_flush_runs);
+    append_test(pool_sync_written);
+    append_test(pool_all_pinned);
+    append_test(pool_prefetch_failed);
+    append_test(pool_small_db);
+}
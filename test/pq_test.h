@@ -0,0 +1,102 @@
+#pragma once
+
+#include "test.h"
+#include "pq.h"
+
+#include <math.h>
+
+#define PQ_DIM 32
+#define PQ_M 8
+
+//clustered vectors, so a trained quantizer reconstructs them much better than chance
+void pq_make_vectors(float *vecs, int count, unsigned int seed) {
+    float centers[16][PQ_DIM];
+    for (int c = 0; c < 16; c++) {
+        for (int d = 0; d < PQ_DIM; d++)
+            centers[c][d] = (float)rand_r(&seed) / RAND_MAX * 10.0f;
+    }
+    for (int i = 0; i < count; i++) {
+        for (int d = 0; d < PQ_DIM; d++)
+            vecs[(size_t)i * PQ_DIM + d] = centers[i % 16][d] + (float)rand_r(&seed) / RAND_MAX * 0.5f;
+    }
+}
+
+void pq_encode_decode() {
+    const int COUNT = 2000;
+    float *vecs = malloc(COUNT * PQ_DIM * sizeof(float));
+    float *decoded = malloc(COUNT * PQ_DIM * sizeof(float));
+    uint8_t *codes = malloc(COUNT * PQ_M);
+    float *codebooks = malloc(xnpq_codebooks_size(PQ_DIM));
+    pq_make_vectors(vecs, COUNT, 1);
+
+    struct xnpq pq;
+    assert(!xnpq_init(&pq, PQ_DIM, 5, codebooks));
+    assert(xnpq_init(&pq, PQ_DIM, PQ_M, codebooks));
+    assert(!xnpq_train(&pq, vecs, XNPQ_KSUB - 1, 1));
+    assert(xnpq_train(&pq, vecs, COUNT, 0));
+
+    xnpq_encode(&pq, vecs, COUNT, codes);
+    xnpq_decode(&pq, codes, COUNT, decoded);
+
+    //reconstruction error is a small fraction of the spread within a cluster
+    double err = 0.0;
+    for (int i = 0; i < COUNT; i++)
+        err += xnvec_l2sq(vecs + (size_t)i * PQ_DIM, decoded + (size_t)i * PQ_DIM, PQ_DIM);
+    assert(err / COUNT < PQ_DIM * 0.02);
+
+    free(vecs);
+    free(decoded);
+    free(codes);
+    free(codebooks);
+}
+
+//a table lookup sums to the distance between the query and the decoded vector, for every instruction set
+void pq_adc() {
+    const int COUNT = 1000;
+    float *vecs = malloc(COUNT * PQ_DIM * sizeof(float));
+    float *decoded = malloc(COUNT * PQ_DIM * sizeof(float));
+    uint8_t *codes = malloc(COUNT * PQ_M);
+    float *codebooks = malloc(xnpq_codebooks_size(PQ_DIM));
+    float *table = malloc(PQ_M * XNPQ_KSUB * sizeof(float));
+    float *dists = malloc(COUNT * sizeof(float));
+    pq_make_vectors(vecs, COUNT, 2);
+
+    struct xnpq pq;
+    assert(xnpq_init(&pq, PQ_DIM, PQ_M, codebooks));
+    assert(xnpq_train(&pq, vecs, COUNT, 0));
+    xnpq_encode(&pq, vecs, COUNT, codes);
+    xnpq_decode(&pq, codes, COUNT, decoded);
+
+    enum xnvisa start = xnvec_isa();
+    const float *query = vecs + 17 * PQ_DIM;
+    bool ok = true;
+    for (enum xnvisa isa = XNVISA_SCALAR; isa <= XNVISA_AVX512; isa++) {
+        if (!xnvec_set_isa(isa))
+            continue;
+
+        //odd counts leave a tail after the gather loops
+        xnpq_table(&pq, XNVM_L2, query, table);
+        xnpq_adc(table, PQ_M, codes, COUNT - 3, dists);
+        for (int i = 0; i < COUNT - 3; i++)
+            ok = ok && fabsf(dists[i] - xnvec_l2sq(query, decoded + (size_t)i * PQ_DIM, PQ_DIM)) < 1e-2f;
+
+        xnpq_table(&pq, XNVM_IP, query, table);
+        xnpq_adc(table, PQ_M, codes, COUNT - 3, dists);
+        for (int i = 0; i < COUNT - 3; i++)
+            ok = ok && fabsf(dists[i] - xnvec_negative_inner_product(query, decoded + (size_t)i * PQ_DIM, PQ_DIM)) < 1e-1f;
+    }
+    assert(ok);
+    assert(xnvec_set_isa(start));
+
+    free(vecs);
+    free(decoded);
+    free(codes);
+    free(codebooks);
+    free(table);
+    free(dists);
+}
+
+void pq_tests() {
+    append_test(pq_encode_decode);
+    append_test(pq_adc);
+}
@@ -0,0 +1,372 @@
+#pragma once
+
+#include "test.h"
+#include "db.h"
+
+#include <fcntl.h>
+#include <unistd.h>
+
+//overwrites a file with zeroes (keeping its size) to simulate data pages that never made it to disk
+bool recovery_zero_file(const char *path) {
+    int fd = open(path, O_WRONLY);
+    if (fd == -1)
+        return false;
+    struct stat s;
+    if (fstat(fd, &s) != 0)
+        return false;
+    uint8_t buf[XNPG_SZ];
+    memset(buf, 0, XNPG_SZ);
+    for (off_t off = 0; off < s.st_size; off += XNPG_SZ) {
+        if (pwrite(fd, buf, XNPG_SZ, off) != XNPG_SZ)
+            return false;
+    }
+    return close(fd) == 0;
+}
+
+bool recovery_count(struct xndb *db, int *out_count) {
+    struct xntx *tx;
+    if (!xntx_create(&tx, db, XNTXMODE_RD))
+        return false;
+    struct xnrs rs;
+    if (!xnrs_open(&rs, db, "data", false, XNRST_HEAP, tx))
+        return false;
+    struct xnrsscan scan;
+    if (!xnrsscan_open(&scan, rs))
+        return false;
+
+    int count = 0;
+    bool more;
+    while (true) {
+        if (!xnrsscan_next(&scan, &more))
+            return false;
+        if (!more)
+            break;
+        struct xnitemid id;
+        int val;
+        if (!xnrsscan_itemid(&scan, &id) || !xnrs_get(rs, id, (uint8_t*)&val, sizeof(int)))
+            return false;
+        if (val != count)
+            return false;
+        count++;
+    }
+
+    *out_count = count;
+    return xntx_close((void**)&tx);
+}
+
+void recovery_redo_committed() {
+    int count = 500;
+    int tx_id_counter;
+    {
+        struct xndb *db;
+        assert(xndb_create("dummy", true, &db));
+
+        //committed
+        struct xntx *tx;
+        assert(xntx_create(&tx, db, XNTXMODE_WR));
+        struct xnrs rs;
+        assert(xnrs_open(&rs, db, "data", true, XNRST_HEAP, tx));
+        for (int i = 0; i < count; i++) {
+            struct xnitemid id;
+            assert(xnrs_put(rs, sizeof(int), (uint8_t*)&i, &id));
+        }
+        assert(xntx_commit(tx));
+
+        //rolled back, but updates are still in the log
+        assert(xntx_create(&tx, db, XNTXMODE_WR));
+        assert(xnrs_open(&rs, db, "data", false, XNRST_HEAP, tx));
+        for (int i = count; i < count * 2; i++) {
+            struct xnitemid id;
+            assert(xnrs_put(rs, sizeof(int), (uint8_t*)&i, &id));
+        }
+        assert(xntx_rollback((void**)&tx));
+
+        tx_id_counter = db->tx_id_counter;
+        assert(xndb_free(db));
+    }
+
+    assert(recovery_zero_file("dummy/data"));
+
+    {
+        struct xndb *db;
+        assert(xndb_create("dummy", false, &db));
+        assert(db->tx_id_counter > tx_id_counter);
+        int recovered;
+        assert(recovery_count(db, &recovered));
+        assert(recovered == count);
+        assert(xndb_free(db));
+    }
+
+    //recovering again gives the same result
+    {
+        struct xndb *db;
+        assert(xndb_create("dummy", false, &db));
+        int recovered;
+        assert(recovery_count(db, &recovered));
+        assert(recovered == count);
+        assert(xndb_free(db));
+    }
+}
+
+//puts the values [from, to) in a single committed tx
+bool recovery_put(struct xndb *db, int from, int to) {
+    struct xntx *tx;
+    if (!xntx_create(&tx, db, XNTXMODE_WR))
+        return false;
+    struct xnrs rs;
+    if (!xnrs_open(&rs, db, "data", from == 0, XNRST_HEAP, tx))
+        return false;
+    for (int i = from; i < to; i++) {
+        struct xnitemid id;
+        if (!xnrs_put(rs, sizeof(int), (uint8_t*)&i, &id))
+            return false;
+    }
+    return xntx_commit(tx);
+}
+
+void recovery_checkpoint() {
+    int count = 500;
+    uint64_t redo_lsn;
+    {
+        struct xndb *db;
+        assert(xndb_create("dummy", true, &db));
+        assert(recovery_put(db, 0, count));
+
+        struct stat before;
+        assert(stat("dummy/log", &before) == 0);
+        assert(xndb_checkpoint(db));
+        redo_lsn = db->log->redo_lsn;
+        assert(redo_lsn > XNLOG_FIRST_LSN);
+
+        //log pages before the redo point were given back to the filesystem
+        struct stat after;
+        assert(stat("dummy/log", &after) == 0);
+        assert(after.st_size == before.st_size);
+        assert(after.st_blocks < before.st_blocks);
+
+        assert(recovery_put(db, count, count * 2));
+        assert(xndb_free(db));
+    }
+
+    //recovery starts at the checkpoint, and only redoes the second tx
+    {
+        struct xndb *db;
+        assert(xndb_create("dummy", false, &db));
+        assert(db->log->redo_lsn == redo_lsn);
+        //the data file was named before the redo point, so its id comes from the checkpoint record
+        assert(db->log->redo_files.named[1] && strcmp(db->log->redo_files.names[1], "data") == 0);
+        int recovered;
+        assert(recovery_count(db, &recovered));
+        assert(recovered == count * 2);
+        assert(xndb_free(db));
+    }
+}
+
+void recovery_checkpoint_by_size() {
+    struct xndbopts opts = xndb_default_opts();
+    opts.checkpoint_log_bytes = 2 * XNPG_SZ;
+    int count = 200;
+    {
+        struct xndb *db;
+        assert(xndb_create_opts("dummy", true, opts, &db));
+        for (int i = 0; i < count; i++) {
+            assert(recovery_put(db, i, i + 1));
+        }
+
+        //recovery never has to scan much more than checkpoint_log_bytes once the flusher catches up
+        assert(xndb_flush(db));
+        assert(db->log->redo_lsn > XNLOG_FIRST_LSN);
+        uint64_t redo_bytes;
+        assert(xnlog_redo_bytes(db->log, &redo_bytes));
+        assert(redo_bytes < opts.checkpoint_log_bytes * 2);
+        assert(xndb_free(db));
+    }
+
+    {
+        struct xndb *db;
+        assert(xndb_create_opts("dummy", false, opts, &db));
+        int recovered;
+        assert(recovery_count(db, &recovered));
+        assert(recovered == count);
+        assert(xndb_free(db));
+    }
+}
+
+//changes made through a pinned page reach the log only through xnpg_mark_dirty, so they have to be enough
+//to redo the page
+void recovery_pinned_page() {
+    {
+        struct xndb *db;
+        assert(xndb_create("dummy", true, &db));
+        assert(recovery_put(db, 0, 1));
+
+        struct xntx *tx;
+        assert(xntx_create(&tx, db, XNTXMODE_WR));
+        struct xnrs rs;
+        assert(xnrs_open(&rs, db, "data", false, XNRST_HEAP, tx));
+        struct xnpg page = { .file_handle = rs.file, .idx = 3 };
+        assert(xnfile_allocate_page(rs.file, tx, &page));
+        uint8_t *data;
+        assert(xnpg_pin(&page, tx, &data));
+        memset(data + 100, 'a', 10);
+        memset(data + 3000, 'b', 20);
+        //the zeroed range in the middle is logged without its bytes
+        struct xnpgrange ranges[3] = { { 100, 10 }, { 200, 50 }, { 3000, 20 } };
+        assert(xnpg_mark_dirty(&page, tx, ranges, 3));
+
+        //the tx reads its own changes
+        uint8_t c;
+        assert(xnpg_read(&page, tx, &c, 3019, 1));
+        assert(c == 'b');
+        struct xnpgrange past_end = { XNPG_SZ - 1, 2 };
+        assert(!xnpg_mark_dirty(&page, tx, &past_end, 1));
+        assert(xntx_commit(tx));
+
+        //read txs can't pin
+        assert(xntx_create(&tx, db, XNTXMODE_RD));
+        assert(!xnpg_pin(&page, tx, &data));
+        assert(xntx_close((void**)&tx));
+        assert(xndb_free(db));
+    }
+
+    assert(recovery_zero_file("dummy/data"));
+
+    {
+        struct xndb *db;
+        assert(xndb_create("dummy", false, &db));
+        struct xntx *tx;
+        assert(xntx_create(&tx, db, XNTXMODE_RD));
+        struct xnrs rs;
+        assert(xnrs_open(&rs, db, "data", false, XNRST_HEAP, tx));
+        struct xnpg page = { .file_handle = rs.file, .idx = 3 };
+        uint8_t buf[XNPG_SZ];
+        assert(xnpg_read(&page, tx, buf, 0, XNPG_SZ));
+        assert(buf[99] == 0 && buf[100] == 'a' && buf[109] == 'a' && buf[110] == 0);
+        assert(buf[200] == 0 && buf[249] == 0);
+        assert(buf[3000] == 'b' && buf[3019] == 'b' && buf[3020] == 0);
+        assert(xntx_close((void**)&tx));
+        assert(xndb_free(db));
+    }
+}
+
+//a commit record torn by a crash fails its checksum, so its tx is not redone and later records overwrite it
+void recovery_torn_commit() {
+    {
+        struct xndb *db;
+        assert(xndb_create("dummy", true, &db));
+        assert(recovery_put(db, 0, 10));
+        assert(recovery_put(db, 10, 20));
+        uint64_t end_lsn;
+        assert(xnlog_end_lsn(db->log, &end_lsn));
+        assert(xndb_free(db));
+
+        //the last byte of the commit record's checksum
+        int fd = open("dummy/log", O_RDWR);
+        assert(fd != -1);
+        uint8_t b;
+        assert(pread(fd, &b, 1, end_lsn - 1) == 1);
+        b ^= 0xff;
+        assert(pwrite(fd, &b, 1, end_lsn - 1) == 1);
+        assert(close(fd) == 0);
+    }
+
+    assert(recovery_zero_file("dummy/data"));
+
+    {
+        struct xndb *db;
+        assert(xndb_create("dummy", false, &db));
+        int recovered;
+        assert(recovery_count(db, &recovered));
+        assert(recovered == 10);
+        assert(recovery_put(db, 10, 15));
+        assert(xndb_free(db));
+    }
+
+    {
+        struct xndb *db;
+        assert(xndb_create("dummy", false, &db));
+        int recovered;
+        assert(recovery_count(db, &recovered));
+        assert(recovered == 15);
+        assert(xndb_free(db));
+    }
+}
+
+//copies a file as it is on disk, to keep an image of it from before a crash
+bool recovery_copy_file(const char *from, const char *to) {
+    int in = open(from, O_RDONLY);
+    int out = open(to, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (in == -1 || out == -1)
+        return false;
+    uint8_t buf[XNPG_SZ];
+    ssize_t n;
+    while ((n = read(in, buf, XNPG_SZ)) > 0) {
+        if (write(out, buf, n) != n)
+            return false;
+    }
+    return n == 0 && close(in) == 0 && close(out) == 0;
+}
+
+//a crash before a tx commits leaves its alloc records in the log with no release records after them.  Recovery
+//redoes them, then gives the claimed pages back.  A page the tx freed and took back stays in use
+void recovery_uncommitted_claims() {
+    {
+        struct xndb *db;
+        assert(xndb_create("dummy", true, &db));
+        assert(recovery_put(db, 0, 10));
+
+        struct xntx *tx;
+        assert(xntx_create(&tx, db, XNTXMODE_WR));
+        struct xnrs rs;
+        assert(xnrs_open(&rs, db, "data", false, XNRST_HEAP, tx));
+        //the heap's data page
+        struct xnpg page = { .file_handle = rs.file, .idx = 2 };
+        assert(xnfile_free_page(rs.file, tx, &page));
+        assert(xnfile_allocate_page(rs.file, tx, &page));
+        assert(page.idx == 2);
+        for (uint64_t i = 3; i < 6; i++) {
+            assert(xnfile_allocate_page(rs.file, tx, &page));
+            assert(page.idx == i);
+        }
+
+        //the crash image: the log up to the alloc records, and whatever data pages were written back
+        uint64_t end_lsn;
+        assert(xnlog_end_lsn(db->log, &end_lsn));
+        assert(xnlog_wait_durable(db->log, end_lsn));
+        assert(xndb_flush(db));
+        assert(recovery_copy_file("dummy/log", "dummy/log.crash"));
+        assert(recovery_copy_file("dummy/data", "dummy/data.crash"));
+
+        assert(xntx_rollback((void**)&tx));
+        assert(xndb_free(db));
+        assert(rename("dummy/log.crash", "dummy/log") == 0);
+        assert(rename("dummy/data.crash", "dummy/data") == 0);
+    }
+
+    for (int run = 0; run < 2; run++) {
+        struct xndb *db;
+        assert(xndb_create("dummy", false, &db));
+        int recovered;
+        assert(recovery_count(db, &recovered));
+        assert(recovered == 10);
+
+        struct xntx *tx;
+        assert(xntx_create(&tx, db, XNTXMODE_WR));
+        struct xnrs rs;
+        assert(xnrs_open(&rs, db, "data", false, XNRST_HEAP, tx));
+        struct xnpg page;
+        assert(xnfile_allocate_page(rs.file, tx, &page));
+        assert(page.idx == 3);
+        assert(xntx_rollback((void**)&tx));
+        assert(xndb_free(db));
+    }
+}
+
+void recovery_tests() {
+    append_test(recovery_redo_committed);
+    append_test(recovery_pinned_page);
+    append_test(recovery_checkpoint);
+    append_test(recovery_checkpoint_by_size);
+    append_test(recovery_torn_commit);
+    append_test(recovery_uncommitted_claims);
+}
@@ -0,0 +1,136 @@
+#include "db.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+//compares point lookups by key in B+tree and hash record stores against a full scan of a heap record store.
+//usage: ./rs_bench [records ...]
+//
+//Each record is its own 8 byte key.  Record stores live in one file, which holds at most
+//XNFILE_GROUP_PAGES * XNFILE_MAX_GROUPS pages - loads that run out of pages are reported and skipped.
+
+#define BATCH 10000
+#define KEYED_LOOKUPS 100000
+#define HEAP_LOOKUPS 10
+
+static double elapsed(struct timespec start, struct timespec end) {
+    return (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+}
+
+static uint64_t rand_key(uint64_t records) {
+    return ((uint64_t)rand() * RAND_MAX + rand()) % records;
+}
+
+//loads keys 0 to records - 1, committing every BATCH records
+static bool load(struct xndb *db, enum xnrst type, uint64_t records) {
+    for (uint64_t k = 0; k < records; k += BATCH) {
+        struct xntx *tx;
+        if (!xntx_create(&tx, db, XNTXMODE_WR))
+            return false;
+        struct xnrs rs;
+        if (!xnrs_open(&rs, db, "data", k == 0, type, tx))
+            return false;
+        for (uint64_t i = k; i < k + BATCH && i < records; i++) {
+            if (type != XNRST_HEAP) {
+                if (!xnrs_put_key(rs, i, sizeof(uint64_t), (uint8_t*)&i))
+                    return false;
+            } else {
+                struct xnitemid id;
+                if (!xnrs_put(rs, sizeof(uint64_t), (uint8_t*)&i, &id))
+                    return false;
+            }
+        }
+        if (!xntx_commit(tx))
+            return false;
+    }
+    return true;
+}
+
+static bool lookup_key(struct xnrs rs, uint64_t key) {
+    uint64_t val;
+    bool found;
+    return xnrs_get_key(rs, key, (uint8_t*)&val, sizeof(uint64_t), &found) && found && val == key;
+}
+
+//without an index the only way to find a key is to scan until it turns up
+static bool lookup_heap(struct xnrs rs, uint64_t key) {
+    struct xnrsscan scan;
+    if (!xnrsscan_open(&scan, rs))
+        return false;
+    bool more;
+    while (xnrsscan_next(&scan, &more) && more) {
+        struct xnitemid id;
+        uint64_t val;
+        if (!xnrsscan_itemid(&scan, &id) || !xnrs_get(rs, id, (uint8_t*)&val, sizeof(uint64_t)))
+            return false;
+        if (val == key)
+            return true;
+    }
+    return false;
+}
+
+static void bench(enum xnrst type, uint64_t records) {
+    const char *names[] = { "heap", "btree", "hash" };
+    const char *name = names[type];
+    int lookups = type == XNRST_HEAP ? HEAP_LOOKUPS : KEYED_LOOKUPS;
+
+    system("rm -rf bench");
+    struct xndb *db;
+    if (!xndb_create("bench", true, &db)) {
+        printf("xndb_create failed\n");
+        exit(1);
+    }
+
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    if (!load(db, type, records)) {
+        printf("%-5s %10lu records: load failed (record store full?)\n", name, records);
+        if (!xndb_free(db))
+            exit(1);
+        return;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    double load_secs = elapsed(start, end);
+
+    struct xntx *tx;
+    struct xnrs rs;
+    if (!xntx_create(&tx, db, XNTXMODE_RD) || !xnrs_open(&rs, db, "data", false, type, tx)) {
+        printf("xnrs_open failed\n");
+        exit(1);
+    }
+
+    srand(42);
+    int found = 0;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (int i = 0; i < lookups; i++) {
+        uint64_t key = rand_key(records);
+        if (type == XNRST_HEAP ? lookup_heap(rs, key) : lookup_key(rs, key))
+            found++;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    printf("%-5s %10lu records: load %8.2fs, %12.1f lookups/sec (%d/%d found)\n",
+           name, records, load_secs, lookups / elapsed(start, end), found, lookups);
+
+    if (!xntx_close((void**)&tx) || !xndb_free(db)) {
+        printf("xndb_free failed\n");
+        exit(1);
+    }
+}
+
+int main(int argc, char **argv) {
+    if (argc > 1) {
+        for (int i = 1; i < argc; i++) {
+            for (enum xnrst type = XNRST_HEAP; type <= XNRST_HASH; type++)
+                bench(type, strtoull(argv[i], NULL, 10));
+        }
+    } else {
+        for (enum xnrst type = XNRST_HEAP; type <= XNRST_HASH; type++)
+            bench(type, 1000000);
+        for (enum xnrst type = XNRST_HEAP; type <= XNRST_HASH; type++)
+            bench(type, 100000000);
+    }
+    system("rm -rf bench");
+    return 0;
+}
@@ -0,0 +1,80 @@
+#include "table.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+//measures xntbl_find throughput at different table sizes.
+//usage: ./table_bench [entries ...]
+
+#define FILE_COUNT 4
+#define LOOKUPS 2000000
+
+static double elapsed(struct timespec start, struct timespec end) {
+    return (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+}
+
+static void bench(int entries) {
+    struct xnfile files[FILE_COUNT];
+    char paths[FILE_COUNT][64];
+    for (int i = 0; i < FILE_COUNT; i++) {
+        sprintf(paths[i], "/var/lib/xenondb/bench/data%d", i);
+        files[i].path = paths[i];
+        files[i].id = i;
+    }
+
+    struct xntbl *tbl;
+    if (!xntbl_create(&tbl, false)) {
+        printf("xntbl_create failed\n");
+        exit(1);
+    }
+
+    //values are never dereferenced, so every entry can share one buffer
+    uint8_t val;
+    for (int i = 0; i < entries; i++) {
+        struct xnpg page = { .file_handle = &files[i % FILE_COUNT], .idx = i / FILE_COUNT };
+        if (!xntbl_insert(tbl, &page, &val)) {
+            printf("xntbl_insert failed\n");
+            exit(1);
+        }
+    }
+
+    //random lookups over existing keys
+    srand(42);
+    int found = 0;
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (int i = 0; i < LOOKUPS; i++) {
+        int k = ((long)rand() * RAND_MAX + rand()) % entries;
+        struct xnpg page = { .file_handle = &files[k % FILE_COUNT], .idx = k / FILE_COUNT };
+        if (xntbl_find(tbl, &page))
+            found++;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    printf("%10d entries: %12.0f lookups/sec (%d/%d found)\n", entries, LOOKUPS / elapsed(start, end), found, LOOKUPS);
+
+    for (int i = 0; i < entries; i++) {
+        struct xnpg page = { .file_handle = &files[i % FILE_COUNT], .idx = i / FILE_COUNT };
+        if (!xntbl_remove(tbl, &page)) {
+            printf("xntbl_remove failed\n");
+            exit(1);
+        }
+    }
+    if (!xntbl_free((void**)&tbl)) {
+        printf("xntbl_free failed\n");
+        exit(1);
+    }
+}
+
+int main(int argc, char **argv) {
+    if (argc > 1) {
+        for (int i = 1; i < argc; i++)
+            bench(atoi(argv[i]));
+    } else {
+        bench(1000);
+        bench(100000);
+        bench(10000000);
+    }
+    return 0;
+}
@@ -2,7 +2,7 @@
 
 #include "table.h"
 #include "test.h"
-/*
+
 
 void table_create_free() {
     //free emptytable with regular buffers
@@ -24,7 +24,7 @@ void table_insert_buffer() {
     struct xntbl *tbl;
     assert(xntbl_create(&tbl, false));
     struct xnfile *handle;
-    assert(xnfile_create(&handle, "dummy", true, false));
+    assert(xnfile_create(&handle, "dummy", 0, true, false));
 
     uint8_t *buf = malloc(XNPG_SZ);
     struct xnpg page = { .file_handle = handle, .idx = 0 };
@@ -39,7 +39,7 @@ void table_find_buffer() {
     struct xntbl *tbl;
     assert(xntbl_create(&tbl, false));
     struct xnfile *handle;
-    assert(xnfile_create(&handle, "dummy", true, false));
+    assert(xnfile_create(&handle, "dummy", 0, true, false));
 
     //not found
     {
@@ -68,7 +68,7 @@ void table_insert_mmap() {
     struct xntbl *tbl;
     assert(xntbl_create(&tbl, true));
     struct xnfile *handle;
-    assert(xnfile_create(&handle, "dummy", true, false));
+    assert(xnfile_create(&handle, "dummy", 0, true, false));
     assert(xnfile_set_size(handle, XNPG_SZ));
     assert(handle->size == XNPG_SZ);
 
@@ -92,7 +92,7 @@ void table_find_mmap() {
     struct xntbl *tbl;
     assert(xntbl_create(&tbl, true));
     struct xnfile *handle;
-    assert(xnfile_create(&handle, "dummy", true, false));
+    assert(xnfile_create(&handle, "dummy", 0, true, false));
     assert(xnfile_set_size(handle, XNPG_SZ));
     assert(handle->size == XNPG_SZ);
 
@@ -124,10 +124,80 @@ void table_find_mmap() {
     assert(xnfile_close((void**)&handle));
 }
 
+void table_grow() {
+    struct xntbl *tbl;
+    assert(xntbl_create(&tbl, false));
+    struct xnfile file0 = { .path = "file0", .id = 0 };
+    struct xnfile file1 = { .path = "file1", .id = 1 };
+
+    //same page index in different files must not collide
+    int count = XNTBL_INIT_CAPACITY * 8;
+    for (int i = 0; i < count; i++) {
+        struct xnpg page0 = { .file_handle = &file0, .idx = i };
+        struct xnpg page1 = { .file_handle = &file1, .idx = i };
+        uint8_t *buf0 = malloc(sizeof(int));
+        uint8_t *buf1 = malloc(sizeof(int));
+        *((int*)buf0) = i;
+        *((int*)buf1) = -i;
+        assert(xntbl_insert(tbl, &page0, buf0));
+        assert(xntbl_insert(tbl, &page1, buf1));
+    }
+    assert(tbl->count == count * 2);
+    assert(tbl->capacity > XNTBL_INIT_CAPACITY);
+
+    for (int i = 0; i < count; i++) {
+        struct xnpg page0 = { .file_handle = &file0, .idx = i };
+        struct xnpg page1 = { .file_handle = &file1, .idx = i };
+        uint8_t *val;
+        assert((val = xntbl_find(tbl, &page0)) && *((int*)val) == i);
+        assert((val = xntbl_find(tbl, &page1)) && *((int*)val) == -i);
+    }
+
+    assert(xntbl_free((void**)&tbl));
+}
+
+void table_remove() {
+    struct xntbl *tbl;
+    assert(xntbl_create(&tbl, false));
+    struct xnfile file = { .path = "file", .id = 0 };
+
+    int count = XNTBL_INIT_CAPACITY * 4;
+    for (int i = 0; i < count; i++) {
+        struct xnpg page = { .file_handle = &file, .idx = i };
+        assert(xntbl_insert(tbl, &page, malloc(sizeof(int))));
+    }
+
+    //remove every other entry, and make sure remaining entries are still reachable
+    for (int i = 0; i < count; i += 2) {
+        struct xnpg page = { .file_handle = &file, .idx = i };
+        uint8_t *val = xntbl_find(tbl, &page);
+        assert(xntbl_remove(tbl, &page));
+        free(val);
+    }
+    assert(tbl->count == count / 2);
+
+    for (int i = 0; i < count; i++) {
+        struct xnpg page = { .file_handle = &file, .idx = i };
+        if (i % 2 == 0) {
+            assert(xntbl_find(tbl, &page) == NULL);
+        } else {
+            assert(xntbl_find(tbl, &page) != NULL);
+        }
+    }
+
+    //removing a missing entry fails
+    struct xnpg page = { .file_handle = &file, .idx = 0 };
+    assert(!xntbl_remove(tbl, &page));
+
+    assert(xntbl_free((void**)&tbl));
+}
+
 void table_tests() {
     append_test(table_create_free);
     append_test(table_insert_buffer);
     append_test(table_find_buffer);
     append_test(table_insert_mmap);
     append_test(table_find_mmap);
-}*/
+    append_test(table_grow);
+    append_test(table_remove);
+}
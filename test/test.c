@@ -18,6 +18,18 @@
 #include "containeritr_test.h"
 #include "heap_test.h"
 #include "rs_test.h"
+#include "pool_test.h"
+#include "uring_test.h"
+#include "growth_test.h"
+#include "freemap_test.h"
+#include "recovery_test.h"
+#include "mvcc_test.h"
+#include "btree_test.h"
+#include "hash_test.h"
+#include "vector_test.h"
+#include "pq_test.h"
+#include "ivfflat_test.h"
+#include "hnsw_test.h"
 
 struct string {
     char *ptr;
@@ -88,7 +100,7 @@ void integrated_test() {
         off_t off = 0;
         float f;
         int count = 0;
-        while (next_float(s, &off, &f)) {
+        while (res == CURLE_OK && next_float(s, &off, &f)) {
             vector[vec_count] = f;
             vec_count++;
         }
@@ -184,6 +196,20 @@ int main() {
     db_tests();*/
     //heap_tests();
 	//rs_tests();
+    table_tests();
+    log_commit_tests();
+    pool_tests();
+    uring_tests();
+    growth_tests();
+    freemap_tests();
+    recovery_tests();
+    mvcc_tests();
+    btree_tests();
+    hash_tests();
+    vector_tests();
+    pq_tests();
+    ivfflat_tests();
+    hnsw_tests();
    
     int passed_count = 0;
     
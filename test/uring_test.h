@@ -0,0 +1,264 @@
+#pragma once
+
+#include <errno.h>
+#include <pthread.h>
+
+#include "test.h"
+#include "db.h"
+
+void uring_run() {
+    if (!xnuring_supported())
+        return;
+
+    struct xnuring *ring;
+    assert(xnuring_create(&ring, 8));
+    struct xnfile *handle;
+    assert(xnfile_create(&handle, "dummy", 0, true, false));
+    assert(xnfile_set_size(handle, XNPG_SZ * 4));
+
+    //two writes and a fdatasync drained behind both
+    uint8_t *bufs = malloc(XNPG_SZ * 4);
+    memset(bufs, 'a', XNPG_SZ * 2);
+    memset(bufs + XNPG_SZ * 2, 'b', XNPG_SZ);
+    struct iovec iov[3] = { { bufs, XNPG_SZ }, { bufs + XNPG_SZ, XNPG_SZ }, { bufs + XNPG_SZ * 2, XNPG_SZ } };
+    struct xnuringop ops[3] = {
+        { .opcode = XNURING_WRITEV, .fd = handle->fd, .iov = iov, .iov_count = 2, .off = 0 },
+        { .opcode = XNURING_WRITEV, .fd = handle->fd, .iov = iov + 2, .iov_count = 1, .off = XNPG_SZ * 3 },
+        { .opcode = XNURING_FDATASYNC, .fd = handle->fd, .drain = true },
+    };
+    assert(xnuring_run(ring, ops, 3));
+    assert(ops[0].res == XNPG_SZ * 2 && ops[1].res == XNPG_SZ && ops[2].res == 0);
+
+    //a read past the end of the file comes back short, and cancels the op linked to it
+    struct iovec read_iov[2] = { { bufs + XNPG_SZ * 3, XNPG_SZ }, { bufs, XNPG_SZ } };
+    struct xnuringop reads[2] = {
+        { .opcode = XNURING_READV, .fd = handle->fd, .iov = read_iov, .iov_count = 1, .off = XNPG_SZ * 4, .link = true },
+        { .opcode = XNURING_READV, .fd = handle->fd, .iov = read_iov + 1, .iov_count = 1, .off = XNPG_SZ * 3 },
+    };
+    assert(xnuring_run(ring, reads, 2));
+    assert(reads[0].res == 0 && reads[1].res == -ECANCELED);
+
+    char c;
+    assert(xnfile_read(handle, &c, XNPG_SZ, 1));
+    assert(c == 'a');
+    assert(xnfile_read(handle, &c, XNPG_SZ * 2, 1));
+    assert(c == 0);
+    assert(xnfile_read(handle, &c, XNPG_SZ * 3, 1));
+    assert(c == 'b');
+
+    free(bufs);
+    assert(xnfile_close((void**)&handle));
+    assert(xnuring_free((void**)&ring));
+}
+
+//a batch can't be submitted past a chain longer than the ring.  The ops before it still complete, and the rest
+//are cancelled
+void uring_chain_too_long() {
+    if (!xnuring_supported())
+        return;
+
+    struct xnuring *ring;
+    assert(xnuring_create(&ring, 8));
+    struct xnfile *handle;
+    assert(xnfile_create(&handle, "dummy", 0, true, false));
+    assert(xnfile_set_size(handle, XNPG_SZ * 16));
+
+    const int COUNT = 12;
+    uint8_t *buf = malloc(XNPG_SZ);
+    memset(buf, 'a', XNPG_SZ);
+    struct iovec iov = { buf, XNPG_SZ };
+    struct xnuringop ops[COUNT];
+    for (int i = 0; i < COUNT; i++)
+        ops[i] = (struct xnuringop){ .opcode = XNURING_WRITEV, .fd = handle->fd, .iov = &iov, .iov_count = 1,
+                                     .off = XNPG_SZ * i, .link = i > 0 && i < COUNT - 1, .res = 1 };
+    assert(!xnuring_run(ring, ops, COUNT));
+    assert(ops[0].res == XNPG_SZ);
+    for (int i = 1; i < COUNT; i++) {
+        assert(ops[i].res == -ECANCELED);
+    }
+    assert(ring->inflight == 0);
+
+    //the ring is still usable
+    struct xnuringop op = { .opcode = XNURING_WRITEV, .fd = handle->fd, .iov = &iov, .iov_count = 1, .off = XNPG_SZ };
+    assert(xnuring_run(ring, &op, 1));
+    assert(op.res == XNPG_SZ);
+
+    free(buf);
+    assert(xnfile_close((void**)&handle));
+    assert(xnuring_free((void**)&ring));
+}
+
+struct uring_shared_arg {
+    struct xnuring *ring;
+    int fd;
+    int thread;
+    bool ok;
+};
+
+//writes and reads back its own pages in batches longer than the ring, so threads keep waiting on each other's ops
+void *uring_shared_fcn(void *arg) {
+    struct uring_shared_arg *a = (struct uring_shared_arg*)arg;
+    const int PAGES = 12;
+    uint8_t *bufs = malloc(XNPG_SZ * PAGES);
+    struct iovec iov[PAGES];
+    struct xnuringop ops[PAGES];
+    a->ok = true;
+    for (int round = 0; round < 10 && a->ok; round++) {
+        for (int i = 0; i < PAGES; i++) {
+            memset(bufs + i * XNPG_SZ, a->thread * 16 + round, XNPG_SZ);
+            iov[i] = (struct iovec){ bufs + i * XNPG_SZ, XNPG_SZ };
+            ops[i] = (struct xnuringop){ .opcode = XNURING_WRITEV, .fd = a->fd, .iov = &iov[i], .iov_count = 1,
+                                         .off = XNPG_SZ * (a->thread * PAGES + i) };
+        }
+        a->ok = xnuring_run(a->ring, ops, PAGES);
+
+        memset(bufs, 0, XNPG_SZ * PAGES);
+        for (int i = 0; i < PAGES && a->ok; i++) {
+            a->ok = ops[i].res == XNPG_SZ;
+            ops[i].opcode = XNURING_READV;
+        }
+        a->ok = a->ok && xnuring_run(a->ring, ops, PAGES);
+        for (int i = 0; i < PAGES * XNPG_SZ && a->ok; i++)
+            a->ok = bufs[i] == a->thread * 16 + round;
+    }
+    free(bufs);
+    return NULL;
+}
+
+//batches from several threads share one ring
+void uring_shared() {
+    if (!xnuring_supported())
+        return;
+
+    const int THREAD_COUNT = 8;
+    struct xnuring *ring;
+    assert(xnuring_create(&ring, 8));
+    struct xnfile *handle;
+    assert(xnfile_create(&handle, "dummy", 0, true, false));
+    assert(xnfile_set_size(handle, XNPG_SZ * 12 * THREAD_COUNT));
+
+    pthread_t threads[THREAD_COUNT];
+    struct uring_shared_arg args[THREAD_COUNT];
+    for (int i = 0; i < THREAD_COUNT; i++) {
+        args[i] = (struct uring_shared_arg){ .ring = ring, .fd = handle->fd, .thread = i };
+        pthread_create(&threads[i], NULL, uring_shared_fcn, &args[i]);
+    }
+    for (int i = 0; i < THREAD_COUNT; i++) {
+        pthread_join(threads[i], NULL);
+        assert(args[i].ok);
+    }
+    assert(ring->inflight == 0 && !ring->reaping);
+
+    assert(xnfile_close((void**)&handle));
+    assert(xnuring_free((void**)&ring));
+}
+
+//the same vectored writes and reads with and without a ring.  Every other page is written, so each page is a run
+//of its own and the batch is longer than the ring
+bool uring_file_transfer(struct xnuring *ring) {
+    const int PAGES = 3 * XNURING_DEPTH;
+    struct xnfile *handle;
+    bool ok = xnfile_create(&handle, "dummy", 0, true, false);
+    handle->uring = ring;
+    ok = ok && xnfile_set_size(handle, XNPG_SZ * PAGES * 2);
+
+    uint8_t *data = malloc(XNPG_SZ * PAGES);
+    struct xnfileiov pages[PAGES];
+    for (int i = 0; i < PAGES; i++) {
+        memset(data + i * XNPG_SZ, i % 251, XNPG_SZ);
+        pages[i].idx = i * 2;
+        pages[i].buf = data + i * XNPG_SZ;
+    }
+    ok = ok && xnfile_writev_sync(handle, pages, PAGES);
+
+    memset(data, 0xff, XNPG_SZ * PAGES);
+    ok = ok && xnfile_readv(handle, pages, PAGES);
+    for (int i = 0; i < PAGES * XNPG_SZ; i++)
+        ok = ok && data[i] == (i / XNPG_SZ) % 251;
+
+    //the pages in between were never written
+    struct xnfileiov gap = { .idx = 1, .buf = data };
+    ok = ok && xnfile_readv(handle, &gap, 1);
+    ok = ok && data[0] == 0 && data[XNPG_SZ - 1] == 0;
+
+    free(data);
+    ok = ok && xnfile_close((void**)&handle);
+    return ok;
+}
+
+void uring_file_sync() {
+    assert(uring_file_transfer(NULL));
+}
+
+void uring_file_ring() {
+    if (!xnuring_supported())
+        return;
+    struct xnuring *ring;
+    assert(xnuring_create(&ring, XNURING_DEPTH));
+    assert(uring_file_transfer(ring));
+    assert(xnuring_free((void**)&ring));
+}
+
+//enough records to span many read-ahead batches, scanned after reopening so every page comes from disk
+bool uring_db_scan(bool io_uring) {
+    const int COUNT = 4000;
+    struct xndbopts opts = xndb_default_opts();
+    opts.io_uring = io_uring;
+    opts.pool_frames = 256;
+    uint8_t val[400];
+
+    struct xndb *db;
+    bool ok = xndb_create_opts("dummy", true, opts, &db);
+    struct xntx *tx;
+    ok = ok && xntx_create(&tx, db, XNTXMODE_WR);
+    struct xnrs rs;
+    ok = ok && xnrs_open(&rs, db, "data", true, XNRST_HEAP, tx);
+    for (int i = 0; i < COUNT; i++) {
+        memset(val, i % 256, sizeof(val));
+        memcpy(val, &i, sizeof(int));
+        struct xnitemid id;
+        ok = ok && xnrs_put(rs, sizeof(val), val, &id);
+    }
+    ok = ok && xntx_commit(tx);
+    ok = ok && xndb_free(db);
+
+    ok = ok && xndb_create_opts("dummy", false, opts, &db);
+    ok = ok && xntx_create(&tx, db, XNTXMODE_RD);
+    ok = ok && xnrs_open(&rs, db, "data", false, XNRST_HEAP, tx);
+    struct xnrsscan scan;
+    ok = ok && xnrsscan_open(&scan, rs);
+    int count = 0;
+    bool more = true;
+    while (ok && more) {
+        ok = xnrsscan_next(&scan, &more);
+        if (!ok || !more)
+            break;
+        ok = ok && xnrsscan_get(&scan, val, sizeof(val));
+        int i;
+        memcpy(&i, val, sizeof(int));
+        ok = ok && i == count && val[sizeof(val) - 1] == i % 256;
+        count++;
+    }
+    ok = ok && count == COUNT;
+    ok = ok && xntx_close((void**)&tx);
+    ok = ok && xndb_free(db);
+    return ok;
+}
+
+void uring_db_scan_sync() {
+    assert(uring_db_scan(false));
+}
+
+void uring_db_scan_ring() {
+    assert(uring_db_scan(true));
+}
+
+void uring_tests() {
+    append_test(uring_run);
+    append_test(uring_chain_too_long);
+    append_test(uring_shared);
+    append_test(uring_file_sync);
+    append_test(uring_file_ring);
+    append_test(uring_db_scan_sync);
+    append_test(uring_db_scan_ring);
+}
@@ -0,0 +1,185 @@
+#include "vector.h"
+#include "pq.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+//compares distance kernels for each instruction set the cpu supports, brute force top-k search
+//one pair at a time against the block functions, and PQ distance table lookups.
+//usage: ./vector_bench [vectors]
+//
+//Each distance is between a fixed query and one of a set of stored vectors, which is how
+//searches use the kernels.  The stored vectors are scanned in order, so the numbers at
+//larger dimensions include the cost of streaming them from memory.
+
+#define ROUNDS 5
+#define K 10
+#define QUERIES 16
+
+static double elapsed(struct timespec start, struct timespec end) {
+    return (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+}
+
+static const char *isa_name(enum xnvisa isa) {
+    switch (isa) {
+        case XNVISA_SCALAR:
+            return "scalar";
+        case XNVISA_SSE:
+            return "sse";
+        case XNVISA_AVX2:
+            return "avx2";
+        case XNVISA_AVX512:
+        default:
+            return "avx512";
+    }
+}
+
+//nanoseconds per distance, best of ROUNDS
+static double run(float (*fcn)(const float*, const float*, int), const float *query, const float *vecs, int count, int dim, float *sink) {
+    double best = 1e9;
+    for (int r = 0; r < ROUNDS; r++) {
+        struct timespec start, end;
+        float sum = 0.0f;
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        for (int i = 0; i < count; i++)
+            sum += fcn(query, vecs + (size_t)i * dim, dim);
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        *sink += sum;
+        double ns = elapsed(start, end) * 1e9 / count;
+        if (ns < best)
+            best = ns;
+    }
+    return best;
+}
+
+//brute force top-k for QUERIES queries three ways, in ns per distance
+static void run_topk(const float *queries, const float *vecs, int count, int dim) {
+    uint64_t ids[QUERIES][K];
+    float dists[QUERIES][K];
+    struct xnvtopk topks[QUERIES];
+    struct timespec start, end;
+    double total = (double)QUERIES * count;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (int q = 0; q < QUERIES; q++) {
+        xnvtopk_init(&topks[q], K, ids[q], dists[q]);
+        for (int i = 0; i < count; i++)
+            xnvtopk_push(&topks[q], i, xnvec_compute_distance(xnvec_l2sq, queries + (size_t)q * dim, vecs + (size_t)i * dim, dim));
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    double pair = elapsed(start, end) * 1e9 / total;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (int q = 0; q < QUERIES; q++) {
+        xnvtopk_init(&topks[q], K, ids[q], dists[q]);
+        xnvec_topk_block(XNVM_L2, queries + (size_t)q * dim, vecs, NULL, count, dim, &topks[q]);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    double block = elapsed(start, end) * 1e9 / total;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (int q = 0; q < QUERIES; q++)
+        xnvtopk_init(&topks[q], K, ids[q], dists[q]);
+    xnvec_topk_block_many(XNVM_L2, queries, QUERIES, vecs, NULL, count, dim, topks);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    double many = elapsed(start, end) * 1e9 / total;
+
+    printf("%6d %10.1f %10.1f %10.1f\n", dim, pair, block, many);
+}
+
+//ns per code for PQ table lookups, best of ROUNDS
+static double run_adc(const float *table, int m, const uint8_t *codes, int count, float *dists) {
+    double best = 1e9;
+    for (int r = 0; r < ROUNDS; r++) {
+        struct timespec start, end;
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        xnpq_adc(table, m, codes, count, dists);
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        double ns = elapsed(start, end) * 1e9 / count;
+        if (ns < best)
+            best = ns;
+    }
+    return best;
+}
+
+int main(int argc, char **argv) {
+    int count = argc > 1 ? atoi(argv[1]) : 10000;
+    int dims[] = { 128, 768, 1536 };
+    float sink = 0.0f;
+
+    printf("%d vectors, ns/distance\n", count);
+    printf("%6s %7s %10s %10s %10s\n", "dim", "isa", "l2sq", "dot", "cosine");
+    for (int d = 0; d < 3; d++) {
+        int dim = dims[d];
+        float *vecs = malloc((size_t)count * dim * sizeof(float));
+        float *query = malloc(dim * sizeof(float));
+        unsigned int seed = 1;
+        for (size_t i = 0; i < (size_t)count * dim; i++)
+            vecs[i] = (float)rand_r(&seed) / RAND_MAX;
+        for (int i = 0; i < dim; i++)
+            query[i] = (float)rand_r(&seed) / RAND_MAX;
+
+        double scalar = 0.0;
+        for (enum xnvisa isa = XNVISA_SCALAR; isa <= XNVISA_AVX512; isa++) {
+            if (!xnvec_set_isa(isa))
+                continue;
+            double l2sq = run(xnvec_l2sq, query, vecs, count, dim, &sink);
+            double dot = run(xnvec_inner_product, query, vecs, count, dim, &sink);
+            double cosine = run(xnvec_cosine_similarity, query, vecs, count, dim, &sink);
+            if (isa == XNVISA_SCALAR)
+                scalar = l2sq;
+            printf("%6d %7s %10.1f %10.1f %10.1f   (l2sq %.1fx scalar)\n", dim, isa_name(isa), l2sq, dot, cosine, scalar / l2sq);
+        }
+
+        free(vecs);
+        free(query);
+    }
+
+    enum xnvisa best = XNVISA_AVX512;
+    while (!xnvec_set_isa(best))
+        best--;
+    printf("\nl2 top-%d for %d queries, ns/distance\n", K, QUERIES);
+    printf("%6s %10s %10s %10s\n", "dim", "per pair", "block", "many");
+    for (int d = 0; d < 3; d++) {
+        int dim = dims[d];
+        float *vecs = malloc((size_t)count * dim * sizeof(float));
+        float *queries = malloc((size_t)QUERIES * dim * sizeof(float));
+        unsigned int seed = 1;
+        for (size_t i = 0; i < (size_t)count * dim; i++)
+            vecs[i] = (float)rand_r(&seed) / RAND_MAX;
+        for (int i = 0; i < QUERIES * dim; i++)
+            queries[i] = (float)rand_r(&seed) / RAND_MAX;
+        run_topk(queries, vecs, count, dim);
+        free(vecs);
+        free(queries);
+    }
+
+    int ms[] = { 16, 32, 64 };
+    printf("\npq table lookups, ns/code\n");
+    printf("%6s %7s %10s %10s %10s\n", "", "isa", "m 16", "m 32", "m 64");
+    uint8_t *codes = malloc((size_t)count * 64);
+    float *table = malloc(64 * XNPQ_KSUB * sizeof(float));
+    float *dists = malloc(count * sizeof(float));
+    unsigned int seed = 1;
+    for (size_t i = 0; i < (size_t)count * 64; i++)
+        codes[i] = rand_r(&seed);
+    for (int i = 0; i < 64 * XNPQ_KSUB; i++)
+        table[i] = (float)rand_r(&seed) / RAND_MAX;
+    for (enum xnvisa isa = XNVISA_SCALAR; isa <= XNVISA_AVX512; isa++) {
+        if (!xnvec_set_isa(isa))
+            continue;
+        printf("%6s %7s", "", isa_name(isa));
+        for (int i = 0; i < 3; i++) {
+            printf(" %10.1f", run_adc(table, ms[i], codes, count, dists));
+            sink += dists[0];
+        }
+        printf("\n");
+    }
+    free(codes);
+    free(table);
+    free(dists);
+
+    //keeps the compiler from dropping the distance calls
+    return sink == 0.12345f;
+}
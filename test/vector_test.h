@@ -0,0 +1,214 @@
+#pragma once
+
+#include "test.h"
+#include "vector.h"
+
+#include <math.h>
+
+//the examples from the vectordb tutorial
+void vector_distances() {
+    float vs[4][3] = { { 1.0f, 1.0f, 1.0f },
+                       { 2.0f, 1.0f, 1.0f },
+                       { 3.0f, 1.0f, 1.0f },
+                       { 4.0f, 1.0f, 1.0f } };
+    float v[] = { 1.0f, 1.0f, 1.0f };
+
+    for (int i = 0; i < 4; i++) {
+        assert(fabsf(xnvec_compute_distance(xnvec_euclidean, v, vs[i], 3) - i) < 1e-5f);
+        assert(fabsf(xnvec_distance(XNVM_IP, v, vs[i], 3) + (i + 3)) < 1e-5f);
+    }
+    assert(fabsf(xnvec_distance(XNVM_COSINE, v, vs[0], 3)) < 1e-5f);
+    assert(fabsf(xnvec_magnitude(vs[3], 3) - sqrtf(18.0f)) < 1e-5f);
+}
+
+//every supported instruction set agrees with the scalar kernels, including lengths that leave a tail
+//cosine distance from a to b through the one-to-many loop, which takes a's norm separately
+float vector_batch_cosine(const float *a, const float *b, int len) {
+    uint64_t id;
+    float dist;
+    struct xnvtopk topk;
+    xnvtopk_init(&topk, 1, &id, &dist);
+    xnvec_topk_block(XNVM_COSINE, a, b, NULL, 1, len, &topk);
+    return dist;
+}
+
+void vector_isa_kernels() {
+    float a[1543];
+    float b[1543];
+    unsigned int seed = 7;
+    for (int i = 0; i < 1543; i++) {
+        a[i] = (float)rand_r(&seed) / RAND_MAX - 0.5f;
+        b[i] = (float)rand_r(&seed) / RAND_MAX - 0.5f;
+    }
+
+    enum xnvisa start = xnvec_isa();
+    int lens[] = { 1, 3, 7, 15, 17, 31, 33, 63, 65, 128, 767, 1543 };
+    float expect[12][3];
+    assert(xnvec_set_isa(XNVISA_SCALAR));
+    for (int i = 0; i < 12; i++) {
+        expect[i][0] = xnvec_l2sq(a, b, lens[i]);
+        expect[i][1] = xnvec_inner_product(a, b, lens[i]);
+        expect[i][2] = xnvec_cosine_similarity(a, b, lens[i]);
+    }
+
+    bool ok = true;
+    for (int i = 0; i < 12; i++)
+        ok = ok && fabsf(vector_batch_cosine(a, b, lens[i]) - expect[i][2]) < 1e-5f;
+    for (enum xnvisa isa = XNVISA_SSE; isa <= XNVISA_AVX512; isa++) {
+        if (!xnvec_isa_supported(isa)) {
+            assert(!xnvec_set_isa(isa));
+            continue;
+        }
+        assert(xnvec_set_isa(isa));
+        assert(xnvec_isa() == isa);
+        for (int i = 0; i < 12; i++) {
+            ok = ok && fabsf(xnvec_l2sq(a, b, lens[i]) - expect[i][0]) < 1e-3f;
+            ok = ok && fabsf(xnvec_inner_product(a, b, lens[i]) - expect[i][1]) < 1e-3f;
+            ok = ok && fabsf(xnvec_cosine_similarity(a, b, lens[i]) - expect[i][2]) < 1e-3f;
+            ok = ok && fabsf(vector_batch_cosine(a, b, lens[i]) - expect[i][2]) < 1e-3f;
+            ok = ok && fabsf(xnvec_euclidean(a, b, lens[i]) - sqrtf(expect[i][0])) < 1e-3f;
+        }
+    }
+    assert(ok);
+    assert(xnvec_set_isa(start));
+}
+
+void vector_topk() {
+    uint64_t ids[3];
+    float dists[3];
+    struct xnvtopk topk;
+    xnvtopk_init(&topk, 3, ids, dists);
+
+    float pushed[] = { 5.0f, 1.0f, 4.0f, 9.0f, 0.5f, 3.0f, 7.0f };
+    for (int i = 0; i < 7; i++)
+        xnvtopk_push(&topk, i, pushed[i]);
+    xnvtopk_sort(&topk);
+
+    assert(topk.count == 3);
+    assert(ids[0] == 4 && dists[0] == 0.5f);
+    assert(ids[1] == 1 && dists[1] == 1.0f);
+    assert(ids[2] == 5 && dists[2] == 3.0f);
+}
+
+//the block functions find the same neighbors as pushing one distance at a time
+void vector_topk_block() {
+    const int COUNT = 1000;
+    const int DIM = 19;
+    const int QUERIES = 3;
+    float *vecs = malloc(COUNT * DIM * sizeof(float));
+    uint64_t *ids = malloc(COUNT * sizeof(uint64_t));
+    unsigned int seed = 3;
+    for (int i = 0; i < COUNT * DIM; i++)
+        vecs[i] = (float)rand_r(&seed) / RAND_MAX;
+    for (int i = 0; i < COUNT; i++)
+        ids[i] = i * 10;
+
+    bool ok = true;
+    enum xnvmetric metrics[] = { XNVM_L2, XNVM_IP, XNVM_COSINE };
+    for (int m = 0; m < 3; m++) {
+        uint64_t block_ids[QUERIES][5];
+        float block_dists[QUERIES][5];
+        struct xnvtopk many[QUERIES];
+        for (int q = 0; q < QUERIES; q++)
+            xnvtopk_init(&many[q], 5, block_ids[q], block_dists[q]);
+        xnvec_topk_block_many(metrics[m], vecs, QUERIES, vecs, ids, COUNT, DIM, many);
+
+        for (int q = 0; q < QUERIES; q++) {
+            const float *query = vecs + q * DIM;
+            uint64_t pair_ids[5];
+            float pair_dists[5];
+            struct xnvtopk pair;
+            xnvtopk_init(&pair, 5, pair_ids, pair_dists);
+            for (int i = 0; i < COUNT; i++)
+                xnvtopk_push(&pair, i * 10, xnvec_rank_distance(metrics[m], query, vecs + i * DIM, DIM));
+
+            uint64_t one_ids[5];
+            float one_dists[5];
+            struct xnvtopk one;
+            xnvtopk_init(&one, 5, one_ids, one_dists);
+            xnvec_topk_block(metrics[m], query, vecs, ids, COUNT, DIM, &one);
+
+            xnvtopk_sort(&pair);
+            xnvtopk_sort(&one);
+            xnvtopk_sort(&many[q]);
+            for (int i = 0; i < 5; i++) {
+                ok = ok && one_ids[i] == pair_ids[i] && block_ids[q][i] == pair_ids[i];
+                ok = ok && fabsf(one_dists[i] - pair_dists[i]) < 1e-5f;
+            }
+        }
+    }
+    assert(ok);
+
+    //without ids the position is used
+    uint64_t out_ids[1];
+    float out_dists[1];
+    struct xnvtopk topk;
+    xnvtopk_init(&topk, 1, out_ids, out_dists);
+    xnvec_topk_block(XNVM_L2, vecs + 700 * DIM, vecs, NULL, COUNT, DIM, &topk);
+    assert(out_ids[0] == 700 && out_dists[0] == 0.0f);
+    assert(xnvec_nearest(XNVM_L2, vecs + 700 * DIM, vecs, COUNT, DIM) == 700);
+
+    free(vecs);
+    free(ids);
+}
+
+void vector_kmeans() {
+    //two well separated blobs
+    const int COUNT = 200;
+    float data[COUNT][2];
+    for (int i = 0; i < COUNT; i++) {
+        float base = i % 2 == 0 ? 0.0f : 100.0f;
+        data[i][0] = base + (i % 7) * 0.1f;
+        data[i][1] = base + (i % 5) * 0.1f;
+    }
+
+    float centroids[2][2];
+    int iterations;
+    assert(xnvec_kmeans((float*)data, COUNT, 2, xnvec_kmeans_default_opts(2), (float*)centroids, &iterations));
+
+    int low = centroids[0][0] < centroids[1][0] ? 0 : 1;
+    assert(centroids[low][0] < 1.0f && centroids[low][1] < 1.0f);
+    assert(centroids[1 - low][0] > 99.0f && centroids[1 - low][1] > 99.0f);
+
+    //k-means++ seeds one centroid in each blob, so the assignments never change and training stops early
+    assert(iterations < 20);
+
+    //more clusters than points fails
+    assert(!xnvec_kmeans((float*)data, 1, 2, xnvec_kmeans_default_opts(2), (float*)centroids, NULL));
+}
+
+//splitting the points across threads gives the same centroids as one thread, up to rounding in the merged sums
+void vector_kmeans_threads() {
+    const int COUNT = 8000;
+    const int DIM = 8;
+    const int K = 16;
+    float *data = malloc(COUNT * DIM * sizeof(float));
+    unsigned int seed = 5;
+    for (int i = 0; i < COUNT * DIM; i++)
+        data[i] = (float)(i / DIM % K) * 10.0f + (float)rand_r(&seed) / RAND_MAX;
+
+    float one[K][DIM];
+    float four[K][DIM];
+    struct xnkmopts opts = xnvec_kmeans_default_opts(K);
+    opts.threads = 1;
+    assert(xnvec_kmeans(data, COUNT, DIM, opts, (float*)one, NULL));
+    opts.threads = 4;
+    assert(xnvec_kmeans(data, COUNT, DIM, opts, (float*)four, NULL));
+
+    bool ok = true;
+    for (int c = 0; c < K; c++) {
+        for (int d = 0; d < DIM; d++)
+            ok = ok && fabsf(one[c][d] - four[c][d]) < 1e-3f;
+    }
+    assert(ok);
+    free(data);
+}
+
+void vector_tests() {
+    append_test(vector_distances);
+    append_test(vector_isa_kernels);
+    append_test(vector_topk);
+    append_test(vector_topk_block);
+    append_test(vector_kmeans);
+    append_test(vector_kmeans_threads);
+}